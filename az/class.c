@@ -20,6 +20,7 @@
 #include <az/function-value.h>
 #include <az/packed-value.h>
 #include <az/private.h>
+#include <az/slab.h>
 #include <az/string.h>
 
 static unsigned char zero_val[16] = { 0 };
@@ -112,6 +113,17 @@ az_class_new (const unsigned char *name, unsigned int parent_type, unsigned int
 		klass->n_ifaces_self = 0;
 		klass->n_props_self = 0;
 		klass->props_self = NULL;
+		klass->iface_index = NULL;
+		klass->iface_index_mask = 0;
+		klass->n_props_all = 0;
+		klass->props_all = NULL;
+		klass->props_index = NULL;
+		klass->props_index_mask = 0;
+		klass->init_steps = NULL;
+		klass->finalize_steps = NULL;
+		klass->n_init_steps = 0;
+		klass->n_finalize_steps = 0;
+		klass->n_init_calls = 0;
 	}
 	klass->impl.flags |= flags;
 	klass->name = name;
@@ -119,15 +131,37 @@ az_class_new (const unsigned char *name, unsigned int parent_type, unsigned int
 	klass->instance_size = instance_size;
 	klass->instance_init = instance_init;
 	klass->instance_finalize = instance_finalize;
+	if (!klass->allocator && instance_size && (instance_size <= az_slab_get_default_max_size ())) {
+		klass->allocator = &az_slab_allocator;
+	}
 
 	az_register_class(klass);
 
 	return klass;
 }
 
+void
+az_class_setup_ancestors (AZClass *klass)
+{
+	uint32_t *ancestors;
+	/* Has to be available before class_init, as it is used by type checks */
+	klass->depth = (klass->parent) ? klass->parent->depth + 1 : 0;
+	ancestors = (uint32_t *) malloc ((klass->depth + 1) * sizeof (uint32_t));
+	if (klass->parent) memcpy (ancestors, klass->parent->ancestors, klass->depth * sizeof (uint32_t));
+	ancestors[klass->depth] = klass->impl.type;
+	klass->ancestors = ancestors;
+}
+
 void
 az_class_new_with_value (AZClass *klass)
 {
+	AZClass *parent;
+	/* Ancestors are not necessarily registered yet, so look up the whole chain */
+	for (parent = klass->parent; parent && (!klass->hash || !klass->equals || !klass->compare); parent = parent->parent) {
+		if (!klass->hash) klass->hash = parent->hash;
+		if (!klass->equals) klass->equals = parent->equals;
+		if (!klass->compare) klass->compare = parent->compare;
+	}
 	az_register_class(klass);
 }
 
@@ -174,6 +208,192 @@ az_class_declare_interface (AZClass *klass, unsigned int idx, unsigned int type,
 	}
 }
 
+/*
+ * Every interface type and all it's supertypes are mapped to the first matching entry of
+ * ifaces_all, so the lookup order is the same as of linear search
+ */
+
+static void
+class_build_iface_index (AZClass *klass)
+{
+	unsigned int n_keys = 0, size = 4, i, j;
+	for (i = 0; i < klass->n_ifaces_all; i++) {
+		n_keys += AZ_CLASS_FROM_TYPE(az_class_iface_all(klass, i)->type)->depth + 1;
+	}
+	while (size < 2 * n_keys) size <<= 1;
+	AZIFEntry *index = (AZIFEntry *) malloc (size * sizeof (AZIFEntry));
+	memset (index, 0, size * sizeof (AZIFEntry));
+	for (i = 0; i < klass->n_ifaces_all; i++) {
+		const AZIFEntry *ifentry = az_class_iface_all(klass, i);
+		AZClass *iface_class = AZ_CLASS_FROM_TYPE(ifentry->type);
+		for (j = 0; j <= iface_class->depth; j++) {
+			uint32_t type = iface_class->ancestors[j];
+			uint32_t pos = AZ_TYPE_INDEX(type) & (size - 1);
+			while (index[pos].type && (index[pos].type != type)) pos = (pos + 1) & (size - 1);
+			if (!index[pos].type) {
+				index[pos] = *ifentry;
+				index[pos].type = type;
+			}
+		}
+	}
+	klass->iface_index_mask = size - 1;
+	klass->iface_index = index;
+}
+
+/*
+ * Properties are collected in the same order as searched by recursive lookup (subclass first), so
+ * the first entry of given key is the one that is visible
+ */
+
+static unsigned int
+class_collect_props (const AZClass *klass, AZPropEntry *entries, unsigned int n_entries, unsigned int impl_offset, unsigned int inst_offset)
+{
+	for (uint16_t i = 0; i < klass->n_props_self; i++) {
+		if (!klass->props_self[i].key) continue;
+		if (entries) {
+			entries[n_entries].key = klass->props_self[i].key;
+			entries[n_entries].def_class = klass;
+			entries[n_entries].prop_idx = i;
+			entries[n_entries].impl_offset = impl_offset;
+			entries[n_entries].inst_offset = inst_offset;
+			entries[n_entries].next = 0;
+		}
+		n_entries += 1;
+	}
+	for (uint16_t i = 0; i < klass->n_ifaces_self; i++) {
+		const AZIFEntry *ifentry = az_class_iface_self(klass, i);
+		n_entries = class_collect_props (AZ_CLASS_FROM_TYPE(ifentry->type), entries, n_entries, impl_offset + ifentry->impl_offset, inst_offset + ifentry->inst_offset);
+	}
+	if (klass->parent) {
+		n_entries = class_collect_props (klass->parent, entries, n_entries, impl_offset, inst_offset);
+	}
+	return n_entries;
+}
+
+static void
+class_build_props_index (AZClass *klass)
+{
+	unsigned int n_entries, size = 4, i;
+	n_entries = class_collect_props (klass, NULL, 0, 0, 0);
+	/* Too big tables are not indexed, recursive lookup is used instead */
+	if (!n_entries || (n_entries >= 0xffff)) return;
+	AZPropEntry *entries = (AZPropEntry *) malloc (n_entries * sizeof (AZPropEntry));
+	class_collect_props (klass, entries, 0, 0, 0);
+	while (size < 2 * n_entries) size <<= 1;
+	uint16_t *index = (uint16_t *) malloc (size * sizeof (uint16_t));
+	memset (index, 0, size * sizeof (uint16_t));
+	for (i = 0; i < n_entries; i++) {
+		uint32_t pos = az_string_hash(entries[i].key) & (size - 1);
+		while (index[pos] && (entries[index[pos] - 1].key != entries[i].key)) pos = (pos + 1) & (size - 1);
+		if (!index[pos]) {
+			index[pos] = i + 1;
+		} else {
+			/* Shadowed or overloaded, append to the chain */
+			AZPropEntry *last = &entries[index[pos] - 1];
+			while (last->next) last = &entries[last->next - 1];
+			last->next = i + 1;
+		}
+	}
+	klass->n_props_all = n_entries;
+	klass->props_all = entries;
+	klass->props_index_mask = size - 1;
+	klass->props_index = index;
+}
+
+static const AZPropEntry *
+class_lookup_prop_entry (const AZClass *klass, const AZString *key)
+{
+	uint32_t pos = az_string_hash(key) & klass->props_index_mask;
+	while (klass->props_index[pos]) {
+		const AZPropEntry *entry = &klass->props_all[klass->props_index[pos] - 1];
+		if (entry->key == key) return entry;
+		pos = (pos + 1) & klass->props_index_mask;
+	}
+	return NULL;
+}
+
+/*
+ * Steps are collected in the same order as az_instance_init_recursive and
+ * az_instance_finalize_recursive run, with offsets accumulated from interfaces
+ */
+
+static unsigned int
+class_collect_init_steps (const AZClass *klass, AZInitStep *steps, unsigned int n_steps, unsigned int impl_offset, unsigned int inst_offset, unsigned int zeroed)
+{
+	if (klass->parent && (AZ_TYPE_INDEX(AZ_CLASS_TYPE(klass->parent)) >= AZ_NUM_FUNDAMENTAL_TYPES)) {
+		n_steps = class_collect_init_steps (klass->parent, steps, n_steps, impl_offset, inst_offset, zeroed);
+	}
+	for (uint16_t i = 0; i < klass->n_ifaces_self; i++) {
+		const AZIFEntry *ifentry = az_class_iface_self(klass, i);
+		AZClass *sub_class = AZ_CLASS_FROM_TYPE(ifentry->type);
+		unsigned int sub_zero = !zeroed && (sub_class->impl.flags & AZ_FLAG_ZERO_MEMORY) && sub_class->instance_size;
+		if (sub_zero) {
+			if (steps) {
+				steps[n_steps].func = NULL;
+				steps[n_steps].impl_offset = impl_offset + ifentry->impl_offset;
+				steps[n_steps].inst_offset = inst_offset + ifentry->inst_offset;
+				steps[n_steps].zero_size = sub_class->instance_size;
+			}
+			n_steps += 1;
+		}
+		n_steps = class_collect_init_steps (sub_class, steps, n_steps, impl_offset + ifentry->impl_offset, inst_offset + ifentry->inst_offset, zeroed || (sub_class->impl.flags & AZ_FLAG_ZERO_MEMORY));
+	}
+	if (klass->instance_init) {
+		if (steps) {
+			steps[n_steps].func = klass->instance_init;
+			steps[n_steps].impl_offset = impl_offset;
+			steps[n_steps].inst_offset = inst_offset;
+			steps[n_steps].zero_size = 0;
+		}
+		n_steps += 1;
+	}
+	return n_steps;
+}
+
+static unsigned int
+class_collect_finalize_steps (const AZClass *klass, AZInitStep *steps, unsigned int n_steps, unsigned int impl_offset, unsigned int inst_offset)
+{
+	if (klass->instance_finalize) {
+		if (steps) {
+			steps[n_steps].func = klass->instance_finalize;
+			steps[n_steps].impl_offset = impl_offset;
+			steps[n_steps].inst_offset = inst_offset;
+			steps[n_steps].zero_size = 0;
+		}
+		n_steps += 1;
+	}
+	for (uint16_t i = 0; i < klass->n_ifaces_self; i++) {
+		const AZIFEntry *ifentry = az_class_iface_self(klass, i);
+		n_steps = class_collect_finalize_steps (AZ_CLASS_FROM_TYPE(ifentry->type), steps, n_steps, impl_offset + ifentry->impl_offset, inst_offset + ifentry->inst_offset);
+	}
+	if (klass->parent && (AZ_TYPE_INDEX(AZ_CLASS_TYPE(klass->parent)) >= AZ_NUM_FUNDAMENTAL_TYPES)) {
+		n_steps = class_collect_finalize_steps (klass->parent, steps, n_steps, impl_offset, inst_offset);
+	}
+	return n_steps;
+}
+
+static void
+class_build_init_steps (AZClass *klass)
+{
+	unsigned int zeroed = (klass->impl.flags & AZ_FLAG_ZERO_MEMORY) != 0;
+	unsigned int n_init = class_collect_init_steps (klass, NULL, 0, 0, 0, zeroed);
+	unsigned int n_finalize = class_collect_finalize_steps (klass, NULL, 0, 0, 0);
+	/* Too long chains use recursive construction */
+	if ((n_init > 0xffff) || (n_finalize > 0xffff)) return;
+	/* Both arrays are allocated even if empty, NULL means that chains are not built */
+	AZInitStep *steps = (AZInitStep *) malloc ((n_init + n_finalize + 1) * sizeof (AZInitStep));
+	class_collect_init_steps (klass, steps, 0, 0, 0, zeroed);
+	class_collect_finalize_steps (klass, steps + n_init, 0, 0, 0);
+	klass->n_init_calls = 0;
+	for (unsigned int i = 0; i < n_init; i++) {
+		if (steps[i].func) klass->n_init_calls += 1;
+	}
+	klass->n_init_steps = n_init;
+	klass->n_finalize_steps = n_finalize;
+	klass->init_steps = steps;
+	klass->finalize_steps = steps + n_init;
+}
+
 void
 az_class_post_init (AZClass *klass)
 {
@@ -251,6 +471,9 @@ az_class_post_init (AZClass *klass)
 			memcpy (&ifaces[idx], az_class_iface_all(klass->parent, 0), klass->parent->n_ifaces_all * sizeof (AZIFEntry *));
 		}
 	}
+	if (klass->n_ifaces_all) class_build_iface_index (klass);
+	class_build_props_index (klass);
+	class_build_init_steps (klass);
 	if (klass->n_ifaces_all) {
 		fprintf (stderr, "Class %s\n", klass->name);
 		fprintf (stderr, "  Self %u\n", klass->n_ifaces_self);
@@ -352,9 +575,9 @@ void
 az_class_define_method (AZClass *klass, unsigned int idx, const unsigned char *key, unsigned int ret_type, unsigned int n_args, const unsigned int arg_types[],
 	unsigned int (*invoke) (const AZImplementation **, const AZValue **, const AZImplementation **, AZValue64 *, AZContext *))
 {
-	AZFunctionSignature *sig;
+	const AZFunctionSignature *sig;
 	AZFunctionValue fval;
-	sig = az_function_signature_new(AZ_CLASS_TYPE(klass), ret_type, n_args, arg_types);
+	sig = az_function_signature_get (AZ_CLASS_TYPE(klass), ret_type, n_args, arg_types);
 	az_function_value_setup (&fval, sig, invoke);
 	az_class_define_property_function_val (klass, idx, key, 1, AZ_FIELD_INSTANCE, AZ_FIELD_READ_STORED_STATIC, AZ_FIELD_WRITE_NONE, sig,
 		(AZImplementation *) az_type_get_class (AZ_TYPE_FUNCTION_VALUE), &fval);
@@ -380,9 +603,9 @@ void
 az_class_define_static_method (AZClass *klass, unsigned int idx, const unsigned char *key, unsigned int ret_type, unsigned int n_args, const unsigned int arg_types[],
 	unsigned int (*invoke) (const AZImplementation **, const AZValue **, const AZImplementation **, AZValue64 *, AZContext *))
 {
-	AZFunctionSignature *sig;
+	const AZFunctionSignature *sig;
 	AZFunctionValue fval;
-	sig = az_function_signature_new (AZ_TYPE_NONE, ret_type, n_args, arg_types);
+	sig = az_function_signature_get (AZ_TYPE_NONE, ret_type, n_args, arg_types);
 	az_function_value_setup (&fval, sig, invoke);
 	az_class_define_property_function_val (klass, idx, key, 1, AZ_FIELD_CLASS, AZ_FIELD_READ_STORED_STATIC, AZ_FIELD_WRITE_NONE, sig,
 		(AZImplementation *) az_type_get_class(AZ_TYPE_FUNCTION_VALUE), &fval);
@@ -392,9 +615,9 @@ void az_class_define_static_method_native (AZClass *klass, unsigned int idx, con
 	unsigned int ret_type, unsigned int n_args, const unsigned int arg_types[],
 	void (*invoke) (void))
 {
-	AZFunctionSignature *sig;
+	const AZFunctionSignature *sig;
 	AZFunctionNative fval;
-	sig = az_function_signature_new (AZ_TYPE_NONE, ret_type, n_args, arg_types);
+	sig = az_function_signature_get (AZ_TYPE_NONE, ret_type, n_args, arg_types);
 	az_function_native_setup (&fval, sig, invoke);
 	az_class_define_property_function_val (klass, idx, key, 1, AZ_FIELD_CLASS, AZ_FIELD_READ_STORED_STATIC, AZ_FIELD_WRITE_NONE, sig,
 		(AZImplementation *) az_type_get_class(AZ_TYPE_FUNCTION_NATIVE), &fval);
@@ -432,11 +655,9 @@ void az_class_define_static_method_native_va (AZClass *klass, unsigned int idx,
 	az_class_define_static_method_native(klass, idx, key, ret_type, n_args, arg_types, invoke);
 }
 
-int
-az_class_lookup_property (const AZClass *klass, const AZImplementation *impl, void *inst, const AZString *key, const AZClass **def_class, const AZImplementation **sub_impl, void **sub_inst)
+static int
+class_lookup_property_recursive (const AZClass *klass, const AZImplementation *impl, void *inst, const AZString *key, const AZClass **def_class, const AZImplementation **sub_impl, void **sub_inst)
 {
-	arikkei_return_val_if_fail (impl != NULL, -1);
-	arikkei_return_val_if_fail (key != NULL, -1);
 	/* NB! Until "new" is handled differently we have to go subclass-first */
 	for (uint16_t i = 0; i < (int) klass->n_props_self; i++) {
 		if (az_string_equals(key, klass->props_self[i].key)) {
@@ -453,23 +674,35 @@ az_class_lookup_property (const AZClass *klass, const AZImplementation *impl, vo
 		AZImplementation *if_impl = (impl) ? (AZImplementation *) ((char *) impl + ifentry->impl_offset) : NULL;
 		void *if_inst = (inst) ? (void *) ((char *) inst + ifentry->inst_offset) : NULL;
 		/* Check properties of this interface */
-		int result = az_class_lookup_property (if_class, if_impl, if_inst, key, def_class, sub_impl, sub_inst);
+		int result = class_lookup_property_recursive (if_class, if_impl, if_inst, key, def_class, sub_impl, sub_inst);
 		if (result >= 0) return result;
 	}
 	/* Superclass */
 	if (klass->parent) {
-		int result = az_class_lookup_property (klass->parent, impl, inst, key, def_class, sub_impl, sub_inst);
+		int result = class_lookup_property_recursive (klass->parent, impl, inst, key, def_class, sub_impl, sub_inst);
 		if (result >= 0) return result;
 	}
 	return -1;
 }
 
 int
-az_class_lookup_function (const AZClass *klass, const AZImplementation *impl, void *inst, const AZString *key, AZFunctionSignature *sig, const AZClass **def_class, const AZImplementation **sub_impl, void **sub_inst)
+az_class_lookup_property (const AZClass *klass, const AZImplementation *impl, void *inst, const AZString *key, const AZClass **def_class, const AZImplementation **sub_impl, void **sub_inst)
 {
-	int result, i;
-	//arikkei_return_val_if_fail (impl != NULL, -1);
+	arikkei_return_val_if_fail (impl != NULL, -1);
 	arikkei_return_val_if_fail (key != NULL, -1);
+	if (!klass->props_index) return class_lookup_property_recursive (klass, impl, inst, key, def_class, sub_impl, sub_inst);
+	const AZPropEntry *entry = class_lookup_prop_entry (klass, key);
+	if (!entry) return -1;
+	*def_class = entry->def_class;
+	if (sub_impl) *sub_impl = (impl) ? (AZImplementation *) ((char *) impl + entry->impl_offset) : NULL;
+	if (sub_inst) *sub_inst = (inst) ? (void *) ((char *) inst + entry->inst_offset) : NULL;
+	return entry->prop_idx;
+}
+
+static int
+class_lookup_function_recursive (const AZClass *klass, const AZImplementation *impl, void *inst, const AZString *key, AZFunctionSignature *sig, const AZClass **def_class, const AZImplementation **sub_impl, void **sub_inst)
+{
+	int result, i;
 	/* NB! Until "new" is handled differently we have to go subclass-first */
 	for (i = 0; i < (int) klass->n_props_self; i++) {
 		if (az_string_equals(key, klass->props_self[i].key) && AZ_FIELD_IS_FUNCTION(&klass->props_self[i])) {
@@ -489,13 +722,34 @@ az_class_lookup_function (const AZClass *klass, const AZImplementation *impl, vo
 		AZImplementation *if_impl = (impl) ? (AZImplementation *) ((char *) impl + ifentry->impl_offset) : NULL;
 		void *if_inst = (inst) ? (void *) ((char *) inst + ifentry->inst_offset) : NULL;
 		/* Check properties of this interface */
-		result = az_class_lookup_function (if_class, if_impl, if_inst, key, sig, def_class, sub_impl, sub_inst);
+		result = class_lookup_function_recursive (if_class, if_impl, if_inst, key, sig, def_class, sub_impl, sub_inst);
 		if (result >= 0) return result;
 	}
 	/* Superclass */
 	if (klass->parent) {
-		result = az_class_lookup_function (klass->parent, impl, inst, key, sig, def_class, sub_impl, sub_inst);
+		result = class_lookup_function_recursive (klass->parent, impl, inst, key, sig, def_class, sub_impl, sub_inst);
 		if (result >= 0) return result;
 	}
 	return -1;
 }
+
+int
+az_class_lookup_function (const AZClass *klass, const AZImplementation *impl, void *inst, const AZString *key, AZFunctionSignature *sig, const AZClass **def_class, const AZImplementation **sub_impl, void **sub_inst)
+{
+	//arikkei_return_val_if_fail (impl != NULL, -1);
+	arikkei_return_val_if_fail (key != NULL, -1);
+	if (!klass->props_index) return class_lookup_function_recursive (klass, impl, inst, key, sig, def_class, sub_impl, sub_inst);
+	const AZPropEntry *entry = class_lookup_prop_entry (klass, key);
+	/* Walk all properties with the same key in lookup order */
+	while (entry) {
+		const AZField *prop = &entry->def_class->props_self[entry->prop_idx];
+		if (AZ_FIELD_IS_FUNCTION(prop) && (!prop->signature || az_function_signature_is_assignable_to (prop->signature, sig, 0))) {
+			*def_class = entry->def_class;
+			if (sub_impl) *sub_impl = (impl) ? (AZImplementation *) ((char *) impl + entry->impl_offset) : NULL;
+			if (sub_inst) *sub_inst = (inst) ? (void *) ((char *) inst + entry->inst_offset) : NULL;
+			return entry->prop_idx;
+		}
+		entry = (entry->next) ? &klass->props_all[entry->next - 1] : NULL;
+	}
+	return -1;
+}
@@ -12,6 +12,8 @@
 #include <az/az.h>
 
 typedef struct _AZIFEntry AZIFEntry;
+typedef struct _AZPropEntry AZPropEntry;
+typedef struct _AZInitStep AZInitStep;
 typedef struct _AZInstanceAllocator AZInstanceAllocator;
 
 #ifdef __cplusplus
@@ -79,6 +81,35 @@ struct _AZIFEntry {
 	uint16_t inst_offset;
 };
 
+/**
+ * @brief A visible property of class (including interfaces and superclasses)
+ * 
+ * The property definition is def_class->props_self[prop_idx], offsets are relative to the
+ * implementation and instance of the class the entry belongs to.
+ */
+struct _AZPropEntry {
+	const AZString *key;
+	const AZClass *def_class;
+	uint16_t prop_idx;
+	uint16_t impl_offset;
+	uint16_t inst_offset;
+	/* Next entry with the same key + 1 (0 if none) */
+	uint16_t next;
+};
+
+/**
+ * @brief A step of flattened constructor or destructor chain
+ * 
+ * Clears zero_size bytes (constructors only) and then calls func (if not NULL) with implementation
+ * and instance shifted by given offsets.
+ */
+struct _AZInitStep {
+	void (*func) (const AZImplementation *impl, void *inst);
+	uint16_t impl_offset;
+	uint16_t inst_offset;
+	uint32_t zero_size;
+};
+
 struct _AZInstanceAllocator {
 	void *(*allocate) (AZClass *klass);
 	void *(*allocate_array) (AZClass *klass, unsigned int n_elements);
@@ -214,6 +245,92 @@ struct _AZClass {
 	/* Property is set by instance */
 	/* Returns 1 on success, 0 if property cannot be set */
 	unsigned int (*set_property) (const AZImplementation *impl, void *inst, unsigned int idx, const AZImplementation *prop_impl, void *prop_inst, AZContext *ctx);
+
+	/**
+	 * @brief The depth of this class in the type hierarchy (0 for root types)
+	 * 
+	 */
+	uint32_t depth;
+	/**
+	 * @brief The types of all ancestors indexed by their depth (Cohen's display)
+	 * 
+	 * ancestors[depth] is the type of this class. Set up at registration.
+	 * 
+	 */
+	const uint32_t *ancestors;
+	/**
+	 * @brief Interface dispatch index (NULL if there are no interfaces)
+	 * 
+	 * Open-addressed table (linear probing by type index) that maps every implemented interface
+	 * type and all it's supertypes to the first matching entry of ifaces_all. Built in
+	 * az_class_post_init.
+	 * 
+	 */
+	AZIFEntry *iface_index;
+	uint32_t iface_index_mask;
+	/**
+	 * @brief The number of all visible properties
+	 * 
+	 */
+	uint32_t n_props_all;
+	/**
+	 * @brief All visible properties in lookup order (NULL if not built)
+	 * 
+	 * Own properties, properties of interfaces, properties of superclasses. Built in
+	 * az_class_post_init.
+	 * 
+	 */
+	AZPropEntry *props_all;
+	/**
+	 * @brief Open-addressed table (by key hash) of the first entries of each key in props_all (position + 1)
+	 * 
+	 */
+	uint16_t *props_index;
+	uint32_t props_index_mask;
+	/**
+	 * @brief Flattened constructor and destructor chains (NULL if not built)
+	 * 
+	 * Built in az_class_post_init, the constructor chain assumes that the instance is cleared
+	 * if the class has AZ_FLAG_ZERO_MEMORY set.
+	 * 
+	 */
+	AZInitStep *init_steps;
+	AZInitStep *finalize_steps;
+	uint16_t n_init_steps;
+	uint16_t n_finalize_steps;
+	/**
+	 * @brief The number of constructor steps that call function
+	 * 
+	 * If 0 the construction is only clearing memory.
+	 */
+	uint16_t n_init_calls;
+	/**
+	 * @brief Calculate the hash of an instance
+	 *
+	 * Has to be consistent with equals. If NULL in static class, it is inherited from the
+	 * nearest ancestor at registration. The default (in AZAnyKlass) hashes the identity of
+	 * block types and the instance memory of value types.
+	 *
+	 */
+	uint32_t (*hash) (const AZImplementation *impl, void *inst);
+	/**
+	 * @brief Test whether two instances of the same type are equal
+	 *
+	 * Inherited in the same way as hash. The default compares the identity of block
+	 * types and the instance memory of value types.
+	 *
+	 */
+	unsigned int (*equals) (const AZImplementation *impl, void *lhs, void *rhs);
+	/**
+	 * @brief Compare two instances of the same type
+	 *
+	 * Returns negative, zero or positive value if lhs is less than, equal to or greater than rhs.
+	 * Has to define total order consistent with equals (except for floating point NaNs).
+	 * Inherited in the same way as hash. The default orders block types by address and value
+	 * types by instance memory.
+	 *
+	 */
+	int (*compare) (const AZImplementation *impl, void *lhs, void *rhs);
 };
 
 /*
@@ -29,6 +29,60 @@ static const AZImplementation *array_list_get_element (const AZListImplementatio
 
 AZArrayListClass *AZArrayListKlass = NULL;
 
+static inline unsigned int
+array_list_stride(AZArrayList *alist)
+{
+	return (alist->element_impl) ? alist->val_size : az_array_list_entry_size(alist);
+}
+
+static inline unsigned int
+array_list_accepts(AZArrayList *alist, const AZImplementation *impl)
+{
+	if (alist->element_impl) {
+		/* Null values can only be stored as null blocks */
+		return (impl == alist->element_impl) || (!impl && AZ_IMPL_IS_BLOCK(alist->element_impl));
+	}
+	return !impl || az_type_is_a(AZ_IMPL_TYPE(impl), alist->element_type);
+}
+
+static void
+array_list_ensure_space(AZArrayList *alist, unsigned int min_size)
+{
+	if (min_size > alist->data_size) {
+		unsigned int data_size = (alist->data_size) ? alist->data_size << 1 : 8;
+		alist->data_size = (data_size < min_size) ? min_size : data_size;
+		alist->data = realloc(alist->data, alist->data_size * array_list_stride(alist));
+	}
+}
+
+static inline void
+packed_set(const AZImplementation *impl, AZValue *dst, void *inst)
+{
+	if (AZ_IMPL_IS_VALUE(impl)) {
+		memcpy(dst, inst, AZ_CLASS_FROM_IMPL(impl)->instance_size);
+	} else {
+		dst->block = inst;
+		if (inst && AZ_IMPL_IS_REFERENCE(impl)) az_reference_ref(dst->reference);
+	}
+}
+
+static void
+array_list_clear_values(AZArrayList *alist)
+{
+	if (alist->element_impl) {
+		/* Packed values need clearing only if they are references */
+		if (!AZ_IMPL_IS_REFERENCE(alist->element_impl)) return;
+		for (unsigned int i = 0; i < alist->list.collection.size; i++) {
+			az_value_clear(alist->element_impl, az_array_list_get_packed(alist, i));
+		}
+	} else {
+		for (unsigned int i = 0; i < alist->list.collection.size; i++) {
+			AZArrayListEntry *entry = az_array_list_get_entry(alist, i);
+			az_value_clear (entry->impl, (AZValue *) entry->val);
+		}
+	}
+}
+
 unsigned int
 az_array_list_get_type (void)
 {
@@ -62,6 +116,7 @@ static void
 array_list_init (AZArrayListClass *klass, AZArrayList *alist)
 {
 	alist->element_type = AZ_TYPE_ANY;
+	alist->element_impl = NULL;
 	alist->list.collection.size = 0;
 	alist->val_size = 8;
 	alist->data_size = 0;
@@ -71,10 +126,7 @@ array_list_init (AZArrayListClass *klass, AZArrayList *alist)
 static void
 array_list_finalize (AZArrayListClass *klass, AZArrayList *alist)
 {
-	for (unsigned int i = 0; i < alist->list.collection.size; i++) {
-		AZArrayListEntry *entry = az_array_list_get_entry(alist, i);
-        az_value_clear (entry->impl, (AZValue *) entry->val);
-	}
+	array_list_clear_values(alist);
 	if (alist->data) free (alist->data);
 }
 
@@ -82,6 +134,17 @@ static unsigned int
 array_list_contains (const AZCollectionImplementation *coll_impl, AZCollection *collection_inst, const AZImplementation *impl, const void *inst)
 {
 	AZArrayList *alist = (AZArrayList *) collection_inst;
+	if (alist->element_impl) {
+		for (unsigned int i = 0; i < alist->list.collection.size; i++) {
+			AZValue *val = az_array_list_get_packed(alist, i);
+			if (AZ_IMPL_IS_BLOCK(alist->element_impl) && !val->block) {
+				if (!impl) return 1;
+				continue;
+			}
+			if (az_value_equals_instance_autobox(alist->element_impl, val, impl, inst)) return 1;
+		}
+		return 0;
+	}
 	for (unsigned int i = 0; i < alist->list.collection.size; i++) {
 		AZArrayListEntry *entry = az_array_list_get_entry(alist, i);
 		if (az_value_equals_instance_autobox(entry->impl, (const AZValue *) entry->val, impl, inst)) return 1;
@@ -93,6 +156,21 @@ static const AZImplementation *
 array_list_get_element (const AZListImplementation *list_impl, void *list_inst, unsigned int idx, AZValue *val, unsigned int size)
 {
 	AZArrayList *alist = (AZArrayList *) list_inst;
+	if (alist->element_impl) {
+		const AZImplementation *impl = alist->element_impl;
+		AZValue *src = az_array_list_get_packed(alist, idx);
+		if (AZ_IMPL_IS_VALUE(impl)) {
+			unsigned int instance_size = AZ_CLASS_FROM_IMPL(impl)->instance_size;
+			if (instance_size <= size) {
+				memcpy(val, src, instance_size);
+				return impl;
+			}
+			return az_value_copy_autobox (impl, val, src, size);
+		}
+		if (!src->block) return NULL;
+		az_value_copy(impl, val, src);
+		return impl;
+	}
 	AZArrayListEntry *entry = az_array_list_get_entry(alist, idx);
 	if (entry->impl) {
 		return az_value_copy_autobox (entry->impl, val, (const AZValue *) entry->val, size);
@@ -105,6 +183,14 @@ az_array_list_new(unsigned int el_type, unsigned int val_size)
 {
 	AZArrayList *alist = az_instance_new(AZ_TYPE_ARRAY_LIST);
 	alist->element_type = el_type;
+	if (AZ_TYPE_IS_FINAL(el_type) && !AZ_TYPE_IS_INTERFACE(el_type)) {
+		AZClass *klass = AZ_CLASS_FROM_TYPE(el_type);
+		if (AZ_CLASS_ELEMENT_SIZE(klass)) {
+			alist->element_impl = &klass->impl;
+			alist->val_size = AZ_CLASS_ELEMENT_SIZE(klass);
+			return alist;
+		}
+	}
 	alist->val_size = (val_size + 0x7) & 0xfffffff8;
 	return alist;
 }
@@ -112,18 +198,21 @@ az_array_list_new(unsigned int el_type, unsigned int val_size)
 void
 az_array_list_clear(AZArrayList *alist)
 {
-	for (unsigned int i = 0; i < alist->list.collection.size; i++) {
-		AZArrayListEntry *entry = az_array_list_get_entry(alist, i);
-        az_value_clear (entry->impl, (AZValue *) entry->val);
-	}
+	array_list_clear_values(alist);
 	alist->list.collection.size = 0;
 }
 
 unsigned int
 az_array_list_set_element (AZArrayList *alist, unsigned int idx, const AZImplementation *impl, void *inst)
 {
-	arikkei_return_val_if_fail(!impl || az_type_is_a(AZ_IMPL_TYPE(impl), alist->element_type), 0);
+	arikkei_return_val_if_fail(array_list_accepts(alist, impl), 0);
 	arikkei_return_val_if_fail(idx < alist->list.collection.size, 0);
+	if (alist->element_impl) {
+		AZValue *dst = az_array_list_get_packed(alist, idx);
+		az_value_clear(alist->element_impl, dst);
+		packed_set(alist->element_impl, dst, (impl) ? inst : NULL);
+		return 1;
+	}
 	AZArrayListEntry *entry = az_array_list_get_entry(alist, idx);
 	az_value_clear(entry->impl, (AZValue *) entry->val);
 	entry->impl = az_value_set_from_inst_autobox(impl, (AZValue *) entry->val, alist->val_size, inst);
@@ -133,10 +222,12 @@ az_array_list_set_element (AZArrayList *alist, unsigned int idx, const AZImpleme
 unsigned int
 az_array_list_append(AZArrayList *alist, const AZImplementation *impl, void *inst)
 {
-	arikkei_return_val_if_fail(!impl || az_type_is_a(AZ_IMPL_TYPE(impl), alist->element_type), 0);
-	if (alist->list.collection.size >= alist->data_size) {
-		alist->data_size = (alist->data_size) ? alist->data_size << 1 : 8;
-		alist->data = (AZArrayListEntry *) realloc(alist->data, alist->data_size * az_array_list_entry_size(alist));
+	arikkei_return_val_if_fail(array_list_accepts(alist, impl), 0);
+	array_list_ensure_space(alist, alist->list.collection.size + 1);
+	if (alist->element_impl) {
+		packed_set(alist->element_impl, az_array_list_get_packed(alist, alist->list.collection.size), (impl) ? inst : NULL);
+		alist->list.collection.size += 1;
+		return 1;
 	}
 	AZArrayListEntry *entry = az_array_list_get_entry(alist, alist->list.collection.size);
 	entry->impl = az_value_set_from_inst_autobox(impl, (AZValue *) entry->val, alist->val_size, inst);
@@ -147,11 +238,15 @@ az_array_list_append(AZArrayList *alist, const AZImplementation *impl, void *ins
 unsigned int
 az_array_list_insert(AZArrayList *alist, unsigned int idx, const AZImplementation *impl, void *inst)
 {
-	arikkei_return_val_if_fail(!impl || az_type_is_a(AZ_IMPL_TYPE(impl), alist->element_type), 0);
+	arikkei_return_val_if_fail(array_list_accepts(alist, impl), 0);
 	arikkei_return_val_if_fail(idx <= alist->list.collection.size, 0);
-	if (alist->list.collection.size >= alist->data_size) {
-		alist->data_size = (alist->data_size) ? alist->data_size << 1 : 8;
-		alist->data = (AZArrayListEntry *) realloc(alist->data, alist->data_size * az_array_list_entry_size(alist));
+	array_list_ensure_space(alist, alist->list.collection.size + 1);
+	if (alist->element_impl) {
+		AZValue *dst = az_array_list_get_packed(alist, idx);
+		memmove((char *) dst + alist->val_size, dst, (alist->list.collection.size - idx) * alist->val_size);
+		packed_set(alist->element_impl, dst, (impl) ? inst : NULL);
+		alist->list.collection.size += 1;
+		return 1;
 	}
 	AZArrayListEntry *entry = az_array_list_get_entry(alist, idx);
 	memmove((char *) entry + az_array_list_entry_size(alist), (char *) entry, (alist->list.collection.size - idx) * az_array_list_entry_size(alist));
@@ -164,9 +259,89 @@ unsigned int
 az_array_list_remove(AZArrayList *alist, unsigned int idx)
 {
 	arikkei_return_val_if_fail(idx < alist->list.collection.size, 0);
+	if (alist->element_impl) {
+		AZValue *dst = az_array_list_get_packed(alist, idx);
+		az_value_clear(alist->element_impl, dst);
+		memmove(dst, (char *) dst + alist->val_size, (alist->list.collection.size - idx - 1) * alist->val_size);
+		alist->list.collection.size -= 1;
+		return 1;
+	}
 	AZArrayListEntry *entry = az_array_list_get_entry(alist, idx);
 	az_value_clear(entry->impl, (AZValue *) entry->val);
 	memmove((char *) entry, (char *) entry + az_array_list_entry_size(alist), (alist->list.collection.size - idx - 1) * az_array_list_entry_size(alist));
 	alist->list.collection.size -= 1;
 	return 1;
 }
+
+unsigned int
+az_array_list_reserve(AZArrayList *alist, unsigned int size)
+{
+	if (size > alist->data_size) {
+		alist->data_size = size;
+		alist->data = realloc(alist->data, alist->data_size * array_list_stride(alist));
+	}
+	return 1;
+}
+
+unsigned int
+az_array_list_append_n(AZArrayList *alist, const AZImplementation *impl, const void *values, unsigned int n_values)
+{
+	return az_array_list_insert_range(alist, alist->list.collection.size, impl, values, n_values);
+}
+
+unsigned int
+az_array_list_insert_range(AZArrayList *alist, unsigned int idx, const AZImplementation *impl, const void *values, unsigned int n_values)
+{
+	arikkei_return_val_if_fail(impl != NULL, 0);
+	arikkei_return_val_if_fail(array_list_accepts(alist, impl), 0);
+	arikkei_return_val_if_fail(idx <= alist->list.collection.size, 0);
+	if (!n_values) return 1;
+	array_list_ensure_space(alist, alist->list.collection.size + n_values);
+	unsigned int stride = array_list_stride(alist);
+	char *dst = (char *) alist->data + idx * stride;
+	memmove(dst + n_values * stride, dst, (alist->list.collection.size - idx) * stride);
+	if (alist->element_impl) {
+		/* Source and list have the same element size */
+		memcpy(dst, values, n_values * stride);
+		if (AZ_IMPL_IS_REFERENCE(impl)) {
+			for (unsigned int i = 0; i < n_values; i++) {
+				AZValue *val = (AZValue *) (dst + i * stride);
+				if (val->reference) az_reference_ref(val->reference);
+			}
+		}
+	} else {
+		unsigned int src_stride = az_class_element_size(AZ_CLASS_FROM_IMPL(impl));
+		for (unsigned int i = 0; i < n_values; i++) {
+			AZArrayListEntry *entry = (AZArrayListEntry *) (dst + i * stride);
+			void *inst = az_value_get_inst(impl, (const AZValue *) ((const char *) values + i * src_stride));
+			entry->impl = (inst) ? az_value_set_from_inst_autobox(impl, (AZValue *) entry->val, alist->val_size, inst) : NULL;
+		}
+	}
+	alist->list.collection.size += n_values;
+	return 1;
+}
+
+unsigned int
+az_array_list_remove_range(AZArrayList *alist, unsigned int idx, unsigned int n_values)
+{
+	arikkei_return_val_if_fail(idx <= alist->list.collection.size, 0);
+	arikkei_return_val_if_fail(n_values <= alist->list.collection.size - idx, 0);
+	if (!n_values) return 1;
+	if (alist->element_impl) {
+		if (AZ_IMPL_IS_REFERENCE(alist->element_impl)) {
+			for (unsigned int i = 0; i < n_values; i++) {
+				az_value_clear(alist->element_impl, az_array_list_get_packed(alist, idx + i));
+			}
+		}
+	} else {
+		for (unsigned int i = 0; i < n_values; i++) {
+			AZArrayListEntry *entry = az_array_list_get_entry(alist, idx + i);
+			az_value_clear(entry->impl, (AZValue *) entry->val);
+		}
+	}
+	unsigned int stride = array_list_stride(alist);
+	char *dst = (char *) alist->data + idx * stride;
+	memmove(dst, dst + n_values * stride, (alist->list.collection.size - idx - n_values) * stride);
+	alist->list.collection.size -= n_values;
+	return 1;
+}
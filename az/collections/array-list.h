@@ -11,6 +11,11 @@
  * A resizable array that keeps elements in [impl,value] tuples
  * Oversized values and interfaces are automatically boxed
  * Containment is defined by value equality (taking boxing into account)
+ *
+ * If the element type is final (and not zero-sized) the list is homogeneous - the values
+ * are packed contiguously without per-element implementations and are never boxed inside
+ * the list. In that case element_impl is the shared implementation and val_size is the
+ * element size of the type.
  */
 
 #define AZ_TYPE_ARRAY_LIST az_array_list_get_type ()
@@ -35,6 +40,8 @@ struct _AZArrayListEntry {
 struct _AZArrayList {
 	AZList list;
 	unsigned int element_type;
+	/* Shared implementation of homogeneous list, NULL if elements are [impl,value] tuples */
+	const AZImplementation *element_impl;
 	unsigned int val_size;
 	unsigned int data_size;
 	void *data;
@@ -70,6 +77,18 @@ unsigned int az_array_list_append(AZArrayList *alist, const AZImplementation *im
 unsigned int az_array_list_insert(AZArrayList *alist, unsigned int idx, const AZImplementation *impl, void *inst);
 unsigned int az_array_list_remove(AZArrayList *alist, unsigned int idx);
 
+/*
+ * Bulk operations
+ * The source values are packed array of values of type impl with the element size of the
+ * class (as allocated by az_value_new_array). The type is checked once per call.
+ */
+/* Ensure that the list can hold size elements without reallocation */
+unsigned int az_array_list_reserve(AZArrayList *alist, unsigned int size);
+unsigned int az_array_list_append_n(AZArrayList *alist, const AZImplementation *impl, const void *values, unsigned int n_values);
+unsigned int az_array_list_insert_range(AZArrayList *alist, unsigned int idx, const AZImplementation *impl, const void *values, unsigned int n_values);
+unsigned int az_array_list_remove_range(AZArrayList *alist, unsigned int idx, unsigned int n_values);
+
+/* Tuple access (only for heterogeneous lists) */
 static inline AZArrayListEntry *
 az_array_list_get_entry(AZArrayList *alist, unsigned int idx)
 {
@@ -82,6 +101,13 @@ az_array_list_entry_size(AZArrayList *alist)
 	return sizeof(AZArrayListEntry) + alist->val_size - 8;
 }
 
+/* Packed value access (only for homogeneous lists) */
+static inline AZValue *
+az_array_list_get_packed(AZArrayList *alist, unsigned int idx)
+{
+	return (AZValue *) ((char *) alist->data + idx * alist->val_size);
+}
+
 #ifdef __cplusplus
 };
 #endif
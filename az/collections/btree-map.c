@@ -0,0 +1,778 @@
+#define __AZ_BTREE_MAP_C__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2016-2026
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <arikkei/arikkei-utils.h>
+
+#include <az/base.h>
+#include <az/value.h>
+#include <az/packed-value.h>
+
+#include "btree-map.h"
+
+/*
+ * Node layout
+ * Leaves: header, keys[leaf_order], values[leaf_order] (at leaf_vals_offset)
+ * Internal: header, keys[inner_order], children[inner_order + 1] (at inner_children_offset)
+ * Separator keys[i] is not bigger than any key in children[i + 1] and bigger than all keys
+ * in children[i]. Separators are owned copies of keys, they may outlive removed entries.
+ */
+struct _AZBTreeMapNode {
+	uint16_t n_keys;
+	uint16_t leaf;
+	uint32_t _filler;
+	/* Leaf chain (leaves only) */
+	AZBTreeMapNode *prev;
+	AZBTreeMapNode *next;
+};
+
+#define CACHE_LINE 64
+#define HEADER_SIZE ((sizeof (AZBTreeMapNode) + 7) & ~7)
+#define ALIGN8(v) (((v) + 7) & ~7)
+/* The entry index is kept in lowest bits of the (cache line aligned) leaf address */
+#define MAX_LEAF_ORDER (CACHE_LINE - 1)
+#define MIN_ORDER 4
+#define MAX_HEIGHT 32
+
+static inline AZValue *
+key_ptr (const AZBTreeMapImplementation *impl, AZBTreeMapNode *node, unsigned int idx)
+{
+	return (AZValue *) ((char *) node + HEADER_SIZE + idx * impl->key_size);
+}
+
+static inline void *
+key_inst (const AZBTreeMapImplementation *impl, AZBTreeMapNode *node, unsigned int idx)
+{
+	return az_value_get_inst (impl->key_impl, key_ptr (impl, node, idx));
+}
+
+static inline AZValue *
+val_ptr (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *node, unsigned int idx)
+{
+	return (AZValue *) ((char *) node + tree->leaf_vals_offset + idx * impl->val_size);
+}
+
+static inline void *
+val_inst (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *node, unsigned int idx)
+{
+	return az_value_get_inst (impl->val_impl, val_ptr (impl, tree, node, idx));
+}
+
+static inline AZBTreeMapNode **
+children (AZBTreeMap *tree, AZBTreeMapNode *node)
+{
+	return (AZBTreeMapNode **) ((char *) node + tree->inner_children_offset);
+}
+
+/* Without callback keys are compared by the method of their type */
+static inline int
+key_compare (const AZBTreeMapImplementation *impl, const void *lhs, const void *rhs)
+{
+	if (impl->compare) return impl->compare (impl, lhs, rhs);
+	return az_instance_compare (impl->key_impl, (void *) lhs, (void *) rhs);
+}
+
+/* The first position with key >= key */
+static unsigned int
+node_lower (const AZBTreeMapImplementation *impl, AZBTreeMapNode *node, const void *key)
+{
+	unsigned int lo = 0, hi = node->n_keys;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) >> 1;
+		if (key_compare (impl, key_inst (impl, node, mid), key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* The first position with key > key */
+static unsigned int
+node_upper (const AZBTreeMapImplementation *impl, AZBTreeMapNode *node, const void *key)
+{
+	unsigned int lo = 0, hi = node->n_keys;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) >> 1;
+		if (key_compare (impl, key_inst (impl, node, mid), key) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static inline const AZImplementation *
+set_iter (AZValue *iter, AZBTreeMapNode *leaf, unsigned int idx)
+{
+	iter->uint64_v = (uint64_t) (uintptr_t) leaf | idx;
+	return &AZUint64Klass.impl;
+}
+
+static inline AZBTreeMapNode *
+iter_leaf (const AZValue *iter)
+{
+	return (AZBTreeMapNode *) (uintptr_t) (iter->uint64_v & ~(uint64_t) (CACHE_LINE - 1));
+}
+
+static inline unsigned int
+iter_idx (const AZValue *iter)
+{
+	return (unsigned int) (iter->uint64_v & (CACHE_LINE - 1));
+}
+
+static AZBTreeMapNode *
+new_node (AZBTreeMap *tree, unsigned int leaf)
+{
+	AZBTreeMapNode *node = (AZBTreeMapNode *) arikkei_aligned_alloc (tree->node_size, CACHE_LINE);
+	node->n_keys = 0;
+	node->leaf = (uint16_t) leaf;
+	node->prev = node->next = NULL;
+	return node;
+}
+
+static AZBTreeMapNode *
+find_leaf (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key)
+{
+	AZBTreeMapNode *node = tree->root;
+	while (!node->leaf) node = children (tree, node)[node_upper (impl, node, key)];
+	return node;
+}
+
+static AZBTreeMapNode *
+first_leaf (AZBTreeMap *tree)
+{
+	AZBTreeMapNode *node = tree->root;
+	while (!node->leaf) node = children (tree, node)[0];
+	return node;
+}
+
+static void free_subtree (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *node);
+static void insert_separator (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode **path, unsigned int *pos, unsigned int level, AZValue64 *sep, AZBTreeMapNode *right);
+static void rebalance (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode **path, unsigned int *pos, unsigned int level, AZBTreeMapNode *node);
+
+static void btree_implementation_init (AZBTreeMapImplementation *impl);
+static void btree_instance_init (const AZBTreeMapImplementation *impl, AZBTreeMap *tree);
+static void btree_instance_finalize (const AZBTreeMapImplementation *impl, AZBTreeMap *tree);
+
+static unsigned int btree_get_element_type (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst);
+static unsigned int btree_contains (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZImplementation *impl, const void *inst);
+static const AZImplementation *btree_get_iter (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
+static const AZImplementation *btree_iter_next (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
+static const AZImplementation *btree_get_element (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZValue *iter, AZValue *val, unsigned int size);
+static unsigned int btree_get_key_type (const AZMapImplementation *map_impl, AZMap *map_inst);
+static const AZImplementation *btree_get_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZValue *iter, AZValue *val, unsigned int size);
+static unsigned int btree_contains_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, const void *key_inst);
+static const AZImplementation *btree_map_lookup (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, void *key_inst, AZValue *val, unsigned int size);
+
+static unsigned int btree_type = 0;
+static AZBTreeMapClass *btree_class;
+
+unsigned int
+az_btree_map_get_type (void)
+{
+	unsigned int t = AZ_TYPE_READ(btree_type);
+	if (t) return t;
+	AZ_TYPES_LOCK();
+	if (!btree_type) {
+		btree_class = (AZBTreeMapClass *) az_register_interface_type (&btree_type, (const unsigned char *) "AZBTreeMap", AZ_TYPE_MAP,
+			sizeof (AZMapClass), sizeof (AZBTreeMapImplementation), sizeof(AZBTreeMap), AZ_FLAG_ZERO_MEMORY | AZ_FLAG_CONSTRUCT,
+			0, 0,
+			NULL,
+			(void (*) (AZImplementation *)) btree_implementation_init,
+			(void (*) (const AZImplementation *, void *)) btree_instance_init,
+			(void (*) (const AZImplementation *, void *)) btree_instance_finalize);
+	}
+	t = btree_type;
+	AZ_TYPES_UNLOCK();
+	return t;
+}
+
+static void
+btree_implementation_init (AZBTreeMapImplementation *impl)
+{
+	impl->map_impl.collection_impl.get_element_type = btree_get_element_type;
+	impl->map_impl.collection_impl.contains = btree_contains;
+	impl->map_impl.collection_impl.get_iterator = btree_get_iter;
+	impl->map_impl.collection_impl.iterator_next = btree_iter_next;
+	impl->map_impl.collection_impl.get_element = btree_get_element;
+	impl->map_impl.get_key_type = btree_get_key_type;
+	impl->map_impl.get_key = btree_get_key;
+	impl->map_impl.contains_key = btree_contains_key;
+	impl->map_impl.lookup = btree_map_lookup;
+	impl->compare = NULL;
+	impl->key_impl = NULL;
+	impl->val_impl = NULL;
+	impl->node_size = 4 * CACHE_LINE;
+	impl->key_size = 0;
+	impl->val_size = 0;
+}
+
+static void
+btree_instance_init (const AZBTreeMapImplementation *impl, AZBTreeMap *tree)
+{
+	unsigned int node_size = (impl->node_size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+	unsigned int leaf_order, inner_order, vals_offset, children_offset, leaf_size, inner_size;
+	/* Leaves */
+	leaf_order = (node_size > HEADER_SIZE) ? (node_size - HEADER_SIZE) / (impl->key_size + impl->val_size) : 0;
+	if (leaf_order > MAX_LEAF_ORDER) leaf_order = MAX_LEAF_ORDER;
+	while (1) {
+		if (leaf_order < MIN_ORDER) leaf_order = MIN_ORDER;
+		vals_offset = ALIGN8(HEADER_SIZE + leaf_order * impl->key_size);
+		leaf_size = vals_offset + leaf_order * impl->val_size;
+		if ((leaf_size <= node_size) || (leaf_order == MIN_ORDER)) break;
+		leaf_order -= 1;
+	}
+	/* Internal nodes have one child more than keys */
+	inner_order = (node_size > HEADER_SIZE + 8) ? (node_size - HEADER_SIZE - 8) / (impl->key_size + sizeof (AZBTreeMapNode *)) : 0;
+	if (inner_order > UINT16_MAX) inner_order = UINT16_MAX;
+	while (1) {
+		if (inner_order < MIN_ORDER) inner_order = MIN_ORDER;
+		children_offset = ALIGN8(HEADER_SIZE + inner_order * impl->key_size);
+		inner_size = children_offset + (inner_order + 1) * sizeof (AZBTreeMapNode *);
+		if ((inner_size <= node_size) || (inner_order == MIN_ORDER)) break;
+		inner_order -= 1;
+	}
+	if (leaf_size > node_size) node_size = leaf_size;
+	if (inner_size > node_size) node_size = inner_size;
+	tree->node_size = (node_size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+	tree->leaf_order = (uint16_t) leaf_order;
+	tree->inner_order = (uint16_t) inner_order;
+	tree->leaf_vals_offset = (uint16_t) vals_offset;
+	tree->inner_children_offset = (uint16_t) children_offset;
+	tree->root = NULL;
+	tree->height = 0;
+}
+
+static void
+btree_instance_finalize (const AZBTreeMapImplementation *impl, AZBTreeMap *tree)
+{
+	if (tree->root) free_subtree (impl, tree, tree->root);
+}
+
+static unsigned int
+btree_get_element_type (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst)
+{
+	AZBTreeMapImplementation *impl = (AZBTreeMapImplementation *) coll_impl;
+	return impl->val_impl->type;
+}
+
+static unsigned int
+btree_contains (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZImplementation *impl, const void *inst)
+{
+	AZBTreeMapImplementation *tree_impl = (AZBTreeMapImplementation *) coll_impl;
+	AZBTreeMap *tree = (AZBTreeMap *) coll_inst;
+	if (!tree->root) return 0;
+	for (AZBTreeMapNode *leaf = first_leaf (tree); leaf; leaf = leaf->next) {
+		for (unsigned int i = 0; i < leaf->n_keys; i++) {
+			if (az_value_equals_instance_autobox (tree_impl->val_impl, val_ptr (tree_impl, tree, leaf, i), tree_impl->val_impl, inst)) return 1;
+		}
+	}
+	return 0;
+}
+
+static const AZImplementation *
+btree_get_iter (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter)
+{
+	AZBTreeMap *tree = (AZBTreeMap *) coll_inst;
+	if (!tree->root) return NULL;
+	return set_iter (iter, first_leaf (tree), 0);
+}
+
+static const AZImplementation *
+btree_iter_next (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter)
+{
+	AZBTreeMapNode *leaf = iter_leaf (iter);
+	unsigned int idx = iter_idx (iter) + 1;
+	if (idx < leaf->n_keys) return set_iter (iter, leaf, idx);
+	if (leaf->next) return set_iter (iter, leaf->next, 0);
+	return NULL;
+}
+
+static const AZImplementation *
+btree_get_element (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZValue *iter, AZValue *val, unsigned int size)
+{
+	AZBTreeMapImplementation *impl = (AZBTreeMapImplementation *) coll_impl;
+	AZBTreeMap *tree = (AZBTreeMap *) coll_inst;
+	return az_value_copy_autobox (impl->val_impl, val, val_ptr (impl, tree, iter_leaf (iter), iter_idx (iter)), size);
+}
+
+static unsigned int
+btree_get_key_type (const AZMapImplementation *map_impl, AZMap *map_inst)
+{
+	AZBTreeMapImplementation *impl = (AZBTreeMapImplementation *) map_impl;
+	return AZ_IMPL_TYPE(impl->key_impl);
+}
+
+static const AZImplementation *
+btree_get_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZValue *iter, AZValue *val, unsigned int size)
+{
+	AZBTreeMapImplementation *impl = (AZBTreeMapImplementation *) map_impl;
+	return az_value_copy_autobox (impl->key_impl, val, key_ptr (impl, iter_leaf (iter), iter_idx (iter)), size);
+}
+
+static unsigned int
+btree_contains_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, const void *key_inst)
+{
+	return az_btree_map_exists ((AZBTreeMapImplementation *) map_impl, (AZBTreeMap *) map_inst, key_inst);
+}
+
+static const AZImplementation *
+btree_map_lookup (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, void *key_inst, AZValue *val, unsigned int size)
+{
+	AZBTreeMapImplementation *impl = (AZBTreeMapImplementation *) map_impl;
+	const void *result = az_btree_map_lookup (impl, (AZBTreeMap *) map_inst, key_inst);
+	if (!result) return NULL;
+	return az_value_set_from_inst_autobox (impl->val_impl, val, size, (void *) result);
+}
+
+static void
+free_subtree (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *node)
+{
+	for (unsigned int i = 0; i < node->n_keys; i++) {
+		az_value_clear (impl->key_impl, key_ptr (impl, node, i));
+		if (node->leaf) az_value_clear (impl->val_impl, val_ptr (impl, tree, node, i));
+	}
+	if (!node->leaf) {
+		for (unsigned int i = 0; i <= node->n_keys; i++) free_subtree (impl, tree, children (tree, node)[i]);
+	}
+	arikkei_aligned_free (node);
+}
+
+/* Move count entries (keys, values or children) inside or between nodes */
+
+static inline void
+move_keys (const AZBTreeMapImplementation *impl, AZBTreeMapNode *dst, unsigned int dst_idx, AZBTreeMapNode *src, unsigned int src_idx, unsigned int count)
+{
+	memmove (key_ptr (impl, dst, dst_idx), key_ptr (impl, src, src_idx), count * impl->key_size);
+}
+
+static inline void
+move_vals (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *dst, unsigned int dst_idx, AZBTreeMapNode *src, unsigned int src_idx, unsigned int count)
+{
+	memmove (val_ptr (impl, tree, dst, dst_idx), val_ptr (impl, tree, src, src_idx), count * impl->val_size);
+}
+
+static inline void
+move_children (AZBTreeMap *tree, AZBTreeMapNode *dst, unsigned int dst_idx, AZBTreeMapNode *src, unsigned int src_idx, unsigned int count)
+{
+	memmove (children (tree, dst) + dst_idx, children (tree, src) + src_idx, count * sizeof (AZBTreeMapNode *));
+}
+
+void
+az_btree_map_insert (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, void *key, void *val)
+{
+	AZBTreeMapNode *path[MAX_HEIGHT];
+	unsigned int pos[MAX_HEIGHT];
+	unsigned int level = 0;
+	if (!tree->root) tree->root = new_node (tree, 1);
+	AZBTreeMapNode *node = tree->root;
+	while (!node->leaf) {
+		unsigned int idx = node_upper (impl, node, key);
+		path[level] = node;
+		pos[level++] = idx;
+		node = children (tree, node)[idx];
+	}
+	unsigned int idx = node_lower (impl, node, key);
+	if ((idx < node->n_keys) && !key_compare (impl, key_inst (impl, node, idx), key)) {
+		AZValue *dst = val_ptr (impl, tree, node, idx);
+		az_value_clear (impl->val_impl, dst);
+		az_value_set_from_inst (impl->val_impl, dst, val);
+		return;
+	}
+	AZBTreeMapNode *right = NULL;
+	if (node->n_keys == tree->leaf_order) {
+		/* Split leaf, the upper half goes to the new right sibling */
+		unsigned int n_left = (tree->leaf_order + 1) / 2;
+		right = new_node (tree, 1);
+		right->n_keys = node->n_keys - n_left;
+		move_keys (impl, right, 0, node, n_left, right->n_keys);
+		move_vals (impl, tree, right, 0, node, n_left, right->n_keys);
+		node->n_keys = n_left;
+		right->next = node->next;
+		if (node->next) node->next->prev = right;
+		right->prev = node;
+		node->next = right;
+		if (idx > n_left) {
+			node = right;
+			idx -= n_left;
+		}
+	}
+	move_keys (impl, node, idx + 1, node, idx, node->n_keys - idx);
+	move_vals (impl, tree, node, idx + 1, node, idx, node->n_keys - idx);
+	az_value_set_from_inst (impl->key_impl, key_ptr (impl, node, idx), key);
+	az_value_set_from_inst (impl->val_impl, val_ptr (impl, tree, node, idx), val);
+	node->n_keys += 1;
+	tree->map.collection.size += 1;
+	if (right) {
+		AZValue64 sep;
+		az_value_copy (impl->key_impl, &sep.value, key_ptr (impl, right, 0));
+		insert_separator (impl, tree, path, pos, level, &sep, right);
+	}
+}
+
+/* Insert separator (ownership is transferred) and new right child after the split child */
+static void
+insert_separator (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode **path, unsigned int *pos, unsigned int level, AZValue64 *sep, AZBTreeMapNode *right)
+{
+	while (level > 0) {
+		level -= 1;
+		AZBTreeMapNode *node = path[level];
+		unsigned int idx = pos[level];
+		AZBTreeMapNode *new_right = NULL;
+		AZValue64 up;
+		if (node->n_keys == tree->inner_order) {
+			/* Split, the middle key moves up */
+			unsigned int mid = node->n_keys / 2;
+			new_right = new_node (tree, 0);
+			new_right->n_keys = node->n_keys - mid - 1;
+			move_keys (impl, new_right, 0, node, mid + 1, new_right->n_keys);
+			move_children (tree, new_right, 0, node, mid + 1, new_right->n_keys + 1);
+			memcpy (&up, key_ptr (impl, node, mid), impl->key_size);
+			node->n_keys = mid;
+			if (idx > mid) {
+				node = new_right;
+				idx -= mid + 1;
+			}
+		}
+		move_keys (impl, node, idx + 1, node, idx, node->n_keys - idx);
+		move_children (tree, node, idx + 2, node, idx + 1, node->n_keys - idx);
+		memcpy (key_ptr (impl, node, idx), sep, impl->key_size);
+		children (tree, node)[idx + 1] = right;
+		node->n_keys += 1;
+		if (!new_right) return;
+		memcpy (sep, &up, impl->key_size);
+		right = new_right;
+	}
+	/* Root was split */
+	AZBTreeMapNode *root = new_node (tree, 0);
+	memcpy (key_ptr (impl, root, 0), sep, impl->key_size);
+	children (tree, root)[0] = tree->root;
+	children (tree, root)[1] = right;
+	root->n_keys = 1;
+	tree->root = root;
+	tree->height += 1;
+}
+
+unsigned int
+az_btree_map_remove (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key)
+{
+	AZBTreeMapNode *path[MAX_HEIGHT];
+	unsigned int pos[MAX_HEIGHT];
+	unsigned int level = 0;
+	if (!tree->root) return 0;
+	AZBTreeMapNode *node = tree->root;
+	while (!node->leaf) {
+		unsigned int idx = node_upper (impl, node, key);
+		path[level] = node;
+		pos[level++] = idx;
+		node = children (tree, node)[idx];
+	}
+	unsigned int idx = node_lower (impl, node, key);
+	if ((idx >= node->n_keys) || key_compare (impl, key_inst (impl, node, idx), key)) return 0;
+	az_value_clear (impl->key_impl, key_ptr (impl, node, idx));
+	az_value_clear (impl->val_impl, val_ptr (impl, tree, node, idx));
+	move_keys (impl, node, idx, node, idx + 1, node->n_keys - idx - 1);
+	move_vals (impl, tree, node, idx, node, idx + 1, node->n_keys - idx - 1);
+	node->n_keys -= 1;
+	tree->map.collection.size -= 1;
+	rebalance (impl, tree, path, pos, level, node);
+	return 1;
+}
+
+/* Merge child idx + 1 of parent into child idx */
+static void
+merge_children (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *parent, unsigned int idx)
+{
+	AZBTreeMapNode *left = children (tree, parent)[idx];
+	AZBTreeMapNode *right = children (tree, parent)[idx + 1];
+	if (left->leaf) {
+		move_keys (impl, left, left->n_keys, right, 0, right->n_keys);
+		move_vals (impl, tree, left, left->n_keys, right, 0, right->n_keys);
+		left->n_keys += right->n_keys;
+		left->next = right->next;
+		if (right->next) right->next->prev = left;
+		az_value_clear (impl->key_impl, key_ptr (impl, parent, idx));
+	} else {
+		/* Separator moves down */
+		move_keys (impl, left, left->n_keys, parent, idx, 1);
+		move_keys (impl, left, left->n_keys + 1, right, 0, right->n_keys);
+		move_children (tree, left, left->n_keys + 1, right, 0, right->n_keys + 1);
+		left->n_keys += right->n_keys + 1;
+	}
+	move_keys (impl, parent, idx, parent, idx + 1, parent->n_keys - idx - 1);
+	move_children (tree, parent, idx + 1, parent, idx + 2, parent->n_keys - idx - 1);
+	parent->n_keys -= 1;
+	arikkei_aligned_free (right);
+}
+
+/* Move the last entry of child idx - 1 to the front of child idx */
+static void
+borrow_left (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *parent, unsigned int idx)
+{
+	AZBTreeMapNode *left = children (tree, parent)[idx - 1];
+	AZBTreeMapNode *node = children (tree, parent)[idx];
+	move_keys (impl, node, 1, node, 0, node->n_keys);
+	if (node->leaf) {
+		move_vals (impl, tree, node, 1, node, 0, node->n_keys);
+		move_keys (impl, node, 0, left, left->n_keys - 1, 1);
+		move_vals (impl, tree, node, 0, left, left->n_keys - 1, 1);
+		az_value_clear (impl->key_impl, key_ptr (impl, parent, idx - 1));
+		az_value_copy (impl->key_impl, key_ptr (impl, parent, idx - 1), key_ptr (impl, node, 0));
+	} else {
+		move_children (tree, node, 1, node, 0, node->n_keys + 1);
+		move_keys (impl, node, 0, parent, idx - 1, 1);
+		children (tree, node)[0] = children (tree, left)[left->n_keys];
+		move_keys (impl, parent, idx - 1, left, left->n_keys - 1, 1);
+	}
+	left->n_keys -= 1;
+	node->n_keys += 1;
+}
+
+/* Move the first entry of child idx + 1 to the end of child idx */
+static void
+borrow_right (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode *parent, unsigned int idx)
+{
+	AZBTreeMapNode *node = children (tree, parent)[idx];
+	AZBTreeMapNode *right = children (tree, parent)[idx + 1];
+	if (node->leaf) {
+		move_keys (impl, node, node->n_keys, right, 0, 1);
+		move_vals (impl, tree, node, node->n_keys, right, 0, 1);
+		move_keys (impl, right, 0, right, 1, right->n_keys - 1);
+		move_vals (impl, tree, right, 0, right, 1, right->n_keys - 1);
+		az_value_clear (impl->key_impl, key_ptr (impl, parent, idx));
+		az_value_copy (impl->key_impl, key_ptr (impl, parent, idx), key_ptr (impl, right, 0));
+	} else {
+		move_keys (impl, node, node->n_keys, parent, idx, 1);
+		children (tree, node)[node->n_keys + 1] = children (tree, right)[0];
+		move_keys (impl, parent, idx, right, 0, 1);
+		move_keys (impl, right, 0, right, 1, right->n_keys - 1);
+		move_children (tree, right, 0, right, 1, right->n_keys);
+	}
+	node->n_keys += 1;
+	right->n_keys -= 1;
+}
+
+static void
+rebalance (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZBTreeMapNode **path, unsigned int *pos, unsigned int level, AZBTreeMapNode *node)
+{
+	while (level > 0) {
+		unsigned int min = (node->leaf) ? tree->leaf_order / 2 : tree->inner_order / 2;
+		if (node->n_keys >= min) return;
+		AZBTreeMapNode *parent = path[level - 1];
+		unsigned int idx = pos[level - 1];
+		/* Non-root internal nodes always have at least one key, so there is a sibling */
+		AZBTreeMapNode *left = (idx > 0) ? children (tree, parent)[idx - 1] : NULL;
+		AZBTreeMapNode *right = (idx < parent->n_keys) ? children (tree, parent)[idx + 1] : NULL;
+		if (left && (left->n_keys > min)) {
+			borrow_left (impl, tree, parent, idx);
+			return;
+		}
+		if (right && (right->n_keys > min)) {
+			borrow_right (impl, tree, parent, idx);
+			return;
+		}
+		merge_children (impl, tree, parent, (left) ? idx - 1 : idx);
+		node = parent;
+		level -= 1;
+	}
+	if (node->n_keys) return;
+	if (node->leaf) {
+		tree->root = NULL;
+	} else {
+		tree->root = children (tree, node)[0];
+		tree->height -= 1;
+	}
+	arikkei_aligned_free (node);
+}
+
+void
+az_btree_map_clear (const AZBTreeMapImplementation *impl, AZBTreeMap *tree)
+{
+	if (tree->root) free_subtree (impl, tree, tree->root);
+	tree->root = NULL;
+	tree->height = 0;
+	tree->map.collection.size = 0;
+}
+
+unsigned int
+az_btree_map_exists (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key)
+{
+	return az_btree_map_lookup (impl, tree, key) != NULL;
+}
+
+const void *
+az_btree_map_lookup (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key)
+{
+	if (!tree->root) return NULL;
+	AZBTreeMapNode *leaf = find_leaf (impl, tree, key);
+	unsigned int idx = node_lower (impl, leaf, key);
+	if ((idx >= leaf->n_keys) || key_compare (impl, key_inst (impl, leaf, idx), key)) return NULL;
+	return val_inst (impl, tree, leaf, idx);
+}
+
+void
+az_btree_map_load_sorted (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, void *const *keys, void *const *vals, unsigned int n_entries)
+{
+	unsigned int sorted = !tree->root;
+	for (unsigned int i = 1; sorted && (i < n_entries); i++) {
+		if (key_compare (impl, keys[i - 1], keys[i]) >= 0) sorted = 0;
+	}
+	if (!sorted) {
+		for (unsigned int i = 0; i < n_entries; i++) az_btree_map_insert (impl, tree, keys[i], vals[i]);
+		return;
+	}
+	if (!n_entries) return;
+	/* Leaves, entries are distributed evenly so that every leaf is at least half full */
+	unsigned int n_nodes = (n_entries + tree->leaf_order - 1) / tree->leaf_order;
+	AZBTreeMapNode **nodes = (AZBTreeMapNode **) malloc (n_nodes * sizeof (AZBTreeMapNode *));
+	/* The smallest key of every subtree */
+	AZValue **firsts = (AZValue **) malloc (n_nodes * sizeof (AZValue *));
+	AZBTreeMapNode *prev = NULL;
+	unsigned int entry = 0;
+	for (unsigned int i = 0; i < n_nodes; i++) {
+		unsigned int count = n_entries / n_nodes + (i < n_entries % n_nodes);
+		AZBTreeMapNode *leaf = new_node (tree, 1);
+		for (unsigned int j = 0; j < count; j++) {
+			az_value_set_from_inst (impl->key_impl, key_ptr (impl, leaf, j), keys[entry]);
+			az_value_set_from_inst (impl->val_impl, val_ptr (impl, tree, leaf, j), vals[entry]);
+			entry += 1;
+		}
+		leaf->n_keys = count;
+		leaf->prev = prev;
+		if (prev) prev->next = leaf;
+		prev = leaf;
+		nodes[i] = leaf;
+		firsts[i] = key_ptr (impl, leaf, 0);
+	}
+	/* Internal levels bottom-up */
+	unsigned int height = 0;
+	while (n_nodes > 1) {
+		unsigned int max_children = tree->inner_order + 1;
+		unsigned int n_parents = (n_nodes + max_children - 1) / max_children;
+		unsigned int child = 0;
+		for (unsigned int i = 0; i < n_parents; i++) {
+			unsigned int count = n_nodes / n_parents + (i < n_nodes % n_parents);
+			AZBTreeMapNode *node = new_node (tree, 0);
+			AZValue *first = firsts[child];
+			for (unsigned int j = 0; j < count; j++) {
+				children (tree, node)[j] = nodes[child];
+				if (j) az_value_copy (impl->key_impl, key_ptr (impl, node, j - 1), firsts[child]);
+				child += 1;
+			}
+			node->n_keys = count - 1;
+			nodes[i] = node;
+			firsts[i] = first;
+		}
+		n_nodes = n_parents;
+		height += 1;
+	}
+	tree->root = nodes[0];
+	tree->height = height;
+	tree->map.collection.size = n_entries;
+	free (firsts);
+	free (nodes);
+}
+
+const AZImplementation *
+az_btree_map_lower_bound (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key, AZValue *iter)
+{
+	if (!tree->root) return NULL;
+	AZBTreeMapNode *leaf = find_leaf (impl, tree, key);
+	unsigned int idx = node_lower (impl, leaf, key);
+	if (idx < leaf->n_keys) return set_iter (iter, leaf, idx);
+	if (leaf->next) return set_iter (iter, leaf->next, 0);
+	return NULL;
+}
+
+const AZImplementation *
+az_btree_map_upper_bound (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key, AZValue *iter)
+{
+	if (!tree->root) return NULL;
+	AZBTreeMapNode *leaf = find_leaf (impl, tree, key);
+	unsigned int idx = node_upper (impl, leaf, key);
+	if (idx < leaf->n_keys) return set_iter (iter, leaf, idx);
+	if (leaf->next) return set_iter (iter, leaf->next, 0);
+	return NULL;
+}
+
+const AZImplementation *
+az_btree_map_floor (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key, AZValue *iter)
+{
+	if (!tree->root) return NULL;
+	AZBTreeMapNode *leaf = find_leaf (impl, tree, key);
+	unsigned int idx = node_upper (impl, leaf, key);
+	if (idx > 0) return set_iter (iter, leaf, idx - 1);
+	if (leaf->prev) return set_iter (iter, leaf->prev, leaf->prev->n_keys - 1);
+	return NULL;
+}
+
+const AZImplementation *
+az_btree_map_get_last (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZValue *iter)
+{
+	if (!tree->root) return NULL;
+	AZBTreeMapNode *node = tree->root;
+	while (!node->leaf) node = children (tree, node)[node->n_keys];
+	return set_iter (iter, node, node->n_keys - 1);
+}
+
+const AZImplementation *
+az_btree_map_iterator_prev (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZValue *iter)
+{
+	AZBTreeMapNode *leaf = iter_leaf (iter);
+	unsigned int idx = iter_idx (iter);
+	if (idx > 0) return set_iter (iter, leaf, idx - 1);
+	if (leaf->prev) return set_iter (iter, leaf->prev, leaf->prev->n_keys - 1);
+	return NULL;
+}
+
+const void *
+az_btree_map_iterator_key (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const AZValue *iter)
+{
+	return key_inst (impl, iter_leaf (iter), iter_idx (iter));
+}
+
+const void *
+az_btree_map_iterator_val (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const AZValue *iter)
+{
+	return val_inst (impl, tree, iter_leaf (iter), iter_idx (iter));
+}
+
+unsigned int
+az_btree_map_forall (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, unsigned int (* forall) (const void *, const void *, void *), void *data)
+{
+	return az_btree_map_forall_range (impl, tree, NULL, NULL, forall, data);
+}
+
+unsigned int
+az_btree_map_forall_range (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *lo, const void *hi, unsigned int (* forall) (const void *, const void *, void *), void *data)
+{
+	AZValue iter;
+	if (!tree->root) return 1;
+	if (lo) {
+		if (!az_btree_map_lower_bound (impl, tree, lo, &iter)) return 1;
+	} else {
+		set_iter (&iter, first_leaf (tree), 0);
+	}
+	AZBTreeMapNode *leaf = iter_leaf (&iter);
+	unsigned int idx = iter_idx (&iter);
+	while (leaf) {
+		for (; idx < leaf->n_keys; idx++) {
+			void *key = key_inst (impl, leaf, idx);
+			if (hi && (key_compare (impl, key, hi) >= 0)) return 1;
+			if (!forall (key, val_inst (impl, tree, leaf, idx), data)) return 0;
+		}
+		leaf = leaf->next;
+		idx = 0;
+	}
+	return 1;
+}
@@ -0,0 +1,110 @@
+#ifndef __BTREE_MAP_H__
+#define __BTREE_MAP_H__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2016-2026
+*/
+
+#define AZ_TYPE_BTREE_MAP (az_btree_map_get_type ())
+
+typedef struct _AZBTreeMap AZBTreeMap;
+typedef struct _AZBTreeMapImplementation AZBTreeMapImplementation;
+typedef struct _AZBTreeMapClass AZBTreeMapClass;
+typedef struct _AZBTreeMapNode AZBTreeMapNode;
+
+#include <az/collections/map.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief An ordered map implementation based on B+ tree
+ *
+ * Entries are kept in key order in leaf nodes, the leaves are linked for sequential scans.
+ * Internal nodes keep only separator keys and child links. Nodes are allocated at cache line
+ * boundaries and keys are stored contiguously, separately from values, so that node search
+ * touches as few cache lines as possible. The number of entries per node is determined by
+ * node_size, key_size and val_size (at most 63 entries per leaf).
+ *
+ * The collection interface access values, iteration is in ascending key order.
+ * The iterator is 64-bit unsigned integer - the leaf address with the entry index in lowest
+ * 6 bits. Iterators are invalidated by insertions and removals.
+ *
+ */
+struct _AZBTreeMap {
+	AZMap map;
+	AZBTreeMapNode *root;
+	/* The number of internal levels (0 if root is leaf) */
+	unsigned int height;
+	unsigned int node_size;
+	uint16_t leaf_order;
+	uint16_t inner_order;
+	uint16_t leaf_vals_offset;
+	uint16_t inner_children_offset;
+};
+
+struct _AZBTreeMapImplementation {
+	AZMapImplementation map_impl;
+	const AZImplementation *key_impl;
+	const AZImplementation *val_impl;
+	/* Node size in bytes, rounded up to cache line size (default 256) */
+	unsigned int node_size;
+	uint16_t key_size;
+	uint16_t val_size;
+
+	/* If NULL, the compare method of the key type is used */
+	int (*compare) (const AZBTreeMapImplementation *impl, const void *lhs, const void *rhs);
+};
+
+struct _AZBTreeMapClass {
+	AZMapClass map_class;
+};
+
+unsigned int az_btree_map_get_type (void);
+
+/* Insert or replace value */
+void az_btree_map_insert (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, void *key, void *val);
+unsigned int az_btree_map_remove (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key);
+void az_btree_map_clear (const AZBTreeMapImplementation *impl, AZBTreeMap *tree);
+unsigned int az_btree_map_exists (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key);
+const void *az_btree_map_lookup (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key);
+/**
+ * @brief Build map from sorted entries
+ *
+ * If the map is empty and keys are strictly ascending, leaves are filled sequentially and
+ * the internal levels are built bottom-up, otherwise entries are inserted one by one.
+ */
+void az_btree_map_load_sorted (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, void *const *keys, void *const *vals, unsigned int n_entries);
+
+/*
+ * Positioned iterators
+ * Return iterator implementation or NULL if there is no such entry. The iterator can be
+ * advanced with az_collection_iterator_next (ascending) or az_btree_map_iterator_prev.
+ */
+
+/* The first entry with key >= key */
+const AZImplementation *az_btree_map_lower_bound (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key, AZValue *iter);
+/* The first entry with key > key */
+const AZImplementation *az_btree_map_upper_bound (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key, AZValue *iter);
+/* The last entry with key <= key */
+const AZImplementation *az_btree_map_floor (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *key, AZValue *iter);
+/* The entry with the biggest key */
+const AZImplementation *az_btree_map_get_last (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZValue *iter);
+const AZImplementation *az_btree_map_iterator_prev (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, AZValue *iter);
+/* Key and value instances at iterator position (without copying) */
+const void *az_btree_map_iterator_key (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const AZValue *iter);
+const void *az_btree_map_iterator_val (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const AZValue *iter);
+
+/* Ascending order */
+unsigned int az_btree_map_forall (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, unsigned int (* forall) (const void *, const void *, void *), void *data);
+/* All entries with lo <= key < hi in ascending order, either bound can be NULL */
+unsigned int az_btree_map_forall_range (const AZBTreeMapImplementation *impl, AZBTreeMap *tree, const void *lo, const void *hi, unsigned int (* forall) (const void *, const void *, void *), void *data);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -16,6 +16,9 @@
 
 /* AZInterface implementation */
 static void collection_class_init (AZCollectionClass* klass);
+static void collection_implementation_init (AZCollectionImplementation *impl);
+/* AZInstance implementation */
+static unsigned int collection_get_property (const AZImplementation *impl, void *inst, unsigned int idx, const AZImplementation **prop_impl, AZValue *prop_val, AZContext *ctx);
 
 static unsigned int collection_call_contains (const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx);
 static unsigned int collection_call_get_iterator (const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx);
@@ -41,7 +44,7 @@ az_collection_get_type (void)
 			sizeof(AZCollectionClass), sizeof(AZCollectionImplementation), sizeof(AZCollection), AZ_FLAG_ABSTRACT,
 			0, NUM_PROPERTIES,
 			(void (*) (AZClass *)) collection_class_init,
-			NULL,
+			(void (*) (AZImplementation *)) collection_implementation_init,
 			NULL, NULL);
 	}
 	t = collection_type;
@@ -54,7 +57,22 @@ collection_class_init (AZCollectionClass *klass)
 {
 	az_class_define_method_va ((AZClass *) klass, FUNC_CONTAINS, (const unsigned char *) "contains", collection_call_contains, AZ_TYPE_BOOLEAN, 1, AZ_TYPE_ANY);
 	az_class_define_method_va ((AZClass *) klass, FUNC_GET_ITERATOR, (const unsigned char *) "getIterator", collection_call_get_iterator, AZ_TYPE_ANY, 0);
-	az_class_define_property ((AZClass *) klass, PROP_SIZE, (const unsigned char *) "size", AZ_TYPE_UINT32, 0, AZ_FIELD_INSTANCE, AZ_FIELD_READ_VALUE, 0, ARIKKEI_OFFSET(AZCollection,size), NULL, NULL);
+	az_class_define_property ((AZClass *) klass, PROP_SIZE, (const unsigned char *) "size", AZ_TYPE_UINT32, 0, AZ_FIELD_INSTANCE, AZ_FIELD_READ_METHOD, 0, 0, NULL, NULL);
+	klass->iface_class.klass.get_property = collection_get_property;
+}
+
+static void
+collection_implementation_init (AZCollectionImplementation *impl)
+{
+	impl->get_size = NULL;
+}
+
+static unsigned int
+collection_get_property (const AZImplementation *impl, void *inst, unsigned int idx, const AZImplementation **prop_impl, AZValue *prop_val, AZContext *ctx)
+{
+	*prop_impl = (AZImplementation *) az_type_get_class (AZ_TYPE_UINT32);
+	prop_val->uint32_v = (uint32_t) az_collection_get_size ((AZCollectionImplementation *) impl, inst);
+	return 1;
 }
 
 static unsigned int
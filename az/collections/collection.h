@@ -30,6 +30,8 @@ struct _AZCollectionImplementation {
 	const AZImplementation *(*get_iterator) (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
 	const AZImplementation *(*iterator_next) (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
 	const AZImplementation *(*get_element) (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZValue *iter, AZValue *val, unsigned int size);
+	/* If NULL, the size member of instance is used */
+	uint64_t (*get_size) (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst);
 };
 
 struct _AZCollectionClass {
@@ -48,6 +50,7 @@ az_collection_get_element_type (const AZCollectionImplementation *coll_impl, AZC
 static inline uint64_t
 az_collection_get_size (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst)
 {
+	if (coll_impl->get_size) return coll_impl->get_size (coll_impl, coll_inst);
 	return coll_inst->size;
 }
 
@@ -0,0 +1,753 @@
+#define __AZ_CONCURRENT_HASH_MAP_C__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2016-2026
+*/
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arikkei/arikkei-utils.h>
+
+#include <az/base.h>
+#include <az/slab.h>
+#include <az/value.h>
+#include <az/packed-value.h>
+
+#include "concurrent-hash-map.h"
+
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+#include <arikkei/arikkei-threads.h>
+#endif
+
+typedef struct _AZConcurrentHashMapEntry AZConcurrentHashMapEntry;
+typedef struct _AZConcurrentHashMapTable AZConcurrentHashMapTable;
+typedef struct _AZConcurrentHashMapRetired AZConcurrentHashMapRetired;
+
+/* Entries are immutable once linked, except the chain link */
+struct _AZConcurrentHashMapEntry {
+	_Atomic (AZConcurrentHashMapEntry *) next;
+	uint32_t hash;
+};
+
+struct _AZConcurrentHashMapTable {
+	/* Link in the list of retired tables */
+	AZConcurrentHashMapTable *retired;
+	unsigned int root_size;
+	_Atomic (AZConcurrentHashMapEntry *) roots[];
+};
+
+/* Unlinked entries and tables that may still be visible to lookups */
+struct _AZConcurrentHashMapRetired {
+	AZConcurrentHashMapEntry **entries;
+	unsigned int n_entries;
+	unsigned int size_entries;
+	AZConcurrentHashMapTable *tables;
+};
+
+/* Shards are aligned to cache line, so that neighbouring shards do not contend */
+#define CACHE_LINE 64
+
+struct _AZConcurrentHashMapShard {
+	_Alignas(CACHE_LINE) _Atomic (AZConcurrentHashMapTable *) table;
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	/* Lookups are counted per generation, see shard_read_begin */
+	_Atomic unsigned int epoch;
+	_Atomic unsigned int readers[2];
+	/* Writer state, kept off the cache line of lookups */
+	_Alignas(CACHE_LINE) mtx_t mutex;
+	/* Entries and tables retired in generation i are kept in retired[i & 1] */
+	AZConcurrentHashMapRetired retired[2];
+#endif
+	unsigned int size;
+};
+
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+/*
+ * Lookups do not lock, they follow chains while modifications (serialized by shard mutex)
+ * link and unlink entries. Unlinked entries are not freed immediately, but retired to the
+ * list of the current generation. Every lookup enters the current generation, incrementing its
+ * reader count. Modifications advance the generation once the readers of the previous one have
+ * finished, at which point the entries retired two generations ago are no longer reachable and
+ * can be freed. Thus neither lookups nor modifications ever wait for each other.
+ */
+static inline unsigned int
+shard_read_begin (AZConcurrentHashMapShard *shard)
+{
+	for (;;) {
+		unsigned int epoch = atomic_load (&shard->epoch);
+		atomic_fetch_add (&shard->readers[epoch & 1], 1);
+		/* Generation may have advanced before we were counted */
+		if (atomic_load (&shard->epoch) == epoch) return epoch & 1;
+		atomic_fetch_sub (&shard->readers[epoch & 1], 1);
+	}
+}
+
+static inline void
+shard_read_end (AZConcurrentHashMapShard *shard, unsigned int gen)
+{
+	atomic_fetch_sub_explicit (&shard->readers[gen], 1, memory_order_release);
+}
+
+#define SHARD_LOCK(s) mtx_lock (&(s)->mutex)
+#define SHARD_UNLOCK(s) mtx_unlock (&(s)->mutex)
+/* Collection size is not written, as writers of different shards would race on it */
+#define SIZE_ADD(m,d) atomic_fetch_add_explicit (&(m)->size, (d), memory_order_relaxed)
+#define SIZE_SUB(m,d) atomic_fetch_sub_explicit (&(m)->size, (d), memory_order_relaxed)
+#else
+static inline unsigned int shard_read_begin (AZConcurrentHashMapShard *shard) { return 0; }
+static inline void shard_read_end (AZConcurrentHashMapShard *shard, unsigned int gen) {}
+
+#define SHARD_LOCK(s)
+#define SHARD_UNLOCK(s)
+#define SIZE_ADD(m,d) ((m)->map.collection.size = ((m)->size += (d)))
+#define SIZE_SUB(m,d) ((m)->map.collection.size = ((m)->size -= (d)))
+#endif
+
+#define MAX_SHARDS 256
+#define MIN_ROOT_SIZE 4
+/* Shard grows if average chain is longer than this */
+#define MAX_LOAD 2
+
+#define SHARD_INDEX(m,h) (((h) >> 24) & ((m)->n_shards - 1))
+#define ITER_SHARD(it) ((unsigned int) ((it) >> 56))
+#define ITER_BUCKET(it) ((unsigned int) ((it) >> 24))
+#define ITER_DEPTH(it) ((unsigned int) ((it) & 0xffffff))
+#define ITER_MAKE(s,b,d) (((uint64_t) (s) << 56) | ((uint64_t) (b) << 24) | (d))
+
+static AZValue *
+key_ptr(const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapEntry *entry)
+{
+	return (AZValue *) ((char *) entry + impl->key_offset);
+}
+
+static void *
+key_inst(const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapEntry *entry)
+{
+	return az_value_get_inst(impl->key_impl, key_ptr(impl, entry));
+}
+
+/* Without callbacks keys are hashed and compared by the methods of their type */
+static inline uint32_t
+key_hash(const AZConcurrentHashMapImplementation *impl, const void *key)
+{
+	if (impl->hash) return impl->hash(impl, key);
+	return az_instance_hash(impl->key_impl, (void *) key);
+}
+
+static inline unsigned int
+key_equal(const AZConcurrentHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+	if (impl->equal) return impl->equal(impl, lhs, rhs);
+	return az_instance_equals(impl->key_impl, (void *) lhs, (void *) rhs);
+}
+
+static AZValue *
+val_ptr(const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapEntry *entry)
+{
+	return (AZValue *) ((char *) entry + impl->val_offset);
+}
+
+static void *
+val_inst(const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapEntry *entry)
+{
+	return az_value_get_inst(impl->val_impl, val_ptr(impl, entry));
+}
+
+static void
+delete_entry(const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapEntry *entry)
+{
+	az_value_clear(impl->key_impl, key_ptr(impl, entry));
+	az_value_clear(impl->val_impl, val_ptr(impl, entry));
+	az_slab_free(entry, impl->entry_size);
+}
+
+static AZConcurrentHashMapEntry *
+new_entry(const AZConcurrentHashMapImplementation *impl, uint32_t hash, void *key)
+{
+	AZConcurrentHashMapEntry *entry = (AZConcurrentHashMapEntry *) az_slab_alloc(impl->entry_size);
+	atomic_init(&entry->next, NULL);
+	entry->hash = hash;
+	az_value_set_from_inst(impl->key_impl, key_ptr(impl, entry), key);
+	return entry;
+}
+
+/* New entry with the key of src, the value is not initialized */
+static AZConcurrentHashMapEntry *
+copy_entry(const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapEntry *src)
+{
+	AZConcurrentHashMapEntry *entry = (AZConcurrentHashMapEntry *) az_slab_alloc(impl->entry_size);
+	atomic_init(&entry->next, NULL);
+	entry->hash = src->hash;
+	az_value_copy(impl->key_impl, key_ptr(impl, entry), key_ptr(impl, src));
+	return entry;
+}
+
+static AZConcurrentHashMapTable *
+new_table (unsigned int root_size)
+{
+	AZConcurrentHashMapTable *table = (AZConcurrentHashMapTable *) malloc(sizeof(AZConcurrentHashMapTable) + root_size * sizeof(AZConcurrentHashMapEntry *));
+	table->retired = NULL;
+	table->root_size = root_size;
+	for (unsigned int b = 0; b < root_size; b++) atomic_init(&table->roots[b], NULL);
+	return table;
+}
+
+static void shard_setup (AZConcurrentHashMapShard *shard, unsigned int root_size);
+static void shard_release (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard);
+static _Atomic (AZConcurrentHashMapEntry *) *shard_find (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, const void *key, uint32_t hash);
+static AZConcurrentHashMapEntry *shard_lookup (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, const void *key, uint32_t hash);
+static void shard_link (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, AZConcurrentHashMapEntry *entry);
+static void shard_retire (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, AZConcurrentHashMapEntry *entry);
+static void shard_retire_table (AZConcurrentHashMapShard *shard, AZConcurrentHashMapTable *table);
+static void shard_reclaim (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard);
+static AZConcurrentHashMapEntry *shard_entry_at (AZConcurrentHashMapShard *shard, uint64_t iter);
+static unsigned int find_next (AZConcurrentHashMap *cmap, AZValue *iter, unsigned int s, unsigned int b, unsigned int d);
+
+static void cmap_implementation_init (AZConcurrentHashMapImplementation *impl);
+static void cmap_instance_init (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap);
+static void cmap_instance_finalize (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap);
+
+static unsigned int cmap_get_element_type (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst);
+static unsigned int cmap_contains (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZImplementation *impl, const void *inst);
+static const AZImplementation *cmap_get_iter (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
+static const AZImplementation *cmap_iter_next (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
+static const AZImplementation *cmap_get_element (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZValue *iter, AZValue *val, unsigned int size);
+static uint64_t cmap_get_size (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst);
+static unsigned int cmap_get_key_type (const AZMapImplementation *map_impl, AZMap *map_inst);
+static const AZImplementation *cmap_get_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZValue *iter, AZValue *val, unsigned int size);
+static unsigned int cmap_contains_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, const void *key_inst);
+static const AZImplementation *cmap_map_lookup (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, void *key_inst, AZValue *val, unsigned int size);
+
+static unsigned int cmap_type = 0;
+static AZConcurrentHashMapClass *cmap_class;
+
+unsigned int
+az_concurrent_hash_map_get_type (void)
+{
+	unsigned int t = AZ_TYPE_READ(cmap_type);
+	if (t) return t;
+	AZ_TYPES_LOCK();
+	if (!cmap_type) {
+		cmap_class = (AZConcurrentHashMapClass *) az_register_interface_type (&cmap_type, (const unsigned char *) "AZConcurrentHashMap", AZ_TYPE_MAP,
+			sizeof (AZMapClass), sizeof (AZConcurrentHashMapImplementation), sizeof(AZConcurrentHashMap), AZ_FLAG_ZERO_MEMORY | AZ_FLAG_CONSTRUCT,
+			0, 0,
+			NULL,
+			(void (*) (AZImplementation *)) cmap_implementation_init,
+			(void (*) (const AZImplementation *, void *)) cmap_instance_init,
+			(void (*) (const AZImplementation *, void *)) cmap_instance_finalize);
+	}
+	t = cmap_type;
+	AZ_TYPES_UNLOCK();
+	return t;
+}
+
+static void
+cmap_implementation_init (AZConcurrentHashMapImplementation *impl)
+{
+	impl->map_impl.collection_impl.get_element_type = cmap_get_element_type;
+	impl->map_impl.collection_impl.contains = cmap_contains;
+	impl->map_impl.collection_impl.get_iterator = cmap_get_iter;
+	impl->map_impl.collection_impl.iterator_next = cmap_iter_next;
+	impl->map_impl.collection_impl.get_element = cmap_get_element;
+	impl->map_impl.collection_impl.get_size = cmap_get_size;
+	/* Keyset instance is the map itself, size is not kept in collection.size */
+	impl->map_impl.keyset_impl.collection_impl.get_size = cmap_get_size;
+	impl->map_impl.get_key_type = cmap_get_key_type;
+	impl->map_impl.get_key = cmap_get_key;
+	impl->map_impl.contains_key = cmap_contains_key;
+	impl->map_impl.lookup = cmap_map_lookup;
+	impl->hash = NULL;
+	impl->equal = NULL;
+	impl->key_impl = NULL;
+	impl->val_impl = NULL;
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	impl->n_shards = 16;
+#else
+	impl->n_shards = 1;
+#endif
+	impl->root_size = 16;
+	impl->entry_size = 0;
+	impl->key_offset = 0;
+	impl->key_size = 0;
+	impl->val_offset = 0;
+	impl->val_size = 0;
+}
+
+static void
+cmap_instance_init (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap)
+{
+	unsigned int n_shards = 1;
+	while ((n_shards < impl->n_shards) && (n_shards < MAX_SHARDS)) n_shards <<= 1;
+	unsigned int root_size = MIN_ROOT_SIZE;
+	while (root_size < impl->root_size) root_size <<= 1;
+	cmap->n_shards = n_shards;
+	atomic_init(&cmap->size, 0);
+	cmap->shards = (AZConcurrentHashMapShard *) arikkei_aligned_alloc(n_shards * sizeof(AZConcurrentHashMapShard), CACHE_LINE);
+	for (unsigned int i = 0; i < n_shards; i++) shard_setup(&cmap->shards[i], root_size);
+}
+
+static void
+cmap_instance_finalize (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap)
+{
+	for (unsigned int i = 0; i < cmap->n_shards; i++) shard_release(impl, &cmap->shards[i]);
+	arikkei_aligned_free(cmap->shards);
+}
+
+static unsigned int
+cmap_get_element_type (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst)
+{
+	AZConcurrentHashMapImplementation *impl = (AZConcurrentHashMapImplementation *) coll_impl;
+	return AZ_IMPL_TYPE(impl->val_impl);
+}
+
+static unsigned int
+cmap_contains (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZImplementation *impl, const void *inst)
+{
+	AZConcurrentHashMapImplementation *cmap_impl = (AZConcurrentHashMapImplementation *) coll_impl;
+	AZConcurrentHashMap *cmap = (AZConcurrentHashMap *) coll_inst;
+	for (unsigned int s = 0; s < cmap->n_shards; s++) {
+		AZConcurrentHashMapShard *shard = &cmap->shards[s];
+		unsigned int gen = shard_read_begin(shard);
+		AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_acquire);
+		for (unsigned int b = 0; b < table->root_size; b++) {
+			AZConcurrentHashMapEntry *entry = atomic_load_explicit(&table->roots[b], memory_order_acquire);
+			for (; entry; entry = atomic_load_explicit(&entry->next, memory_order_acquire)) {
+				if (az_value_equals_instance_autobox(cmap_impl->val_impl, val_ptr(cmap_impl, entry), impl, inst)) {
+					shard_read_end(shard, gen);
+					return 1;
+				}
+			}
+		}
+		shard_read_end(shard, gen);
+	}
+	return 0;
+}
+
+static const AZImplementation *
+cmap_get_iter (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter)
+{
+	if (!find_next((AZConcurrentHashMap *) coll_inst, iter, 0, 0, 0)) return NULL;
+	return &AZUint64Klass.impl;
+}
+
+static const AZImplementation *
+cmap_iter_next (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter)
+{
+	uint64_t it = iter->uint64_v;
+	if (!find_next((AZConcurrentHashMap *) coll_inst, iter, ITER_SHARD(it), ITER_BUCKET(it), ITER_DEPTH(it) + 1)) return NULL;
+	return &AZUint64Klass.impl;
+}
+
+static const AZImplementation *
+cmap_get_element (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZValue *iter, AZValue *val, unsigned int size)
+{
+	AZConcurrentHashMapImplementation *impl = (AZConcurrentHashMapImplementation *) coll_impl;
+	AZConcurrentHashMap *cmap = (AZConcurrentHashMap *) coll_inst;
+	const AZImplementation *result = NULL;
+	AZConcurrentHashMapShard *shard = &cmap->shards[ITER_SHARD(iter->uint64_v)];
+	unsigned int gen = shard_read_begin(shard);
+	AZConcurrentHashMapEntry *entry = shard_entry_at(shard, iter->uint64_v);
+	if (entry) result = az_value_copy_autobox(impl->val_impl, val, val_ptr(impl, entry), size);
+	shard_read_end(shard, gen);
+	return result;
+}
+
+static uint64_t
+cmap_get_size (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst)
+{
+	return az_concurrent_hash_map_get_size ((AZConcurrentHashMap *) coll_inst);
+}
+
+static unsigned int
+cmap_get_key_type (const AZMapImplementation *map_impl, AZMap *map_inst)
+{
+	AZConcurrentHashMapImplementation *impl = (AZConcurrentHashMapImplementation *) map_impl;
+	return AZ_IMPL_TYPE(impl->key_impl);
+}
+
+static const AZImplementation *
+cmap_get_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZValue *iter, AZValue *val, unsigned int size)
+{
+	AZConcurrentHashMapImplementation *impl = (AZConcurrentHashMapImplementation *) map_impl;
+	AZConcurrentHashMap *cmap = (AZConcurrentHashMap *) map_inst;
+	const AZImplementation *result = NULL;
+	AZConcurrentHashMapShard *shard = &cmap->shards[ITER_SHARD(iter->uint64_v)];
+	unsigned int gen = shard_read_begin(shard);
+	AZConcurrentHashMapEntry *entry = shard_entry_at(shard, iter->uint64_v);
+	if (entry) result = az_value_copy_autobox(impl->key_impl, val, key_ptr(impl, entry), size);
+	shard_read_end(shard, gen);
+	return result;
+}
+
+static unsigned int
+cmap_contains_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, const void *key_inst)
+{
+	return az_concurrent_hash_map_exists((AZConcurrentHashMapImplementation *) map_impl, (AZConcurrentHashMap *) map_inst, key_inst);
+}
+
+static const AZImplementation *
+cmap_map_lookup (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, void *key_inst, AZValue *val, unsigned int size)
+{
+	return az_concurrent_hash_map_get((AZConcurrentHashMapImplementation *) map_impl, (AZConcurrentHashMap *) map_inst, key_inst, val, size);
+}
+
+void
+az_concurrent_hash_map_insert (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, void *key, void *val)
+{
+	uint32_t hash = key_hash(impl, key);
+	AZConcurrentHashMapShard *shard = &cmap->shards[SHARD_INDEX(cmap, hash)];
+	SHARD_LOCK(shard);
+	_Atomic (AZConcurrentHashMapEntry *) *slot = shard_find(impl, shard, key, hash);
+	AZConcurrentHashMapEntry *old = atomic_load_explicit(slot, memory_order_relaxed);
+	if (old) {
+		/* Lookups may be copying the old value, so the entry is replaced instead */
+		AZConcurrentHashMapEntry *entry = copy_entry(impl, old);
+		az_value_set_from_inst(impl->val_impl, val_ptr(impl, entry), val);
+		atomic_init(&entry->next, atomic_load_explicit(&old->next, memory_order_relaxed));
+		atomic_store_explicit(slot, entry, memory_order_release);
+		shard_retire(impl, shard, old);
+	} else {
+		AZConcurrentHashMapEntry *entry = new_entry(impl, hash, key);
+		az_value_set_from_inst(impl->val_impl, val_ptr(impl, entry), val);
+		shard_link(impl, shard, entry);
+		SIZE_ADD(cmap, 1);
+	}
+	shard_reclaim(impl, shard);
+	SHARD_UNLOCK(shard);
+}
+
+unsigned int
+az_concurrent_hash_map_remove (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, const void *key)
+{
+	uint32_t hash = key_hash(impl, key);
+	AZConcurrentHashMapShard *shard = &cmap->shards[SHARD_INDEX(cmap, hash)];
+	SHARD_LOCK(shard);
+	_Atomic (AZConcurrentHashMapEntry *) *slot = shard_find(impl, shard, key, hash);
+	AZConcurrentHashMapEntry *entry = atomic_load_explicit(slot, memory_order_relaxed);
+	if (entry) {
+		/* Lookups positioned at entry can still follow its link */
+		atomic_store_explicit(slot, atomic_load_explicit(&entry->next, memory_order_relaxed), memory_order_release);
+		shard->size -= 1;
+		SIZE_SUB(cmap, 1);
+		shard_retire(impl, shard, entry);
+	}
+	shard_reclaim(impl, shard);
+	SHARD_UNLOCK(shard);
+	return entry != NULL;
+}
+
+void
+az_concurrent_hash_map_clear (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap)
+{
+	for (unsigned int s = 0; s < cmap->n_shards; s++) {
+		AZConcurrentHashMapShard *shard = &cmap->shards[s];
+		SHARD_LOCK(shard);
+		AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+		for (unsigned int b = 0; b < table->root_size; b++) {
+			AZConcurrentHashMapEntry *entry = atomic_load_explicit(&table->roots[b], memory_order_relaxed);
+			atomic_store_explicit(&table->roots[b], NULL, memory_order_release);
+			while (entry) {
+				AZConcurrentHashMapEntry *next = atomic_load_explicit(&entry->next, memory_order_relaxed);
+				shard_retire(impl, shard, entry);
+				entry = next;
+			}
+		}
+		SIZE_SUB(cmap, shard->size);
+		shard->size = 0;
+		shard_reclaim(impl, shard);
+		SHARD_UNLOCK(shard);
+	}
+}
+
+uint64_t
+az_concurrent_hash_map_get_size (AZConcurrentHashMap *cmap)
+{
+	return atomic_load_explicit(&cmap->size, memory_order_relaxed);
+}
+
+unsigned int
+az_concurrent_hash_map_exists (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, const void *key)
+{
+	uint32_t hash = key_hash(impl, key);
+	AZConcurrentHashMapShard *shard = &cmap->shards[SHARD_INDEX(cmap, hash)];
+	unsigned int gen = shard_read_begin(shard);
+	unsigned int result = shard_lookup(impl, shard, key, hash) != NULL;
+	shard_read_end(shard, gen);
+	return result;
+}
+
+const AZImplementation *
+az_concurrent_hash_map_get (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, const void *key, AZValue *dst, unsigned int size)
+{
+	uint32_t hash = key_hash(impl, key);
+	AZConcurrentHashMapShard *shard = &cmap->shards[SHARD_INDEX(cmap, hash)];
+	const AZImplementation *result = NULL;
+	unsigned int gen = shard_read_begin(shard);
+	AZConcurrentHashMapEntry *entry = shard_lookup(impl, shard, key, hash);
+	if (entry) result = az_value_copy_autobox(impl->val_impl, dst, val_ptr(impl, entry), size);
+	shard_read_end(shard, gen);
+	return result;
+}
+
+const AZImplementation *
+az_concurrent_hash_map_get_or_insert (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, void *key, void *val, AZValue *dst, unsigned int size, unsigned int *inserted)
+{
+	uint32_t hash = key_hash(impl, key);
+	AZConcurrentHashMapShard *shard = &cmap->shards[SHARD_INDEX(cmap, hash)];
+	SHARD_LOCK(shard);
+	AZConcurrentHashMapEntry *entry = atomic_load_explicit(shard_find(impl, shard, key, hash), memory_order_relaxed);
+	if (inserted) *inserted = (entry == NULL);
+	if (!entry) {
+		entry = new_entry(impl, hash, key);
+		az_value_set_from_inst(impl->val_impl, val_ptr(impl, entry), val);
+		shard_link(impl, shard, entry);
+		SIZE_ADD(cmap, 1);
+	}
+	const AZImplementation *result = az_value_copy_autobox(impl->val_impl, dst, val_ptr(impl, entry), size);
+	shard_reclaim(impl, shard);
+	SHARD_UNLOCK(shard);
+	return result;
+}
+
+const AZImplementation *
+az_concurrent_hash_map_compute_if_absent (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, void *key,
+	unsigned int (*compute) (const void *key, AZValue *val, void *data), void *data, AZValue *dst, unsigned int size)
+{
+	uint32_t hash = key_hash(impl, key);
+	AZConcurrentHashMapShard *shard = &cmap->shards[SHARD_INDEX(cmap, hash)];
+	const AZImplementation *result = NULL;
+	SHARD_LOCK(shard);
+	AZConcurrentHashMapEntry *entry = atomic_load_explicit(shard_find(impl, shard, key, hash), memory_order_relaxed);
+	if (!entry) {
+		entry = new_entry(impl, hash, key);
+		if (compute(key, val_ptr(impl, entry), data)) {
+			shard_link(impl, shard, entry);
+			SIZE_ADD(cmap, 1);
+		} else {
+			az_value_clear(impl->key_impl, key_ptr(impl, entry));
+			az_slab_free(entry, impl->entry_size);
+			entry = NULL;
+		}
+	}
+	if (entry) result = az_value_copy_autobox(impl->val_impl, dst, val_ptr(impl, entry), size);
+	shard_reclaim(impl, shard);
+	SHARD_UNLOCK(shard);
+	return result;
+}
+
+unsigned int
+az_concurrent_hash_map_forall (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, unsigned int (* forall) (const void *, const void *, void *), void *data)
+{
+	for (unsigned int s = 0; s < cmap->n_shards; s++) {
+		AZConcurrentHashMapShard *shard = &cmap->shards[s];
+		unsigned int gen = shard_read_begin(shard);
+		AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_acquire);
+		for (unsigned int b = 0; b < table->root_size; b++) {
+			AZConcurrentHashMapEntry *entry = atomic_load_explicit(&table->roots[b], memory_order_acquire);
+			for (; entry; entry = atomic_load_explicit(&entry->next, memory_order_acquire)) {
+				if (!forall(key_inst(impl, entry), val_inst(impl, entry), data)) {
+					shard_read_end(shard, gen);
+					return 0;
+				}
+			}
+		}
+		shard_read_end(shard, gen);
+	}
+	return 1;
+}
+
+static void
+shard_setup (AZConcurrentHashMapShard *shard, unsigned int root_size)
+{
+	atomic_init(&shard->table, new_table(root_size));
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	atomic_init(&shard->epoch, 0);
+	atomic_init(&shard->readers[0], 0);
+	atomic_init(&shard->readers[1], 0);
+	mtx_init(&shard->mutex, mtx_plain);
+	memset(shard->retired, 0, sizeof(shard->retired));
+#endif
+	shard->size = 0;
+}
+
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+static void
+retired_free (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapRetired *retired)
+{
+	for (unsigned int i = 0; i < retired->n_entries; i++) delete_entry(impl, retired->entries[i]);
+	retired->n_entries = 0;
+	while (retired->tables) {
+		AZConcurrentHashMapTable *table = retired->tables;
+		retired->tables = table->retired;
+		free(table);
+	}
+}
+#endif
+
+/* Delete all entries and tables, there must be no concurrent access */
+static void
+shard_release (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard)
+{
+	AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	for (unsigned int b = 0; b < table->root_size; b++) {
+		AZConcurrentHashMapEntry *entry = atomic_load_explicit(&table->roots[b], memory_order_relaxed);
+		while (entry) {
+			AZConcurrentHashMapEntry *next = atomic_load_explicit(&entry->next, memory_order_relaxed);
+			delete_entry(impl, entry);
+			entry = next;
+		}
+	}
+	free(table);
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	for (unsigned int i = 0; i < 2; i++) {
+		retired_free(impl, &shard->retired[i]);
+		free(shard->retired[i].entries);
+	}
+	mtx_destroy(&shard->mutex);
+#endif
+}
+
+/* Requires shard lock, returns the link pointing to matching entry or the terminating NULL link */
+static _Atomic (AZConcurrentHashMapEntry *) *
+shard_find (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, const void *key, uint32_t hash)
+{
+	AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	_Atomic (AZConcurrentHashMapEntry *) *slot = &table->roots[hash & (table->root_size - 1)];
+	AZConcurrentHashMapEntry *entry;
+	while ((entry = atomic_load_explicit(slot, memory_order_relaxed)) != NULL) {
+		if ((entry->hash == hash) && key_equal(impl, key, key_inst(impl, entry))) break;
+		slot = &entry->next;
+	}
+	return slot;
+}
+
+/* Lock-free lookup, has to be called between shard_read_begin and shard_read_end */
+static AZConcurrentHashMapEntry *
+shard_lookup (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, const void *key, uint32_t hash)
+{
+	AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_acquire);
+	AZConcurrentHashMapEntry *entry = atomic_load_explicit(&table->roots[hash & (table->root_size - 1)], memory_order_acquire);
+	while (entry) {
+		if ((entry->hash == hash) && key_equal(impl, key, key_inst(impl, entry))) return entry;
+		entry = atomic_load_explicit(&entry->next, memory_order_acquire);
+	}
+	return NULL;
+}
+
+/*
+ * Requires shard lock
+ * Growing copies the entries to new table, as lookups may be following the chains of the old one.
+ */
+static void
+shard_link (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, AZConcurrentHashMapEntry *entry)
+{
+	AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	if (shard->size >= (MAX_LOAD * table->root_size)) {
+		AZConcurrentHashMapTable *grown = new_table(table->root_size << 1);
+		for (unsigned int b = 0; b < table->root_size; b++) {
+			AZConcurrentHashMapEntry *e = atomic_load_explicit(&table->roots[b], memory_order_relaxed);
+			while (e) {
+				AZConcurrentHashMapEntry *next = atomic_load_explicit(&e->next, memory_order_relaxed);
+				AZConcurrentHashMapEntry *copy = copy_entry(impl, e);
+				az_value_copy(impl->val_impl, val_ptr(impl, copy), val_ptr(impl, e));
+				unsigned int new_b = copy->hash & (grown->root_size - 1);
+				atomic_init(&copy->next, atomic_load_explicit(&grown->roots[new_b], memory_order_relaxed));
+				atomic_init(&grown->roots[new_b], copy);
+				shard_retire(impl, shard, e);
+				e = next;
+			}
+		}
+		atomic_store_explicit(&shard->table, grown, memory_order_release);
+		shard_retire_table(shard, table);
+		table = grown;
+	}
+	unsigned int b = entry->hash & (table->root_size - 1);
+	atomic_init(&entry->next, atomic_load_explicit(&table->roots[b], memory_order_relaxed));
+	atomic_store_explicit(&table->roots[b], entry, memory_order_release);
+	shard->size += 1;
+}
+
+/* Requires shard lock, the entry has to be unlinked */
+static void
+shard_retire (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard, AZConcurrentHashMapEntry *entry)
+{
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	AZConcurrentHashMapRetired *retired = &shard->retired[atomic_load_explicit(&shard->epoch, memory_order_relaxed) & 1];
+	if (retired->n_entries >= retired->size_entries) {
+		retired->size_entries = (retired->size_entries) ? retired->size_entries << 1 : 16;
+		retired->entries = (AZConcurrentHashMapEntry **) realloc(retired->entries, retired->size_entries * sizeof(AZConcurrentHashMapEntry *));
+	}
+	retired->entries[retired->n_entries++] = entry;
+#else
+	delete_entry(impl, entry);
+#endif
+}
+
+/* Requires shard lock, the table has to be replaced */
+static void
+shard_retire_table (AZConcurrentHashMapShard *shard, AZConcurrentHashMapTable *table)
+{
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	AZConcurrentHashMapRetired *retired = &shard->retired[atomic_load_explicit(&shard->epoch, memory_order_relaxed) & 1];
+	table->retired = retired->tables;
+	retired->tables = table;
+#else
+	free(table);
+#endif
+}
+
+/*
+ * Requires shard lock
+ * Once the readers of previous generation have finished, the objects retired in it are freed
+ * and the generation is advanced if anything was retired in the current one.
+ */
+static void
+shard_reclaim (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMapShard *shard)
+{
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	unsigned int epoch = atomic_load_explicit(&shard->epoch, memory_order_relaxed);
+	if (atomic_load(&shard->readers[(epoch + 1) & 1])) return;
+	/* Lookups that started after the previous advance can not reach these */
+	retired_free(impl, &shard->retired[(epoch + 1) & 1]);
+	AZConcurrentHashMapRetired *current = &shard->retired[epoch & 1];
+	if (current->n_entries || current->tables) atomic_store(&shard->epoch, epoch + 1);
+#endif
+}
+
+/* Has to be called between shard_read_begin and shard_read_end */
+static AZConcurrentHashMapEntry *
+shard_entry_at (AZConcurrentHashMapShard *shard, uint64_t iter)
+{
+	AZConcurrentHashMapTable *table = atomic_load_explicit(&shard->table, memory_order_acquire);
+	unsigned int b = ITER_BUCKET(iter);
+	if (b >= table->root_size) return NULL;
+	AZConcurrentHashMapEntry *entry = atomic_load_explicit(&table->roots[b], memory_order_acquire);
+	for (unsigned int d = ITER_DEPTH(iter); entry && d; d--) entry = atomic_load_explicit(&entry->next, memory_order_acquire);
+	return entry;
+}
+
+/* Find the first entry at or after given position */
+static unsigned int
+find_next (AZConcurrentHashMap *cmap, AZValue *iter, unsigned int s, unsigned int b, unsigned int d)
+{
+	for (; s < cmap->n_shards; s++) {
+		AZConcurrentHashMapShard *shard = &cmap->shards[s];
+		unsigned int gen = shard_read_begin(shard);
+		unsigned int root_size = atomic_load_explicit(&shard->table, memory_order_acquire)->root_size;
+		for (; b < root_size; b++) {
+			if (shard_entry_at(shard, ITER_MAKE(s, b, d))) {
+				shard_read_end(shard, gen);
+				iter->uint64_v = ITER_MAKE(s, b, d);
+				return 1;
+			}
+			d = 0;
+		}
+		shard_read_end(shard, gen);
+		b = 0;
+	}
+	return 0;
+}
@@ -0,0 +1,126 @@
+#ifndef __CONCURRENT_HASH_MAP_H__
+#define __CONCURRENT_HASH_MAP_H__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2016-2026
+*/
+
+#define AZ_TYPE_CONCURRENT_HASH_MAP (az_concurrent_hash_map_get_type ())
+
+typedef struct _AZConcurrentHashMap AZConcurrentHashMap;
+typedef struct _AZConcurrentHashMapImplementation AZConcurrentHashMapImplementation;
+typedef struct _AZConcurrentHashMapClass AZConcurrentHashMapClass;
+typedef struct _AZConcurrentHashMapShard AZConcurrentHashMapShard;
+
+#include <az/collections/map.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A thread-safe map implementation based on sharded hash table
+ *
+ * Entries are distributed between n_shards (power of 2) independent chained tables by the
+ * highest bits of hash. Lookups do not lock - they follow the chains while modifications, that
+ * are serialized per shard by mutex, publish new links. Unlinked entries are freed only after all
+ * lookups that could have seen them have finished, so lookups never wait for modifications and
+ * modifications never wait for lookups. In AZ_GLOBALS_MULTI_THREAD builds all operations are
+ * thread-safe.
+ *
+ * Values are never exposed by pointer - lookups copy value to caller's AZValue, taking new
+ * reference of reference types, so values stay alive until the caller clears the copy,
+ * even if these are concurrently removed from the map.
+ *
+ * The number of entries is kept in atomic counter (az_concurrent_hash_map_get_size), that is
+ * also returned by az_collection_get_size. In AZ_GLOBALS_MULTI_THREAD builds the size member of
+ * collection is not written and has to be not read directly.
+ *
+ * Entries are allocated separately, every entry starts with 16-byte header (chain link and
+ * cached hash), thus key_offset and val_offset have to be at least 16. Linked entries are never
+ * modified - replacing a value and growing the shard create new entries.
+ *
+ * The collection interface access values.
+ * Iteration is weakly consistent - it never fails, but entries inserted or removed during
+ * iteration may be skipped or returned twice.
+ * The iterator is 64-bit unsigned integer with the following layout:
+ *   - 63-56: shard index
+ *   - 55-24: bucket index
+ *   - 23-0: position in chain
+ */
+struct _AZConcurrentHashMap {
+	AZMap map;
+	unsigned int n_shards;
+	AZConcurrentHashMapShard *shards;
+	_Atomic uint64_t size;
+};
+
+struct _AZConcurrentHashMapImplementation {
+	AZMapImplementation map_impl;
+	const AZImplementation *key_impl;
+	const AZImplementation *val_impl;
+	/* Number of shards (power of 2, up to 256) */
+	unsigned int n_shards;
+	/* Initial number of buckets per shard (power of 2) */
+	unsigned int root_size;
+	unsigned int entry_size;
+	uint16_t key_offset;
+	uint16_t key_size;
+	uint16_t val_offset;
+	uint16_t val_size;
+
+	/* If NULL, the hash or equals method of the key type is used */
+	uint32_t (*hash) (const AZConcurrentHashMapImplementation *impl, const void *key);
+	unsigned int (*equal) (const AZConcurrentHashMapImplementation *impl, const void *lhs, const void *rhs);
+};
+
+struct _AZConcurrentHashMapClass {
+	AZMapClass map_class;
+};
+
+unsigned int az_concurrent_hash_map_get_type (void);
+
+/* Insert or replace value */
+void az_concurrent_hash_map_insert (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, void *key, void *val);
+unsigned int az_concurrent_hash_map_remove (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, const void *key);
+void az_concurrent_hash_map_clear (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap);
+/* Thread-safe number of entries */
+uint64_t az_concurrent_hash_map_get_size (AZConcurrentHashMap *cmap);
+unsigned int az_concurrent_hash_map_exists (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, const void *key);
+/**
+ * @brief Copy the value of key to dst
+ *
+ * @param dst the destination value (uninitialized), has to be cleared by caller
+ * @param size the size of the destination value
+ * @return the dst implementation or NULL if key is not in map
+ */
+const AZImplementation *az_concurrent_hash_map_get (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, const void *key, AZValue *dst, unsigned int size);
+/**
+ * @brief Atomically insert value if key is not present
+ *
+ * The value now in map (either existing or new) is copied to dst.
+ * @param inserted if not NULL, set to 1 if val was inserted, 0 otherwise
+ * @return the dst implementation
+ */
+const AZImplementation *az_concurrent_hash_map_get_or_insert (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, void *key, void *val, AZValue *dst, unsigned int size, unsigned int *inserted);
+/**
+ * @brief Atomically compute and insert value if key is not present
+ *
+ * Compute is called at most once, with the shard locked, so it may look up but must not modify the same map.
+ * It has to initialize val (of val_impl type, ownership is transferred to map) and
+ * return 1, or return 0 to leave the map unchanged.
+ * The value now in map (if any) is copied to dst.
+ * @return the dst implementation or NULL if compute failed
+ */
+const AZImplementation *az_concurrent_hash_map_compute_if_absent (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, void *key,
+	unsigned int (*compute) (const void *key, AZValue *val, void *data), void *data, AZValue *dst, unsigned int size);
+/* Weakly consistent like iteration, forall may look up but must not modify the same map */
+unsigned int az_concurrent_hash_map_forall (const AZConcurrentHashMapImplementation *impl, AZConcurrentHashMap *cmap, unsigned int (* forall) (const void *, const void *, void *), void *data);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
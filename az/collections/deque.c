@@ -0,0 +1,250 @@
+#define __AZ_DEQUE_C__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2026
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <arikkei/arikkei-utils.h>
+
+#include <az/boxed-value.h>
+#include <az/private.h>
+#include <az/extend.h>
+
+#include "deque.h"
+
+static void deque_class_init (AZDequeClass *klass);
+static void deque_init (AZDequeClass *klass, AZDeque *deque);
+static void deque_finalize (AZDequeClass *klass, AZDeque *deque);
+
+/* AZCollection implementation */
+static unsigned int deque_contains (const AZCollectionImplementation *collection_impl, AZCollection *collection_inst, const AZImplementation *impl, const void *inst);
+/* AZList implementation */
+static const AZImplementation *deque_get_element (const AZListImplementation *list_impl, void *list_inst, unsigned int idx, AZValue *val, unsigned int size);
+
+AZDequeClass *AZDequeKlass = NULL;
+
+unsigned int
+az_deque_get_type (void)
+{
+	static unsigned int type = 0;
+	unsigned int t = AZ_TYPE_READ(type);
+	if (t) return t;
+	AZ_TYPES_LOCK();
+	if (!type) {
+		AZDequeKlass = (AZDequeClass *) az_register_type (&type, (const unsigned char *) "AZDeque", AZ_TYPE_BLOCK, sizeof (AZDequeClass), sizeof (AZDeque), 0,
+			1, 0,
+			(void (*) (AZClass *)) deque_class_init,
+			(void (*) (const AZImplementation *, void *)) deque_init,
+			(void (*) (const AZImplementation *, void *)) deque_finalize);
+
+		AZDequeKlass->list_impl.collection_impl.contains = deque_contains;
+		AZDequeKlass->list_impl.get_element = deque_get_element;
+	}
+	t = type;
+	AZ_TYPES_UNLOCK();
+	return t;
+}
+
+static void
+deque_class_init (AZDequeClass *klass)
+{
+	az_class_declare_interface((AZClass *) klass, 0, AZ_TYPE_LIST, ARIKKEI_OFFSET(AZDequeClass, list_impl), 0);
+}
+
+static void
+deque_init (AZDequeClass *klass, AZDeque *deque)
+{
+	deque->element_type = AZ_TYPE_ANY;
+	deque->element_impl = NULL;
+	deque->list.collection.size = 0;
+	deque->val_size = 8;
+	deque->data_size = 0;
+	deque->head = 0;
+	deque->data = NULL;
+}
+
+static void
+deque_finalize (AZDequeClass *klass, AZDeque *deque)
+{
+	az_deque_clear(deque);
+	if (deque->data) free (deque->data);
+}
+
+static inline unsigned int
+deque_accepts(AZDeque *deque, const AZImplementation *impl)
+{
+	if (deque->element_impl) {
+		/* Null values can only be stored as null blocks */
+		return (impl == deque->element_impl) || (!impl && AZ_IMPL_IS_BLOCK(deque->element_impl));
+	}
+	return !impl || az_type_is_a(AZ_IMPL_TYPE(impl), deque->element_type);
+}
+
+/* Impl of the value stored in slot, NULL for null values */
+static inline const AZImplementation *
+deque_slot_value(AZDeque *deque, void *slot, AZValue **val)
+{
+	if (deque->element_impl) {
+		*val = (AZValue *) slot;
+		if (AZ_IMPL_IS_BLOCK(deque->element_impl) && !(*val)->block) return NULL;
+		return deque->element_impl;
+	}
+	AZArrayListEntry *entry = (AZArrayListEntry *) slot;
+	*val = (AZValue *) entry->val;
+	return entry->impl;
+}
+
+static void
+deque_set_slot(AZDeque *deque, void *slot, const AZImplementation *impl, void *inst)
+{
+	if (deque->element_impl) {
+		AZValue *dst = (AZValue *) slot;
+		if (AZ_IMPL_IS_VALUE(deque->element_impl)) {
+			memcpy(dst, inst, AZ_CLASS_FROM_IMPL(deque->element_impl)->instance_size);
+		} else {
+			dst->block = (impl) ? inst : NULL;
+			if (dst->block && AZ_IMPL_IS_REFERENCE(deque->element_impl)) az_reference_ref(dst->reference);
+		}
+	} else {
+		AZArrayListEntry *entry = (AZArrayListEntry *) slot;
+		entry->impl = az_value_set_from_inst_autobox(impl, (AZValue *) entry->val, deque->val_size, inst);
+	}
+}
+
+/* Copy value to val, boxing if it does not fit */
+static inline const AZImplementation *
+deque_copy_value(const AZImplementation *impl, AZValue *val, const AZValue *src, unsigned int size)
+{
+	if (!impl) return NULL;
+	if (AZ_IMPL_IS_VALUE(impl) && (AZ_CLASS_FROM_IMPL(impl)->instance_size <= size)) {
+		memcpy(val, src, AZ_CLASS_FROM_IMPL(impl)->instance_size);
+		return impl;
+	}
+	return az_value_copy_autobox (impl, val, src, size);
+}
+
+static void
+deque_ensure_space(AZDeque *deque)
+{
+	if (deque->list.collection.size < deque->data_size) return;
+	unsigned int entry_size = az_deque_entry_size(deque);
+	unsigned int old_size = deque->data_size;
+	deque->data_size = (old_size) ? old_size << 1 : 8;
+	deque->data = realloc(deque->data, deque->data_size * entry_size);
+	/* Move the wrapped part after the old end */
+	if (deque->head + deque->list.collection.size > old_size) {
+		unsigned int n_wrapped = deque->head + deque->list.collection.size - old_size;
+		memcpy((char *) deque->data + old_size * entry_size, deque->data, n_wrapped * entry_size);
+	}
+}
+
+static unsigned int
+deque_contains (const AZCollectionImplementation *coll_impl, AZCollection *collection_inst, const AZImplementation *impl, const void *inst)
+{
+	AZDeque *deque = (AZDeque *) collection_inst;
+	for (unsigned int i = 0; i < deque->list.collection.size; i++) {
+		AZValue *val;
+		const AZImplementation *val_impl = deque_slot_value(deque, az_deque_get_slot(deque, i), &val);
+		if (!val_impl) {
+			if (!impl) return 1;
+			continue;
+		}
+		if (az_value_equals_instance_autobox(val_impl, val, impl, inst)) return 1;
+	}
+	return 0;
+}
+
+static const AZImplementation *
+deque_get_element (const AZListImplementation *list_impl, void *list_inst, unsigned int idx, AZValue *val, unsigned int size)
+{
+	AZDeque *deque = (AZDeque *) list_inst;
+	arikkei_return_val_if_fail(idx < deque->list.collection.size, NULL);
+	AZValue *src;
+	const AZImplementation *impl = deque_slot_value(deque, az_deque_get_slot(deque, idx), &src);
+	return deque_copy_value(impl, val, src, size);
+}
+
+AZDeque *
+az_deque_new(unsigned int el_type, unsigned int val_size)
+{
+	AZDeque *deque = az_instance_new(AZ_TYPE_DEQUE);
+	deque->element_type = el_type;
+	if (AZ_TYPE_IS_FINAL(el_type) && !AZ_TYPE_IS_INTERFACE(el_type)) {
+		AZClass *klass = AZ_CLASS_FROM_TYPE(el_type);
+		if (AZ_CLASS_ELEMENT_SIZE(klass)) {
+			deque->element_impl = &klass->impl;
+			deque->val_size = AZ_CLASS_ELEMENT_SIZE(klass);
+			return deque;
+		}
+	}
+	deque->val_size = (val_size + 0x7) & 0xfffffff8;
+	return deque;
+}
+
+void
+az_deque_clear(AZDeque *deque)
+{
+	if (!deque->element_impl || AZ_IMPL_IS_REFERENCE(deque->element_impl)) {
+		for (unsigned int i = 0; i < deque->list.collection.size; i++) {
+			AZValue *val;
+			const AZImplementation *impl = deque_slot_value(deque, az_deque_get_slot(deque, i), &val);
+			az_value_clear(impl, val);
+		}
+	}
+	deque->list.collection.size = 0;
+	deque->head = 0;
+}
+
+unsigned int
+az_deque_push_back(AZDeque *deque, const AZImplementation *impl, void *inst)
+{
+	arikkei_return_val_if_fail(deque_accepts(deque, impl), 0);
+	deque_ensure_space(deque);
+	deque_set_slot(deque, az_deque_get_slot(deque, deque->list.collection.size), impl, inst);
+	deque->list.collection.size += 1;
+	return 1;
+}
+
+unsigned int
+az_deque_push_front(AZDeque *deque, const AZImplementation *impl, void *inst)
+{
+	arikkei_return_val_if_fail(deque_accepts(deque, impl), 0);
+	deque_ensure_space(deque);
+	deque->head = (deque->head + deque->data_size - 1) & (deque->data_size - 1);
+	deque_set_slot(deque, az_deque_get_slot(deque, 0), impl, inst);
+	deque->list.collection.size += 1;
+	return 1;
+}
+
+static void
+deque_take(AZDeque *deque, unsigned int idx, const AZImplementation **impl, AZValue *val, unsigned int size)
+{
+	AZValue *src;
+	const AZImplementation *src_impl = deque_slot_value(deque, az_deque_get_slot(deque, idx), &src);
+	*impl = deque_copy_value(src_impl, val, src, size);
+	az_value_clear(src_impl, src);
+}
+
+unsigned int
+az_deque_pop_front(AZDeque *deque, const AZImplementation **impl, AZValue *val, unsigned int size)
+{
+	if (!deque->list.collection.size) return 0;
+	deque_take(deque, 0, impl, val, size);
+	deque->head = (deque->head + 1) & (deque->data_size - 1);
+	deque->list.collection.size -= 1;
+	return 1;
+}
+
+unsigned int
+az_deque_pop_back(AZDeque *deque, const AZImplementation **impl, AZValue *val, unsigned int size)
+{
+	if (!deque->list.collection.size) return 0;
+	deque_take(deque, deque->list.collection.size - 1, impl, val, size);
+	deque->list.collection.size -= 1;
+	return 1;
+}
@@ -0,0 +1,94 @@
+#ifndef __AZ_DEQUE_H__
+#define __AZ_DEQUE_H__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2026
+*/
+
+/*
+ * A double-ended queue in a ring buffer
+ * Elements are stored in the same way as in AZArrayList - either [impl,value] tuples with
+ * oversized values and interfaces automatically boxed, or packed values with shared
+ * implementation if the element type is final (and not zero-sized)
+ * Pushing and popping at both ends is amortized O(1)
+ * Index 0 is the front of queue
+ */
+
+#define AZ_TYPE_DEQUE az_deque_get_type ()
+
+typedef struct _AZDeque AZDeque;
+typedef struct _AZDequeClass AZDequeClass;
+
+#include <az/collections/array-list.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _AZDeque {
+	AZList list;
+	unsigned int element_type;
+	/* Shared implementation of homogeneous deque, NULL if elements are [impl,value] tuples */
+	const AZImplementation *element_impl;
+	unsigned int val_size;
+	/* Capacity, always power of 2 */
+	unsigned int data_size;
+	/* Physical index of the front element */
+	unsigned int head;
+	void *data;
+};
+
+struct _AZDequeClass {
+	AZClass klass;
+	AZListImplementation list_impl;
+};
+
+extern AZDequeClass *AZDequeKlass;
+
+unsigned int az_deque_get_type (void);
+
+AZDeque *az_deque_new(unsigned int el_type, unsigned int val_size);
+
+static inline void
+az_deque_delete(AZDeque *deque)
+{
+	az_instance_delete(AZ_TYPE_DEQUE, deque);
+}
+
+static inline const AZImplementation *
+az_deque_get_element (AZDeque *deque, unsigned int idx, AZValue *val, unsigned int size)
+{
+	return az_list_get_element(&AZDequeKlass->list_impl, deque, idx, val, size);
+}
+
+void az_deque_clear(AZDeque *deque);
+unsigned int az_deque_push_back(AZDeque *deque, const AZImplementation *impl, void *inst);
+unsigned int az_deque_push_front(AZDeque *deque, const AZImplementation *impl, void *inst);
+/*
+ * Remove the element from either end and transfer it to val, boxing if it does not fit
+ * into size bytes
+ * Returns 0 if the deque is empty
+ */
+unsigned int az_deque_pop_front(AZDeque *deque, const AZImplementation **impl, AZValue *val, unsigned int size);
+unsigned int az_deque_pop_back(AZDeque *deque, const AZImplementation **impl, AZValue *val, unsigned int size);
+
+static inline unsigned int
+az_deque_entry_size(AZDeque *deque)
+{
+	return (deque->element_impl) ? deque->val_size : sizeof(AZArrayListEntry) + deque->val_size - 8;
+}
+
+/* The storage of element at logical index */
+static inline void *
+az_deque_get_slot(AZDeque *deque, unsigned int idx)
+{
+	return (char *) deque->data + ((deque->head + idx) & (deque->data_size - 1)) * az_deque_entry_size(deque);
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
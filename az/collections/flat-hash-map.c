@@ -0,0 +1,525 @@
+#define __AZ_FLAT_HASH_MAP_C__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2016-2026
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <az/base.h>
+#include <az/value.h>
+#include <az/packed-value.h>
+
+#include "flat-hash-map.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define AZ_FLAT_HASH_MAP_SSE2
+#include <emmintrin.h>
+#elif (defined(__aarch64__) && defined(__ARM_NEON)) || defined(_M_ARM64)
+#define AZ_FLAT_HASH_MAP_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef _WIN32
+#include <intrin.h>
+#define aligned_alloc(a,s) _aligned_malloc(s,a)
+#define aligned_free(p) _aligned_free(p)
+#else
+#define aligned_free(p) free(p)
+#endif
+
+/*
+ * Control bytes
+ * Full slots keep the lowest 7 bits of hash (H2), the remaining bits (H1) determine the
+ * start of probe sequence. The first GROUP_WIDTH control bytes are mirrored after the end
+ * of table so that any group can be loaded with a single unaligned read.
+ */
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+#define GROUP_WIDTH 16
+#define MIN_CAPACITY GROUP_WIDTH
+
+#define H1(h) ((h) >> 7)
+#define H2(h) ((uint8_t) ((h) & 0x7f))
+#define IS_FULL(c) (((c) & 0x80) == 0)
+
+/* Maximum load factor is 7/8 */
+#define MAX_LOAD(c) ((c) - ((c) >> 3))
+
+static inline unsigned int
+ctz16 (unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward (&idx, mask);
+	return (unsigned int) idx;
+#else
+	return (unsigned int) __builtin_ctz (mask);
+#endif
+}
+
+static inline unsigned int
+clz16 (unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanReverse (&idx, mask);
+	return 15 - (unsigned int) idx;
+#else
+	return (unsigned int) __builtin_clz (mask) - 16;
+#endif
+}
+
+#ifdef AZ_FLAT_HASH_MAP_NEON
+/* NEON has no movemask, lanes are weighted by their bit and both halves summed */
+static inline unsigned int
+neon_movemask (uint8x16_t m)
+{
+	static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t b = vandq_u8 (m, vld1q_u8 (weights));
+	return (unsigned int) vaddv_u8 (vget_low_u8 (b)) | ((unsigned int) vaddv_u8 (vget_high_u8 (b)) << 8);
+}
+#endif
+
+/* Bitmask of group bytes equal to h2 */
+static inline unsigned int
+group_match (const uint8_t *ctrl, uint8_t h2)
+{
+#if defined(AZ_FLAT_HASH_MAP_SSE2)
+	__m128i g = _mm_loadu_si128 ((const __m128i *) ctrl);
+	return (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (g, _mm_set1_epi8 ((char) h2)));
+#elif defined(AZ_FLAT_HASH_MAP_NEON)
+	return neon_movemask (vceqq_u8 (vld1q_u8 (ctrl), vdupq_n_u8 (h2)));
+#else
+	unsigned int mask = 0;
+	for (unsigned int i = 0; i < GROUP_WIDTH; i++) if (ctrl[i] == h2) mask |= (1U << i);
+	return mask;
+#endif
+}
+
+static inline unsigned int
+group_match_empty (const uint8_t *ctrl)
+{
+	return group_match (ctrl, CTRL_EMPTY);
+}
+
+/* Both empty and deleted have the highest bit set */
+static inline unsigned int
+group_match_empty_or_deleted (const uint8_t *ctrl)
+{
+#if defined(AZ_FLAT_HASH_MAP_SSE2)
+	return (unsigned int) _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) ctrl));
+#elif defined(AZ_FLAT_HASH_MAP_NEON)
+	return neon_movemask (vtstq_u8 (vld1q_u8 (ctrl), vdupq_n_u8 (0x80)));
+#else
+	unsigned int mask = 0;
+	for (unsigned int i = 0; i < GROUP_WIDTH; i++) if (!IS_FULL(ctrl[i])) mask |= (1U << i);
+	return mask;
+#endif
+}
+
+static inline void *
+slot_ptr (const AZFlatHashMapImplementation *impl, void *slots, unsigned int pos)
+{
+	return (char *) slots + pos * impl->slot_size;
+}
+
+static inline AZValue *
+key_ptr (const AZFlatHashMapImplementation *impl, void *slot)
+{
+	return (AZValue *) ((char *) slot + impl->key_offset);
+}
+
+static inline void *
+key_inst (const AZFlatHashMapImplementation *impl, void *slot)
+{
+	return az_value_get_inst (impl->key_impl, key_ptr (impl, slot));
+}
+
+/* Without callbacks keys are hashed and compared by the methods of their type */
+static inline uint32_t
+key_hash (const AZFlatHashMapImplementation *impl, const void *key)
+{
+	if (impl->hash) return impl->hash (impl, key);
+	return az_instance_hash (impl->key_impl, (void *) key);
+}
+
+static inline unsigned int
+key_equal (const AZFlatHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+	if (impl->equal) return impl->equal (impl, lhs, rhs);
+	return az_instance_equals (impl->key_impl, (void *) lhs, (void *) rhs);
+}
+
+static inline AZValue *
+val_ptr (const AZFlatHashMapImplementation *impl, void *slot)
+{
+	return (AZValue *) ((char *) slot + impl->val_offset);
+}
+
+static inline void *
+val_inst (const AZFlatHashMapImplementation *impl, void *slot)
+{
+	return az_value_get_inst (impl->val_impl, val_ptr (impl, slot));
+}
+
+static inline void
+clear_slot (const AZFlatHashMapImplementation *impl, void *slot)
+{
+	az_value_clear (impl->key_impl, key_ptr (impl, slot));
+	az_value_clear (impl->val_impl, val_ptr (impl, slot));
+}
+
+static inline void
+set_ctrl (AZFlatHashMap *hmap, unsigned int pos, uint8_t c)
+{
+	hmap->ctrl[pos] = c;
+	if (pos < GROUP_WIDTH) hmap->ctrl[hmap->capacity + pos] = c;
+}
+
+static void allocate_table (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int capacity);
+static void rehash (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap);
+static int find_slot (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key, uint32_t hval);
+static unsigned int find_insert_slot (AZFlatHashMap *hmap, uint32_t hval);
+static void erase_slot (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int pos);
+
+static void fmap_implementation_init (AZFlatHashMapImplementation *impl);
+static void fmap_instance_init (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap);
+static void fmap_instance_finalize (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap);
+
+static unsigned int fmap_get_element_type (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst);
+static unsigned int fmap_contains (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZImplementation *impl, const void *inst);
+static const AZImplementation *fmap_get_iter (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
+static const AZImplementation *fmap_iter_next (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter);
+static const AZImplementation *fmap_get_element (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZValue *iter, AZValue *val, unsigned int size);
+static unsigned int fmap_get_key_type (const AZMapImplementation *map_impl, AZMap *map_inst);
+static const AZImplementation *fmap_get_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZValue *iter, AZValue *val, unsigned int size);
+static unsigned int fmap_contains_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, const void *key_inst);
+static const AZImplementation *fmap_map_lookup (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, void *key_inst, AZValue *val, unsigned int size);
+
+static unsigned int fmap_type = 0;
+static AZFlatHashMapClass *fmap_class;
+
+unsigned int
+az_flat_hash_map_get_type (void)
+{
+	unsigned int t = AZ_TYPE_READ(fmap_type);
+	if (t) return t;
+	AZ_TYPES_LOCK();
+	if (!fmap_type) {
+		fmap_class = (AZFlatHashMapClass *) az_register_interface_type (&fmap_type, (const unsigned char *) "AZFlatHashMap", AZ_TYPE_MAP,
+			sizeof (AZMapClass), sizeof (AZFlatHashMapImplementation), sizeof(AZFlatHashMap), AZ_FLAG_ZERO_MEMORY | AZ_FLAG_CONSTRUCT,
+			0, 0,
+			NULL,
+			(void (*) (AZImplementation *)) fmap_implementation_init,
+			(void (*) (const AZImplementation *, void *)) fmap_instance_init,
+			(void (*) (const AZImplementation *, void *)) fmap_instance_finalize);
+	}
+	t = fmap_type;
+	AZ_TYPES_UNLOCK();
+	return t;
+}
+
+static void
+fmap_implementation_init (AZFlatHashMapImplementation *impl)
+{
+	impl->map_impl.collection_impl.get_element_type = fmap_get_element_type;
+	impl->map_impl.collection_impl.contains = fmap_contains;
+	impl->map_impl.collection_impl.get_iterator = fmap_get_iter;
+	impl->map_impl.collection_impl.iterator_next = fmap_iter_next;
+	impl->map_impl.collection_impl.get_element = fmap_get_element;
+	impl->map_impl.get_key_type = fmap_get_key_type;
+	impl->map_impl.get_key = fmap_get_key;
+	impl->map_impl.contains_key = fmap_contains_key;
+	impl->map_impl.lookup = fmap_map_lookup;
+	impl->hash = NULL;
+	impl->equal = NULL;
+	impl->key_impl = NULL;
+	impl->val_impl = NULL;
+	impl->initial_capacity = MIN_CAPACITY;
+	impl->slot_size = 0;
+	impl->key_offset = 0;
+	impl->key_size = 0;
+	impl->val_offset = 0;
+	impl->val_size = 0;
+}
+
+static void
+fmap_instance_init (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap)
+{
+	unsigned int capacity = MIN_CAPACITY;
+	while (capacity < impl->initial_capacity) capacity <<= 1;
+	allocate_table (impl, hmap, capacity);
+}
+
+static void
+fmap_instance_finalize (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap)
+{
+	for (unsigned int i = 0; i < hmap->capacity; i++) {
+		if (IS_FULL(hmap->ctrl[i])) clear_slot (impl, slot_ptr (impl, hmap->slots, i));
+	}
+	aligned_free (hmap->ctrl);
+}
+
+static unsigned int
+fmap_get_element_type (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst)
+{
+	AZFlatHashMapImplementation *impl = (AZFlatHashMapImplementation *) coll_impl;
+	return impl->val_impl->type;
+}
+
+static unsigned int
+fmap_contains (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZImplementation *impl, const void *inst)
+{
+	return az_flat_hash_map_exists_val ((AZFlatHashMapImplementation *) coll_impl, (AZFlatHashMap *) coll_inst, inst);
+}
+
+static const AZImplementation *
+fmap_get_iter (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter)
+{
+	AZFlatHashMap *hmap = (AZFlatHashMap *) coll_inst;
+	for (unsigned int i = 0; i < hmap->capacity; i++) {
+		if (IS_FULL(hmap->ctrl[i])) {
+			iter->uint64_v = i;
+			return &AZUint64Klass.impl;
+		}
+	}
+	return NULL;
+}
+
+static const AZImplementation *
+fmap_iter_next (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, AZValue *iter)
+{
+	AZFlatHashMap *hmap = (AZFlatHashMap *) coll_inst;
+	for (unsigned int i = (unsigned int) iter->uint64_v + 1; i < hmap->capacity; i++) {
+		if (IS_FULL(hmap->ctrl[i])) {
+			iter->uint64_v = i;
+			return &AZUint64Klass.impl;
+		}
+	}
+	return NULL;
+}
+
+static const AZImplementation *
+fmap_get_element (const AZCollectionImplementation *coll_impl, AZCollection *coll_inst, const AZValue *iter, AZValue *val, unsigned int size)
+{
+	AZFlatHashMapImplementation *impl = (AZFlatHashMapImplementation *) coll_impl;
+	AZFlatHashMap *hmap = (AZFlatHashMap *) coll_inst;
+	void *slot = slot_ptr (impl, hmap->slots, (unsigned int) iter->uint64_v);
+	return az_value_copy_autobox (impl->val_impl, val, val_ptr (impl, slot), size);
+}
+
+static unsigned int
+fmap_get_key_type (const AZMapImplementation *map_impl, AZMap *map_inst)
+{
+	AZFlatHashMapImplementation *impl = (AZFlatHashMapImplementation *) map_impl;
+	return AZ_IMPL_TYPE(impl->key_impl);
+}
+
+static const AZImplementation *
+fmap_get_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZValue *iter, AZValue *val, unsigned int size)
+{
+	AZFlatHashMapImplementation *impl = (AZFlatHashMapImplementation *) map_impl;
+	AZFlatHashMap *hmap = (AZFlatHashMap *) map_inst;
+	void *slot = slot_ptr (impl, hmap->slots, (unsigned int) iter->uint64_v);
+	return az_value_copy_autobox (impl->key_impl, val, key_ptr (impl, slot), size);
+}
+
+static unsigned int
+fmap_contains_key (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, const void *key_inst)
+{
+	return az_flat_hash_map_exists ((AZFlatHashMapImplementation *) map_impl, (AZFlatHashMap *) map_inst, key_inst);
+}
+
+static const AZImplementation *
+fmap_map_lookup (const AZMapImplementation *map_impl, AZMap *map_inst, const AZImplementation *key_impl, void *key_inst, AZValue *val, unsigned int size)
+{
+	AZFlatHashMapImplementation *impl = (AZFlatHashMapImplementation *) map_impl;
+	const void *result = az_flat_hash_map_lookup (impl, (AZFlatHashMap *) map_inst, key_inst);
+	if (!result) return NULL;
+	return az_value_set_from_inst_autobox (impl->val_impl, val, size, (void *) result);
+}
+
+void
+az_flat_hash_map_insert (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, void *key, void *val)
+{
+	uint32_t hval = key_hash (impl, key);
+	int found = find_slot (impl, hmap, key, hval);
+	if (found >= 0) {
+		AZValue *dst_val = val_ptr (impl, slot_ptr (impl, hmap->slots, found));
+		az_value_clear (impl->val_impl, dst_val);
+		az_value_set_from_inst (impl->val_impl, dst_val, val);
+		return;
+	}
+	unsigned int pos = find_insert_slot (hmap, hval);
+	if (!hmap->growth_left && (hmap->ctrl[pos] == CTRL_EMPTY)) {
+		rehash (impl, hmap);
+		pos = find_insert_slot (hmap, hval);
+	}
+	if (hmap->ctrl[pos] == CTRL_EMPTY) hmap->growth_left -= 1;
+	set_ctrl (hmap, pos, H2(hval));
+	void *slot = slot_ptr (impl, hmap->slots, pos);
+	az_value_set_from_inst (impl->key_impl, key_ptr (impl, slot), key);
+	az_value_set_from_inst (impl->val_impl, val_ptr (impl, slot), val);
+	hmap->map.collection.size += 1;
+}
+
+unsigned int
+az_flat_hash_map_remove (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key)
+{
+	int pos = find_slot (impl, hmap, key, key_hash (impl, key));
+	if (pos < 0) return 0;
+	erase_slot (impl, hmap, pos);
+	return 1;
+}
+
+void
+az_flat_hash_map_clear (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap)
+{
+	for (unsigned int i = 0; i < hmap->capacity; i++) {
+		if (IS_FULL(hmap->ctrl[i])) clear_slot (impl, slot_ptr (impl, hmap->slots, i));
+	}
+	memset (hmap->ctrl, CTRL_EMPTY, hmap->capacity + GROUP_WIDTH);
+	hmap->growth_left = MAX_LOAD(hmap->capacity);
+	hmap->map.collection.size = 0;
+}
+
+unsigned int
+az_flat_hash_map_exists (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key)
+{
+	return find_slot (impl, hmap, key, key_hash (impl, key)) >= 0;
+}
+
+unsigned int
+az_flat_hash_map_exists_val (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *val)
+{
+	for (unsigned int i = 0; i < hmap->capacity; i++) {
+		if (!IS_FULL(hmap->ctrl[i])) continue;
+		if (az_value_equals_instance_autobox (impl->val_impl, val_ptr (impl, slot_ptr (impl, hmap->slots, i)), impl->val_impl, val)) return 1;
+	}
+	return 0;
+}
+
+const void *
+az_flat_hash_map_lookup (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key)
+{
+	int pos = find_slot (impl, hmap, key, key_hash (impl, key));
+	if (pos < 0) return NULL;
+	return val_inst (impl, slot_ptr (impl, hmap->slots, pos));
+}
+
+unsigned int
+az_flat_hash_map_forall (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int (* forall) (const void *, const void *, void *), void *data)
+{
+	for (unsigned int i = 0; i < hmap->capacity; i++) {
+		if (!IS_FULL(hmap->ctrl[i])) continue;
+		void *slot = slot_ptr (impl, hmap->slots, i);
+		if (!forall (key_inst (impl, slot), val_inst (impl, slot), data)) return 0;
+	}
+	return 1;
+}
+
+unsigned int
+az_flat_hash_map_remove_all (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int (*remove) (const void *, const void *, void *), void *data)
+{
+	unsigned int n_removed = 0;
+	for (unsigned int i = 0; i < hmap->capacity; i++) {
+		if (!IS_FULL(hmap->ctrl[i])) continue;
+		void *slot = slot_ptr (impl, hmap->slots, i);
+		if (remove (key_inst (impl, slot), val_inst (impl, slot), data)) {
+			erase_slot (impl, hmap, i);
+			n_removed += 1;
+		}
+	}
+	return n_removed;
+}
+
+/* Returns the position of key or -1 */
+static int
+find_slot (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key, uint32_t hval)
+{
+	unsigned int mask = hmap->capacity - 1;
+	unsigned int pos = H1(hval) & mask;
+	uint8_t h2 = H2(hval);
+	for (unsigned int step = GROUP_WIDTH;; step += GROUP_WIDTH) {
+		const uint8_t *group = hmap->ctrl + pos;
+		unsigned int match = group_match (group, h2);
+		while (match) {
+			unsigned int idx = (pos + ctz16 (match)) & mask;
+			if (key_equal (impl, key, key_inst (impl, slot_ptr (impl, hmap->slots, idx)))) return (int) idx;
+			match &= match - 1;
+		}
+		if (group_match_empty (group)) return -1;
+		pos = (pos + step) & mask;
+	}
+}
+
+/* Returns the first empty or deleted position in probe sequence */
+static unsigned int
+find_insert_slot (AZFlatHashMap *hmap, uint32_t hval)
+{
+	unsigned int mask = hmap->capacity - 1;
+	unsigned int pos = H1(hval) & mask;
+	for (unsigned int step = GROUP_WIDTH;; step += GROUP_WIDTH) {
+		unsigned int match = group_match_empty_or_deleted (hmap->ctrl + pos);
+		if (match) return (pos + ctz16 (match)) & mask;
+		pos = (pos + step) & mask;
+	}
+}
+
+static void
+erase_slot (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int pos)
+{
+	unsigned int mask = hmap->capacity - 1;
+	clear_slot (impl, slot_ptr (impl, hmap->slots, pos));
+	/*
+	 * The slot can be marked empty only if no probe sequence has ever seen a full group
+	 * spanning it, i.e. there is an empty slot within GROUP_WIDTH on either side
+	 */
+	unsigned int empty_before = group_match_empty (hmap->ctrl + ((pos - GROUP_WIDTH) & mask));
+	unsigned int empty_after = group_match_empty (hmap->ctrl + pos);
+	if (empty_before && empty_after && ((ctz16 (empty_after) + clz16 (empty_before)) < GROUP_WIDTH)) {
+		set_ctrl (hmap, pos, CTRL_EMPTY);
+		hmap->growth_left += 1;
+	} else {
+		set_ctrl (hmap, pos, CTRL_DELETED);
+	}
+	hmap->map.collection.size -= 1;
+}
+
+static void
+allocate_table (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int capacity)
+{
+	unsigned int ctrl_size = capacity + GROUP_WIDTH;
+	unsigned int slots_size = (capacity * impl->slot_size + 15) & ~15U;
+	hmap->ctrl = (uint8_t *) aligned_alloc (16, ctrl_size + slots_size);
+	memset (hmap->ctrl, CTRL_EMPTY, ctrl_size);
+	hmap->slots = hmap->ctrl + ctrl_size;
+	hmap->capacity = capacity;
+	hmap->growth_left = MAX_LOAD(capacity);
+}
+
+/* Drop tombstones, grow table if it would be more than half full afterwards */
+static void
+rehash (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap)
+{
+	unsigned int old_capacity = hmap->capacity;
+	uint8_t *old_ctrl = hmap->ctrl;
+	void *old_slots = hmap->slots;
+	unsigned int new_capacity = old_capacity;
+	if (hmap->map.collection.size >= (MAX_LOAD(old_capacity) >> 1)) new_capacity <<= 1;
+	allocate_table (impl, hmap, new_capacity);
+	for (unsigned int i = 0; i < old_capacity; i++) {
+		if (!IS_FULL(old_ctrl[i])) continue;
+		void *slot = slot_ptr (impl, old_slots, i);
+		uint32_t hval = key_hash (impl, key_inst (impl, slot));
+		unsigned int pos = find_insert_slot (hmap, hval);
+		set_ctrl (hmap, pos, H2(hval));
+		memcpy (slot_ptr (impl, hmap->slots, pos), slot, impl->slot_size);
+	}
+	hmap->growth_left -= hmap->map.collection.size;
+	aligned_free (old_ctrl);
+}
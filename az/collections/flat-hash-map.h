@@ -0,0 +1,78 @@
+#ifndef __FLAT_HASH_MAP_H__
+#define __FLAT_HASH_MAP_H__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2016-2026
+*/
+
+#define AZ_TYPE_FLAT_HASH_MAP (az_flat_hash_map_get_type ())
+
+typedef struct _AZFlatHashMap AZFlatHashMap;
+typedef struct _AZFlatHashMapImplementation AZFlatHashMapImplementation;
+typedef struct _AZFlatHashMapClass AZFlatHashMapClass;
+
+#include <az/collections/map.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A map implementation based on open-addressing hash table
+ *
+ * Keys and values are stored inline in slots (at key_offset and val_offset), the state of
+ * every slot is kept in separate control byte (empty, deleted or 7 bits of hash). Control
+ * bytes are probed in groups of 16 (using SSE2 or ARM64 NEON if available, a scalar loop
+ * otherwise). The capacity is always power of 2 and the table grows if it becomes more
+ * than 7/8 full.
+ *
+ * The collection interface access values.
+ * The iterator is 64-bit unsigned integer - the slot index.
+ *
+ */
+struct _AZFlatHashMap {
+	AZMap map;
+	unsigned int capacity;
+	unsigned int growth_left;
+	uint8_t *ctrl;
+	void *slots;
+};
+
+struct _AZFlatHashMapImplementation {
+	AZMapImplementation map_impl;
+	const AZImplementation *key_impl;
+	const AZImplementation *val_impl;
+	unsigned int initial_capacity;
+	unsigned int slot_size;
+	uint16_t key_offset;
+	uint16_t key_size;
+	uint16_t val_offset;
+	uint16_t val_size;
+
+	/* If NULL, the hash or equals method of the key type is used */
+	uint32_t (*hash) (const AZFlatHashMapImplementation *impl, const void *key);
+	unsigned int (*equal) (const AZFlatHashMapImplementation *impl, const void *lhs, const void *rhs);
+};
+
+struct _AZFlatHashMapClass {
+	AZMapClass map_class;
+};
+
+unsigned int az_flat_hash_map_get_type (void);
+
+void az_flat_hash_map_insert(const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, void *key, void *val);
+unsigned int az_flat_hash_map_remove(const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key);
+void az_flat_hash_map_clear(const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap);
+unsigned int az_flat_hash_map_exists(const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key);
+unsigned int az_flat_hash_map_exists_val(const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *val);
+const void *az_flat_hash_map_lookup(const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, const void *key);
+unsigned int az_flat_hash_map_forall (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int (* forall) (const void *, const void *, void *), void *data);
+unsigned int az_flat_hash_map_remove_all (const AZFlatHashMapImplementation *impl, AZFlatHashMap *hmap, unsigned int (*remove) (const void *, const void *, void *), void *data);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
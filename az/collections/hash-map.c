@@ -23,13 +23,27 @@
 #define aligned_free(p) free(p)
 #endif
 
+/* Full hash value is cached so that rehashing and mismatching chain entries do not need callbacks */
 struct _AZHashMapEntry {
     uint32_t next;
+    uint32_t hash;
 };
 
 #define EMPTY 0
 #define END 1
 
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch((const char *) (p), _MM_HINT_T0)
+#else
+#define PREFETCH(p)
+#endif
+
+/* Batched operations hash and prefetch this many keys ahead of probing */
+#define BATCH_SIZE 16
+
 static AZHashMapEntry *
 entry_ptr(const AZHashMapImplementation *impl, AZHashMapEntry *entries, unsigned int pos)
 {
@@ -48,6 +62,21 @@ key_inst(const AZHashMapImplementation *impl, AZHashMapEntry *entry)
 	return az_value_get_inst(impl->key_impl, key_ptr(impl, entry));
 }
 
+/* Without callbacks keys are hashed and compared by the methods of their type */
+static inline uint32_t
+key_hash(const AZHashMapImplementation *impl, const void *key)
+{
+	if (impl->hash) return impl->hash(impl, key);
+	return az_instance_hash(impl->key_impl, (void *) key);
+}
+
+static inline unsigned int
+key_equal(const AZHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+	if (impl->equal) return impl->equal(impl, lhs, rhs);
+	return az_instance_equals(impl->key_impl, (void *) lhs, (void *) rhs);
+}
+
 static AZValue *
 val_ptr(const AZHashMapImplementation *impl, AZHashMapEntry *entry)
 {
@@ -68,10 +97,11 @@ clear_entry(const AZHashMapImplementation *impl, AZHashMapEntry *entry)
 }
 
 static void
-set_entry(const AZHashMapImplementation *impl, AZHashMapEntry *entry, unsigned int next, void *key, void *val, unsigned int replace)
+set_entry(const AZHashMapImplementation *impl, AZHashMapEntry *entry, unsigned int next, uint32_t hash, void *key, void *val, unsigned int replace)
 {
 	entry->next = next;
 	if (key) {
+		entry->hash = hash;
 		AZValue *dst_key = key_ptr(impl, entry);
 		if (replace) az_value_clear(impl->key_impl, dst_key);
         az_value_set_from_inst(impl->key_impl, dst_key, key);
@@ -82,7 +112,26 @@ set_entry(const AZHashMapImplementation *impl, AZHashMapEntry *entry, unsigned i
 }
 
 static AZHashMapEntry *allocate_entries(const AZHashMapImplementation *impl, unsigned int size, unsigned int root_size);
-static void reallocate (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int new_root_size);
+static void insert_hashed(const AZHashMapImplementation *impl, AZHashMap *hmap, uint32_t hash, void *key, void *val);
+static const void *lookup_hashed(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *key, uint32_t hash);
+static void reallocate (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int new_root_size, unsigned int new_size);
+
+/* The number of entries allowed for given root size */
+static unsigned int
+max_size(const AZHashMapImplementation *impl, unsigned int root_size)
+{
+	float load = (impl->max_load_factor > 0) ? impl->max_load_factor : 3;
+	unsigned int size = (unsigned int) (load * root_size);
+	return (size) ? size : 1;
+}
+
+/* The default size of chain area (the number of entries beyond roots) */
+static unsigned int
+overflow_size(const AZHashMapImplementation *impl, unsigned int root_size)
+{
+	unsigned int size = max_size(impl, root_size);
+	return (size > root_size) ? size - root_size : root_size / 2 + 1;
+}
 
 static void hmap_implementation_init (AZHashMapImplementation *impl);
 static void hmap_instance_init (const AZHashMapImplementation *impl, AZHashMap *hmap);
@@ -144,9 +193,12 @@ hmap_implementation_init (AZHashMapImplementation *impl)
 	//impl->map_impl.keyset_impl.collection_impl.get_iterator = hmap_get_iter;
 	//impl->map_impl.keyset_impl.collection_impl.iterator_next = hmap_iter_next;
 	//impl->map_impl.keyset_impl.collection_impl.get_element = hmap_keyset_get_element;
+    impl->hash = NULL;
+    impl->equal = NULL;
     impl->key_impl = NULL;
     impl->val_impl = NULL;
     impl->root_size = 31;
+    impl->max_load_factor = 3;
     impl->entry_size = 0;
     impl->key_offset = 0;
     impl->key_size = 0;
@@ -158,8 +210,9 @@ static void
 hmap_instance_init (const AZHashMapImplementation *impl, AZHashMap *hmap)
 {
     hmap->root_size = impl->root_size;
-    hmap->allocated_size = 3 * impl->root_size;
+    hmap->allocated_size = impl->root_size + overflow_size(impl, impl->root_size);
     hmap->free = hmap->root_size;
+    hmap->max_size = max_size(impl, impl->root_size);
     hmap->entries = allocate_entries(impl, hmap->allocated_size, hmap->root_size);
 }
 
@@ -308,46 +361,57 @@ hmap_keyset_get_element (const AZCollectionImplementation *coll_impl, AZCollecti
 void
 az_hash_map_insert(const AZHashMapImplementation *impl, AZHashMap *hmap, void *key, void *val)
 {
-	unsigned int pos = impl->hash(impl, key) % hmap->root_size;
+	insert_hashed(impl, hmap, key_hash(impl, key), key, val);
+}
+
+static void
+insert_hashed(const AZHashMapImplementation *impl, AZHashMap *hmap, uint32_t hash, void *key, void *val)
+{
+	unsigned int pos = hash % hmap->root_size;
 	AZHashMapEntry *root_entry = entry_ptr(impl, hmap->entries, pos);
 	if(root_entry->next == EMPTY) {
-		set_entry(impl, root_entry, END, key, val, 0);
+		if (hmap->map.collection.size >= hmap->max_size) {
+			reallocate (impl, hmap, hmap->root_size << 1, 0);
+			insert_hashed(impl, hmap, hash, key, val);
+			return;
+		}
+		set_entry(impl, root_entry, END, hash, key, val, 0);
 		hmap->map.collection.size += 1;
 		return;
 	}
-	if (impl->equal(impl, key, key_inst(impl, root_entry))) {
-		set_entry(impl, root_entry, root_entry->next, NULL, val, 1);
+	if ((root_entry->hash == hash) && key_equal(impl, key, key_inst(impl, root_entry))) {
+		set_entry(impl, root_entry, root_entry->next, hash, NULL, val, 1);
 		return;
 	}
 	pos = root_entry->next;
 	while (pos != END) {
 		AZHashMapEntry *entry = entry_ptr(impl, hmap->entries, pos);
-		if (impl->equal(impl, key, key_inst(impl, entry))) {
-			set_entry(impl, entry, entry->next, NULL, val, 1);
+		if ((entry->hash == hash) && key_equal(impl, key, key_inst(impl, entry))) {
+			set_entry(impl, entry, entry->next, hash, NULL, val, 1);
 			return;
 		}
 		pos = entry->next;
 	}
-	if (hmap->free != END) {
+	if ((hmap->free != END) && (hmap->map.collection.size < hmap->max_size)) {
 		pos = hmap->free;
 		AZHashMapEntry *entry = entry_ptr(impl, hmap->entries, pos);
 		hmap->free = entry->next;
-		set_entry(impl, entry, root_entry->next, key, val, 0);
+		set_entry(impl, entry, root_entry->next, hash, key, val, 0);
 		root_entry->next = pos;
 		hmap->map.collection.size += 1;
 		return;
 	}
-	reallocate (impl, hmap, hmap->root_size << 1);
-	az_hash_map_insert(impl, hmap, key, val);
+	reallocate (impl, hmap, hmap->root_size << 1, 0);
+	insert_hashed(impl, hmap, hash, key, val);
 }
 
 unsigned int
 az_hash_map_remove(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *key)
 {
-	unsigned int hval = impl->hash(impl, key) % hmap->root_size;
-	AZHashMapEntry *root_entry = entry_ptr(impl, hmap->entries, hval);
+	uint32_t hash = key_hash(impl, key);
+	AZHashMapEntry *root_entry = entry_ptr(impl, hmap->entries, hash % hmap->root_size);
 	if(root_entry->next == EMPTY) return 0;
-	if (impl->equal(impl, key, key_inst(impl, root_entry))) {
+	if ((root_entry->hash == hash) && key_equal(impl, key, key_inst(impl, root_entry))) {
 		clear_entry(impl, root_entry);
 		if (root_entry->next != END) {
 			int pos = root_entry->next;
@@ -365,7 +429,7 @@ az_hash_map_remove(const AZHashMapImplementation *impl, AZHashMap *hmap, const v
 	int pos = root_entry->next;
 	while (pos != END) {
 		AZHashMapEntry *entry = entry_ptr(impl, hmap->entries, pos);
-		if (impl->equal (impl, key, key_inst(impl, entry))) {
+		if ((entry->hash == hash) && key_equal (impl, key, key_inst(impl, entry))) {
 			clear_entry(impl, entry);
 			prev_entry->next = entry->next;
 			entry->next = hmap->free;
@@ -430,17 +494,57 @@ az_hash_map_exists_val(const AZHashMapImplementation *impl, AZHashMap *hmap, con
 const void *
 az_hash_map_lookup(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *key)
 {
-	unsigned int pos = impl->hash(impl, key) % hmap->root_size;
-	AZHashMapEntry *entry = entry_ptr(impl, hmap->entries, pos);
+	return lookup_hashed(impl, hmap, key, key_hash(impl, key));
+}
+
+static const void *
+lookup_hashed(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *key, uint32_t hash)
+{
+	AZHashMapEntry *entry = entry_ptr(impl, hmap->entries, hash % hmap->root_size);
 	if (entry->next == EMPTY) return NULL;
-	if (impl->equal (impl, key, key_inst(impl, entry))) return val_inst(impl, entry);
-	for (pos = entry->next; pos != END; pos = entry->next) {
+	if ((entry->hash == hash) && key_equal (impl, key, key_inst(impl, entry))) return val_inst(impl, entry);
+	for (unsigned int pos = entry->next; pos != END; pos = entry->next) {
 		entry = entry_ptr(impl, hmap->entries, pos);
-		if (impl->equal (impl, key, key_inst(impl, entry))) return val_inst(impl, entry);
+		if ((entry->hash == hash) && key_equal (impl, key, key_inst(impl, entry))) return val_inst(impl, entry);
 	}
 	return NULL;
 }
 
+unsigned int
+az_hash_map_lookup_batch(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *const *keys, const void **vals, unsigned int n_keys)
+{
+	uint32_t hashes[BATCH_SIZE];
+	unsigned int n_found = 0;
+	for (unsigned int start = 0; start < n_keys; start += BATCH_SIZE) {
+		unsigned int len = ((n_keys - start) < BATCH_SIZE) ? n_keys - start : BATCH_SIZE;
+		for (unsigned int i = 0; i < len; i++) {
+			hashes[i] = key_hash(impl, keys[start + i]);
+			PREFETCH(entry_ptr(impl, hmap->entries, hashes[i] % hmap->root_size));
+		}
+		for (unsigned int i = 0; i < len; i++) {
+			vals[start + i] = lookup_hashed(impl, hmap, keys[start + i], hashes[i]);
+			if (vals[start + i]) n_found += 1;
+		}
+	}
+	return n_found;
+}
+
+void
+az_hash_map_insert_batch(const AZHashMapImplementation *impl, AZHashMap *hmap, void *const *keys, void *const *vals, unsigned int n_keys)
+{
+	uint32_t hashes[BATCH_SIZE];
+	for (unsigned int start = 0; start < n_keys; start += BATCH_SIZE) {
+		unsigned int len = ((n_keys - start) < BATCH_SIZE) ? n_keys - start : BATCH_SIZE;
+		for (unsigned int i = 0; i < len; i++) {
+			hashes[i] = key_hash(impl, keys[start + i]);
+			PREFETCH(entry_ptr(impl, hmap->entries, hashes[i] % hmap->root_size));
+		}
+		for (unsigned int i = 0; i < len; i++) {
+			insert_hashed(impl, hmap, hashes[i], keys[start + i], vals[start + i]);
+		}
+	}
+}
+
 unsigned int
 az_hash_map_forall (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int (* forall) (const void *, const void *, void *), void *data)
 {
@@ -502,6 +606,49 @@ az_hash_map_remove_all (const AZHashMapImplementation *impl, AZHashMap *hmap, un
 	return n_removed;
 }
 
+void
+az_hash_map_reserve(const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int n_entries)
+{
+	float load = (impl->max_load_factor > 0) ? impl->max_load_factor : 3;
+	unsigned int root_size = (unsigned int) (n_entries / load) + 1;
+	if (root_size < hmap->root_size) root_size = hmap->root_size;
+	unsigned int overflow = overflow_size(impl, root_size);
+	/* Chain area has to fit all entries in the worst case */
+	if (overflow < n_entries) overflow = n_entries;
+	if ((root_size == hmap->root_size) && ((hmap->allocated_size - hmap->root_size) >= overflow)) return;
+	reallocate (impl, hmap, root_size, root_size + overflow);
+}
+
+void
+az_hash_map_shrink_to_fit(const AZHashMapImplementation *impl, AZHashMap *hmap)
+{
+	float load = (impl->max_load_factor > 0) ? impl->max_load_factor : 3;
+	unsigned int root_size = (unsigned int) (hmap->map.collection.size / load) + 1;
+	if (root_size < impl->root_size) root_size = impl->root_size;
+	/* Count the roots used after rehashing to determine the exact size of chain area */
+	unsigned char *used = (unsigned char *) calloc(root_size, 1);
+	unsigned int n_roots = 0;
+	for (unsigned int hval = 0; hval < hmap->root_size; hval++) {
+		AZHashMapEntry *root_entry = entry_ptr(impl, hmap->entries, hval);
+		if (root_entry->next == EMPTY) continue;
+		unsigned int pos = hval;
+		do {
+			AZHashMapEntry *entry = entry_ptr(impl, hmap->entries, pos);
+			unsigned int new_hval = entry->hash % root_size;
+			if (!used[new_hval]) {
+				used[new_hval] = 1;
+				n_roots += 1;
+			}
+			pos = entry->next;
+		} while (pos != END);
+	}
+	free(used);
+	unsigned int overflow = overflow_size(impl, root_size);
+	if (overflow < (hmap->map.collection.size - n_roots)) overflow = hmap->map.collection.size - n_roots;
+	if ((root_size + overflow) >= hmap->allocated_size) return;
+	reallocate (impl, hmap, root_size, root_size + overflow);
+}
+
 static AZHashMapEntry *
 allocate_entries(const AZHashMapImplementation *impl, unsigned int size, unsigned int root_size)
 {
@@ -515,9 +662,13 @@ allocate_entries(const AZHashMapImplementation *impl, unsigned int size, unsigne
 }
 
 static void
-reallocate (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int new_root_size)
+reallocate (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int new_root_size, unsigned int new_size)
 {
-	unsigned int new_size = 3 * new_root_size;
+	if (!new_size) {
+		unsigned int overflow = overflow_size(impl, new_root_size);
+		if (overflow < hmap->map.collection.size) overflow = hmap->map.collection.size;
+		new_size = new_root_size + overflow;
+	}
 	AZHashMapEntry *new_entries =  allocate_entries(impl, new_size, new_root_size);
 	unsigned int new_free = new_root_size;
 	for (unsigned int hval = 0; hval < hmap->root_size; hval++) {
@@ -526,7 +677,7 @@ reallocate (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int n
 		unsigned int pos = hval;
 		do {
 			AZHashMapEntry *entry = entry_ptr(impl, hmap->entries, pos);
-			unsigned int new_hval = impl->hash(impl, key_inst(impl, entry)) % new_root_size;
+			unsigned int new_hval = entry->hash % new_root_size;
 			AZHashMapEntry *new_root_entry = entry_ptr(impl, new_entries, new_hval);
 			if (new_root_entry->next == EMPTY) {
 				memcpy(new_root_entry, entry, impl->entry_size);
@@ -546,5 +697,6 @@ reallocate (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int n
 	hmap->root_size = new_root_size;
 	hmap->allocated_size = new_size;
 	hmap->free = new_free;
+	hmap->max_size = max_size(impl, new_root_size);
 	hmap->entries = new_entries;
 }
@@ -24,6 +24,10 @@ extern "C" {
  * @brief A map implementation based on a hash table.
  * 
  * The collection interface access values.
+ * Every entry starts with 8-byte header (chain link and cached hash value), thus
+ * key_offset and val_offset have to be at least 8. The hash function is called only once
+ * per insert, remove or lookup and equal only for entries with matching hash.
+ *
  * The iterator is 64-bit unsigned integer with the following layout:
  *   - 63-32: current root index
  *   - 31-0: current entry index
@@ -34,6 +38,7 @@ struct _AZHashMap {
     unsigned int allocated_size;
     unsigned int root_size;
     unsigned int free;
+    unsigned int max_size;
     AZHashMapEntry *entries;
 };
 
@@ -42,12 +47,15 @@ struct _AZHashMapImplementation {
     const AZImplementation *key_impl;
     const AZImplementation *val_impl;
     unsigned int root_size;
+    /* Maximum average chain length, the table grows if exceeded (default 3) */
+    float max_load_factor;
     unsigned int entry_size;
 	uint16_t key_offset;
 	uint16_t key_size;
 	uint16_t val_offset;
 	uint16_t val_size;
 
+    /* If NULL, the hash or equals method of the key type is used */
     uint32_t (*hash) (const AZHashMapImplementation *impl, const void *key);
     unsigned int (*equal) (const AZHashMapImplementation *impl, const void *lhs, const void *rhs);
 };
@@ -64,6 +72,26 @@ void az_hash_map_clear(const AZHashMapImplementation *impl, AZHashMap *hmap);
 unsigned int az_hash_map_exists(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *key);
 unsigned int az_hash_map_exists_val(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *val);
 const void *az_hash_map_lookup(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *key);
+/**
+ * @brief Resize table so that n_entries can be inserted without reallocation
+ *
+ * Never shrinks the table.
+ */
+void az_hash_map_reserve(const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int n_entries);
+/**
+ * @brief Shrink table to the smallest size that keeps load factor (but not below initial root size)
+ */
+void az_hash_map_shrink_to_fit(const AZHashMapImplementation *impl, AZHashMap *hmap);
+/**
+ * @brief Look up many keys at once
+ *
+ * Keys are hashed and their buckets prefetched in groups, hiding memory latency on big tables.
+ * @param vals the result array, values are set to NULL for missing keys
+ * @return the number of keys found
+ */
+unsigned int az_hash_map_lookup_batch(const AZHashMapImplementation *impl, AZHashMap *hmap, const void *const *keys, const void **vals, unsigned int n_keys);
+/* Insert or replace many key-value pairs at once */
+void az_hash_map_insert_batch(const AZHashMapImplementation *impl, AZHashMap *hmap, void *const *keys, void *const *vals, unsigned int n_keys);
 unsigned int az_hash_map_forall (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int (* forall) (const void *, const void *, void *), void *data);
 unsigned int az_hash_map_remove_all (const AZHashMapImplementation *impl, AZHashMap *hmap, unsigned int (*remove) (const void *, const void *, void *), void *data);
 
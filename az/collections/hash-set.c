@@ -22,13 +22,27 @@
 #define aligned_free(p) free(p)
 #endif
 
+/* Full hash value is cached so that rehashing and mismatching chain entries do not need callbacks */
 struct _AZHashSetEntry {
     uint32_t next;
+    uint32_t hash;
 };
 
 #define EMPTY 0
 #define END 1
 
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch((const char *) (p), _MM_HINT_T0)
+#else
+#define PREFETCH(p)
+#endif
+
+/* Batched operations hash and prefetch this many keys ahead of probing */
+#define BATCH_SIZE 16
+
 static AZHashSetEntry *
 entry_ptr(const AZHashSetImplementation *impl, AZHashSetEntry *entries, unsigned int pos)
 {
@@ -47,6 +61,21 @@ elem_inst(const AZHashSetImplementation *impl, AZHashSetEntry *entry)
 	return az_value_get_inst(impl->elem_impl, elem_ptr(impl, entry));
 }
 
+/* Without callbacks elements are hashed and compared by the methods of their type */
+static inline uint32_t
+elem_hash(const AZHashSetImplementation *impl, const void *elem)
+{
+	if (impl->hash) return impl->hash(impl, elem);
+	return az_instance_hash(impl->elem_impl, (void *) elem);
+}
+
+static inline unsigned int
+elem_equal(const AZHashSetImplementation *impl, const void *lhs, const void *rhs)
+{
+	if (impl->equal) return impl->equal(impl, lhs, rhs);
+	return az_instance_equals(impl->elem_impl, (void *) lhs, (void *) rhs);
+}
+
 static inline void
 clear_entry(const AZHashSetImplementation *impl, AZHashSetEntry *entry)
 {
@@ -54,15 +83,35 @@ clear_entry(const AZHashSetImplementation *impl, AZHashSetEntry *entry)
 }
 
 static void
-set_entry(const AZHashSetImplementation *impl, AZHashSetEntry *entry, unsigned int next, void *elem)
+set_entry(const AZHashSetImplementation *impl, AZHashSetEntry *entry, unsigned int next, uint32_t hash, void *elem)
 {
 	entry->next = next;
+	entry->hash = hash;
 	AZValue *dst = elem_ptr(impl, entry);
     az_value_set_from_inst(impl->elem_impl, dst, elem);
 }
 
 static AZHashSetEntry *allocate_entries(const AZHashSetImplementation *impl, unsigned int size, unsigned int root_size);
-static void reallocate (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int new_root_size);
+static void insert_hashed(const AZHashSetImplementation *impl, AZHashSet *hset, uint32_t hash, void *elem);
+static unsigned int contains_hashed(const AZHashSetImplementation *impl, AZHashSet *hset, const void *elem, uint32_t hash);
+static void reallocate (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int new_root_size, unsigned int new_size);
+
+/* The number of entries allowed for given root size */
+static unsigned int
+max_size(const AZHashSetImplementation *impl, unsigned int root_size)
+{
+	float load = (impl->max_load_factor > 0) ? impl->max_load_factor : 3;
+	unsigned int size = (unsigned int) (load * root_size);
+	return (size) ? size : 1;
+}
+
+/* The default size of chain area (the number of entries beyond roots) */
+static unsigned int
+overflow_size(const AZHashSetImplementation *impl, unsigned int root_size)
+{
+	unsigned int size = max_size(impl, root_size);
+	return (size > root_size) ? size - root_size : root_size / 2 + 1;
+}
 
 static void hset_implementation_init (AZHashSetImplementation *impl);
 static void hset_instance_init (const AZHashSetImplementation *impl, AZHashSet *hset);
@@ -105,8 +154,11 @@ hset_implementation_init (AZHashSetImplementation *impl)
 	impl->set_impl.collection_impl.get_iterator = hset_get_iter;
 	impl->set_impl.collection_impl.iterator_next = hset_iter_next;
 	impl->set_impl.collection_impl.get_element = hset_get_element;
+    impl->hash = NULL;
+    impl->equal = NULL;
     impl->elem_impl = NULL;
     impl->root_size = 31;
+    impl->max_load_factor = 3;
     impl->entry_size = 0;
     impl->elem_offset = 0;
     impl->elem_size = 0;
@@ -116,8 +168,9 @@ static void
 hset_instance_init (const AZHashSetImplementation *impl, AZHashSet *hset)
 {
     hset->root_size = impl->root_size;
-    hset->allocated_size = 3 * impl->root_size;
+    hset->allocated_size = impl->root_size + overflow_size(impl, impl->root_size);
     hset->free = hset->root_size;
+    hset->max_size = max_size(impl, impl->root_size);
     hset->entries = allocate_entries(impl, hset->allocated_size, hset->root_size);
 }
 
@@ -203,44 +256,55 @@ hset_get_element (const AZCollectionImplementation *coll_impl, AZCollection *col
 void
 az_hash_set_insert(const AZHashSetImplementation *impl, AZHashSet *hset, void *elem)
 {
-	unsigned int pos = impl->hash(impl, elem) % hset->root_size;
+	insert_hashed(impl, hset, elem_hash(impl, elem), elem);
+}
+
+static void
+insert_hashed(const AZHashSetImplementation *impl, AZHashSet *hset, uint32_t hash, void *elem)
+{
+	unsigned int pos = hash % hset->root_size;
 	AZHashSetEntry *root_entry = entry_ptr(impl, hset->entries, pos);
 	if(root_entry->next == EMPTY) {
-		set_entry(impl, root_entry, END, elem);
+		if (hset->set.collection.size >= hset->max_size) {
+			reallocate (impl, hset, hset->root_size << 1, 0);
+			insert_hashed(impl, hset, hash, elem);
+			return;
+		}
+		set_entry(impl, root_entry, END, hash, elem);
 		hset->set.collection.size += 1;
 		return;
 	}
-	if (impl->equal(impl, elem, elem_inst(impl, root_entry))) {
+	if ((root_entry->hash == hash) && elem_equal(impl, elem, elem_inst(impl, root_entry))) {
 		return;
 	}
 	pos = root_entry->next;
 	while (pos != END) {
 		AZHashSetEntry *entry = entry_ptr(impl, hset->entries, pos);
-		if (impl->equal(impl, elem, elem_inst(impl, entry))) {
+		if ((entry->hash == hash) && elem_equal(impl, elem, elem_inst(impl, entry))) {
 			return;
 		}
 		pos = entry->next;
 	}
-	if (hset->free != END) {
+	if ((hset->free != END) && (hset->set.collection.size < hset->max_size)) {
 		pos = hset->free;
 		AZHashSetEntry *entry = entry_ptr(impl, hset->entries, pos);
 		hset->free = entry->next;
-		set_entry(impl, entry, root_entry->next, elem);
+		set_entry(impl, entry, root_entry->next, hash, elem);
 		root_entry->next = pos;
 		hset->set.collection.size += 1;
 		return;
 	}
-	reallocate (impl, hset, hset->root_size << 1);
-	az_hash_set_insert(impl, hset, elem);
+	reallocate (impl, hset, hset->root_size << 1, 0);
+	insert_hashed(impl, hset, hash, elem);
 }
 
 unsigned int
 az_hash_set_remove(const AZHashSetImplementation *impl, AZHashSet *hset, const void *elem)
 {
-	unsigned int hval = impl->hash(impl, elem) % hset->root_size;
-	AZHashSetEntry *root_entry = entry_ptr(impl, hset->entries, hval);
+	uint32_t hash = elem_hash(impl, elem);
+	AZHashSetEntry *root_entry = entry_ptr(impl, hset->entries, hash % hset->root_size);
 	if(root_entry->next == EMPTY) return 0;
-	if (impl->equal(impl, elem, elem_inst(impl, root_entry))) {
+	if ((root_entry->hash == hash) && elem_equal(impl, elem, elem_inst(impl, root_entry))) {
 		clear_entry(impl, root_entry);
 		if (root_entry->next != END) {
 			int pos = root_entry->next;
@@ -258,7 +322,7 @@ az_hash_set_remove(const AZHashSetImplementation *impl, AZHashSet *hset, const v
 	int pos = root_entry->next;
 	while (pos != END) {
 		AZHashSetEntry *entry = entry_ptr(impl, hset->entries, pos);
-		if (impl->equal (impl, elem, elem_inst(impl, entry))) {
+		if ((entry->hash == hash) && elem_equal (impl, elem, elem_inst(impl, entry))) {
 			clear_entry(impl, entry);
 			prev_entry->next = entry->next;
 			entry->next = hset->free;
@@ -300,17 +364,57 @@ az_hash_set_clear(const AZHashSetImplementation *impl, AZHashSet *hset)
 unsigned int
 az_hash_set_contains(const AZHashSetImplementation *impl, AZHashSet *hset, const void *elem)
 {
-	unsigned int pos = impl->hash(impl, elem) % hset->root_size;
-	AZHashSetEntry *entry = entry_ptr(impl, hset->entries, pos);
+	return contains_hashed(impl, hset, elem, elem_hash(impl, elem));
+}
+
+static unsigned int
+contains_hashed(const AZHashSetImplementation *impl, AZHashSet *hset, const void *elem, uint32_t hash)
+{
+	AZHashSetEntry *entry = entry_ptr(impl, hset->entries, hash % hset->root_size);
 	if (entry->next == EMPTY) return 0;
-	if (impl->equal(impl, elem, elem_inst(impl, entry))) return 1;
-	for (pos = entry->next; pos != END; pos = entry->next) {
+	if ((entry->hash == hash) && elem_equal(impl, elem, elem_inst(impl, entry))) return 1;
+	for (unsigned int pos = entry->next; pos != END; pos = entry->next) {
 		entry = entry_ptr(impl, hset->entries, pos);
-		if (impl->equal(impl, elem, elem_inst(impl, entry))) return 1;
+		if ((entry->hash == hash) && elem_equal(impl, elem, elem_inst(impl, entry))) return 1;
 	}
 	return 0;
 }
 
+unsigned int
+az_hash_set_contains_batch(const AZHashSetImplementation *impl, AZHashSet *hset, const void *const *elems, unsigned int *results, unsigned int n_elems)
+{
+	uint32_t hashes[BATCH_SIZE];
+	unsigned int n_found = 0;
+	for (unsigned int start = 0; start < n_elems; start += BATCH_SIZE) {
+		unsigned int len = ((n_elems - start) < BATCH_SIZE) ? n_elems - start : BATCH_SIZE;
+		for (unsigned int i = 0; i < len; i++) {
+			hashes[i] = elem_hash(impl, elems[start + i]);
+			PREFETCH(entry_ptr(impl, hset->entries, hashes[i] % hset->root_size));
+		}
+		for (unsigned int i = 0; i < len; i++) {
+			results[start + i] = contains_hashed(impl, hset, elems[start + i], hashes[i]);
+			n_found += results[start + i];
+		}
+	}
+	return n_found;
+}
+
+void
+az_hash_set_insert_batch(const AZHashSetImplementation *impl, AZHashSet *hset, void *const *elems, unsigned int n_elems)
+{
+	uint32_t hashes[BATCH_SIZE];
+	for (unsigned int start = 0; start < n_elems; start += BATCH_SIZE) {
+		unsigned int len = ((n_elems - start) < BATCH_SIZE) ? n_elems - start : BATCH_SIZE;
+		for (unsigned int i = 0; i < len; i++) {
+			hashes[i] = elem_hash(impl, elems[start + i]);
+			PREFETCH(entry_ptr(impl, hset->entries, hashes[i] % hset->root_size));
+		}
+		for (unsigned int i = 0; i < len; i++) {
+			insert_hashed(impl, hset, hashes[i], elems[start + i]);
+		}
+	}
+}
+
 unsigned int
 az_hash_set_forall (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int (* forall) (const void *, void *), void *data)
 {
@@ -372,6 +476,49 @@ az_hash_set_remove_all (const AZHashSetImplementation *impl, AZHashSet *hset, un
 	return n_removed;
 }
 
+void
+az_hash_set_reserve(const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int n_entries)
+{
+	float load = (impl->max_load_factor > 0) ? impl->max_load_factor : 3;
+	unsigned int root_size = (unsigned int) (n_entries / load) + 1;
+	if (root_size < hset->root_size) root_size = hset->root_size;
+	unsigned int overflow = overflow_size(impl, root_size);
+	/* Chain area has to fit all entries in the worst case */
+	if (overflow < n_entries) overflow = n_entries;
+	if ((root_size == hset->root_size) && ((hset->allocated_size - hset->root_size) >= overflow)) return;
+	reallocate (impl, hset, root_size, root_size + overflow);
+}
+
+void
+az_hash_set_shrink_to_fit(const AZHashSetImplementation *impl, AZHashSet *hset)
+{
+	float load = (impl->max_load_factor > 0) ? impl->max_load_factor : 3;
+	unsigned int root_size = (unsigned int) (hset->set.collection.size / load) + 1;
+	if (root_size < impl->root_size) root_size = impl->root_size;
+	/* Count the roots used after rehashing to determine the exact size of chain area */
+	unsigned char *used = (unsigned char *) calloc(root_size, 1);
+	unsigned int n_roots = 0;
+	for (unsigned int hval = 0; hval < hset->root_size; hval++) {
+		AZHashSetEntry *root_entry = entry_ptr(impl, hset->entries, hval);
+		if (root_entry->next == EMPTY) continue;
+		unsigned int pos = hval;
+		do {
+			AZHashSetEntry *entry = entry_ptr(impl, hset->entries, pos);
+			unsigned int new_hval = entry->hash % root_size;
+			if (!used[new_hval]) {
+				used[new_hval] = 1;
+				n_roots += 1;
+			}
+			pos = entry->next;
+		} while (pos != END);
+	}
+	free(used);
+	unsigned int overflow = overflow_size(impl, root_size);
+	if (overflow < (hset->set.collection.size - n_roots)) overflow = hset->set.collection.size - n_roots;
+	if ((root_size + overflow) >= hset->allocated_size) return;
+	reallocate (impl, hset, root_size, root_size + overflow);
+}
+
 static AZHashSetEntry *
 allocate_entries(const AZHashSetImplementation *impl, unsigned int size, unsigned int root_size)
 {
@@ -385,9 +532,13 @@ allocate_entries(const AZHashSetImplementation *impl, unsigned int size, unsigne
 }
 
 static void
-reallocate (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int new_root_size)
+reallocate (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int new_root_size, unsigned int new_size)
 {
-	unsigned int new_size = 3 * new_root_size;
+	if (!new_size) {
+		unsigned int overflow = overflow_size(impl, new_root_size);
+		if (overflow < hset->set.collection.size) overflow = hset->set.collection.size;
+		new_size = new_root_size + overflow;
+	}
 	AZHashSetEntry *new_entries =  allocate_entries(impl, new_size, new_root_size);
 	unsigned int new_free = new_root_size;
 	for (unsigned int hval = 0; hval < hset->root_size; hval++) {
@@ -396,7 +547,7 @@ reallocate (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int n
 		unsigned int pos = hval;
 		do {
 			AZHashSetEntry *entry = entry_ptr(impl, hset->entries, pos);
-			unsigned int new_hval = impl->hash(impl, elem_inst(impl, entry)) % new_root_size;
+			unsigned int new_hval = entry->hash % new_root_size;
 			AZHashSetEntry *new_root_entry = entry_ptr(impl, new_entries, new_hval);
 			if (new_root_entry->next == EMPTY) {
 				memcpy(new_root_entry, entry, impl->entry_size);
@@ -416,5 +567,6 @@ reallocate (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int n
 	hset->root_size = new_root_size;
 	hset->allocated_size = new_size;
 	hset->free = new_free;
+	hset->max_size = max_size(impl, new_root_size);
 	hset->entries = new_entries;
 }
@@ -24,6 +24,10 @@ extern "C" {
  * @brief A set implementation based on a hash table.
  *
  * The collection interface accesses elements.
+ * Every entry starts with 8-byte header (chain link and cached hash value), thus
+ * elem_offset have to be at least 8. The hash function is called only once
+ * per insert, remove or lookup and equal only for entries with matching hash.
+ *
  * The iterator is 64-bit unsigned integer with the following layout:
  *   - 63-32: current root index
  *   - 31-0: current entry index
@@ -34,6 +38,7 @@ struct _AZHashSet {
     unsigned int allocated_size;
     unsigned int root_size;
     unsigned int free;
+    unsigned int max_size;
     AZHashSetEntry *entries;
 };
 
@@ -41,10 +46,13 @@ struct _AZHashSetImplementation {
 	AZSetImplementation set_impl;
     const AZImplementation *elem_impl;
     unsigned int root_size;
+    /* Maximum average chain length, the table grows if exceeded (default 3) */
+    float max_load_factor;
     unsigned int entry_size;
     uint16_t elem_offset;
     uint16_t elem_size;
 
+    /* If NULL, the hash or equals method of the element type is used */
     uint32_t (*hash) (const AZHashSetImplementation *impl, const void *elem);
     unsigned int (*equal) (const AZHashSetImplementation *impl, const void *lhs, const void *rhs);
 };
@@ -59,6 +67,25 @@ void az_hash_set_insert(const AZHashSetImplementation *impl, AZHashSet *hset, vo
 unsigned int az_hash_set_remove(const AZHashSetImplementation *impl, AZHashSet *hset, const void *elem);
 void az_hash_set_clear(const AZHashSetImplementation *impl, AZHashSet *hset);
 unsigned int az_hash_set_contains(const AZHashSetImplementation *impl, AZHashSet *hset, const void *elem);
+/**
+ * @brief Resize table so that n_entries can be inserted without reallocation
+ *
+ * Never shrinks the table.
+ */
+void az_hash_set_reserve(const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int n_entries);
+/**
+ * @brief Shrink table to the smallest size that keeps load factor (but not below initial root size)
+ */
+void az_hash_set_shrink_to_fit(const AZHashSetImplementation *impl, AZHashSet *hset);
+/**
+ * @brief Test many elements at once
+ *
+ * Elements are hashed and their buckets prefetched in groups, hiding memory latency on big tables.
+ * @param results the result array (1 if element is in set, 0 otherwise)
+ * @return the number of elements found
+ */
+unsigned int az_hash_set_contains_batch(const AZHashSetImplementation *impl, AZHashSet *hset, const void *const *elems, unsigned int *results, unsigned int n_elems);
+void az_hash_set_insert_batch(const AZHashSetImplementation *impl, AZHashSet *hset, void *const *elems, unsigned int n_elems);
 unsigned int az_hash_set_forall (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int (* forall) (const void *, void *), void *data);
 unsigned int az_hash_set_remove_all (const AZHashSetImplementation *impl, AZHashSet *hset, unsigned int (*remove) (const void *, void *), void *data);
 
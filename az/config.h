@@ -24,7 +24,7 @@ extern "C" {
  * Three variants of handling global type arrays:
  * AZ_GLOBALS_STATIC - use compile-time fixed size arrays (AZ_MAX_TYPES)
  * AZ_GLOBALS_SINGLE_THREAD - completely ignore concurrency 
- * AZ_GLOBALS_MULTI_THREAD - use mutex
+ * AZ_GLOBALS_MULTI_THREAD - lock-free lookups, use mutex for registration
  * 
  * The following macros are redefined depending on globals handling:
  * - AZ_CLASS_FROM_TYPE
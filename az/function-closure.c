@@ -0,0 +1,166 @@
+#define __AZ_FUNCTION_CLOSURE_C__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2026
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <arikkei/arikkei-utils.h>
+
+#include <az/function-closure.h>
+#include <az/extend.h>
+
+/* Maximum number of target arguments (the same limit as in signatures) */
+#define CLOSURE_MAX_ARGS 63
+
+static void function_closure_class_init (AZFunctionClosureClass *klass);
+static void function_closure_finalize (AZFunctionClosureClass *klass, AZFunctionClosure *closure);
+
+/* AZFunction implementation */
+static const AZFunctionSignature *closure_signature (const AZFunctionImplementation *impl, void *inst);
+static unsigned int closure_invoke (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx);
+
+static unsigned int function_closure_type = 0;
+AZFunctionClosureClass *AZFunctionClosureKlass = NULL;
+
+unsigned int
+az_function_closure_get_type (void)
+{
+	unsigned int t = AZ_TYPE_READ(function_closure_type);
+	if (t) return t;
+	AZ_TYPES_LOCK();
+	if (!function_closure_type) {
+		/* Instances are variable-sized and allocated by az_function_closure_new */
+		AZFunctionClosureKlass = (AZFunctionClosureClass *) az_register_type (&function_closure_type, (const unsigned char *) "FunctionClosure", AZ_TYPE_REFERENCE, sizeof (AZFunctionClosureClass), 0, AZ_FLAG_FINAL,
+			1, 0,
+			(void (*) (AZClass *)) function_closure_class_init,
+			NULL,
+			(void (*) (const AZImplementation *, void *)) function_closure_finalize);
+	}
+	t = function_closure_type;
+	AZ_TYPES_UNLOCK();
+	return t;
+}
+
+static void
+function_closure_class_init (AZFunctionClosureClass *klass)
+{
+	az_class_declare_interface (&klass->reference_klass.klass, 0, AZ_TYPE_FUNCTION, ARIKKEI_OFFSET (AZFunctionClosureClass, function_impl), 0);
+	klass->function_impl.signature = closure_signature;
+	klass->function_impl.invoke = closure_invoke;
+}
+
+static void
+function_closure_finalize (AZFunctionClosureClass *klass, AZFunctionClosure *closure)
+{
+	unsigned int i;
+	for (i = 0; i < closure->n_bound; i++) {
+		az_value_clear (closure->bound_impls[i], (AZValue *) closure->bound_vals[i]);
+	}
+	az_value_clear (closure->target_val_impl, closure->target_val);
+}
+
+static const AZFunctionSignature *
+closure_signature (const AZFunctionImplementation *impl, void *inst)
+{
+	AZFunctionClosure *closure = (AZFunctionClosure *) inst;
+	return closure->signature;
+}
+
+static unsigned int
+closure_invoke (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
+{
+	AZFunctionClosure *closure = (AZFunctionClosure *) inst;
+	const AZImplementation *impls[CLOSURE_MAX_ARGS];
+	const AZValue *vals[CLOSURE_MAX_ARGS];
+	unsigned int n_args = closure->signature->n_args;
+	unsigned int i;
+
+	for (i = 0; i < closure->n_bound; i++) {
+		impls[i] = closure->bound_impls[i];
+		vals[i] = closure->bound_vals[i];
+	}
+	for (i = 0; i < n_args; i++) {
+		impls[closure->n_bound + i] = arg_impls[i];
+		vals[closure->n_bound + i] = arg_vals[i];
+	}
+	return closure->target_impl->invoke (closure->target_impl, closure->target_inst, impls, vals, ret_impl, ret_val, ctx);
+}
+
+/* Storage size of value, never smaller than AZValue so it can be safely read as one */
+static unsigned int
+closure_slot_size (const AZImplementation *impl)
+{
+	unsigned int size = sizeof (AZValue);
+	if (impl && AZ_IMPL_IS_VALUE (impl)) {
+		unsigned int inst_size = (AZ_CLASS_FROM_IMPL (impl)->instance_size + 7) & ~7U;
+		if (inst_size > size) size = inst_size;
+	}
+	return size;
+}
+
+AZFunctionClosure *
+az_function_closure_new (const AZImplementation *impl, void *inst, unsigned int n_bound, const AZImplementation *bound_impls[], void *bound_insts[])
+{
+	const AZFunctionImplementation *target_impl;
+	const AZFunctionSignature *sig;
+	AZFunctionClosure *closure;
+	void *target_inst;
+	unsigned int size, i;
+	char *p;
+
+	arikkei_return_val_if_fail (impl != NULL, NULL);
+	arikkei_return_val_if_fail (AZ_IMPL_IS_CLASS (impl), NULL);
+	arikkei_return_val_if_fail (inst != NULL, NULL);
+	target_impl = (const AZFunctionImplementation *) az_instance_get_interface (impl, inst, AZ_TYPE_FUNCTION, &target_inst);
+	arikkei_return_val_if_fail (target_impl != NULL, NULL);
+	sig = target_impl->signature (target_impl, target_inst);
+	arikkei_return_val_if_fail (sig != NULL, NULL);
+	arikkei_return_val_if_fail (sig->n_args <= CLOSURE_MAX_ARGS, NULL);
+	arikkei_return_val_if_fail (n_bound <= sig->n_args, NULL);
+	for (i = 0; i < n_bound; i++) {
+		if (!bound_impls[i]) {
+			/* Null values are only allowed for blocks */
+			arikkei_return_val_if_fail (AZ_TYPE_IS_BLOCK (sig->arg_types[i]), NULL);
+		} else {
+			arikkei_return_val_if_fail (az_type_is_a (AZ_IMPL_TYPE (bound_impls[i]), sig->arg_types[i]), NULL);
+		}
+	}
+
+	/* Instance, bound implementations and value pointers, value slots and target value */
+	size = (sizeof (AZFunctionClosure) + 7) & ~7U;
+	size += n_bound * (sizeof (AZImplementation *) + sizeof (AZValue *));
+	for (i = 0; i < n_bound; i++) size += closure_slot_size (bound_impls[i]);
+	size += closure_slot_size (impl);
+	closure = (AZFunctionClosure *) malloc (size);
+	az_instance_init (AZ_IMPL_FROM_TYPE (AZ_TYPE_FUNCTION_CLOSURE), closure);
+
+	p = (char *) closure + ((sizeof (AZFunctionClosure) + 7) & ~7U);
+	closure->n_bound = n_bound;
+	closure->bound_impls = (const AZImplementation **) p;
+	p += n_bound * sizeof (AZImplementation *);
+	closure->bound_vals = (const AZValue **) p;
+	p += n_bound * sizeof (AZValue *);
+	for (i = 0; i < n_bound; i++) {
+		AZValue *slot = (AZValue *) p;
+		closure->bound_impls[i] = bound_impls[i];
+		if (bound_impls[i]) {
+			az_value_set_from_inst (bound_impls[i], slot, bound_insts[i]);
+		} else {
+			slot->block = NULL;
+		}
+		closure->bound_vals[i] = slot;
+		p += closure_slot_size (bound_impls[i]);
+	}
+	closure->target_val_impl = impl;
+	closure->target_val = (AZValue *) p;
+	az_value_set_from_inst (impl, closure->target_val, inst);
+	/* Resolve interface again as value types are now stored inside closure */
+	closure->target_impl = (const AZFunctionImplementation *) az_instance_get_interface (impl, az_value_get_inst (impl, closure->target_val), AZ_TYPE_FUNCTION, &closure->target_inst);
+	closure->signature = az_function_signature_get (0, sig->ret_type, sig->n_args - n_bound, sig->arg_types + n_bound);
+	return closure;
+}
@@ -0,0 +1,87 @@
+#ifndef __AZ_FUNCTION_CLOSURE_H__
+#define __AZ_FUNCTION_CLOSURE_H__
+
+/*
+* A run-time type library
+*
+* Copyright (C) Lauris Kaplinski 2026
+*/
+
+/*
+ * Reference type that binds leading arguments of another function (partial application)
+ *
+ * The target function and the bound arguments are stored inline in the closure instance,
+ * invoking the closure prepends the bound arguments to call arguments without copying
+ * or referencing values.
+ * The signature of closure is the (interned) signature of target without the bound arguments.
+ */
+
+#define AZ_TYPE_FUNCTION_CLOSURE az_function_closure_get_type ()
+
+typedef struct _AZFunctionClosureClass AZFunctionClosureClass;
+typedef struct _AZFunctionClosure AZFunctionClosure;
+
+#include <az/function.h>
+#include <az/reference.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _AZFunctionClosure {
+	AZReference reference;
+	unsigned int n_bound;
+	/* Interned signature of target without bound arguments */
+	const AZFunctionSignature *signature;
+	/* Function interface of target */
+	const AZFunctionImplementation *target_impl;
+	void *target_inst;
+	/* Implementation and storage of target value */
+	const AZImplementation *target_val_impl;
+	AZValue *target_val;
+	/* Bound arguments, values point to the inline storage after instance */
+	const AZImplementation **bound_impls;
+	const AZValue **bound_vals;
+};
+
+struct _AZFunctionClosureClass {
+	AZReferenceClass reference_klass;
+	AZFunctionImplementation function_impl;
+};
+
+extern AZFunctionClosureClass *AZFunctionClosureKlass;
+
+unsigned int az_function_closure_get_type (void);
+
+/**
+ * @brief Create a new closure
+ *
+ * The closure holds a copy of target value (or a reference if it is a reference type) and
+ * copies of bound arguments in a single allocation.
+ *
+ * @param impl the implementation of target (has to implement AZFunction)
+ * @param inst the target instance
+ * @param n_bound the number of bound leading arguments
+ * @param bound_impls implementations of bound arguments
+ * @param bound_insts instances of bound arguments
+ * @return a new closure or NULL if bound arguments do not match the signature of target
+ */
+AZFunctionClosure *az_function_closure_new (const AZImplementation *impl, void *inst, unsigned int n_bound, const AZImplementation *bound_impls[], void *bound_insts[]);
+
+static inline void
+az_function_closure_ref (AZFunctionClosure *closure)
+{
+	az_reference_ref (&closure->reference);
+}
+
+static inline void
+az_function_closure_unref (AZFunctionClosure *closure)
+{
+	az_reference_unref (&AZFunctionClosureKlass->reference_klass, &closure->reference);
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
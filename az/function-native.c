@@ -10,12 +10,14 @@
 
 #include <az/function-native.h>
 #include <az/extend.h>
+#include <az/private.h>
 
 static void function_native_class_init (AZFunctionNativeClass *klass);
 
 /* AZFunction implementation */
 const AZFunctionSignature *fnat_signature (const AZFunctionImplementation *impl, void *inst);
 static unsigned int function_native_invoke (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx);
+static unsigned int function_native_invoke_batch (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col, AZContext *ctx);
 
 static unsigned int function_native_type = 0;
 
@@ -42,6 +44,7 @@ function_native_class_init (AZFunctionNativeClass *klass)
 	az_class_declare_interface (&klass->klass, 0, AZ_TYPE_FUNCTION, ARIKKEI_OFFSET (AZFunctionNativeClass, function_impl), 0);
 	klass->function_impl.signature = fnat_signature;
 	klass->function_impl.invoke = function_native_invoke;
+	klass->function_impl.invoke_batch = function_native_invoke_batch;
 }
 
 const AZFunctionSignature *
@@ -55,12 +58,23 @@ static unsigned int
 function_native_invoke (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
 {
 	AZFunctionNative *fnat = (AZFunctionNative *) inst;
+	if (fnat->plan) return az_function_call_native_plan (fnat->func, fnat->plan, ret_impl, ret_val, arg_impls, arg_vals);
 	return az_function_call_native (fnat->func, fnat->signature, ret_impl, ret_val, arg_impls, arg_vals);
 }
 
+/* Runs the shared call plan over rows if available, otherwise falls back to the scalar row loop */
+static unsigned int
+function_native_invoke_batch (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col, AZContext *ctx)
+{
+	AZFunctionNative *fnat = (AZFunctionNative *) inst;
+	if (fnat->plan) return az_function_call_native_plan_rows (fnat->func, fnat->plan, fnat->signature, arg_impls, arg_cols, n_rows, ret_impls, ret_col);
+	return az_function_invoke_rows (impl, inst, fnat->signature, function_native_invoke, arg_impls, arg_cols, n_rows, ret_impls, ret_col, ctx);
+}
+
 void
-az_function_native_setup (AZFunctionNative *fnat, AZFunctionSignature *sig, void (*func) (void))
+az_function_native_setup (AZFunctionNative *fnat, const AZFunctionSignature *sig, void (*func) (void))
 {
 	fnat->signature = sig;
 	fnat->func = func;
+	fnat->plan = (sig) ? az_native_call_plan_get (sig) : NULL;
 }
@@ -6,11 +6,15 @@
 * Copyright (C) Lauris Kaplinski 2016-2019
 */
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 
+#include <arikkei/arikkei-dict.h>
+#include <arikkei/arikkei-utils.h>
+
 #include <az/base.h>
 #include <az/convert.h>
 #include <az/instance.h>
@@ -20,6 +24,16 @@
 
 #include <az/function.h>
 
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+#include <arikkei/arikkei-threads.h>
+#endif
+
+static void signatures_init (void);
+static void native_plans_init (void);
+
+/* The size of signature content (return type, number of arguments and argument types) */
+#define SIGNATURE_SIZE(sig) (8 + 4 * (sig)->n_args)
+
 //static AZClass *function_signature_class = NULL;
 //static AZClass *function_class = NULL;
 
@@ -53,6 +67,8 @@ az_init_function_classes (void)
 {
 	az_class_new_with_value(&AZFunctionSignatureKlass);
 	az_class_new_with_value(&AZFunctionKlass.klass);
+	signatures_init ();
+	native_plans_init ();
 }
 
 AZFunctionSignature *
@@ -106,11 +122,198 @@ az_function_signature_new_va (unsigned int ret_type, unsigned int n_args, ...)
 void
 az_function_signature_delete(AZFunctionSignature* sig)
 {
+	arikkei_return_if_fail (!az_function_signature_is_interned (sig));
 	az_instance_delete(AZ_TYPE_FUNCTION_SIGNATURE, sig);
 }
 
+/*
+ * Interned signatures and assignability cache
+ *
+ * Interned signatures are immutable and live until the program exits.
+ * Besides the content dictionary (guarded by signatures lock) interned entries are linked to
+ * lock-free chains by address, so testing whether a signature is interned does not need lock.
+ * The results of assignability tests between interned signatures are cached by signature
+ * addresses. Because interned signatures are never freed, their addresses can not be reused
+ * by other signatures and the cached results stay valid forever.
+ * The cache is direct-mapped, colliding pairs simply replace older entries. Every slot is
+ * guarded by sequence counter: a writer makes the counter odd while updating the slot (and
+ * gives up if another writer already did) and readers recompute the result if the counter was
+ * odd or changed during the read.
+ */
+
+typedef struct _SignatureEntry SignatureEntry;
+typedef struct _AssignableSlot AssignableSlot;
+
+struct _SignatureEntry {
+	/* Next entry in the same address chain */
+	_Atomic (SignatureEntry *) next;
+	uint32_t hash;
+	AZFunctionSignature sig;
+};
+
+struct _AssignableSlot {
+	_Atomic uint32_t seq;
+	/* (test_ret_val << 1) | result */
+	_Atomic uint32_t value;
+	_Atomic (const AZFunctionSignature *) sig;
+	_Atomic (const AZFunctionSignature *) other;
+};
+
+/* Number of address chains of interned signatures (2^10) */
+#define INTERNED_CHAINS_BITS 10
+/* Number of cache slots (power of 2) */
+#define ASSIGNABLE_CACHE_SIZE 1024
+
+#define SIGNATURE_ENTRY_FROM_SIG(s) ((SignatureEntry *) ((char *) (s) - ARIKKEI_OFFSET (SignatureEntry, sig)))
+
+static ArikkeiDict signatures;
+static _Atomic (SignatureEntry *) interned_chains[1 << INTERNED_CHAINS_BITS];
+static AssignableSlot assignable[ASSIGNABLE_CACHE_SIZE];
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+static mtx_t signatures_mutex;
+#define SIGNATURES_LOCK() mtx_lock (&signatures_mutex)
+#define SIGNATURES_UNLOCK() mtx_unlock (&signatures_mutex)
+#else
+#define SIGNATURES_LOCK()
+#define SIGNATURES_UNLOCK()
+#endif
+
+static unsigned int
+signature_hash (const void *data)
+{
+	const AZFunctionSignature *sig = *((const AZFunctionSignature **) data);
+	return SIGNATURE_ENTRY_FROM_SIG (sig)->hash;
+}
+
+static unsigned int
+signature_equal (const void *l, const void *r)
+{
+	const AZFunctionSignature *lhs = *((const AZFunctionSignature **) l);
+	const AZFunctionSignature *rhs = *((const AZFunctionSignature **) r);
+	if ((SIGNATURE_ENTRY_FROM_SIG (lhs)->hash != SIGNATURE_ENTRY_FROM_SIG (rhs)->hash) || (lhs->n_args != rhs->n_args)) return 0;
+	return !memcmp (lhs, rhs, SIGNATURE_SIZE (lhs));
+}
+
+static unsigned int
+signature_data_equal (const void *l, const void *r)
+{
+	const AZFunctionSignature *lhs = (const AZFunctionSignature *) l;
+	const AZFunctionSignature *rhs = *((const AZFunctionSignature **) r);
+	if (lhs->n_args != rhs->n_args) return 0;
+	return !memcmp (lhs, rhs, SIGNATURE_SIZE (lhs));
+}
+
+static unsigned int
+assignable_hash (const AZFunctionSignature *sig, const AZFunctionSignature *other, unsigned int test_ret_val)
+{
+	uint64_t h = ((uint64_t) (uintptr_t) sig * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t) (uintptr_t) other * 0xc2b2ae3d27d4eb4fULL) ^ test_ret_val;
+	return (unsigned int) (h ^ (h >> 32));
+}
+
+static void
+signatures_init (void)
+{
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	mtx_init (&signatures_mutex, mtx_plain);
+#endif
+	arikkei_dict_setup_full (&signatures, 251, signature_hash, signature_equal);
+}
+
+/* Requires lock */
+static const AZFunctionSignature *
+signature_lookup (const AZFunctionSignature *sig, uint32_t hash)
+{
+	const AZFunctionSignature **ptr = (const AZFunctionSignature **) arikkei_dict_lookup_foreign (&signatures, sig, hash, signature_data_equal);
+	return (ptr) ? *ptr : NULL;
+}
+
+static unsigned int
+interned_chain (const AZFunctionSignature *sig)
+{
+	return (unsigned int) (((uint64_t) (uintptr_t) sig * 0x9e3779b97f4a7c15ULL) >> (64 - INTERNED_CHAINS_BITS));
+}
+
+/* Lock-free, chains only grow and interned entries are never freed */
+static unsigned int
+signature_is_interned (const AZFunctionSignature *sig)
+{
+	SignatureEntry *entry = atomic_load_explicit (&interned_chains[interned_chain (sig)], memory_order_acquire);
+	while (entry) {
+		if (&entry->sig == sig) return 1;
+		entry = atomic_load_explicit (&entry->next, memory_order_acquire);
+	}
+	return 0;
+}
+
+const AZFunctionSignature *
+az_function_signature_intern (const AZFunctionSignature *sig)
+{
+	arikkei_return_val_if_fail (sig != NULL, NULL);
+	arikkei_return_val_if_fail (sig->n_args < 64, NULL);
+	uint32_t hash = arikkei_memory_hash (sig, SIGNATURE_SIZE (sig));
+	SIGNATURES_LOCK ();
+	const AZFunctionSignature *interned = signature_lookup (sig, hash);
+	if (!interned) {
+		SignatureEntry *entry = (SignatureEntry *) malloc (sizeof (SignatureEntry) - 4 + 4 * sig->n_args);
+		entry->hash = hash;
+		az_instance_init_by_type (&entry->sig, AZ_TYPE_FUNCTION_SIGNATURE);
+		memcpy (&entry->sig, sig, SIGNATURE_SIZE (sig));
+		interned = &entry->sig;
+		arikkei_dict_insert_pval (&signatures, (void *) interned, (void *) interned);
+		_Atomic (SignatureEntry *) *chain = &interned_chains[interned_chain (interned)];
+		atomic_init (&entry->next, atomic_load_explicit (chain, memory_order_relaxed));
+		atomic_store_explicit (chain, entry, memory_order_release);
+	}
+	SIGNATURES_UNLOCK ();
+	return interned;
+}
+
+/* Stack storage for signatures of up to 63 arguments */
+typedef union {
+	AZFunctionSignature sig;
+	uint32_t data[2 + 63];
+} SignatureBuffer;
+
+const AZFunctionSignature *
+az_function_signature_get (unsigned int this_type, unsigned int ret_type, unsigned int n_args, const unsigned int arg_types[])
+{
+	SignatureBuffer buf;
+	unsigned int i;
+	arikkei_return_val_if_fail (((this_type) ? n_args + 1 : n_args) < 64, NULL);
+	buf.sig.ret_type = ret_type;
+	buf.sig.n_args = 0;
+	/* Argument types are written through data, as sig.arg_types is declared with single element */
+	if (this_type) buf.data[2 + buf.sig.n_args++] = this_type;
+	for (i = 0; i < n_args; i++) buf.data[2 + buf.sig.n_args++] = arg_types[i];
+	return az_function_signature_intern (&buf.sig);
+}
+
+const AZFunctionSignature *
+az_function_signature_get_va (unsigned int ret_type, unsigned int n_args, ...)
+{
+	SignatureBuffer buf;
+	unsigned int i;
+	va_list ap;
+	arikkei_return_val_if_fail (n_args < 64, NULL);
+	buf.sig.ret_type = ret_type;
+	buf.sig.n_args = n_args;
+	va_start (ap, n_args);
+	for (i = 0; i < n_args; i++) {
+		buf.data[2 + i] = va_arg (ap, unsigned int);
+	}
+	va_end (ap);
+	return az_function_signature_intern (&buf.sig);
+}
+
 unsigned int
-az_function_signature_is_assignable_to (const AZFunctionSignature *sig, const AZFunctionSignature *other, unsigned int test_ret_val)
+az_function_signature_is_interned (const AZFunctionSignature *sig)
+{
+	arikkei_return_val_if_fail (sig != NULL, 0);
+	return signature_is_interned (sig);
+}
+
+static unsigned int
+signature_is_assignable_to (const AZFunctionSignature *sig, const AZFunctionSignature *other, unsigned int test_ret_val)
 {
 	unsigned int i;
 	if (sig->n_args != other->n_args) return 0;
@@ -121,6 +324,52 @@ az_function_signature_is_assignable_to (const AZFunctionSignature *sig, const AZ
 	return 1;
 }
 
+/* Lock-free, returns 1 and sets result if the pair is cached */
+static unsigned int
+assignable_lookup (AssignableSlot *slot, const AZFunctionSignature *sig, const AZFunctionSignature *other, unsigned int test_ret_val, unsigned int *result)
+{
+	uint32_t seq = atomic_load_explicit (&slot->seq, memory_order_acquire);
+	if (seq & 1) return 0;
+	uint32_t value = atomic_load_explicit (&slot->value, memory_order_relaxed);
+	unsigned int match = (atomic_load_explicit (&slot->sig, memory_order_relaxed) == sig) &&
+		(atomic_load_explicit (&slot->other, memory_order_relaxed) == other) && ((value >> 1) == test_ret_val);
+	atomic_thread_fence (memory_order_acquire);
+	if (!match || (atomic_load_explicit (&slot->seq, memory_order_relaxed) != seq)) return 0;
+	*result = value & 1;
+	return 1;
+}
+
+/* Lock-free, leaves the slot unchanged if another thread is updating it */
+static void
+assignable_store (AssignableSlot *slot, const AZFunctionSignature *sig, const AZFunctionSignature *other, unsigned int test_ret_val, unsigned int result)
+{
+	uint32_t seq = atomic_load_explicit (&slot->seq, memory_order_relaxed);
+	if (seq & 1) return;
+	if (!atomic_compare_exchange_strong_explicit (&slot->seq, &seq, seq + 1, memory_order_relaxed, memory_order_relaxed)) return;
+	atomic_thread_fence (memory_order_release);
+	atomic_store_explicit (&slot->value, (test_ret_val << 1) | result, memory_order_relaxed);
+	atomic_store_explicit (&slot->sig, sig, memory_order_relaxed);
+	atomic_store_explicit (&slot->other, other, memory_order_relaxed);
+	atomic_store_explicit (&slot->seq, seq + 2, memory_order_release);
+}
+
+unsigned int
+az_function_signature_is_assignable_to (const AZFunctionSignature *sig, const AZFunctionSignature *other, unsigned int test_ret_val)
+{
+	unsigned int result;
+	if (sig == other) return 1;
+	if (sig->n_args != other->n_args) return 0;
+	test_ret_val = (test_ret_val != 0);
+	AssignableSlot *slot = &assignable[assignable_hash (sig, other, test_ret_val) & (ASSIGNABLE_CACHE_SIZE - 1)];
+	if (assignable_lookup (slot, sig, other, test_ret_val, &result)) return result;
+	result = signature_is_assignable_to (sig, other, test_ret_val);
+	/* Private signatures can be freed and their addresses reused, so only interned pairs are cached */
+	if (signature_is_interned (sig) && signature_is_interned (other)) {
+		assignable_store (slot, sig, other, test_ret_val, result);
+	}
+	return result;
+}
+
 const AZFunctionSignature *
 az_function_get_signature (const AZFunctionImplementation *impl, void *inst)
 {
@@ -160,6 +409,119 @@ az_function_convert_args_in_place (const AZFunctionImplementation *impl, void *i
 	return 1;
 }
 
+void
+az_function_frame_setup (AZFunctionFrame *frame, unsigned int n_args)
+{
+	frame->n_args = n_args;
+	frame->flags = 0;
+	frame->signature = NULL;
+	memset (frame->slots, 0, 2 * n_args * sizeof (void *));
+}
+
+unsigned int
+az_function_frame_validate (AZFunctionFrame *frame, const AZFunctionSignature *sig)
+{
+	const AZImplementation **impls = AZ_FUNCTION_FRAME_IMPLS(frame);
+	unsigned int i;
+	if (!sig || (sig->n_args != frame->n_args)) return 0;
+	for (i = 0; i < frame->n_args; i++) {
+		if (!impls[i]) {
+			/* Null values are only allowed for blocks */
+			if (!AZ_TYPE_IS_BLOCK (sig->arg_types[i])) return 0;
+		} else if (!az_type_is_a (AZ_IMPL_TYPE(impls[i]), sig->arg_types[i])) {
+			return 0;
+		}
+	}
+	frame->flags |= AZ_FUNCTION_FRAME_VALIDATED;
+	frame->signature = sig;
+	return 1;
+}
+
+unsigned int
+az_function_invoke_frame (const AZFunctionImplementation *impl, void *inst, AZFunctionFrame *frame, const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
+{
+	if (!impl || !inst) return 0;
+	const AZFunctionSignature *sig = impl->signature (impl, inst);
+	/* Even trusted frames have to match the number of arguments */
+	if (!sig || (sig->n_args != frame->n_args)) return 0;
+	if (!(frame->flags & AZ_FUNCTION_FRAME_VALIDATED) || (sig != frame->signature)) {
+		if (!az_function_frame_validate (frame, sig)) return 0;
+	}
+	return impl->invoke (impl, inst, AZ_FUNCTION_FRAME_IMPLS(frame), AZ_FUNCTION_FRAME_VALS(frame), ret_impl, ret_val, ctx);
+}
+
+/* Argument arrays of up to this number of arguments are allocated on stack */
+#define FUNCTION_STACK_FRAME_ARGS 16
+
+/* Stores the result of row, returns 0 (and clears the value) if it does not fit into AZValue */
+static inline unsigned int
+function_row_store (const AZImplementation *ret_impl, AZValue64 *ret_val, unsigned int row, const AZImplementation *ret_impls[], AZValue *ret_col)
+{
+	if (ret_impl && AZ_IMPL_IS_VALUE (ret_impl) && (AZ_CLASS_FROM_IMPL (ret_impl)->instance_size > sizeof (AZValue))) {
+		az_value_clear (ret_impl, &ret_val->value);
+		return 0;
+	}
+	if (ret_impls) ret_impls[row] = ret_impl;
+	if (!ret_impl) return 1;
+	if (ret_col) {
+		ret_col[row] = ret_val->value;
+	} else {
+		az_value_clear (ret_impl, &ret_val->value);
+	}
+	return 1;
+}
+
+/* Releases the results of completed rows after failure */
+static void
+function_rows_release (const AZFunctionSignature *sig, unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col)
+{
+	const AZImplementation *ret_impl;
+	unsigned int i;
+	if (!ret_col || (!ret_impls && !AZ_TYPE_IS_FINAL (sig->ret_type))) return;
+	for (i = 0; i < n_rows; i++) {
+		ret_impl = (ret_impls) ? ret_impls[i] : AZ_IMPL_FROM_TYPE (sig->ret_type);
+		if (ret_impl) az_value_clear (ret_impl, &ret_col[i]);
+	}
+}
+
+unsigned int
+az_function_invoke_rows (const AZFunctionImplementation *impl, void *inst, const AZFunctionSignature *sig,
+	unsigned int (*invoke) (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx),
+	const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col, AZContext *ctx)
+{
+	const AZValue *stack_vals[FUNCTION_STACK_FRAME_ARGS];
+	const AZValue **arg_vals = stack_vals;
+	AZValue64 ret_val;
+	const AZImplementation *ret_impl;
+	unsigned int i, j;
+
+	if (!sig) return 0;
+	if (sig->n_args > FUNCTION_STACK_FRAME_ARGS) arg_vals = (const AZValue **) malloc (sig->n_args * sizeof (AZValue *));
+	for (i = 0; i < n_rows; i++) {
+		for (j = 0; j < sig->n_args; j++) arg_vals[j] = arg_cols[j] + i;
+		ret_impl = NULL;
+		if (!invoke (impl, inst, arg_impls, arg_vals, &ret_impl, &ret_val, ctx)) break;
+		if (!function_row_store (ret_impl, &ret_val, i, ret_impls, ret_col)) break;
+	}
+	if (arg_vals != stack_vals) free (arg_vals);
+	if (i == n_rows) return 1;
+	function_rows_release (sig, i, ret_impls, ret_col);
+	return 0;
+}
+
+unsigned int
+az_function_invoke_batch (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col, AZContext *ctx)
+{
+#if AZ_SAFETY_CHECKS
+	arikkei_return_val_if_fail (impl != NULL, 0);
+	arikkei_return_val_if_fail (az_type_is_a (AZ_IMPL_TYPE(&impl->implementation), AZ_TYPE_FUNCTION), 0);
+	arikkei_return_val_if_fail (inst != NULL, 0);
+#endif
+	if (!n_rows) return 1;
+	if (impl->invoke_batch) return impl->invoke_batch (impl, inst, arg_impls, arg_cols, n_rows, ret_impls, ret_col, ctx);
+	return az_function_invoke_rows (impl, inst, impl->signature (impl, inst), impl->invoke, arg_impls, arg_cols, n_rows, ret_impls, ret_col, ctx);
+}
+
 unsigned int
 az_function_invoke_packed (const AZFunctionImplementation *impl, void *inst, AZPackedValue *thisval, AZPackedValue64 *retval, AZPackedValue *args, unsigned int checktypes)
 {
@@ -168,6 +530,7 @@ az_function_invoke_packed (const AZFunctionImplementation *impl, void *inst, AZP
 	arikkei_return_val_if_fail (az_type_is_a (AZ_IMPL_TYPE(&impl->implementation), AZ_TYPE_FUNCTION), 0);
 	arikkei_return_val_if_fail (inst != NULL, 0);
 	const AZFunctionSignature *sig = az_function_get_signature(impl, inst);
+	arikkei_return_val_if_fail (sig->n_args <= 32, 0);
 	if (checktypes) {
 		s = d = 0;
 		if (thisval->impl) {
@@ -363,6 +726,78 @@ az_function_invoke_by_value_signature_va (const AZImplementation *impl, const AZ
 	return f_impl->invoke (f_impl, f_inst, arg_impls, arg_ptrs, ret_impl, ret_val, NULL);
 }
 
+/*
+ * Native call plans
+ *
+ * The argument marshalling is resolved once per signature into a list of moves - each
+ * move reads an argument (or the return storage address), converts it to a 64-bit slot
+ * and stores it at a fixed offset of the architecture-specific AZNativeCallFrame.
+ * The return value is decoded by copying bytes from AZNativeCallResult to AZValue64
+ * (all supported architectures are little-endian, so narrowing is just copying the low
+ * bytes) and setting the return implementation according to the return mode.
+ * Plans are built only for x86-64 System V, other architectures marshal arguments directly.
+ */
+
+enum {
+	/* Sign-extended to 32 bits, zero-extended to 64 bits */
+	NATIVE_MOVE_SX8,
+	NATIVE_MOVE_SX16,
+	/* Zero-extended to 64 bits */
+	NATIVE_MOVE_ZX8,
+	NATIVE_MOVE_ZX16,
+	NATIVE_MOVE_ZX32,
+	NATIVE_MOVE_64,
+	/* The address of argument value */
+	NATIVE_MOVE_VALUE_PTR,
+	/* Argument implementation (or the default implementation if NULL) */
+	NATIVE_MOVE_IMPL,
+	/* Argument instance */
+	NATIVE_MOVE_INST,
+	/* The address of return value */
+	NATIVE_MOVE_RET_STORAGE
+};
+
+enum {
+	NATIVE_RETURN_NONE,
+	/* The implementation of the return type */
+	NATIVE_RETURN_FIXED,
+	/* The class of the returned object (or the return type if NULL) */
+	NATIVE_RETURN_OBJECT,
+	/* The implementation returned in the general purpose register */
+	NATIVE_RETURN_IMPL
+};
+
+typedef struct _AZNativeCallMove AZNativeCallMove;
+
+struct _AZNativeCallMove {
+	uint8_t kind;
+	uint8_t src_offset;
+	uint16_t arg;
+	uint16_t dst_offset;
+	/* The default implementation of non-final types */
+	const AZImplementation *impl;
+};
+
+struct _AZNativeCallPlan {
+	uint32_t n_args;
+	uint32_t n_moves;
+	uint32_t stack_bytes;
+	/* The number of floating point registers used */
+	uint32_t n_fpr;
+	uint32_t ret_mode;
+	uint32_t n_ret_copies;
+	const AZImplementation *ret_impl;
+	struct {
+		uint16_t src_offset;
+		uint16_t dst_offset;
+		uint16_t size;
+	} ret_copies[2];
+	AZNativeCallMove moves[1];
+};
+
+/* Each argument needs at most 2 moves, plus the hidden return storage */
+#define NATIVE_CALL_PLAN_SIZE(n_args) (sizeof (AZNativeCallPlan) + 2 * (n_args) * sizeof (AZNativeCallMove))
+
 #if defined(ARCH_ARM_64) && defined(__GNUC__)
 
 /*
@@ -450,6 +885,10 @@ __asm__(
 	"ret\n"
 );
 
+
+/* Arguments are marshalled directly, without call plans */
+#define NATIVE_CALL_DIRECT
+
 static unsigned int
 native_frame_push_gpr (AZNativeCallFrame *frame, unsigned int *n_gpr, unsigned int *stack_bytes, uint64_t val)
 {
@@ -790,11 +1229,58 @@ __asm__(
 	"ret\n"
 );
 
+
+#define NATIVE_CALL_N_GPR 6
+#define NATIVE_CALL_N_FPR 8
+#define NATIVE_CALL_RESULT_FPR(i) (offsetof (AZNativeCallResult, fprs) + 8 * (i))
+#define NATIVE_CALL_TRAMPOLINE az_native_call_frame_sysv64
+
+#elif defined(AZ_NATIVE_CALL_WIN64)
+
+/*
+ * Windows x64 (Microsoft x64 calling convention) native call
+ *
+ * The C code marshals the arguments into an AZNativeCallFrame (4 general purpose
+ * registers, 4 FP registers and the stack overflow area) and the MASM trampoline
+ * loads the registers, copies the stack area and performs the call. Integer and
+ * floating point arguments share the same four argument slots - the register used
+ * (rcx/rdx/r8/r9 or xmm0-xmm3) depends on the position and type of the argument.
+ * Aggregates of 1, 2, 4 or 8 bytes (complex float) are passed and returned by value
+ * as if they were integers, larger aggregates (complex double) are passed by pointer
+ * and returned through a hidden storage pointer (the first argument). After the call
+ * the trampoline stores rax and xmm0 into the result buffer - this covers all return
+ * types of the native calling rules (integers, pointers, floats, doubles and 8-byte
+ * aggregates).
+ */
+
+#include <stddef.h>
+
+#define AZ_NATIVE_CALL_MAX_STACK 1024
+
+typedef struct {
+	uint64_t gprs[4];
+	uint64_t fprs[4];
+	uint64_t stack[AZ_NATIVE_CALL_MAX_STACK / 8];
+} AZNativeCallFrame;
+
+typedef struct {
+	uint64_t gpr;
+	uint64_t fpr;
+} AZNativeCallResult;
+
+/* The trampoline expects the stack area at offset 64 (4 gprs + 4 fprs) */
+_Static_assert (offsetof (AZNativeCallFrame, stack) == 64, "AZNativeCallFrame stack offset has to be 64");
+
+extern void az_native_call_frame_win64 (void (*func) (void), const AZNativeCallFrame *frame, uint64_t stack_bytes, AZNativeCallResult *result);
+
+/* Arguments are marshalled directly, without call plans */
+#define NATIVE_CALL_DIRECT
+
 static unsigned int
-native_frame_push_gpr (AZNativeCallFrame *frame, unsigned int *n_gpr, unsigned int *stack_bytes, uint64_t val)
+native_frame_push_gpr (AZNativeCallFrame *frame, unsigned int *n_slots, unsigned int *stack_bytes, uint64_t val)
 {
-	if (*n_gpr < 6) {
-		frame->gprs[(*n_gpr)++] = val;
+	if (*n_slots < 4) {
+		frame->gprs[(*n_slots)++] = val;
 	} else {
 		if (*stack_bytes + 8 > AZ_NATIVE_CALL_MAX_STACK) return 0;
 		frame->stack[*stack_bytes / 8] = val;
@@ -804,14 +1290,15 @@ native_frame_push_gpr (AZNativeCallFrame *frame, unsigned int *n_gpr, unsigned i
 }
 
 static unsigned int
-native_frame_push_fpr32 (AZNativeCallFrame *frame, unsigned int *n_fpr, unsigned int *stack_bytes, float val)
+native_frame_push_fpr32 (AZNativeCallFrame *frame, unsigned int *n_slots, unsigned int *stack_bytes, float val)
 {
-	if (*n_fpr < 8) {
+	if (*n_slots < 4) {
 		uint32_t u;
 		memcpy (&u, &val, 4);
-		frame->fprs[(*n_fpr)++] = u;
+		frame->fprs[(*n_slots)++] = u;
 	} else {
 		if (*stack_bytes + 8 > AZ_NATIVE_CALL_MAX_STACK) return 0;
+		memset ((uint8_t *) frame->stack + *stack_bytes, 0, 8);
 		memcpy ((uint8_t *) frame->stack + *stack_bytes, &val, 4);
 		*stack_bytes += 8;
 	}
@@ -819,10 +1306,10 @@ native_frame_push_fpr32 (AZNativeCallFrame *frame, unsigned int *n_fpr, unsigned
 }
 
 static unsigned int
-native_frame_push_fpr64 (AZNativeCallFrame *frame, unsigned int *n_fpr, unsigned int *stack_bytes, double val)
+native_frame_push_fpr64 (AZNativeCallFrame *frame, unsigned int *n_slots, unsigned int *stack_bytes, double val)
 {
-	if (*n_fpr < 8) {
-		memcpy (&frame->fprs[(*n_fpr)++], &val, 8);
+	if (*n_slots < 4) {
+		memcpy (&frame->fprs[(*n_slots)++], &val, 8);
 	} else {
 		if (*stack_bytes + 8 > AZ_NATIVE_CALL_MAX_STACK) return 0;
 		memcpy ((uint8_t *) frame->stack + *stack_bytes, &val, 8);
@@ -831,23 +1318,13 @@ native_frame_push_fpr64 (AZNativeCallFrame *frame, unsigned int *n_fpr, unsigned
 	return 1;
 }
 
-static unsigned int
-native_frame_push_stack (AZNativeCallFrame *frame, unsigned int *stack_bytes, const void *data, unsigned int size)
-{
-	unsigned int n = (size + 7) & ~7u;
-	if (*stack_bytes + n > AZ_NATIVE_CALL_MAX_STACK) return 0;
-	memcpy ((uint8_t *) frame->stack + *stack_bytes, data, size);
-	*stack_bytes += n;
-	return 1;
-}
-
 unsigned int
 az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[])
 {
 	AZNativeCallFrame frame;
 	AZNativeCallResult result;
 	AZValue64 tmp_ret;
-	unsigned int n_gpr = 0, n_fpr = 0, stack_bytes = 0;
+	unsigned int n_slots = 0, stack_bytes = 0;
 	unsigned int i, rtype;
 	AZClass *rklass;
 
@@ -858,14 +1335,19 @@ az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, co
 	if (!ret_val) ret_val = &tmp_ret;
 
 	/* Hidden return storage argument */
-	if (sig->ret_type && !AZ_TYPE_IS_OBJECT (sig->ret_type) && !AZ_TYPE_IS_PRIMITIVE (sig->ret_type)) {
-		if (!AZ_TYPE_IS_FINAL (sig->ret_type) || !AZ_TYPE_IS_BLOCK (sig->ret_type)) {
-			/* Final values and all non-final types: the first argument is a pointer to the return storage */
-			void *storage = (AZ_TYPE_IS_BLOCK (sig->ret_type)) ? (void *) &ret_val->value.block : (void *) ret_val;
-			if (!AZ_TYPE_IS_BLOCK (sig->ret_type)) {
-				arikkei_return_val_if_fail (AZ_CLASS_FROM_TYPE (sig->ret_type)->instance_size <= AZ_FUNCTION_MAX_RETURN_VALUE_SIZE, 0);
+	if (sig->ret_type) {
+		if (sig->ret_type == AZ_TYPE_COMPLEX_DOUBLE) {
+			/* 16-byte aggregate - returned through a hidden storage pointer by the ABI */
+			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) ret_val)) return 0;
+		} else if (!AZ_TYPE_IS_OBJECT (sig->ret_type) && !AZ_TYPE_IS_PRIMITIVE (sig->ret_type)) {
+			if (!AZ_TYPE_IS_FINAL (sig->ret_type) || !AZ_TYPE_IS_BLOCK (sig->ret_type)) {
+				/* Final values and all non-final types: the first argument is a pointer to the return storage */
+				void *storage = (AZ_TYPE_IS_BLOCK (sig->ret_type)) ? (void *) &ret_val->value.block : (void *) ret_val;
+				if (!AZ_TYPE_IS_BLOCK (sig->ret_type)) {
+					arikkei_return_val_if_fail (AZ_CLASS_FROM_TYPE (sig->ret_type)->instance_size <= AZ_FUNCTION_MAX_RETURN_VALUE_SIZE, 0);
+				}
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) storage)) return 0;
 			}
-			if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uintptr_t) storage)) return 0;
 		}
 	}
 
@@ -875,79 +1357,72 @@ az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, co
 		AZClass *klass = AZ_CLASS_FROM_TYPE (type);
 		if (AZ_TYPE_IS_OBJECT (type)) {
 			/* Objects - [pointer] */
-			if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uintptr_t) arg_vals[i]->block)) return 0;
+			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) arg_vals[i]->block)) return 0;
 		} else if (AZ_TYPE_IS_PRIMITIVE (type)) {
 			/* Primitive types - [value] */
 			switch (type) {
 			case AZ_TYPE_BOOLEAN:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, arg_vals[i]->boolean_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->boolean_v)) return 0;
 				break;
 			case AZ_TYPE_INT8:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uint32_t) (int32_t) arg_vals[i]->int8_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uint32_t) (int32_t) arg_vals[i]->int8_v)) return 0;
 				break;
 			case AZ_TYPE_UINT8:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, arg_vals[i]->uint8_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint8_v)) return 0;
 				break;
 			case AZ_TYPE_INT16:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uint32_t) (int32_t) arg_vals[i]->int16_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uint32_t) (int32_t) arg_vals[i]->int16_v)) return 0;
 				break;
 			case AZ_TYPE_UINT16:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, arg_vals[i]->uint16_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint16_v)) return 0;
 				break;
 			case AZ_TYPE_INT32:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uint32_t) arg_vals[i]->int32_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uint32_t) arg_vals[i]->int32_v)) return 0;
 				break;
 			case AZ_TYPE_UINT32:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, arg_vals[i]->uint32_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint32_v)) return 0;
 				break;
 			case AZ_TYPE_INT64:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) arg_vals[i]->int64_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) arg_vals[i]->int64_v)) return 0;
 				break;
 			case AZ_TYPE_UINT64:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, arg_vals[i]->uint64_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint64_v)) return 0;
 				break;
 			case AZ_TYPE_FLOAT:
-				if (!native_frame_push_fpr32 (&frame, &n_fpr, &stack_bytes, arg_vals[i]->float_v)) return 0;
+				if (!native_frame_push_fpr32 (&frame, &n_slots, &stack_bytes, arg_vals[i]->float_v)) return 0;
 				break;
 			case AZ_TYPE_DOUBLE:
-				if (!native_frame_push_fpr64 (&frame, &n_fpr, &stack_bytes, arg_vals[i]->double_v)) return 0;
+				if (!native_frame_push_fpr64 (&frame, &n_slots, &stack_bytes, arg_vals[i]->double_v)) return 0;
 				break;
-			case AZ_TYPE_COMPLEX_FLOAT:
-				/* Two-float aggregate - both members in a single SSE register or on the stack */
-				if (n_fpr < 8) {
-					memcpy (&frame.fprs[n_fpr++], &arg_vals[i]->cfloat_v, 8);
-				} else {
-					if (!native_frame_push_stack (&frame, &stack_bytes, &arg_vals[i]->cfloat_v, 8)) return 0;
-				}
+			case AZ_TYPE_COMPLEX_FLOAT: {
+				/* 8-byte aggregate - passed by value as if it was an integer */
+				uint64_t u;
+				memcpy (&u, &arg_vals[i]->cfloat_v, 8);
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, u)) return 0;
 				break;
+			}
 			case AZ_TYPE_COMPLEX_DOUBLE:
-				/* Two-double aggregate - members in two consecutive SSE registers or everything on the stack */
-				if (n_fpr + 2 <= 8) {
-					if (!native_frame_push_fpr64 (&frame, &n_fpr, &stack_bytes, arg_vals[i]->cdouble_v.c[0])) return 0;
-					if (!native_frame_push_fpr64 (&frame, &n_fpr, &stack_bytes, arg_vals[i]->cdouble_v.c[1])) return 0;
-				} else {
-					if (!native_frame_push_stack (&frame, &stack_bytes, &arg_vals[i]->cdouble_v, 16)) return 0;
-				}
+				/* 16-byte aggregate - passed by pointer */
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) &arg_vals[i]->cdouble_v)) return 0;
 				break;
 			case AZ_TYPE_POINTER:
-				if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uintptr_t) arg_vals[i]->pointer_v)) return 0;
+				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) arg_vals[i]->pointer_v)) return 0;
 				break;
 			}
 		} else if (AZ_TYPE_IS_FINAL (type)) {
 			/* Final types - [pointer] */
 			uint64_t p = (AZ_TYPE_IS_BLOCK (type)) ? (uint64_t) (uintptr_t) arg_vals[i]->block : (uint64_t) (uintptr_t) arg_vals[i];
-			if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, p)) return 0;
+			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, p)) return 0;
 		} else {
 			/* Non-final types - [impl, pointer] */
 			const AZImplementation *impl = arg_impls[i];
 			if (!impl) impl = &klass->impl;
-			if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uintptr_t) impl)) return 0;
-			if (!native_frame_push_gpr (&frame, &n_gpr, &stack_bytes, (uint64_t) (uintptr_t) az_value_get_inst (impl, arg_vals[i]))) return 0;
+			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) impl)) return 0;
+			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) az_value_get_inst (impl, arg_vals[i]))) return 0;
 		}
 	}
 
-	frame.n_fpr = n_fpr;
-	az_native_call_frame_sysv64 (func, &frame, stack_bytes, &result);
+	az_native_call_frame_win64 (func, &frame, stack_bytes, &result);
 
 	if (!sig->ret_type) {
 		if (ret_impl) *ret_impl = NULL;
@@ -992,24 +1467,23 @@ az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, co
 			ret_val->value.uint64_v = result.gpr;
 			break;
 		case AZ_TYPE_FLOAT: {
-			uint32_t u = (uint32_t) result.fprs[0];
+			uint32_t u = (uint32_t) result.fpr;
 			memcpy (&ret_val->value.float_v, &u, 4);
 			break;
 		}
 		case AZ_TYPE_DOUBLE:
-			memcpy (&ret_val->value.double_v, &result.fprs[0], 8);
+			memcpy (&ret_val->value.double_v, &result.fpr, 8);
 			break;
 		case AZ_TYPE_COMPLEX_FLOAT: {
-			/* Two-float aggregate - returned in a single SSE register (r in the low dword, i in the high) */
-			uint32_t r = (uint32_t) result.fprs[0];
-			uint32_t j = (uint32_t) (result.fprs[0] >> 32);
+			/* 8-byte aggregate - returned in rax (r in the low dword, i in the high) */
+			uint32_t r = (uint32_t) result.gpr;
+			uint32_t j = (uint32_t) (result.gpr >> 32);
 			memcpy (&ret_val->value.cfloat_v.c[0], &r, 4);
 			memcpy (&ret_val->value.cfloat_v.c[1], &j, 4);
 			break;
 		}
 		case AZ_TYPE_COMPLEX_DOUBLE:
-			memcpy (&ret_val->value.cdouble_v.c[0], &result.fprs[0], 8);
-			memcpy (&ret_val->value.cdouble_v.c[1], &result.fprs[1], 8);
+			/* 16-byte aggregate - written to the hidden storage */
 			break;
 		case AZ_TYPE_POINTER:
 			ret_val->value.pointer_v = (void *) (uintptr_t) result.gpr;
@@ -1026,116 +1500,136 @@ az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, co
 	return 1;
 }
 
-#elif defined(AZ_NATIVE_CALL_WIN64)
-
-/*
- * Windows x64 (Microsoft x64 calling convention) native call
- *
- * The C code marshals the arguments into an AZNativeCallFrame (4 general purpose
- * registers, 4 FP registers and the stack overflow area) and the MASM trampoline
- * loads the registers, copies the stack area and performs the call. Integer and
- * floating point arguments share the same four argument slots - the register used
- * (rcx/rdx/r8/r9 or xmm0-xmm3) depends on the position and type of the argument.
- * Aggregates of 1, 2, 4 or 8 bytes (complex float) are passed and returned by value
- * as if they were integers, larger aggregates (complex double) are passed by pointer
- * and returned through a hidden storage pointer (the first argument). After the call
- * the trampoline stores rax and xmm0 into the result buffer - this covers all return
- * types of the native calling rules (integers, pointers, floats, doubles and 8-byte
- * aggregates).
- */
-
-#include <stddef.h>
-
-#define AZ_NATIVE_CALL_MAX_STACK 1024
+#endif
 
-typedef struct {
-	uint64_t gprs[4];
-	uint64_t fprs[4];
-	uint64_t stack[AZ_NATIVE_CALL_MAX_STACK / 8];
-} AZNativeCallFrame;
+#ifdef NATIVE_CALL_TRAMPOLINE
 
 typedef struct {
-	uint64_t gpr;
-	uint64_t fpr;
-} AZNativeCallResult;
-
-/* The trampoline expects the stack area at offset 64 (4 gprs + 4 fprs) */
-_Static_assert (offsetof (AZNativeCallFrame, stack) == 64, "AZNativeCallFrame stack offset has to be 64");
+	AZNativeCallPlan *plan;
+	unsigned int n_gpr;
+	unsigned int n_fpr;
+	unsigned int stack_bytes;
+} NativePlanBuilder;
 
-extern void az_native_call_frame_win64 (void (*func) (void), const AZNativeCallFrame *frame, uint64_t stack_bytes, AZNativeCallResult *result);
+static void
+native_plan_add_move (NativePlanBuilder *b, unsigned int kind, unsigned int arg, unsigned int src_offset, unsigned int dst_offset, const AZImplementation *impl)
+{
+	AZNativeCallMove *move = &b->plan->moves[b->plan->n_moves++];
+	move->kind = kind;
+	move->src_offset = src_offset;
+	move->arg = arg;
+	move->dst_offset = dst_offset;
+	move->impl = impl;
+}
 
 static unsigned int
-native_frame_push_gpr (AZNativeCallFrame *frame, unsigned int *n_slots, unsigned int *stack_bytes, uint64_t val)
+native_plan_push_stack (NativePlanBuilder *b, unsigned int kind, unsigned int arg, unsigned int src_offset, const AZImplementation *impl)
 {
-	if (*n_slots < 4) {
-		frame->gprs[(*n_slots)++] = val;
-	} else {
-		if (*stack_bytes + 8 > AZ_NATIVE_CALL_MAX_STACK) return 0;
-		frame->stack[*stack_bytes / 8] = val;
-		*stack_bytes += 8;
-	}
+	if (b->stack_bytes + 8 > AZ_NATIVE_CALL_MAX_STACK) return 0;
+	native_plan_add_move (b, kind, arg, src_offset, offsetof (AZNativeCallFrame, stack) + b->stack_bytes, impl);
+	b->stack_bytes += 8;
 	return 1;
 }
 
 static unsigned int
-native_frame_push_fpr32 (AZNativeCallFrame *frame, unsigned int *n_slots, unsigned int *stack_bytes, float val)
+native_plan_push_gpr (NativePlanBuilder *b, unsigned int kind, unsigned int arg, unsigned int src_offset, const AZImplementation *impl)
 {
-	if (*n_slots < 4) {
-		uint32_t u;
-		memcpy (&u, &val, 4);
-		frame->fprs[(*n_slots)++] = u;
-	} else {
-		if (*stack_bytes + 8 > AZ_NATIVE_CALL_MAX_STACK) return 0;
-		memset ((uint8_t *) frame->stack + *stack_bytes, 0, 8);
-		memcpy ((uint8_t *) frame->stack + *stack_bytes, &val, 4);
-		*stack_bytes += 8;
-	}
+	if (b->n_gpr >= NATIVE_CALL_N_GPR) return native_plan_push_stack (b, kind, arg, src_offset, impl);
+	native_plan_add_move (b, kind, arg, src_offset, offsetof (AZNativeCallFrame, gprs) + 8 * b->n_gpr++, impl);
 	return 1;
 }
 
 static unsigned int
-native_frame_push_fpr64 (AZNativeCallFrame *frame, unsigned int *n_slots, unsigned int *stack_bytes, double val)
+native_plan_push_fpr (NativePlanBuilder *b, unsigned int kind, unsigned int arg, unsigned int src_offset)
 {
-	if (*n_slots < 4) {
-		memcpy (&frame->fprs[(*n_slots)++], &val, 8);
-	} else {
-		if (*stack_bytes + 8 > AZ_NATIVE_CALL_MAX_STACK) return 0;
-		memcpy ((uint8_t *) frame->stack + *stack_bytes, &val, 8);
-		*stack_bytes += 8;
-	}
+	if (b->n_fpr >= NATIVE_CALL_N_FPR) return native_plan_push_stack (b, kind, arg, src_offset, NULL);
+	native_plan_add_move (b, kind, arg, src_offset, offsetof (AZNativeCallFrame, fprs) + 8 * b->n_fpr++, NULL);
 	return 1;
 }
 
-unsigned int
-az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[])
+static void
+native_plan_add_ret_copy (AZNativeCallPlan *plan, unsigned int src_offset, unsigned int dst_offset, unsigned int size)
 {
-	AZNativeCallFrame frame;
-	AZNativeCallResult result;
-	AZValue64 tmp_ret;
-	unsigned int n_slots = 0, stack_bytes = 0;
-	unsigned int i, rtype;
-	AZClass *rklass;
-
-	arikkei_return_val_if_fail (func != NULL, 0);
-	arikkei_return_val_if_fail (sig != NULL, 0);
-	arikkei_return_val_if_fail (sig->n_args < 64, 0);
-
-	if (!ret_val) ret_val = &tmp_ret;
+	plan->ret_copies[plan->n_ret_copies].src_offset = src_offset;
+	plan->ret_copies[plan->n_ret_copies].dst_offset = dst_offset;
+	plan->ret_copies[plan->n_ret_copies].size = size;
+	plan->n_ret_copies += 1;
+}
 
-	/* Hidden return storage argument */
-	if (sig->ret_type) {
-		if (sig->ret_type == AZ_TYPE_COMPLEX_DOUBLE) {
-			/* 16-byte aggregate - returned through a hidden storage pointer by the ABI */
-			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) ret_val)) return 0;
-		} else if (!AZ_TYPE_IS_OBJECT (sig->ret_type) && !AZ_TYPE_IS_PRIMITIVE (sig->ret_type)) {
-			if (!AZ_TYPE_IS_FINAL (sig->ret_type) || !AZ_TYPE_IS_BLOCK (sig->ret_type)) {
-				/* Final values and all non-final types: the first argument is a pointer to the return storage */
-				void *storage = (AZ_TYPE_IS_BLOCK (sig->ret_type)) ? (void *) &ret_val->value.block : (void *) ret_val;
-				if (!AZ_TYPE_IS_BLOCK (sig->ret_type)) {
-					arikkei_return_val_if_fail (AZ_CLASS_FROM_TYPE (sig->ret_type)->instance_size <= AZ_FUNCTION_MAX_RETURN_VALUE_SIZE, 0);
-				}
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) storage)) return 0;
+/* The plan has to have space for NATIVE_CALL_PLAN_SIZE(sig->n_args) bytes */
+static unsigned int
+native_plan_build (AZNativeCallPlan *plan, const AZFunctionSignature *sig)
+{
+	NativePlanBuilder b = {plan, 0, 0, 0};
+	unsigned int i, rtype = sig->ret_type;
+
+	plan->n_args = sig->n_args;
+	plan->n_moves = 0;
+	plan->n_ret_copies = 0;
+	plan->ret_mode = NATIVE_RETURN_NONE;
+	plan->ret_impl = (rtype) ? &AZ_CLASS_FROM_TYPE (rtype)->impl : NULL;
+
+	/* Return value and hidden return storage argument */
+	if (!rtype) {
+		/* Void */
+	} else if (AZ_TYPE_IS_OBJECT (rtype)) {
+		/* Objects - returned by pointer */
+		plan->ret_mode = NATIVE_RETURN_OBJECT;
+		native_plan_add_ret_copy (plan, offsetof (AZNativeCallResult, gpr), offsetof (AZValue64, value.block), 8);
+	} else if (AZ_TYPE_IS_PRIMITIVE (rtype)) {
+		/* Primitives - returned by value */
+		plan->ret_mode = NATIVE_RETURN_FIXED;
+		switch (rtype) {
+		case AZ_TYPE_INT8:
+		case AZ_TYPE_UINT8:
+			native_plan_add_ret_copy (plan, offsetof (AZNativeCallResult, gpr), 0, 1);
+			break;
+		case AZ_TYPE_INT16:
+		case AZ_TYPE_UINT16:
+			native_plan_add_ret_copy (plan, offsetof (AZNativeCallResult, gpr), 0, 2);
+			break;
+		case AZ_TYPE_BOOLEAN:
+		case AZ_TYPE_INT32:
+		case AZ_TYPE_UINT32:
+			native_plan_add_ret_copy (plan, offsetof (AZNativeCallResult, gpr), 0, 4);
+			break;
+		case AZ_TYPE_INT64:
+		case AZ_TYPE_UINT64:
+		case AZ_TYPE_POINTER:
+			native_plan_add_ret_copy (plan, offsetof (AZNativeCallResult, gpr), 0, 8);
+			break;
+		case AZ_TYPE_FLOAT:
+			native_plan_add_ret_copy (plan, NATIVE_CALL_RESULT_FPR (0), 0, 4);
+			break;
+		case AZ_TYPE_DOUBLE:
+			native_plan_add_ret_copy (plan, NATIVE_CALL_RESULT_FPR (0), 0, 8);
+			break;
+		case AZ_TYPE_COMPLEX_FLOAT:
+			/* Two-float aggregate - returned in a single SSE register */
+			native_plan_add_ret_copy (plan, NATIVE_CALL_RESULT_FPR (0), 0, 8);
+			break;
+		case AZ_TYPE_COMPLEX_DOUBLE:
+			/* Two-double aggregate - returned in two SSE registers */
+			native_plan_add_ret_copy (plan, NATIVE_CALL_RESULT_FPR (0), 0, 8);
+			native_plan_add_ret_copy (plan, NATIVE_CALL_RESULT_FPR (1), 8, 8);
+			break;
+		}
+	} else {
+		if (!AZ_TYPE_IS_BLOCK (rtype)) {
+			arikkei_return_val_if_fail (AZ_CLASS_FROM_TYPE (rtype)->instance_size <= AZ_FUNCTION_MAX_RETURN_VALUE_SIZE, 0);
+		}
+		if (AZ_TYPE_IS_FINAL (rtype)) {
+			/* Final blocks - returned by pointer, final values are written to the hidden storage */
+			plan->ret_mode = NATIVE_RETURN_FIXED;
+			if (AZ_TYPE_IS_BLOCK (rtype)) {
+				native_plan_add_ret_copy (plan, offsetof (AZNativeCallResult, gpr), offsetof (AZValue64, value.block), 8);
+			} else {
+				if (!native_plan_push_gpr (&b, NATIVE_MOVE_RET_STORAGE, 0, 0, NULL)) return 0;
 			}
+		} else {
+			/* Non-final types - implementation returned, value is written to the hidden storage */
+			plan->ret_mode = NATIVE_RETURN_IMPL;
+			if (!native_plan_push_gpr (&b, NATIVE_MOVE_RET_STORAGE, 0, 0, NULL)) return 0;
 		}
 	}
 
@@ -1143,158 +1637,356 @@ az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, co
 	for (i = 0; i < sig->n_args; i++) {
 		unsigned int type = sig->arg_types[i];
 		AZClass *klass = AZ_CLASS_FROM_TYPE (type);
+		unsigned int result = 1;
 		if (AZ_TYPE_IS_OBJECT (type)) {
 			/* Objects - [pointer] */
-			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) arg_vals[i]->block)) return 0;
+			result = native_plan_push_gpr (&b, NATIVE_MOVE_64, i, 0, NULL);
 		} else if (AZ_TYPE_IS_PRIMITIVE (type)) {
 			/* Primitive types - [value] */
 			switch (type) {
-			case AZ_TYPE_BOOLEAN:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->boolean_v)) return 0;
-				break;
 			case AZ_TYPE_INT8:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uint32_t) (int32_t) arg_vals[i]->int8_v)) return 0;
+				result = native_plan_push_gpr (&b, NATIVE_MOVE_SX8, i, 0, NULL);
 				break;
 			case AZ_TYPE_UINT8:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint8_v)) return 0;
+				result = native_plan_push_gpr (&b, NATIVE_MOVE_ZX8, i, 0, NULL);
 				break;
 			case AZ_TYPE_INT16:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uint32_t) (int32_t) arg_vals[i]->int16_v)) return 0;
+				result = native_plan_push_gpr (&b, NATIVE_MOVE_SX16, i, 0, NULL);
 				break;
 			case AZ_TYPE_UINT16:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint16_v)) return 0;
+				result = native_plan_push_gpr (&b, NATIVE_MOVE_ZX16, i, 0, NULL);
 				break;
+			case AZ_TYPE_BOOLEAN:
 			case AZ_TYPE_INT32:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uint32_t) arg_vals[i]->int32_v)) return 0;
-				break;
 			case AZ_TYPE_UINT32:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint32_v)) return 0;
+				result = native_plan_push_gpr (&b, NATIVE_MOVE_ZX32, i, 0, NULL);
 				break;
 			case AZ_TYPE_INT64:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) arg_vals[i]->int64_v)) return 0;
-				break;
 			case AZ_TYPE_UINT64:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, arg_vals[i]->uint64_v)) return 0;
+			case AZ_TYPE_POINTER:
+				result = native_plan_push_gpr (&b, NATIVE_MOVE_64, i, 0, NULL);
 				break;
 			case AZ_TYPE_FLOAT:
-				if (!native_frame_push_fpr32 (&frame, &n_slots, &stack_bytes, arg_vals[i]->float_v)) return 0;
+				result = native_plan_push_fpr (&b, NATIVE_MOVE_ZX32, i, 0);
 				break;
 			case AZ_TYPE_DOUBLE:
-				if (!native_frame_push_fpr64 (&frame, &n_slots, &stack_bytes, arg_vals[i]->double_v)) return 0;
+				result = native_plan_push_fpr (&b, NATIVE_MOVE_64, i, 0);
 				break;
-			case AZ_TYPE_COMPLEX_FLOAT: {
-				/* 8-byte aggregate - passed by value as if it was an integer */
-				uint64_t u;
-				memcpy (&u, &arg_vals[i]->cfloat_v, 8);
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, u)) return 0;
+			case AZ_TYPE_COMPLEX_FLOAT:
+				/* Two-float aggregate - both members in a single SSE register or on the stack */
+				result = native_plan_push_fpr (&b, NATIVE_MOVE_64, i, 0);
 				break;
-			}
 			case AZ_TYPE_COMPLEX_DOUBLE:
-				/* 16-byte aggregate - passed by pointer */
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) &arg_vals[i]->cdouble_v)) return 0;
-				break;
-			case AZ_TYPE_POINTER:
-				if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) arg_vals[i]->pointer_v)) return 0;
+				/* Two-double aggregate - either both members in registers or everything on the stack */
+				if (b.n_fpr + 2 <= NATIVE_CALL_N_FPR) {
+					result = native_plan_push_fpr (&b, NATIVE_MOVE_64, i, 0) && native_plan_push_fpr (&b, NATIVE_MOVE_64, i, 8);
+				} else {
+					result = native_plan_push_stack (&b, NATIVE_MOVE_64, i, 0, NULL) && native_plan_push_stack (&b, NATIVE_MOVE_64, i, 8, NULL);
+				}
 				break;
 			}
 		} else if (AZ_TYPE_IS_FINAL (type)) {
 			/* Final types - [pointer] */
-			uint64_t p = (AZ_TYPE_IS_BLOCK (type)) ? (uint64_t) (uintptr_t) arg_vals[i]->block : (uint64_t) (uintptr_t) arg_vals[i];
-			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, p)) return 0;
+			result = native_plan_push_gpr (&b, (AZ_TYPE_IS_BLOCK (type)) ? NATIVE_MOVE_64 : NATIVE_MOVE_VALUE_PTR, i, 0, NULL);
 		} else {
 			/* Non-final types - [impl, pointer] */
-			const AZImplementation *impl = arg_impls[i];
-			if (!impl) impl = &klass->impl;
-			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) impl)) return 0;
-			if (!native_frame_push_gpr (&frame, &n_slots, &stack_bytes, (uint64_t) (uintptr_t) az_value_get_inst (impl, arg_vals[i]))) return 0;
+			result = native_plan_push_gpr (&b, NATIVE_MOVE_IMPL, i, 0, &klass->impl) && native_plan_push_gpr (&b, NATIVE_MOVE_INST, i, 0, &klass->impl);
 		}
+		if (!result) return 0;
 	}
+	plan->stack_bytes = b.stack_bytes;
+	plan->n_fpr = b.n_fpr;
+	return 1;
+}
 
-	az_native_call_frame_win64 (func, &frame, stack_bytes, &result);
+AZNativeCallPlan *
+az_native_call_plan_new (const AZFunctionSignature *sig)
+{
+	arikkei_return_val_if_fail (sig != NULL, NULL);
+	arikkei_return_val_if_fail (sig->n_args < 64, NULL);
+	AZNativeCallPlan *plan = (AZNativeCallPlan *) malloc (NATIVE_CALL_PLAN_SIZE (sig->n_args));
+	if (!native_plan_build (plan, sig)) {
+		free (plan);
+		return NULL;
+	}
+	return plan;
+}
 
-	if (!sig->ret_type) {
-		if (ret_impl) *ret_impl = NULL;
-		return 1;
+/* Converts argument to 64-bit slot (all moves except the return storage) */
+static inline uint64_t
+native_move_value (const AZNativeCallMove *move, const AZImplementation *impl, const AZValue *val)
+{
+	const uint8_t *src;
+	uint64_t v = 0;
+	switch (move->kind) {
+	case NATIVE_MOVE_SX8:
+		v = (uint32_t) (int32_t) val->int8_v;
+		break;
+	case NATIVE_MOVE_SX16:
+		v = (uint32_t) (int32_t) val->int16_v;
+		break;
+	case NATIVE_MOVE_ZX8:
+		v = val->uint8_v;
+		break;
+	case NATIVE_MOVE_ZX16:
+		v = val->uint16_v;
+		break;
+	case NATIVE_MOVE_ZX32: {
+		uint32_t u;
+		src = (const uint8_t *) val + move->src_offset;
+		memcpy (&u, src, 4);
+		v = u;
+		break;
 	}
-	rtype = sig->ret_type;
-	rklass = AZ_CLASS_FROM_TYPE (rtype);
-	if (AZ_TYPE_IS_OBJECT (rtype)) {
-		/* Objects - returned by pointer */
-		AZObject *obj = (AZObject *) (uintptr_t) result.gpr;
-		ret_val->value.block = obj;
-		if (ret_impl) *ret_impl = (obj) ? (const AZImplementation *) obj->klass : &rklass->impl;
-	} else if (AZ_TYPE_IS_PRIMITIVE (rtype)) {
-		/* Primitives - returned by value */
-		if (ret_impl) *ret_impl = &rklass->impl;
-		switch (rtype) {
-		case AZ_TYPE_BOOLEAN:
-			ret_val->value.boolean_v = (uint32_t) result.gpr;
-			break;
-		case AZ_TYPE_INT8:
-			ret_val->value.int8_v = (int8_t) result.gpr;
-			break;
-		case AZ_TYPE_UINT8:
-			ret_val->value.uint8_v = (uint8_t) result.gpr;
-			break;
-		case AZ_TYPE_INT16:
-			ret_val->value.int16_v = (int16_t) result.gpr;
-			break;
-		case AZ_TYPE_UINT16:
-			ret_val->value.uint16_v = (uint16_t) result.gpr;
-			break;
-		case AZ_TYPE_INT32:
-			ret_val->value.int32_v = (int32_t) result.gpr;
-			break;
-		case AZ_TYPE_UINT32:
-			ret_val->value.uint32_v = (uint32_t) result.gpr;
-			break;
-		case AZ_TYPE_INT64:
-			ret_val->value.int64_v = (int64_t) result.gpr;
+	case NATIVE_MOVE_64:
+		src = (const uint8_t *) val + move->src_offset;
+		memcpy (&v, src, 8);
+		break;
+	case NATIVE_MOVE_VALUE_PTR:
+		v = (uint64_t) (uintptr_t) val;
+		break;
+	case NATIVE_MOVE_IMPL:
+		if (!impl) impl = move->impl;
+		v = (uint64_t) (uintptr_t) impl;
+		break;
+	case NATIVE_MOVE_INST:
+		if (!impl) impl = move->impl;
+		v = (uint64_t) (uintptr_t) az_value_get_inst (impl, val);
+		break;
+	}
+	return v;
+}
+
+static inline void
+native_plan_return (const AZNativeCallPlan *plan, const AZNativeCallResult *result, const AZImplementation **ret_impl, AZValue64 *ret_val)
+{
+	unsigned int i;
+	for (i = 0; i < plan->n_ret_copies; i++) {
+		memcpy ((uint8_t *) ret_val + plan->ret_copies[i].dst_offset, (const uint8_t *) result + plan->ret_copies[i].src_offset, plan->ret_copies[i].size);
+	}
+	if (ret_impl) {
+		switch (plan->ret_mode) {
+		case NATIVE_RETURN_NONE:
+			*ret_impl = NULL;
 			break;
-		case AZ_TYPE_UINT64:
-			ret_val->value.uint64_v = result.gpr;
+		case NATIVE_RETURN_FIXED:
+			*ret_impl = plan->ret_impl;
 			break;
-		case AZ_TYPE_FLOAT: {
-			uint32_t u = (uint32_t) result.fpr;
-			memcpy (&ret_val->value.float_v, &u, 4);
+		case NATIVE_RETURN_OBJECT: {
+			AZObject *obj = (AZObject *) ret_val->value.block;
+			*ret_impl = (obj) ? (const AZImplementation *) obj->klass : plan->ret_impl;
 			break;
 		}
-		case AZ_TYPE_DOUBLE:
-			memcpy (&ret_val->value.double_v, &result.fpr, 8);
-			break;
-		case AZ_TYPE_COMPLEX_FLOAT: {
-			/* 8-byte aggregate - returned in rax (r in the low dword, i in the high) */
-			uint32_t r = (uint32_t) result.gpr;
-			uint32_t j = (uint32_t) (result.gpr >> 32);
-			memcpy (&ret_val->value.cfloat_v.c[0], &r, 4);
-			memcpy (&ret_val->value.cfloat_v.c[1], &j, 4);
+		case NATIVE_RETURN_IMPL:
+			*ret_impl = (const AZImplementation *) (uintptr_t) result->gpr;
 			break;
 		}
-		case AZ_TYPE_COMPLEX_DOUBLE:
-			/* 16-byte aggregate - written to the hidden storage */
-			break;
-		case AZ_TYPE_POINTER:
-			ret_val->value.pointer_v = (void *) (uintptr_t) result.gpr;
-			break;
+	}
+}
+
+static inline unsigned int
+native_plan_execute (void (*func) (void), const AZNativeCallPlan *plan, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[])
+{
+	AZNativeCallFrame frame;
+	AZNativeCallResult result;
+	AZValue64 tmp_ret;
+	unsigned int i;
+
+	if (!ret_val) ret_val = &tmp_ret;
+
+	for (i = 0; i < plan->n_moves; i++) {
+		const AZNativeCallMove *move = &plan->moves[i];
+		uint64_t v;
+		if (move->kind == NATIVE_MOVE_RET_STORAGE) {
+			v = (uint64_t) (uintptr_t) ret_val;
+		} else {
+			v = native_move_value (move, arg_impls[move->arg], arg_vals[move->arg]);
 		}
-	} else if (AZ_TYPE_IS_FINAL (rtype)) {
-		/* Final blocks - returned by pointer, final values were written to the hidden storage */
-		if (ret_impl) *ret_impl = &rklass->impl;
-		if (AZ_TYPE_IS_BLOCK (rtype)) ret_val->value.block = (void *) (uintptr_t) result.gpr;
-	} else {
-		/* Non-final types - implementation returned, value was written to the hidden storage */
-		if (ret_impl) *ret_impl = (const AZImplementation *) (uintptr_t) result.gpr;
+		memcpy ((uint8_t *) &frame + move->dst_offset, &v, 8);
 	}
+	frame.n_fpr = plan->n_fpr;
+
+	NATIVE_CALL_TRAMPOLINE (func, &frame, plan->stack_bytes, &result);
+
+	native_plan_return (plan, &result, ret_impl, ret_val);
 	return 1;
 }
 
+unsigned int
+az_function_call_native_plan_rows (void (*func) (void), const AZNativeCallPlan *plan, const AZFunctionSignature *sig, const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col)
+{
+	AZNativeCallFrame frame;
+	AZNativeCallResult result;
+	AZValue64 ret_val;
+	const AZImplementation *ret_impl;
+	/* Plan has at most 2 * 63 moves */
+	uint8_t row_moves[128];
+	unsigned int n_row_moves = 0;
+	unsigned int i, j;
+
+	/* Implementations and the return storage are the same for all rows */
+	for (j = 0; j < plan->n_moves; j++) {
+		const AZNativeCallMove *move = &plan->moves[j];
+		uint64_t v;
+		if (move->kind == NATIVE_MOVE_RET_STORAGE) {
+			v = (uint64_t) (uintptr_t) &ret_val;
+		} else if (move->kind == NATIVE_MOVE_IMPL) {
+			v = native_move_value (move, arg_impls[move->arg], NULL);
+		} else {
+			row_moves[n_row_moves++] = (uint8_t) j;
+			continue;
+		}
+		memcpy ((uint8_t *) &frame + move->dst_offset, &v, 8);
+	}
+	frame.n_fpr = plan->n_fpr;
+
+	for (i = 0; i < n_rows; i++) {
+		for (j = 0; j < n_row_moves; j++) {
+			const AZNativeCallMove *move = &plan->moves[row_moves[j]];
+			uint64_t v = native_move_value (move, arg_impls[move->arg], arg_cols[move->arg] + i);
+			memcpy ((uint8_t *) &frame + move->dst_offset, &v, 8);
+		}
+		NATIVE_CALL_TRAMPOLINE (func, &frame, plan->stack_bytes, &result);
+		ret_impl = NULL;
+		native_plan_return (plan, &result, &ret_impl, &ret_val);
+		if (!function_row_store (ret_impl, &ret_val, i, ret_impls, ret_col)) break;
+	}
+	if (i == n_rows) return 1;
+	function_rows_release (sig, i, ret_impls, ret_col);
+	return 0;
+}
+
+unsigned int
+az_function_call_native_plan (void (*func) (void), const AZNativeCallPlan *plan, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[])
+{
+#ifdef AZ_SAFETY_CHECKS
+	arikkei_return_val_if_fail (func != NULL, 0);
+	arikkei_return_val_if_fail (plan != NULL, 0);
+#endif
+	return native_plan_execute (func, plan, ret_impl, ret_val, arg_impls, arg_vals);
+}
+
+unsigned int
+az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[])
+{
+	const AZNativeCallPlan *plan;
+	arikkei_return_val_if_fail (func != NULL, 0);
+	arikkei_return_val_if_fail (sig != NULL, 0);
+	arikkei_return_val_if_fail (sig->n_args < 64, 0);
+	/* Plans are cached per signature, so repeated calls only marshal arguments */
+	plan = az_native_call_plan_get (sig);
+	if (!plan) return 0;
+	return native_plan_execute (func, plan, ret_impl, ret_val, arg_impls, arg_vals);
+}
+
 #else
 
+AZNativeCallPlan *
+az_native_call_plan_new (const AZFunctionSignature *sig)
+{
+	return NULL;
+}
+
+unsigned int
+az_function_call_native_plan (void (*func) (void), const AZNativeCallPlan *plan, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[])
+{
+	fprintf (stderr, "az_function_call_native_plan is not implemented for this architecture\n");
+	return 0;
+}
+
+unsigned int
+az_function_call_native_plan_rows (void (*func) (void), const AZNativeCallPlan *plan, const AZFunctionSignature *sig, const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col)
+{
+	fprintf (stderr, "az_function_call_native_plan_rows is not implemented for this architecture\n");
+	return 0;
+}
+
+#ifndef NATIVE_CALL_DIRECT
 unsigned int
 az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[])
 {
 	fprintf (stderr, "az_function_call_native is not implemented for this architecture\n");
 	return 0;
 }
+#endif
 
 #endif
+
+void
+az_native_call_plan_delete (AZNativeCallPlan *plan)
+{
+	free (plan);
+}
+
+/*
+ * Shared plans, keyed by signature content
+ *
+ * Entries are linked to lock-free chains by content hash and never freed, so lookups do not
+ * need lock. New entries are added under lock after checking the chain again.
+ */
+
+typedef struct _NativePlanEntry NativePlanEntry;
+
+struct _NativePlanEntry {
+	/* Next entry in the same hash chain */
+	_Atomic (NativePlanEntry *) next;
+	uint32_t hash;
+	/* NULL if the signature can not be called natively */
+	AZNativeCallPlan *plan;
+	AZFunctionSignature sig;
+};
+
+/* Number of hash chains of shared plans (2^8) */
+#define NATIVE_PLAN_CHAINS_BITS 8
+
+static _Atomic (NativePlanEntry *) native_plan_chains[1 << NATIVE_PLAN_CHAINS_BITS];
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+static mtx_t native_plans_mutex;
+#define NATIVE_PLANS_LOCK() mtx_lock (&native_plans_mutex)
+#define NATIVE_PLANS_UNLOCK() mtx_unlock (&native_plans_mutex)
+#else
+#define NATIVE_PLANS_LOCK()
+#define NATIVE_PLANS_UNLOCK()
+#endif
+
+static void
+native_plans_init (void)
+{
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	mtx_init (&native_plans_mutex, mtx_plain);
+#endif
+}
+
+static NativePlanEntry *
+native_plan_lookup (_Atomic (NativePlanEntry *) *chain, const AZFunctionSignature *sig, uint32_t hash)
+{
+	NativePlanEntry *entry = atomic_load_explicit (chain, memory_order_acquire);
+	while (entry) {
+		if ((entry->hash == hash) && (entry->sig.n_args == sig->n_args) && !memcmp (&entry->sig, sig, SIGNATURE_SIZE (sig))) return entry;
+		entry = atomic_load_explicit (&entry->next, memory_order_acquire);
+	}
+	return NULL;
+}
+
+const AZNativeCallPlan *
+az_native_call_plan_get (const AZFunctionSignature *sig)
+{
+	arikkei_return_val_if_fail (sig != NULL, NULL);
+	arikkei_return_val_if_fail (sig->n_args < 64, NULL);
+	uint32_t hash = arikkei_memory_hash (sig, SIGNATURE_SIZE (sig));
+	_Atomic (NativePlanEntry *) *chain = &native_plan_chains[hash & ((1 << NATIVE_PLAN_CHAINS_BITS) - 1)];
+	NativePlanEntry *entry = native_plan_lookup (chain, sig, hash);
+	if (entry) return entry->plan;
+	NATIVE_PLANS_LOCK ();
+	entry = native_plan_lookup (chain, sig, hash);
+	if (!entry) {
+		entry = (NativePlanEntry *) malloc (sizeof (NativePlanEntry) - 4 + 4 * sig->n_args);
+		entry->hash = hash;
+		memcpy (&entry->sig, sig, SIGNATURE_SIZE (sig));
+		entry->plan = az_native_call_plan_new (sig);
+		atomic_init (&entry->next, atomic_load_explicit (chain, memory_order_relaxed));
+		atomic_store_explicit (chain, entry, memory_order_release);
+	}
+	NATIVE_PLANS_UNLOCK ();
+	return entry->plan;
+}
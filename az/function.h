@@ -13,6 +13,8 @@ typedef struct _AZFunctionSignature AZFunctionSignature;
 typedef struct _AZFunctionSignature32 AZFunctionSignature32;
 
 typedef struct _AZFunctionImplementation AZFunctionImplementation;
+typedef struct _AZNativeCallPlan AZNativeCallPlan;
+typedef struct _AZFunctionFrame AZFunctionFrame;
 
 #include <az/interface.h>
 
@@ -48,6 +50,19 @@ struct _AZFunctionSignature32 {
 AZFunctionSignature* az_function_signature_new (unsigned int this_type, unsigned int ret_type, unsigned int n_args, const unsigned int arg_types[]);
 AZFunctionSignature* az_function_signature_new_any(unsigned int this_type, unsigned int ret_type, unsigned int n_args);
 AZFunctionSignature *az_function_signature_new_va (unsigned int ret_type, unsigned int n_args, ...);
+/*
+ * Interned signatures
+ *
+ * Identical signatures share a single immutable instance that lives until the program exits, so they can
+ * be compared by pointer. Interned signatures must not be deleted.
+ * The results of az_function_signature_is_assignable_to are cached for pairs of interned signatures,
+ * so repeated tests between these are cheap.
+ */
+const AZFunctionSignature *az_function_signature_intern (const AZFunctionSignature *sig);
+const AZFunctionSignature *az_function_signature_get (unsigned int this_type, unsigned int ret_type, unsigned int n_args, const unsigned int arg_types[]);
+const AZFunctionSignature *az_function_signature_get_va (unsigned int ret_type, unsigned int n_args, ...);
+unsigned int az_function_signature_is_interned (const AZFunctionSignature *sig);
+
 /* Strict compatibility check, i.e. only subclass types accepted */
 unsigned int az_function_signature_is_assignable_to (const AZFunctionSignature *sig, const AZFunctionSignature *other, unsigned int test_ret_val);
 
@@ -70,6 +85,12 @@ struct _AZFunctionImplementation {
 	 * 
 	 */
 	unsigned int (*invoke) (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx);
+	/**
+	 * @brief Invoke function over argument columns (optional)
+	 *
+	 * See az_function_invoke_batch, if NULL the scalar invoke is called for each row
+	 */
+	unsigned int (*invoke_batch) (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col, AZContext *ctx);
 };
 
 const AZFunctionSignature *az_function_get_signature (const AZFunctionImplementation *impl, void *inst);
@@ -80,6 +101,81 @@ const AZFunctionSignature *az_function_get_signature (const AZFunctionImplementa
 unsigned int az_function_invoke (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx);
 unsigned int az_function_convert_args_in_place (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], AZValue *arg_vals[]);
 
+/** @ingroup function
+ * @brief Caller-owned argument frame
+ *
+ * A frame holds argument implementations and value pointers of a single call site, so invoking
+ * through it does not need temporary arrays and the argument types are validated only once,
+ * either on the first invocation or never if the caller sets AZ_FUNCTION_FRAME_VALIDATED together
+ * with the signature.
+ * The validated state is tied to the signature it was validated against, invoking a function with
+ * a different signature (pointer) validates the frame again.
+ * Replacing an argument implementation by a different one resets the validated state.
+ * The frame memory (AZ_FUNCTION_FRAME_SIZE bytes) can be on stack or embedded in other structures.
+ */
+#define AZ_FUNCTION_FRAME_VALIDATED 1
+
+struct _AZFunctionFrame {
+	uint32_t n_args;
+	uint32_t flags;
+	/* The signature frame was validated against */
+	const AZFunctionSignature *signature;
+	/* n_args implementations followed by n_args value pointers */
+	const void *slots[1];
+};
+
+#define AZ_FUNCTION_FRAME_SIZE(n_args) (sizeof (AZFunctionFrame) - sizeof (void *) + 2 * (n_args) * sizeof (void *))
+#define AZ_FUNCTION_FRAME_IMPLS(f) ((const AZImplementation **) (f)->slots)
+#define AZ_FUNCTION_FRAME_VALS(f) ((const AZValue **) ((f)->slots + (f)->n_args))
+
+void az_function_frame_setup (AZFunctionFrame *frame, unsigned int n_args);
+
+static inline void
+az_function_frame_set_arg (AZFunctionFrame *frame, unsigned int idx, const AZImplementation *impl, const AZValue *val)
+{
+	if (AZ_FUNCTION_FRAME_IMPLS(frame)[idx] != impl) {
+		AZ_FUNCTION_FRAME_IMPLS(frame)[idx] = impl;
+		frame->flags &= ~AZ_FUNCTION_FRAME_VALIDATED;
+	}
+	AZ_FUNCTION_FRAME_VALS(frame)[idx] = val;
+}
+
+/**
+ * @brief Test frame arguments against function signature
+ *
+ * Sets AZ_FUNCTION_FRAME_VALIDATED and the signature on success. Never prints anything.
+ *
+ * @return 1 if all arguments are compatible with the signature
+ */
+unsigned int az_function_frame_validate (AZFunctionFrame *frame, const AZFunctionSignature *sig);
+
+/**
+ * @brief Invoke function with arguments from frame
+ *
+ * Validates the frame if it is not validated yet or was validated against a different signature.
+ * Does not allocate memory and never prints anything, returns 0 on invalid arguments.
+ */
+unsigned int az_function_invoke_frame (const AZFunctionImplementation *impl, void *inst, AZFunctionFrame *frame, const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx);
+
+/** @ingroup function
+ * @brief Invoke function over argument columns
+ *
+ * Calls the function n_rows times, row i takes arg_cols[j][i] as the argument j and writes the
+ * result to ret_col[i]. All values of a column share the implementation from arg_impls.
+ * Return values have to fit into AZValue, rows that do not return a value leave ret_col[i]
+ * untouched.
+ * If the invocation fails at some row, the return values of the previous rows are cleared.
+ * Unless the return type is final, this needs ret_impls.
+ *
+ * @param arg_impls argument implementations (one per column)
+ * @param arg_cols argument columns
+ * @param n_rows the number of rows
+ * @param ret_impls the returned implementations (may be NULL)
+ * @param ret_col the returned values (may be NULL if the function does not return a value)
+ * @return 1 on success, 0 on error
+ */
+unsigned int az_function_invoke_batch (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col, AZContext *ctx);
+
 /** @ingroup function
  * @brief Invoke function using packed arguments
  * 
@@ -150,6 +246,39 @@ unsigned int az_function_invoke_by_value_signature_va (const AZImplementation *i
  */
 unsigned int az_function_call_native (void (*func) (void), const AZFunctionSignature *sig, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[]);
 
+/** @ingroup function
+ * @brief Precompiled argument marshalling for native calls
+ *
+ * The plan resolves the register and stack placement of all arguments and the decoding
+ * of the return value once, so repeated calls with the same signature only copy values.
+ * On x86-64 System V az_function_call_native uses the shared plan of the signature.
+ *
+ * Plans are currently built only for x86-64 System V. On ARM64 and Windows x64
+ * az_native_call_plan_new returns NULL and az_function_call_native marshals the
+ * arguments directly.
+ *
+ * @param sig the function signature
+ * @return a new plan or NULL if the signature can not be called natively on this architecture
+ */
+AZNativeCallPlan *az_native_call_plan_new (const AZFunctionSignature *sig);
+void az_native_call_plan_delete (AZNativeCallPlan *plan);
+/**
+ * @brief Get the shared plan for signature
+ *
+ * Plans are cached by the signature content and live until the program exits
+ *
+ * @param sig the function signature
+ * @return the shared plan or NULL if the signature can not be called natively
+ */
+const AZNativeCallPlan *az_native_call_plan_get (const AZFunctionSignature *sig);
+/**
+ * @brief Call a native C function using precompiled plan
+ *
+ * Arguments are the same as in az_function_call_native, the signature of the plan has to
+ * match the signature of func
+ */
+unsigned int az_function_call_native_plan (void (*func) (void), const AZNativeCallPlan *plan, const AZImplementation **ret_impl, AZValue64 *ret_val, const AZImplementation *arg_impls[], const AZValue *arg_vals[]);
+
 #ifdef __cplusplus
 };
 #endif
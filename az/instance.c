@@ -79,6 +79,36 @@ az_instance_finalize_recursive (const AZClass *klass, const AZImplementation *im
 	}
 }
 
+/* Run the flattened chains if built by az_class_post_init, otherwise recurse */
+
+static inline void
+instance_init_chain (const AZClass *klass, const AZImplementation *impl, void *inst)
+{
+	if (!klass->init_steps) {
+		az_instance_init_recursive (klass, impl, inst, klass->impl.flags & AZ_FLAG_ZERO_MEMORY);
+		return;
+	}
+	for (uint16_t i = 0; i < klass->n_init_steps; i++) {
+		const AZInitStep *step = &klass->init_steps[i];
+		void *sub_inst = (char *) inst + step->inst_offset;
+		if (step->zero_size) memset (sub_inst, 0, step->zero_size);
+		if (step->func) step->func ((const AZImplementation *) ((const char *) impl + step->impl_offset), sub_inst);
+	}
+}
+
+static inline void
+instance_finalize_chain (const AZClass *klass, const AZImplementation *impl, void *inst)
+{
+	if (!klass->finalize_steps) {
+		az_instance_finalize_recursive (klass, impl, inst);
+		return;
+	}
+	for (uint16_t i = 0; i < klass->n_finalize_steps; i++) {
+		const AZInitStep *step = &klass->finalize_steps[i];
+		step->func ((const AZImplementation *) ((const char *) impl + step->impl_offset), (char *) inst + step->inst_offset);
+	}
+}
+
 void
 az_instance_init (const AZImplementation *impl, void *inst)
 {
@@ -91,7 +121,7 @@ az_instance_init (const AZImplementation *impl, void *inst)
 	arikkei_return_if_fail (!AZ_CLASS_IS_ABSTRACT(klass));
 #endif
 	if (klass->impl.flags & AZ_FLAG_ZERO_MEMORY) memset (inst, 0, klass->instance_size);
-	if (klass->impl.flags & AZ_FLAG_CONSTRUCT) az_instance_init_recursive (klass, impl, inst, klass->impl.flags & AZ_FLAG_ZERO_MEMORY);
+	if (klass->impl.flags & AZ_FLAG_CONSTRUCT) instance_init_chain (klass, impl, inst);
 }
 
 void
@@ -105,7 +135,7 @@ az_instance_finalize (const AZImplementation *impl, void *inst)
 #ifdef AZ_SAFETY_CHECKS
 	arikkei_return_if_fail (!AZ_CLASS_IS_ABSTRACT(klass));
 #endif
-	if (klass->impl.flags & AZ_FLAG_CONSTRUCT) az_instance_finalize_recursive (klass, impl, inst);
+	if (klass->impl.flags & AZ_FLAG_CONSTRUCT) instance_finalize_chain (klass, impl, inst);
 }
 
 void *
@@ -124,7 +154,7 @@ az_instance_new (unsigned int type)
 		inst = malloc(klass->instance_size);
 	}
 	if (klass->impl.flags & AZ_FLAG_ZERO_MEMORY) memset (inst, 0, klass->instance_size);
-	az_instance_init_recursive (klass, &klass->impl, inst, klass->impl.flags & AZ_FLAG_ZERO_MEMORY);
+	instance_init_chain (klass, &klass->impl, inst);
 	return inst;
 }
 
@@ -142,10 +172,15 @@ az_instance_new_array (unsigned int type, unsigned int n_elements)
 	} else {
 		elements = malloc(n_elements * AZ_CLASS_ELEMENT_SIZE(klass));
 	}
+	if (klass->init_steps && !klass->n_init_calls) {
+		/* Construction is only clearing memory, so a cleared array is a copy of a valid prototype */
+		if ((klass->impl.flags & AZ_FLAG_ZERO_MEMORY) || klass->n_init_steps) memset (elements, 0, n_elements * AZ_CLASS_ELEMENT_SIZE(klass));
+		return elements;
+	}
 	if (klass->impl.flags & AZ_FLAG_ZERO_MEMORY) memset (elements, 0, n_elements * AZ_CLASS_ELEMENT_SIZE(klass));
 	for (unsigned int i = 0; i < n_elements; i++) {
 		void *instance = (char *) elements + i * AZ_CLASS_ELEMENT_SIZE(klass);
-		az_instance_init_recursive (klass, &klass->impl, instance, klass->impl.flags & AZ_FLAG_ZERO_MEMORY);
+		instance_init_chain (klass, &klass->impl, instance);
 	}
 	return elements;
 }
@@ -158,7 +193,7 @@ az_instance_delete (unsigned int type, void *instance)
 	arikkei_return_if_fail(!AZ_TYPE_IS_INTERFACE(type));
 #endif
 	AZClass *klass = az_type_get_class (type);
-	az_instance_finalize_recursive (klass, &klass->impl, instance);
+	instance_finalize_chain (klass, &klass->impl, instance);
 	if (klass->allocator && klass->allocator->free) {
 		klass->allocator->free (klass, instance);
 	} else {
@@ -176,7 +211,7 @@ az_instance_delete_array (unsigned int type, void *elements, unsigned int neleme
 	AZClass *klass = az_type_get_class (type);
 	for (unsigned int i = 0; i < nelements; i++) {
 		void *instance = (char *) elements + i * AZ_CLASS_ELEMENT_SIZE(klass);
-		az_instance_finalize_recursive (klass, &klass->impl, instance);
+		instance_finalize_chain (klass, &klass->impl, instance);
 	}
 	if (klass->allocator && klass->allocator->free_array) {
 		klass->allocator->free_array (klass, elements, nelements);
@@ -236,14 +271,29 @@ az_instance_get_interface (const AZImplementation *impl, void *inst, unsigned in
 		return impl;
 	}
 	AZClass *klass = AZ_CLASS_FROM_IMPL(impl);
-	const AZIFEntry *ifentry = az_class_iface_all(klass, 0);
-	for (uint16_t i = 0; i < klass->n_ifaces_all; i++) {
-		if (az_type_is_a(ifentry->type, if_type)) {
-			AZImplementation *sub_impl = (AZImplementation *) ((char *) impl + ifentry->impl_offset);
-			if (if_inst) *if_inst = (char *) inst + ifentry->inst_offset;
-			return sub_impl;
+	const AZIFEntry *ifentry = NULL;
+	if (klass->iface_index) {
+		uint32_t pos = AZ_TYPE_INDEX(if_type) & klass->iface_index_mask;
+		while (klass->iface_index[pos].type) {
+			if (klass->iface_index[pos].type == if_type) {
+				ifentry = &klass->iface_index[pos];
+				break;
+			}
+			pos = (pos + 1) & klass->iface_index_mask;
 		}
-		ifentry += 1;
+	} else {
+		/* Index is not built (before post_init) */
+		for (uint16_t i = 0; i < klass->n_ifaces_all; i++) {
+			if (az_type_is_a(az_class_iface_all(klass, i)->type, if_type)) {
+				ifentry = az_class_iface_all(klass, i);
+				break;
+			}
+		}
+	}
+	if (ifentry) {
+		AZImplementation *sub_impl = (AZImplementation *) ((char *) impl + ifentry->impl_offset);
+		if (if_inst) *if_inst = (char *) inst + ifentry->inst_offset;
+		return sub_impl;
 	}
 	if (if_inst) *if_inst = NULL;
 	return NULL;
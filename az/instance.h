@@ -11,6 +11,7 @@
 
 #include <az/az.h>
 #include <az/class.h>
+#include <az/string.h>
 #include <az/types.h>
 
 #ifdef __cplusplus
@@ -100,6 +101,104 @@ unsigned int az_instance_to_string (const AZImplementation *impl, void *inst, un
  */
 uint8_t *az_instance_to_string_new (const AZImplementation *impl, void *inst);
 
+/* Integer finalizers (MurmurHash3 / SplitMix64), usable as fast hashes of integral values */
+static inline uint32_t
+az_hash_uint32 (uint32_t x)
+{
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	return (x >> 16) ^ x;
+}
+
+static inline uint32_t
+az_hash_uint64 (uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (uint32_t) (x ^ (x >> 31));
+}
+
+/**
+ * @brief calculate the hash of instance
+ *
+ * 32 and 64-bit integers and strings are hashed inline, other types by the hash
+ * method of the class. Strings are interned so their content hash is cached.
+ *
+ * @param impl type implementation
+ * @param inst type instance
+ * @return the hash value
+ */
+static inline uint32_t
+az_instance_hash (const AZImplementation *impl, void *inst)
+{
+	switch (AZ_IMPL_TYPE(impl)) {
+	case AZ_TYPE_INT32:
+	case AZ_TYPE_UINT32:
+		return az_hash_uint32 (*((uint32_t *) inst));
+	case AZ_TYPE_INT64:
+	case AZ_TYPE_UINT64:
+		return az_hash_uint64 (*((uint64_t *) inst));
+	case AZ_TYPE_STRING:
+		return (inst) ? az_string_hash ((const AZString *) inst) : 0;
+	default:
+		return AZ_CLASS_FROM_IMPL(impl)->hash (impl, inst);
+	}
+}
+
+/**
+ * @brief test whether two instances of the same type are equal
+ *
+ * Fast paths are the same as in az_instance_hash. Strings are compared by identity.
+ *
+ * @param impl type implementation
+ * @param lhs type instance
+ * @param rhs type instance
+ * @return 1 if equal, 0 if not
+ */
+static inline unsigned int
+az_instance_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	switch (AZ_IMPL_TYPE(impl)) {
+	case AZ_TYPE_INT32:
+	case AZ_TYPE_UINT32:
+		return *((uint32_t *) lhs) == *((uint32_t *) rhs);
+	case AZ_TYPE_INT64:
+	case AZ_TYPE_UINT64:
+		return *((uint64_t *) lhs) == *((uint64_t *) rhs);
+	case AZ_TYPE_STRING:
+		return lhs == rhs;
+	default:
+		return AZ_CLASS_FROM_IMPL(impl)->equals (impl, lhs, rhs);
+	}
+}
+
+/**
+ * @brief compare two instances of the same type
+ *
+ * 32 and 64-bit integers are compared inline, other types by the compare method of the class.
+ *
+ * @param impl type implementation
+ * @param lhs type instance
+ * @param rhs type instance
+ * @return negative, zero or positive value if lhs is less than, equal to or greater than rhs
+ */
+static inline int
+az_instance_compare (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	switch (AZ_IMPL_TYPE(impl)) {
+	case AZ_TYPE_INT32:
+		return (*((int32_t *) lhs) > *((int32_t *) rhs)) - (*((int32_t *) lhs) < *((int32_t *) rhs));
+	case AZ_TYPE_UINT32:
+		return (*((uint32_t *) lhs) > *((uint32_t *) rhs)) - (*((uint32_t *) lhs) < *((uint32_t *) rhs));
+	case AZ_TYPE_INT64:
+		return (*((int64_t *) lhs) > *((int64_t *) rhs)) - (*((int64_t *) lhs) < *((int64_t *) rhs));
+	case AZ_TYPE_UINT64:
+		return (*((uint64_t *) lhs) > *((uint64_t *) rhs)) - (*((uint64_t *) lhs) < *((uint64_t *) rhs));
+	default:
+		return AZ_CLASS_FROM_IMPL(impl)->compare (impl, lhs, rhs);
+	}
+}
+
 /* Get rootmost interface */
 const AZImplementation *az_instance_get_interface (const AZImplementation *impl, void *inst, unsigned int if_type, void **if_inst);
 
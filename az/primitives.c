@@ -318,6 +318,217 @@ any_get_property (const AZImplementation *impl, void *inst, unsigned int idx, co
 	return 1;
 }
 
+/* Hash and equality */
+
+static uint32_t
+any_hash (const AZImplementation *impl, void *inst)
+{
+	AZClass *klass = AZ_CLASS_FROM_IMPL(impl);
+	if (klass->impl.flags & AZ_FLAG_BLOCK) return az_hash_uint64 ((uint64_t) (uintptr_t) inst);
+	return arikkei_memory_hash (inst, klass->instance_size);
+}
+
+static unsigned int
+any_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	AZClass *klass = AZ_CLASS_FROM_IMPL(impl);
+	if ((lhs == rhs) || (klass->impl.flags & AZ_FLAG_BLOCK)) return lhs == rhs;
+	return !memcmp (lhs, rhs, klass->instance_size);
+}
+
+static uint32_t
+int8_hash (const AZImplementation *impl, void *inst)
+{
+	return az_hash_uint32 (*((uint8_t *) inst));
+}
+
+static unsigned int
+int8_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	return *((uint8_t *) lhs) == *((uint8_t *) rhs);
+}
+
+static uint32_t
+int16_hash (const AZImplementation *impl, void *inst)
+{
+	return az_hash_uint32 (*((uint16_t *) inst));
+}
+
+static unsigned int
+int16_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	return *((uint16_t *) lhs) == *((uint16_t *) rhs);
+}
+
+static uint32_t
+int32_hash (const AZImplementation *impl, void *inst)
+{
+	return az_hash_uint32 (*((uint32_t *) inst));
+}
+
+static unsigned int
+int32_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	return *((uint32_t *) lhs) == *((uint32_t *) rhs);
+}
+
+static uint32_t
+int64_hash (const AZImplementation *impl, void *inst)
+{
+	return az_hash_uint64 (*((uint64_t *) inst));
+}
+
+static unsigned int
+int64_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	return *((uint64_t *) lhs) == *((uint64_t *) rhs);
+}
+
+/* Floating point values that compare equal (0.0 and -0.0) have to have the same hash */
+static uint32_t
+hash_float (float val)
+{
+	uint32_t bits;
+	if (val == 0) val = 0;
+	memcpy (&bits, &val, 4);
+	return az_hash_uint32 (bits);
+}
+
+static uint32_t
+hash_double (double val)
+{
+	uint64_t bits;
+	if (val == 0) val = 0;
+	memcpy (&bits, &val, 8);
+	return az_hash_uint64 (bits);
+}
+
+/*
+ * Numerically equal or bitwise identical, so that NaN keys are equal to themselves
+ * (consistent with hash_float and hash_double, which only merge +0 and -0)
+ */
+static inline unsigned int
+equal_float (float lhs, float rhs)
+{
+	return (lhs == rhs) || !memcmp (&lhs, &rhs, 4);
+}
+
+static inline unsigned int
+equal_double (double lhs, double rhs)
+{
+	return (lhs == rhs) || !memcmp (&lhs, &rhs, 8);
+}
+
+static uint32_t
+float_hash (const AZImplementation *impl, void *inst)
+{
+	return hash_float (*((float *) inst));
+}
+
+static unsigned int
+float_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	return equal_float (*((float *) lhs), *((float *) rhs));
+}
+
+static uint32_t
+double_hash (const AZImplementation *impl, void *inst)
+{
+	return hash_double (*((double *) inst));
+}
+
+static unsigned int
+double_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	return equal_double (*((double *) lhs), *((double *) rhs));
+}
+
+static uint32_t
+complex_float_hash (const AZImplementation *impl, void *inst)
+{
+	float *c = (float *) inst;
+	return hash_float (c[0]) ^ (hash_float (c[1]) * 31);
+}
+
+static unsigned int
+complex_float_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	float *l = (float *) lhs, *r = (float *) rhs;
+	return equal_float (l[0], r[0]) && equal_float (l[1], r[1]);
+}
+
+static uint32_t
+complex_double_hash (const AZImplementation *impl, void *inst)
+{
+	double *c = (double *) inst;
+	return hash_double (c[0]) ^ (hash_double (c[1]) * 31);
+}
+
+static unsigned int
+complex_double_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	double *l = (double *) lhs, *r = (double *) rhs;
+	return equal_double (l[0], r[0]) && equal_double (l[1], r[1]);
+}
+
+static uint32_t
+pointer_hash (const AZImplementation *impl, void *inst)
+{
+	return az_hash_uint64 ((uint64_t) *((uintptr_t *) inst));
+}
+
+static unsigned int
+pointer_equals (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	return *((void **) lhs) == *((void **) rhs);
+}
+
+static int
+any_compare (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	AZClass *klass = AZ_CLASS_FROM_IMPL(impl);
+	if (klass->impl.flags & AZ_FLAG_BLOCK) return ((uintptr_t) lhs > (uintptr_t) rhs) - ((uintptr_t) lhs < (uintptr_t) rhs);
+	return memcmp (lhs, rhs, klass->instance_size);
+}
+
+/* Numeric order, NaNs are unordered */
+#define PRIMITIVE_COMPARE(name,T) \
+static int \
+name##_compare (const AZImplementation *impl, void *lhs, void *rhs) \
+{ \
+	T l = *((T *) lhs), r = *((T *) rhs); \
+	return (l > r) - (l < r); \
+}
+
+PRIMITIVE_COMPARE(int8, int8_t)
+PRIMITIVE_COMPARE(uint8, uint8_t)
+PRIMITIVE_COMPARE(int16, int16_t)
+PRIMITIVE_COMPARE(uint16, uint16_t)
+PRIMITIVE_COMPARE(int32, int32_t)
+PRIMITIVE_COMPARE(uint32, uint32_t)
+PRIMITIVE_COMPARE(int64, int64_t)
+PRIMITIVE_COMPARE(uint64, uint64_t)
+PRIMITIVE_COMPARE(float, float)
+PRIMITIVE_COMPARE(double, double)
+PRIMITIVE_COMPARE(pointer, uintptr_t)
+
+/* Lexicographic by real and imaginary part */
+static int
+complex_float_compare (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	float *l = (float *) lhs, *r = (float *) rhs;
+	if (l[0] != r[0]) return (l[0] > r[0]) - (l[0] < r[0]);
+	return (l[1] > r[1]) - (l[1] < r[1]);
+}
+
+static int
+complex_double_compare (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	double *l = (double *) lhs, *r = (double *) rhs;
+	if (l[0] != r[0]) return (l[0] > r[0]) - (l[0] < r[0]);
+	return (l[1] > r[1]) - (l[1] < r[1]);
+}
+
 static unsigned char zero_val[16] = { 0 };
 
 AZClass AZAnyKlass = {
@@ -525,12 +736,39 @@ static AZClass *primitive_classes[] = {
 
 #define AZ_NUM_PRIMITIVE_CLASSES (sizeof(primitive_classes) / sizeof(primitive_classes[0]))
 
+static const struct {
+	uint32_t (*hash) (const AZImplementation *impl, void *inst);
+	unsigned int (*equals) (const AZImplementation *impl, void *lhs, void *rhs);
+	int (*compare) (const AZImplementation *impl, void *lhs, void *rhs);
+} primitive_methods[] = {
+	{int32_hash, int32_equals, uint32_compare},
+	{int8_hash, int8_equals, int8_compare},
+	{int8_hash, int8_equals, uint8_compare},
+	{int16_hash, int16_equals, int16_compare},
+	{int16_hash, int16_equals, uint16_compare},
+	{int32_hash, int32_equals, int32_compare},
+	{int32_hash, int32_equals, uint32_compare},
+	{int64_hash, int64_equals, int64_compare},
+	{int64_hash, int64_equals, uint64_compare},
+	{float_hash, float_equals, float_compare},
+	{double_hash, double_equals, double_compare},
+	{complex_float_hash, complex_float_equals, complex_float_compare},
+	{complex_double_hash, complex_double_equals, complex_double_compare},
+	{pointer_hash, pointer_equals, pointer_compare}
+};
+
 void
 az_init_primitive_classes (void)
 {
 	unsigned int i;
+	AZAnyKlass.hash = any_hash;
+	AZAnyKlass.equals = any_equals;
+	AZAnyKlass.compare = any_compare;
 	az_class_new_with_value(&AZAnyKlass);
 	for (unsigned int i = 0; i < AZ_NUM_PRIMITIVE_CLASSES; i++) {
+		primitive_classes[i]->hash = primitive_methods[i].hash;
+		primitive_classes[i]->equals = primitive_methods[i].equals;
+		primitive_classes[i]->compare = primitive_methods[i].compare;
 		az_class_new_with_value(primitive_classes[i]);
 	}
 }
@@ -9,29 +9,47 @@
 #endif
 
 #if defined(AZ_GLOBALS_STATIC)
-	AZClass *az_types[AZ_MAX_TYPES];
+	AZTypeInfo az_types[AZ_MAX_TYPES];
 	unsigned int az_num_types = 0;
 	#define ensure_type()
 #elif defined(AZ_GLOBALS_SINGLE_THREAD)
-	AZClass **az_types = NULL;
+	AZTypeInfo *az_types = NULL;
 	unsigned int az_num_types = 0;
 	static unsigned int az_num_types_allocated = 0;
 	static inline void ensure_type() {
 		if (az_num_types >= az_num_types_allocated) {
 			az_num_types_allocated += 32;
-			az_types = (AZClass **) realloc (az_types, az_num_types_allocated * sizeof(AZClass *));
+			az_types = (AZTypeInfo *) realloc (az_types, az_num_types_allocated * sizeof(AZTypeInfo));
 		}
 	}
 #elif defined(AZ_GLOBALS_MULTI_THREAD)
+	/*
+	 * Type slots are kept in fixed-size segments that are never moved or freed, so
+	 * lookups can read them without the lock. Writers (registration) are serialized by the
+	 * mutex and publish both the segment pointer and the class pointer with release stores,
+	 * az_num_types is bumped (release) only after the slot has been written.
+	 * The depth and ancestors of slot are written before the class pointer and are valid
+	 * once the class pointer has been read (acquire) as non-NULL.
+	 */
+	#define AZ_TYPES_SEGMENT_BITS 12
+	#define AZ_TYPES_SEGMENT_SIZE (1 << AZ_TYPES_SEGMENT_BITS)
+	#define AZ_TYPES_NUM_SEGMENTS ((AZ_TYPE_MASK + 1) >> AZ_TYPES_SEGMENT_BITS)
+	typedef struct {
+		_Atomic(AZClass *) klass;
+		uint32_t depth;
+		const uint32_t *ancestors;
+	} AZTypeSlot;
 	static mtx_t mutex;
-	static AZClass **az_types = NULL;
-	static unsigned int az_num_types = 0;
-	static unsigned int az_num_types_allocated = 0;
-	static inline void ensure_type() {
-		if (az_num_types >= az_num_types_allocated) {
-			az_num_types_allocated += 32;
-			az_types = (AZClass **) realloc (az_types, az_num_types_allocated * sizeof(AZClass *));
+	static _Atomic(AZTypeSlot *) az_types[AZ_TYPES_NUM_SEGMENTS];
+	static _Atomic unsigned int az_num_types = 0;
+	static AZTypeSlot *
+	ensure_segment (unsigned int idx) {
+		AZTypeSlot *seg = atomic_load_explicit(&az_types[idx >> AZ_TYPES_SEGMENT_BITS], memory_order_relaxed);
+		if (!seg) {
+			seg = (AZTypeSlot *) calloc (AZ_TYPES_SEGMENT_SIZE, sizeof(AZTypeSlot));
+			atomic_store_explicit(&az_types[idx >> AZ_TYPES_SEGMENT_BITS], seg, memory_order_release);
 		}
+		return seg;
 	}
 #endif
 
@@ -44,13 +62,12 @@ az_globals_init (void)
 	// No action needed
 #elif defined(AZ_GLOBALS_SINGLE_THREAD)
 	az_num_types_allocated = AZ_NUM_BASE_TYPES + 32;
-	az_types = (AZClass **) malloc (az_num_types_allocated * sizeof(AZClass *));
+	az_types = (AZTypeInfo *) malloc (az_num_types_allocated * sizeof(AZTypeInfo));
+	memset(az_types, 0, AZ_NUM_BASE_TYPES * sizeof(AZTypeInfo));
 #elif defined(AZ_GLOBALS_MULTI_THREAD)
 	mtx_init(&mutex, mtx_plain | mtx_recursive);
-	az_num_types_allocated = AZ_NUM_BASE_TYPES + 32;
-	az_types = (AZClass **) malloc (az_num_types_allocated * sizeof(AZClass *));
+	ensure_segment (0);
 #endif
-	memset(az_types, 0, AZ_NUM_BASE_TYPES * sizeof(AZClass *));
 
 	az_num_types = AZ_NUM_BASE_TYPES;
 }
@@ -60,38 +77,74 @@ az_register_class(AZClass *klass)
 {
 #if defined(AZ_GLOBALS_MULTI_THREAD)
 	mtx_lock(&mutex);
-#endif
+	if (!klass->impl.type) {
+		klass->impl.type = atomic_load_explicit(&az_num_types, memory_order_relaxed) | (klass->impl.flags & ~AZ_TYPE_MASK);
+	}
+	unsigned int idx = AZ_TYPE_INDEX(klass->impl.type);
+	AZTypeSlot *slot = &ensure_segment (idx)[idx & (AZ_TYPES_SEGMENT_SIZE - 1)];
+	az_class_setup_ancestors (klass);
+	slot->depth = klass->depth;
+	slot->ancestors = klass->ancestors;
+	atomic_store_explicit(&slot->klass, klass, memory_order_release);
+	if (idx >= az_num_types) atomic_store_explicit(&az_num_types, idx + 1, memory_order_release);
+	mtx_unlock(&mutex);
+#else
 	if (!klass->impl.type) {
 		ensure_type();
 		klass->impl.type = az_num_types++ | (klass->impl.flags & ~AZ_TYPE_MASK);
 	}
-	az_types[AZ_TYPE_INDEX(klass->impl.type)] = klass;
-#if defined(AZ_GLOBALS_MULTI_THREAD)
-	mtx_unlock(&mutex);
+	az_class_setup_ancestors (klass);
+	az_types[AZ_TYPE_INDEX(klass->impl.type)].klass = klass;
+	az_types[AZ_TYPE_INDEX(klass->impl.type)].depth = klass->depth;
+	az_types[AZ_TYPE_INDEX(klass->impl.type)].ancestors = klass->ancestors;
 #endif
 }
 
 #if defined(AZ_GLOBALS_MULTI_THREAD)
+	static inline AZTypeSlot *
+	type_get_slot (unsigned int idx)
+	{
+		AZTypeSlot *seg = atomic_load_explicit(&az_types[idx >> AZ_TYPES_SEGMENT_BITS], memory_order_acquire);
+		return &seg[idx & (AZ_TYPES_SEGMENT_SIZE - 1)];
+	}
+
+	static inline AZClass *
+	type_get_class (unsigned int idx)
+	{
+		return atomic_load_explicit(&type_get_slot (idx)->klass, memory_order_acquire);
+	}
+
 	AZClass *
 	az_type_get_class (unsigned int type)
 	{
-		AZClass *ret = NULL;
-		mtx_lock(&mutex);
-		if (AZ_TYPE_INDEX(type) < az_num_types) ret = az_types[AZ_TYPE_INDEX(type)];
-		mtx_unlock(&mutex);
+		unsigned int idx = AZ_TYPE_INDEX(type);
 #ifdef AZ_SAFETY_CHECKS
-		arikkei_return_val_if_fail (AZ_TYPE_INDEX(type) < az_num_types, NULL);
+		arikkei_return_val_if_fail (idx < atomic_load_explicit(&az_num_types, memory_order_acquire), NULL);
+#else
+		if (idx >= atomic_load_explicit(&az_num_types, memory_order_acquire)) return NULL;
 #endif
-		return ret;
+		return type_get_class (idx);
 	}
 
 	unsigned int
 	az_type_is_valid(uint32_t type)
 	{
-		mtx_lock(&mutex);
-		unsigned int valid = (AZ_TYPE_INDEX(type) != 0) && (AZ_TYPE_INDEX(type) < az_num_types)  && (az_types[AZ_TYPE_INDEX(type)]->impl.type == type);
-		mtx_unlock(&mutex);
-		return valid;
+		unsigned int idx = AZ_TYPE_INDEX(type);
+		if (!idx || (idx >= atomic_load_explicit(&az_num_types, memory_order_acquire))) return 0;
+		AZClass *klass = type_get_class (idx);
+		return klass && (klass->impl.type == type);
+	}
+
+	unsigned int
+	az_type_descends_from (unsigned int type, unsigned int test)
+	{
+		unsigned int n_types = atomic_load_explicit(&az_num_types, memory_order_acquire);
+		if ((AZ_TYPE_INDEX(type) >= n_types) || (AZ_TYPE_INDEX(test) >= n_types)) return 0;
+		AZTypeSlot *slot = type_get_slot (AZ_TYPE_INDEX(type));
+		AZTypeSlot *test_slot = type_get_slot (AZ_TYPE_INDEX(test));
+		if (!atomic_load_explicit(&slot->klass, memory_order_acquire)) return 0;
+		if (!atomic_load_explicit(&test_slot->klass, memory_order_acquire)) return 0;
+		return (test_slot->depth < slot->depth) && (slot->ancestors[test_slot->depth] == test);
 	}
 
 	void
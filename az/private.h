@@ -12,6 +12,7 @@
 
 #include <az/types.h>
 #include <az/class.h>
+#include <az/function.h>
 
 #define AZ_TYPE_VALUE_SIZE(t) az_class_value_size(az_type_get_class(t))
 
@@ -24,9 +25,21 @@
 		AZImplementation *impl = AZ_IMPL_FROM_TYPE(type);
 		return type == impl->type;
 	}
+	/* Ancestor display test using only the registry slots (0 if either type is not registered) */
+	static inline unsigned int
+	az_type_descends_from (unsigned int type, unsigned int test)
+	{
+		if ((AZ_TYPE_INDEX(type) >= az_num_types) || (AZ_TYPE_INDEX(test) >= az_num_types)) return 0;
+		const AZTypeInfo *info = &az_types[AZ_TYPE_INDEX(type)];
+		const AZTypeInfo *test_info = &az_types[AZ_TYPE_INDEX(test)];
+		if (!info->klass || !test_info->klass) return 0;
+		return (test_info->depth < info->depth) && (info->ancestors[test_info->depth] == test);
+	}
 	#define ENSURE_INITIALIZED() if (!az_num_types) az_init()
 #elif defined(AZ_GLOBALS_MULTI_THREAD)
 	unsigned int az_type_is_valid(uint32_t type);
+	/* Ancestor display test using only the registry slots (0 if either type is not registered) */
+	unsigned int az_type_descends_from (unsigned int type, unsigned int test);
 	/* fixme: Think if we can do multi-threaded initialization */
 	#define ENSURE_INITIALIZED()
 #endif
@@ -79,9 +92,29 @@ AZClass *az_class_new (const unsigned char *name, unsigned int parent_type, unsi
 /* Used internally for fundamental types */
 void az_class_new_with_value (AZClass *klass);
 
+/* Sets up the ancestor display (parent has to be registered) */
+void az_class_setup_ancestors (AZClass *klass);
+
 /* Called after class constructor has run (builds interface chain etc.) */
 void az_class_post_init (AZClass *klass);
 
+/*
+ * Calls invoke for every row of argument columns, shared by the default and implementation
+ * specific batch invocations (see az_function_invoke_batch).
+ * If some row fails, the results of the completed rows are cleared (this needs ret_impls
+ * unless the return type is final).
+ */
+unsigned int az_function_invoke_rows (const AZFunctionImplementation *impl, void *inst, const AZFunctionSignature *sig,
+	unsigned int (*invoke) (const AZFunctionImplementation *impl, void *inst, const AZImplementation *arg_impls[], const AZValue *arg_vals[], const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx),
+	const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col, AZContext *ctx);
+/*
+ * Calls native function for every row of argument columns using precompiled plan.
+ * Implementations are marshalled once per batch, only argument values are updated per row.
+ * Failure semantics are the same as in az_function_invoke_rows.
+ */
+unsigned int az_function_call_native_plan_rows (void (*func) (void), const AZNativeCallPlan *plan, const AZFunctionSignature *sig,
+	const AZImplementation *arg_impls[], const AZValue *arg_cols[], unsigned int n_rows, const AZImplementation *ret_impls[], AZValue *ret_col);
+
 /* Constrained type */
 typedef struct _AZTypeConstraint AZTypeConstraint;
 
@@ -17,105 +17,83 @@
 #include <az/reference.h>
 
 #ifdef AZ_MT_REFERENCES
-#include <arikkei/arikkei-threads.h>
-#endif
-
-#ifdef AZ_MT_REFERENCES
-mtx_t mutex;
-
-#define AZ_REFERENCE_LOCK() mtx_lock (&mutex)
-#define AZ_REFERENCE_UNLOCK() mtx_unlock (&mutex)
-
 static void az_reference_drop (AZReferenceClass *klass, AZReference *ref);
 
+/* Decrease refcount unless we are holding the last reference, returns 1 if decreased */
+static inline unsigned int
+reference_release_unless_last (AZReference *ref)
+{
+	uint32_t refcount = atomic_load_explicit (&ref->refcount, memory_order_relaxed);
+	while (refcount != 1) {
+		if (atomic_compare_exchange_weak_explicit (&ref->refcount, &refcount, refcount - 1, memory_order_release, memory_order_relaxed)) return 1;
+	}
+	/* Synchronize with the releases of all other holders before disposing */
+	atomic_thread_fence (memory_order_acquire);
+	return 0;
+}
+
 void
 az_reference_ref (AZReference* ref)
 {
-	AZ_REFERENCE_LOCK ();
 #ifdef AZ_SAFETY_CHECKS
-	if (!ref->refcount) {
-		AZ_REFERENCE_UNLOCK ();
-		return;
-	}
+	if (!atomic_load_explicit (&ref->refcount, memory_order_relaxed)) return;
 #endif
-	ref->refcount += 1;
-	AZ_REFERENCE_UNLOCK ();
+	atomic_fetch_add_explicit (&ref->refcount, 1, memory_order_relaxed);
 }
 
 void
 az_reference_unref (AZReferenceClass* klass, AZReference* ref)
 {
-	AZ_REFERENCE_LOCK ();
 #ifdef AZ_SAFETY_CHECKS
-	if (!ref->refcount) {
-		AZ_REFERENCE_UNLOCK ();
-		return;
-	}
+	if (!atomic_load_explicit (&ref->refcount, memory_order_relaxed)) return;
 #endif
-	if (ref->refcount == 1) {
-		AZ_REFERENCE_UNLOCK ();
+	if (!reference_release_unless_last (ref)) {
 		az_reference_drop (klass, ref);
-	} else {
-		ref->refcount -= 1;
-		AZ_REFERENCE_UNLOCK ();
 	}
 }
 #else
-#define AZ_REFERENCE_LOCK()
-#define AZ_REFERENCE_UNLOCK()
+static inline unsigned int
+reference_release_unless_last (AZReference *ref)
+{
+	if (ref->refcount == 1) return 0;
+	ref->refcount -= 1;
+	return 1;
+}
 #endif
 
 void
 az_reference_drop (AZReferenceClass *klass, AZReference *ref)
 {
-#ifdef AZ_SAFETY_CHECKS
-	AZ_REFERENCE_LOCK ();
-	if (ref->refcount != 1) {
-		AZ_REFERENCE_UNLOCK ();
-		return;
-	}
-	AZ_REFERENCE_UNLOCK ();
-#endif
 	/* We are guaranteed to hold the only reference to this object */
-	if (!klass->drop || klass->drop (klass, ref)) {
-		/* No one took ownership of the object */
-		if (klass->dispose) klass->dispose (klass, ref);
-		az_instance_delete(AZ_CLASS_TYPE(&klass->klass), ref);
-	} else {
-		/* Someone took ownership but may have dropped it in another thread */
-		AZ_REFERENCE_LOCK ();
-		if (ref->refcount == 1) {
-			AZ_REFERENCE_UNLOCK ();
-			if (klass->dispose) klass->dispose (klass, ref);
-			az_instance_delete(AZ_CLASS_TYPE(&klass->klass), ref);
-		} else {
-            ref->refcount -= 1;
-			AZ_REFERENCE_UNLOCK ();
-		}
+	/* The refcount cannot be checked here, as drop handlers may hand out new references concurrently */
+	while (klass->drop && !klass->drop (klass, ref)) {
+		/* Someone took ownership */
+		if (reference_release_unless_last (ref)) return;
+		/* But has already dropped it in another thread, we hold the only reference again */
 	}
+	/* No one took ownership of the object */
+	if (klass->dispose) klass->dispose (klass, ref);
+	az_instance_delete(AZ_CLASS_TYPE(&klass->klass), ref);
 }
 
 void
 az_reference_dispose (AZReferenceClass *klass, AZReference *ref)
 {
 #ifdef AZ_SAFETY_CHECKS
-	AZ_REFERENCE_LOCK ();
-	if (ref->refcount == 0) {
-		AZ_REFERENCE_UNLOCK ();
-		return;
-	}
-	AZ_REFERENCE_UNLOCK ();
+	if (ref->refcount == 0) return;
 #endif
 	/* We are guaranteed to hold reference so no another threas can auto-dispose by unref */
 	if (klass->dispose) klass->dispose (klass, ref);
-	AZ_REFERENCE_LOCK ();
+#ifdef AZ_MT_REFERENCES
+	if (atomic_fetch_sub_explicit (&ref->refcount, 1, memory_order_acq_rel) == 1) {
+		az_instance_delete(AZ_CLASS_TYPE(&klass->klass), ref);
+	}
+#else
 	ref->refcount -= 1;
 	if (!ref->refcount) {
-		AZ_REFERENCE_UNLOCK ();
 		az_instance_delete(AZ_CLASS_TYPE(&klass->klass), ref);
-	} else {
-		AZ_REFERENCE_UNLOCK ();
 	}
+#endif
 }
 
 static void
@@ -141,7 +119,4 @@ void
 az_init_reference_class (void)
 {
 	az_class_new_with_value(&AZReferenceKlass.klass);
-#ifdef AZ_MT_REFERENCES
-	mtx_init (&mutex, mtx_plain);
-#endif
 }
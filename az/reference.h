@@ -9,7 +9,7 @@
 
 /**
  * Use multi-threaded reference counting
- * Single global mutex is created for all reference types
+ * Reference count is a C11 atomic, ref/unref do not take any locks
  */
 
 #define AZ_MT_REFERENCES
@@ -23,7 +23,11 @@ extern "C" {
 #endif
 
 struct _AZReference {
+#ifdef AZ_MT_REFERENCES
+	_Atomic uint32_t refcount;
+#else
 	uint32_t refcount;
+#endif
 };
 
 struct _AZReferenceClass {
@@ -34,8 +38,9 @@ struct _AZReferenceClass {
 	 * Called before the last reference to instance will be dropped (unref with refcount 1) to
 	 * allow object managers to claim ownership of unowned objects.
 	 * If it returns 1, instance will be disposed and deleted immediately. Otherwise reference
-	 * count is decreased and instance disposed and deleted only if there are no remaining references to it.
-	 * It is called with mutex unlocked.
+	 * count is decreased. If the new owner has already released its reference in another thread, drop
+	 * is invoked again, as the caller is holding the last reference.
+	 * It is called without holding any locks.
 	 *
 	 * @return 1 if object should be disposed, 0 if someone else aquired new reference
 	 * @see dispose
@@ -0,0 +1,254 @@
+#define __AZ_SLAB_C__
+
+/*
+ * A run-time type library
+ *
+ * Copyright (C) 2016-2025 Lauris Kaplinski <lauris@kaplinski.com>
+ *
+ * Licensed under GNU General Public License version 3 or any later version.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include <az/config.h>
+#include <az/slab.h>
+
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+#include <arikkei/arikkei-threads.h>
+#define AZ_SLAB_THREAD_LOCAL _Thread_local
+#else
+#define AZ_SLAB_THREAD_LOCAL
+#endif
+
+#define AZ_SLAB_NUM_CLASSES (AZ_SLAB_MAX_SIZE / AZ_SLAB_QUANTUM)
+/* Size of memory chunk carved into blocks */
+#define AZ_SLAB_CHUNK_SIZE 65536
+/* Number of blocks moved between thread cache and depot at once */
+#define AZ_SLAB_BATCH_SIZE 32
+/* Thread cache is flushed if it grows over this */
+#define AZ_SLAB_CACHE_MAX (2 * AZ_SLAB_BATCH_SIZE)
+
+#define AZ_SLAB_CLASS(s) (((s) - 1) / AZ_SLAB_QUANTUM)
+
+typedef struct _AZSlabBlock AZSlabBlock;
+typedef struct _AZSlabChunk AZSlabChunk;
+typedef struct _AZSlabCache AZSlabCache;
+
+/* Free block, the first block of batch links to the next batch */
+struct _AZSlabBlock {
+	AZSlabBlock *next;
+	AZSlabBlock *next_batch;
+};
+
+/* Chunks are kept in global list, the header keeps blocks aligned */
+struct _AZSlabChunk {
+	AZSlabChunk *next;
+	void *padding;
+};
+
+struct _AZSlabCache {
+	AZSlabBlock *blocks;
+	unsigned int n_blocks;
+};
+
+/*
+ * Stacks of batches of free blocks
+ * Pushing is lock-free, popping is serialized by mutex - as nobody else can pop the head
+ * meanwhile, the compare-exchange cannot suffer from ABA problem
+ */
+static _Atomic(AZSlabBlock *) depots[AZ_SLAB_NUM_CLASSES];
+static _Atomic(AZSlabChunk *) chunks;
+static _Atomic unsigned int default_max_size;
+
+static AZ_SLAB_THREAD_LOCAL AZSlabCache caches[AZ_SLAB_NUM_CLASSES];
+
+static void
+slab_push_batches (unsigned int cls, AZSlabBlock *first, AZSlabBlock *last)
+{
+	AZSlabBlock *head = atomic_load_explicit (&depots[cls], memory_order_relaxed);
+	do {
+		last->next_batch = head;
+	} while (!atomic_compare_exchange_weak_explicit (&depots[cls], &head, first, memory_order_release, memory_order_relaxed));
+}
+
+static void
+slab_flush (unsigned int cls, AZSlabCache *cache, unsigned int n_batches)
+{
+	for (unsigned int i = 0; i < n_batches; i++) {
+		AZSlabBlock *first = cache->blocks;
+		AZSlabBlock *last = first;
+		for (unsigned int j = 1; j < AZ_SLAB_BATCH_SIZE; j++) last = last->next;
+		cache->blocks = last->next;
+		cache->n_blocks -= AZ_SLAB_BATCH_SIZE;
+		last->next = NULL;
+		slab_push_batches (cls, first, first);
+	}
+}
+
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+static mtx_t depot_mutexes[AZ_SLAB_NUM_CLASSES];
+static tss_t cache_key;
+static once_flag slab_once = ONCE_FLAG_INIT;
+static AZ_SLAB_THREAD_LOCAL unsigned int cache_registered = 0;
+#define AZ_SLAB_DEPOT_LOCK(c) mtx_lock (&depot_mutexes[c])
+#define AZ_SLAB_DEPOT_UNLOCK(c) mtx_unlock (&depot_mutexes[c])
+
+/* Move the cached blocks of exiting thread to depots */
+static void
+slab_thread_exit (void *data)
+{
+	AZSlabCache *thread_caches = (AZSlabCache *) data;
+	for (unsigned int cls = 0; cls < AZ_SLAB_NUM_CLASSES; cls++) {
+		AZSlabCache *cache = &thread_caches[cls];
+		slab_flush (cls, cache, cache->n_blocks / AZ_SLAB_BATCH_SIZE);
+		if (cache->blocks) {
+			/* Leftover blocks are pushed as a short batch */
+			slab_push_batches (cls, cache->blocks, cache->blocks);
+			cache->blocks = NULL;
+			cache->n_blocks = 0;
+		}
+	}
+}
+
+static void
+slab_init (void)
+{
+	for (unsigned int i = 0; i < AZ_SLAB_NUM_CLASSES; i++) mtx_init (&depot_mutexes[i], mtx_plain);
+	tss_create (&cache_key, slab_thread_exit);
+}
+
+/* Both allocating and freeing threads have to flush their caches at exit */
+static inline void
+slab_register_cache (void)
+{
+	if (!cache_registered) {
+		call_once (&slab_once, slab_init);
+		tss_set (cache_key, caches);
+		cache_registered = 1;
+	}
+}
+#else
+#define AZ_SLAB_DEPOT_LOCK(c)
+#define AZ_SLAB_DEPOT_UNLOCK(c)
+#define slab_register_cache()
+#endif
+
+/* Batches pushed at thread exit can be incomplete */
+static unsigned int
+slab_batch_length (AZSlabBlock *batch)
+{
+	unsigned int len = 0;
+	while (batch) {
+		len += 1;
+		batch = batch->next;
+	}
+	return len;
+}
+
+static void
+slab_refill (unsigned int cls, AZSlabCache *cache)
+{
+	slab_register_cache ();
+	AZ_SLAB_DEPOT_LOCK(cls);
+	AZSlabBlock *batch = atomic_load_explicit (&depots[cls], memory_order_acquire);
+	while (batch && !atomic_compare_exchange_weak_explicit (&depots[cls], &batch, batch->next_batch, memory_order_acquire, memory_order_acquire)) {}
+	AZ_SLAB_DEPOT_UNLOCK(cls);
+	if (batch) {
+		cache->blocks = batch;
+		cache->n_blocks = slab_batch_length (batch);
+		return;
+	}
+	/* Carve a new chunk */
+	unsigned int size = (cls + 1) * AZ_SLAB_QUANTUM;
+	AZSlabChunk *chunk = (AZSlabChunk *) malloc (AZ_SLAB_CHUNK_SIZE);
+	if (!chunk) return;
+	chunk->next = atomic_load_explicit (&chunks, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit (&chunks, &chunk->next, chunk, memory_order_release, memory_order_relaxed)) {}
+	unsigned int n_blocks = (AZ_SLAB_CHUNK_SIZE - sizeof (AZSlabChunk)) / size;
+	char *p = (char *) chunk + sizeof (AZSlabChunk);
+	for (unsigned int i = 0; i < n_blocks; i++) {
+		AZSlabBlock *block = (AZSlabBlock *) (p + i * size);
+		block->next = (i < (n_blocks - 1)) ? (AZSlabBlock *) (p + (i + 1) * size) : NULL;
+	}
+	cache->blocks = (AZSlabBlock *) p;
+	cache->n_blocks = n_blocks;
+}
+
+void *
+az_slab_alloc (unsigned int size)
+{
+	if (!size || (size > AZ_SLAB_MAX_SIZE)) return malloc (size);
+	unsigned int cls = AZ_SLAB_CLASS(size);
+	AZSlabCache *cache = &caches[cls];
+	if (!cache->blocks) {
+		slab_refill (cls, cache);
+		if (!cache->blocks) return NULL;
+	}
+	AZSlabBlock *block = cache->blocks;
+	cache->blocks = block->next;
+	cache->n_blocks -= 1;
+	return block;
+}
+
+void
+az_slab_free (void *location, unsigned int size)
+{
+	if (!location) return;
+	if (!size || (size > AZ_SLAB_MAX_SIZE)) {
+		free (location);
+		return;
+	}
+	slab_register_cache ();
+	unsigned int cls = AZ_SLAB_CLASS(size);
+	AZSlabCache *cache = &caches[cls];
+	AZSlabBlock *block = (AZSlabBlock *) location;
+	block->next = cache->blocks;
+	cache->blocks = block;
+	cache->n_blocks += 1;
+	if (cache->n_blocks > AZ_SLAB_CACHE_MAX) slab_flush (cls, cache, 1);
+}
+
+static void *
+slab_allocate (AZClass *klass)
+{
+	return az_slab_alloc (klass->instance_size);
+}
+
+static void *
+slab_allocate_array (AZClass *klass, unsigned int n_elements)
+{
+	return az_slab_alloc (n_elements * AZ_CLASS_ELEMENT_SIZE(klass));
+}
+
+static void
+slab_free (AZClass *klass, void *location)
+{
+	az_slab_free (location, klass->instance_size);
+}
+
+static void
+slab_free_array (AZClass *klass, void *location, unsigned int n_elements)
+{
+	az_slab_free (location, n_elements * AZ_CLASS_ELEMENT_SIZE(klass));
+}
+
+AZInstanceAllocator az_slab_allocator = {
+	slab_allocate,
+	slab_allocate_array,
+	slab_free,
+	slab_free_array
+};
+
+void
+az_slab_set_default_max_size (unsigned int max_size)
+{
+	if (max_size > AZ_SLAB_MAX_SIZE) max_size = AZ_SLAB_MAX_SIZE;
+	atomic_store_explicit (&default_max_size, max_size, memory_order_relaxed);
+}
+
+unsigned int
+az_slab_get_default_max_size (void)
+{
+	return atomic_load_explicit (&default_max_size, memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+#ifndef __AZ_SLAB_H__
+#define __AZ_SLAB_H__
+
+/*
+ * A run-time type library
+ *
+ * Copyright (C) 2016-2025 Lauris Kaplinski <lauris@kaplinski.com>
+ *
+ * Licensed under GNU General Public License version 3 or any later version.
+ */
+
+#include <az/class.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size classes are multiples of quantum up to max size, bigger blocks are passed to malloc */
+#define AZ_SLAB_QUANTUM 16
+#define AZ_SLAB_MAX_SIZE 512
+
+/**
+ * @brief Slab allocator for small fixed-size instances
+ *
+ * Can be attached to any class as klass->allocator. Memory is taken from per-thread caches
+ * without locking, cache overflows are moved to global lock-free depots in batches. Blocks
+ * can be freed from any thread. Memory of slabs is never returned to the system.
+ *
+ * Instances have to be allocated and freed through az_instance_new/az_instance_new_array and
+ * az_instance_delete/az_instance_delete_array.
+ */
+extern AZInstanceAllocator az_slab_allocator;
+
+/**
+ * @brief Allocate memory block
+ *
+ * Blocks up to AZ_SLAB_MAX_SIZE are served from slabs, bigger ones by malloc.
+ * @param size the size of block
+ * @return pointer to memory (16-byte aligned)
+ */
+void *az_slab_alloc (unsigned int size);
+/**
+ * @brief Free memory block allocated by az_slab_alloc
+ *
+ * @param location pointer to memory (can be NULL)
+ * @param size the size of block (has to be the same as in allocation)
+ */
+void az_slab_free (void *location, unsigned int size);
+
+/**
+ * @brief Enable slab allocator for all small classes
+ *
+ * All classes registered after this call (az_register_type, az_register_composite_type) with
+ * instance size up to max_size that do not inherit an allocator use az_slab_allocator.
+ * Classes registered earlier are not affected. Set to 0 to disable (the default).
+ * @param max_size the maximum instance size (clamped to AZ_SLAB_MAX_SIZE)
+ */
+void az_slab_set_default_max_size (unsigned int max_size);
+unsigned int az_slab_get_default_max_size (void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -10,25 +10,60 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <arikkei/arikkei-dict.h>
+
 #include <az/class.h>
+#include <az/instance.h>
 #include <az/private.h>
 #include <az/serialization.h>
 #include <az/string.h>
 
 #include "value.h"
 
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+#include <arikkei/arikkei-threads.h>
+#endif
+
 typedef struct _AZStringLookup AZStringLookup;
+typedef struct _AZStringShard AZStringShard;
 
 struct _AZStringLookup {
+	uint32_t hash;
 	unsigned int len;
 	const unsigned char *str;
 };
 
+/* Number of interning table shards, has to be power of 2 */
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+#define AZ_STRING_NUM_SHARDS 16
+#else
+#define AZ_STRING_NUM_SHARDS 1
+#endif
+
+struct _AZStringShard {
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+	mtx_t mutex;
+#endif
+	ArikkeiDict chr2str;
+};
+
+static AZStringShard shards[AZ_STRING_NUM_SHARDS];
+
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+#define AZ_STRING_SHARD_LOCK(s) mtx_lock (&(s)->mutex)
+#define AZ_STRING_SHARD_UNLOCK(s) mtx_unlock (&(s)->mutex)
+#else
+#define AZ_STRING_SHARD_LOCK(s)
+#define AZ_STRING_SHARD_UNLOCK(s)
+#endif
+
+#define AZ_STRING_SHARD(h) (&shards[(h) & (AZ_STRING_NUM_SHARDS - 1)])
+
 static unsigned int
 string_hash (const void *data)
 {
 	AZString *str = *((AZString **) data);
-	return arikkei_memory_hash(str->str, str->length);
+	return str->hash;
 }
 
 static unsigned int
@@ -36,24 +71,42 @@ string_equal (const void *l, const void *r)
 {
 	AZString *lhs = *((AZString **) l);
 	AZString *rhs = *((AZString **) r);
-	if (lhs->length != rhs->length) return 0;
-	return !strcmp ((const char *) lhs->str, (const char *) rhs->str);
+	if ((lhs->hash != rhs->hash) || (lhs->length != rhs->length)) return 0;
+	return !memcmp (lhs->str, rhs->str, lhs->length);
 }
 
 static unsigned int
-string_data_hash (const void *data)
+string_data_equal (const void *l, const void *r)
+{
+	AZStringLookup *lhs = (AZStringLookup *) l;
+	AZString *rhs = *((AZString **) r);
+	if ((lhs->hash != rhs->hash) || (lhs->len != rhs->length)) return 0;
+	return !memcmp (lhs->str, rhs->str, lhs->len);
+}
+
+/* Strings are interned, so the cached content hash and identity are enough */
+static uint32_t
+string_instance_hash (const AZImplementation *impl, void *inst)
 {
-	AZStringLookup *lookup = (AZStringLookup *) data;
-	return arikkei_memory_hash(lookup->str, lookup->len);
+	return (inst) ? ((AZString *) inst)->hash : 0;
 }
 
 static unsigned int
-string_data_equal (const void *l, const void *r)
+string_instance_equals (const AZImplementation *impl, void *lhs, void *rhs)
 {
-	AZStringLookup *lhs = (AZStringLookup *) l;
-	AZString *rhs = *((AZString **) r);
-	if (lhs->len != rhs->length) return 0;
-	return !strncmp ((const char *) lhs->str, (const char *) rhs->str, lhs->len);
+	return lhs == rhs;
+}
+
+/* Lexicographic by bytes, shorter prefix first */
+static int
+string_instance_compare (const AZImplementation *impl, void *lhs, void *rhs)
+{
+	AZString *l = (AZString *) lhs, *r = (AZString *) rhs;
+	if (l == r) return 0;
+	if (!l || !r) return (l != NULL) - (r != NULL);
+	int result = memcmp (l->str, r->str, (l->length < r->length) ? l->length : r->length);
+	if (result) return result;
+	return (l->length > r->length) - (l->length < r->length);
 }
 
 static unsigned int
@@ -106,11 +159,25 @@ deserialize_string (const AZImplementation *impl, AZValue *value, const unsigned
 	return 5 + len;
 }
 
-static void
-string_dispose (AZReferenceClass *klass, AZReference *ref)
+/*
+ * Interned strings are only ever referenced from the table under shard lock, so if the refcount
+ * is still 1 with the lock held no other thread can obtain it anymore
+ */
+
+static unsigned int
+string_drop (AZReferenceClass *klass, AZReference *ref)
 {
 	AZString *str = (AZString *) ref;
-	arikkei_dict_remove_pval (&AZStringKlass.chr2str, str);
+	AZStringShard *shard = AZ_STRING_SHARD(str->hash);
+	AZ_STRING_SHARD_LOCK (shard);
+	if (ref->refcount != 1) {
+		/* Someone looked it up while we were waiting for the lock */
+		AZ_STRING_SHARD_UNLOCK (shard);
+		return 0;
+	}
+	arikkei_dict_remove_pval (&shard->chr2str, str);
+	AZ_STRING_SHARD_UNLOCK (shard);
+	return 1;
 }
 
 AZStringClass AZStringKlass = {
@@ -123,44 +190,63 @@ AZStringClass AZStringKlass = {
 	NULL, NULL,
 	serialize_string, deserialize_string, string_to_string,
 	NULL, NULL},
-	NULL, string_dispose},
-	{0}
+	string_drop, NULL}
 };
 
 void
 az_init_string_class (void)
 {
+	unsigned int i;
+	AZStringKlass.reference_class.klass.hash = string_instance_hash;
+	AZStringKlass.reference_class.klass.equals = string_instance_equals;
+	AZStringKlass.reference_class.klass.compare = string_instance_compare;
 	az_class_new_with_value(&AZStringKlass.reference_class.klass);
-	arikkei_dict_setup_full (&AZStringKlass.chr2str, 701, string_hash, string_equal);
-}
-
-AZString *
-az_string_new (const unsigned char *str)
-{
-	if (!str) return NULL;
-	return az_string_new_length (str, (unsigned int) strlen ((const char *) str));
+	for (i = 0; i < AZ_STRING_NUM_SHARDS; i++) {
+#if defined(AZ_GLOBALS_MULTI_THREAD)
+		mtx_init (&shards[i].mutex, mtx_plain);
+#endif
+		arikkei_dict_setup_full (&shards[i].chr2str, 701 / AZ_STRING_NUM_SHARDS, string_hash, string_equal);
+	}
 }
 
-AZString *
-az_string_new_length (const unsigned char *str, unsigned int length)
+/* Returns new reference to interned string, creates and interns a new string if not found and create is set */
+static AZString *
+string_intern (const unsigned char *str, unsigned int length, unsigned int create)
 {
-	AZString *astr;
-	AZStringLookup lookup = {length, str};
-	AZString **ptr = (AZString **) arikkei_dict_lookup_foreign(&AZStringKlass.chr2str, &lookup, string_data_hash(&lookup), string_data_equal);
+	AZString *astr = NULL;
+	AZStringLookup lookup = {arikkei_memory_hash(str, length), length, str};
+	AZStringShard *shard = AZ_STRING_SHARD(lookup.hash);
+	AZ_STRING_SHARD_LOCK (shard);
+	AZString **ptr = (AZString **) arikkei_dict_lookup_foreign(&shard->chr2str, &lookup, lookup.hash, string_data_equal);
 	if (ptr) {
 		astr = *ptr;
 		az_string_ref (astr);
-	} else {
+	} else if (create) {
 		astr = (AZString *) malloc (sizeof (AZString) + length);
-		az_instance_init_by_type (astr, AZ_TYPE_STRING);
+		az_instance_init (&AZStringKlass.reference_class.klass.impl, astr);
+		astr->hash = lookup.hash;
 		astr->length = length;
 		memcpy ((unsigned char *) astr->str, str, length);
 		((unsigned char *) astr->str)[length] = 0;
-		arikkei_dict_insert_pval (&AZStringKlass.chr2str, astr, astr);
+		arikkei_dict_insert_pval (&shard->chr2str, astr, astr);
 	}
+	AZ_STRING_SHARD_UNLOCK (shard);
 	return astr;
 }
 
+AZString *
+az_string_new (const unsigned char *str)
+{
+	if (!str) return NULL;
+	return az_string_new_length (str, (unsigned int) strlen ((const char *) str));
+}
+
+AZString *
+az_string_new_length (const unsigned char *str, unsigned int length)
+{
+	return string_intern (str, length, 1);
+}
+
 AZString *
 az_string_lookup (const unsigned char *chars)
 {
@@ -171,34 +257,22 @@ az_string_lookup (const unsigned char *chars)
 AZString *
 az_string_lookup_length (const unsigned char *chars, unsigned int length)
 {
-	AZStringLookup lookup = {length, chars};
-	AZString **ptr = (AZString **) arikkei_dict_lookup_foreign(&AZStringKlass.chr2str, &lookup, string_data_hash(&lookup), string_data_equal);
-	if (!ptr) return NULL;
-	AZString *astr = *ptr;
-	if (astr) az_string_ref (astr);
-	return astr;
+	return string_intern (chars, length, 0);
 }
 
 AZString *
 az_string_concat (AZString *lhs, AZString *rhs)
 {
-	AZString *built, *astr;
+	AZString *astr;
+	unsigned char *chars;
 	if (!lhs) return rhs;
 	if (!rhs) return lhs;
-	built = (AZString *) malloc (sizeof (AZString) + lhs->length + rhs->length);
-	az_instance_init_by_type (built, AZ_TYPE_STRING);
-	built->length = lhs->length + rhs->length;
-	if (lhs->length) memcpy ((unsigned char *) built->str, lhs->str, lhs->length);
-	if (rhs->length) memcpy ((unsigned char *) built->str + lhs->length, rhs->str, rhs->length);
-	((unsigned char *) built->str)[lhs->length + rhs->length] = 0;
-	AZString **ptr = (AZString **) arikkei_dict_lookup(&AZStringKlass.chr2str, &built);
-	if (ptr) {
-		az_string_unref (*ptr);
-		return *ptr;
-	} else {
-		arikkei_dict_insert_pval (&AZStringKlass.chr2str, built, built);
-	}
-	return built;
+	chars = (unsigned char *) malloc (lhs->length + rhs->length);
+	if (lhs->length) memcpy (chars, lhs->str, lhs->length);
+	if (rhs->length) memcpy (chars + lhs->length, rhs->str, rhs->length);
+	astr = string_intern (chars, lhs->length + rhs->length, 1);
+	free (chars);
+	return astr;
 }
 
 const unsigned char *
@@ -7,8 +7,6 @@
 * Copyright (C) Lauris Kaplinski 2016-2018
 */
 
-#include <arikkei/arikkei-dict.h>
-
 #include <az/reference.h>
 
 typedef struct _AZStringClass AZStringClass;
@@ -19,13 +17,20 @@ extern "C" {
 
 struct _AZString {
 	AZReference reference;
+	/* Hash of string bytes (arikkei_memory_hash), computed at creation */
+	uint32_t hash;
 	unsigned int length;
 	const unsigned char str[1];
 };
 
+/*
+ * All strings are interned in a global table, so equal strings are always the same instance.
+ * In multi-threaded mode the table is split into shards (by string hash), each protected by
+ * its own mutex.
+ */
+
 struct _AZStringClass {
 	AZReferenceClass reference_class;
-	ArikkeiDict chr2str;
 };
 
 extern AZStringClass AZStringKlass;
@@ -54,6 +59,13 @@ az_string_equals (const AZString *lhs, const AZString *rhs)
 	return lhs == rhs;
 }
 
+/* Cached hash, can be used directly by collections keyed by strings */
+static inline uint32_t
+az_string_hash (const AZString *astr)
+{
+	return astr->hash;
+}
+
 AZString *az_string_concat (AZString *lhs, AZString *rhs);
 
 /* Get serialized string as char array */
@@ -46,31 +46,14 @@ az_type_get_parent_primitive (unsigned int type)
 unsigned int
 az_type_is_a (unsigned int type, unsigned int test)
 {
-	AZClass *klass;
-	unsigned int i;
 #ifdef AZ_SAFETY_CHECKS
 	ENSURE_INITIALIZED();
 	arikkei_return_val_if_fail (az_type_is_valid(type), 0);
 	arikkei_return_val_if_fail (az_type_is_valid(test), 0);
 #endif
-	if (!type) return 0;
+	if (!type || !test) return 0;
 	if (type == test) return 1;
-
-#if defined(AZ_GLOBALS_STATIC) || defined(AZ_GLOBALS_SINGLE_THREAD)
-	test = AZ_TYPE_INDEX(test);
-	uint32_t idx = az_types[AZ_TYPE_INDEX(type)].pidx;
-	while (idx) {
-		if (idx == test) return 1;
-		idx = az_types[idx].pidx;
-	}
-#else
-	klass = AZ_CLASS_FROM_TYPE(type);
-	while (klass->parent) {
-		if (klass->parent->impl.type == test) return 1;
-		klass = klass->parent;
-	}
-#endif
-	return 0;
+	return az_type_descends_from (type, test);
 }
 
 unsigned int
@@ -55,6 +55,20 @@ extern "C" {
  * Basic type queries
  */
 
+/**
+ * @brief Type registry slot
+ *
+ * Besides the class, the slot keeps copies of the class depth and ancestor display so that
+ * subtype tests do not need to resolve classes.
+ */
+typedef struct _AZTypeInfo AZTypeInfo;
+
+struct _AZTypeInfo {
+	AZClass *klass;
+	uint32_t depth;
+	const uint32_t *ancestors;
+};
+
 #if defined(AZ_GLOBALS_STATIC)
 	/* Fixed-length static array */
 	extern AZTypeInfo az_types[];
@@ -0,0 +1,1003 @@
+#define __AZ_BENCH_C__
+
+/*
+ * Microbenchmarks for hot paths of az library
+ *
+ * Usage: az_bench [--json] [--scale N] [NAME...]
+ *
+ * Runs all benchmarks (or those whose name starts with one of the given names) and prints
+ * results as CSV (default) or JSON to stdout, one record per benchmark and thread count.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arikkei/arikkei-threads.h>
+
+#include <az/base.h>
+#include <az/extend.h>
+#include <az/field.h>
+#include <az/function.h>
+#include <az/function-closure.h>
+#include <az/function-native.h>
+#include <az/instance.h>
+#include <az/object.h>
+#include <az/packed-value.h>
+#include <az/primitives.h>
+#include <az/slab.h>
+#include <az/string.h>
+#include <az/types.h>
+#include <az/value.h>
+#include <az/classes/active-object.h>
+#include <az/collections/array-list.h>
+#include <az/collections/btree-map.h>
+#include <az/collections/concurrent-hash-map.h>
+#include <az/collections/deque.h>
+#include <az/collections/flat-hash-map.h>
+#include <az/collections/hash-map.h>
+#include <az/collections/hash-set.h>
+
+#define BENCH_MAX_THREADS 8
+
+static unsigned int json = 0;
+static unsigned int n_records = 0;
+static unsigned int scale = 1;
+static int n_filters = 0;
+static const char **filters = NULL;
+
+/* Defeats dead code elimination */
+static volatile uint64_t sink;
+
+static double
+bench_now (void)
+{
+	struct timespec t;
+	timespec_get (&t, TIME_UTC);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static unsigned int
+bench_enabled (const char *name)
+{
+	if (!n_filters) return 1;
+	for (int i = 0; i < n_filters; i++) {
+		if (!strncmp (name, filters[i], strlen (filters[i]))) return 1;
+	}
+	return 0;
+}
+
+static void
+bench_report (const char *name, unsigned int n_threads, uint64_t n_ops, double seconds)
+{
+	double ns_per_op = (n_ops) ? seconds * 1e9 / n_ops : 0;
+	double mops = (seconds > 0) ? n_ops / seconds / 1e6 : 0;
+	if (json) {
+		fprintf (stdout, "%s\n  {\"name\": \"%s\", \"threads\": %u, \"ops\": %" PRIu64 ", \"seconds\": %.6f, \"ns_per_op\": %.3f, \"mops\": %.3f}",
+			(n_records) ? "," : "", name, n_threads, n_ops, seconds, ns_per_op, mops);
+	} else {
+		fprintf (stdout, "%s,%u,%" PRIu64 ",%.6f,%.3f,%.3f\n", name, n_threads, n_ops, seconds, ns_per_op, mops);
+	}
+	n_records += 1;
+}
+
+/* Type system */
+
+typedef struct {
+	unsigned int n_types;
+	unsigned int n;
+	uint64_t sum;
+} TypeLookupData;
+
+static int
+type_lookup_thread (void *arg)
+{
+	TypeLookupData *d = (TypeLookupData *) arg;
+	for (unsigned int i = 0; i < d->n; i++) {
+		unsigned int idx = 1 + (i % (d->n_types - 1));
+		/* Lookup only needs the index part of type */
+		AZClass *klass = az_type_get_class (idx);
+		if (klass) d->sum += klass->instance_size;
+	}
+	return 0;
+}
+
+static void
+bench_type_lookup (unsigned int n)
+{
+	/* Includes some dynamically registered types */
+	unsigned int n_types = AZ_TYPE_INDEX (AZ_TYPE_ARRAY_LIST) + 1;
+	thrd_t threads[BENCH_MAX_THREADS];
+	TypeLookupData data[BENCH_MAX_THREADS];
+	uint64_t sum = 0;
+	for (unsigned int n_threads = 1; n_threads <= BENCH_MAX_THREADS; n_threads *= 2) {
+		for (unsigned int i = 0; i < n_threads; i++) {
+			data[i].n_types = n_types;
+			data[i].n = n;
+			data[i].sum = 0;
+		}
+		double t0 = bench_now ();
+		for (unsigned int i = 0; i < n_threads; i++) thrd_create (&threads[i], type_lookup_thread, &data[i]);
+		for (unsigned int i = 0; i < n_threads; i++) thrd_join (threads[i], NULL);
+		bench_report ("type-lookup", n_threads, (uint64_t) n_threads * n, bench_now () - t0);
+		for (unsigned int i = 0; i < n_threads; i++) sum += data[i].sum;
+	}
+	sink = sum;
+}
+
+#define BENCH_IS_A_DEPTH 32
+
+static unsigned int bench_is_a_types[BENCH_IS_A_DEPTH];
+static char bench_is_a_names[BENCH_IS_A_DEPTH][16];
+
+/* Reference subtype check by walking the parent chain */
+static unsigned int
+bench_type_is_a_walk (unsigned int type, unsigned int test)
+{
+	if (type == test) return 1;
+	const AZClass *klass = AZ_CLASS_FROM_TYPE (type);
+	while (klass->parent) {
+		if (klass->parent->impl.type == test) return 1;
+		klass = klass->parent;
+	}
+	return 0;
+}
+
+static void
+bench_type_is_a (unsigned int n)
+{
+	unsigned int test_types[4] = {AZ_TYPE_INT32, AZ_TYPE_STRING, AZ_TYPE_ACTIVE_OBJECT, AZ_TYPE_ARRAY_LIST};
+	unsigned int ancestors[4] = {AZ_TYPE_ANY, AZ_TYPE_REFERENCE, AZ_TYPE_OBJECT, AZ_TYPE_BLOCK};
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		sum += az_type_is_a (test_types[i & 3], ancestors[(i >> 2) & 3]);
+	}
+	bench_report ("type-is-a", 1, n, bench_now () - t0);
+	/* Deep hierarchy, ancestor display against parent walk */
+	unsigned int parent = AZ_TYPE_BLOCK;
+	for (int i = 0; i < BENCH_IS_A_DEPTH; i++) {
+		snprintf (bench_is_a_names[i], 16, "BenchIsA%d", i);
+		az_register_type (&bench_is_a_types[i], (const unsigned char *) bench_is_a_names[i], parent, sizeof (AZClass), 0, 0, 0, 0, NULL, NULL, NULL);
+		parent = bench_is_a_types[i];
+	}
+	for (unsigned int walk = 0; walk < 2; walk++) {
+		t0 = bench_now ();
+		for (unsigned int i = 0; i < n; i++) {
+			unsigned int type = bench_is_a_types[i % BENCH_IS_A_DEPTH];
+			unsigned int test = bench_is_a_types[(i / BENCH_IS_A_DEPTH) % BENCH_IS_A_DEPTH];
+			sum += (walk) ? bench_type_is_a_walk (type, test) : az_type_is_a (type, test);
+		}
+		bench_report ((walk) ? "type-is-a-deep-parent-walk" : "type-is-a-deep", 1, n, bench_now () - t0);
+	}
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		sum += az_type_implements (AZ_TYPE_ARRAY_LIST, (i & 1) ? AZ_TYPE_LIST : AZ_TYPE_COLLECTION);
+	}
+	bench_report ("type-implements", 1, n, bench_now () - t0);
+	sink = sum;
+}
+
+static void
+bench_interface (unsigned int n)
+{
+	AZArrayList *alist = az_array_list_new (AZ_TYPE_INT32, 4);
+	const AZImplementation *impl = AZ_IMPL_FROM_TYPE (AZ_TYPE_ARRAY_LIST);
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		void *inst;
+		const AZImplementation *if_impl = az_instance_get_interface (impl, alist, (i & 1) ? AZ_TYPE_LIST : AZ_TYPE_COLLECTION, &inst);
+		sum += (uintptr_t) if_impl;
+	}
+	bench_report ("interface-get", 1, n, bench_now () - t0);
+	az_array_list_delete (alist);
+	sink = sum;
+}
+
+/* References */
+
+typedef struct {
+	AZObject *shared;
+	AZObject *own;
+	unsigned int n;
+} RefData;
+
+static int
+ref_thread (void *arg)
+{
+	RefData *d = (RefData *) arg;
+	for (unsigned int i = 0; i < d->n; i++) {
+		az_object_ref (d->shared);
+		az_object_ref (d->own);
+		az_object_unref (d->own);
+		az_object_unref (d->shared);
+	}
+	return 0;
+}
+
+static unsigned int bench_object_type = 0;
+
+static void
+bench_references (unsigned int n)
+{
+	if (!bench_object_type) {
+		az_register_type (&bench_object_type, (const unsigned char *) "BenchObject", AZ_TYPE_ACTIVE_OBJECT, sizeof (AZActiveObjectClass), sizeof (AZActiveObject), 0, 0, 0, NULL, NULL, NULL);
+	}
+	AZObject *shared = az_object_new (bench_object_type);
+	thrd_t threads[BENCH_MAX_THREADS];
+	RefData data[BENCH_MAX_THREADS];
+	for (unsigned int n_threads = 1; n_threads <= BENCH_MAX_THREADS; n_threads *= 2) {
+		for (unsigned int i = 0; i < n_threads; i++) {
+			data[i].shared = shared;
+			data[i].own = az_object_new (bench_object_type);
+			data[i].n = n / 4;
+		}
+		double t0 = bench_now ();
+		for (unsigned int i = 0; i < n_threads; i++) thrd_create (&threads[i], ref_thread, &data[i]);
+		for (unsigned int i = 0; i < n_threads; i++) thrd_join (threads[i], NULL);
+		bench_report ("reference-ref-unref", n_threads, (uint64_t) n_threads * (n / 4) * 4, bench_now () - t0);
+		for (unsigned int i = 0; i < n_threads; i++) az_object_unref (data[i].own);
+	}
+	az_object_unref (shared);
+}
+
+/* Strings */
+
+static void
+bench_strings (unsigned int n)
+{
+	char c[32];
+	/* Existing strings (lookup path) */
+	AZString *held[256];
+	for (unsigned int i = 0; i < 256; i++) {
+		snprintf (c, 32, "bench string %u", i);
+		held[i] = az_string_new ((const uint8_t *) c);
+	}
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		AZString *str = az_string_new (held[i & 255]->str);
+		az_string_unref (str);
+	}
+	bench_report ("string-intern-existing", 1, n, bench_now () - t0);
+	for (unsigned int i = 0; i < 256; i++) az_string_unref (held[i]);
+	/* New strings (create and destroy) */
+	unsigned int n_new = n / 4;
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n_new; i++) {
+		snprintf (c, 32, "new string %u", i & 4095);
+		AZString *str = az_string_new ((const uint8_t *) c);
+		az_string_unref (str);
+	}
+	bench_report ("string-intern-new", 1, n_new, bench_now () - t0);
+}
+
+/* Properties */
+
+typedef struct {
+	AZClass klass;
+} BenchPropClass;
+
+typedef struct {
+	int32_t value;
+} BenchPropInstance;
+
+static unsigned int bench_prop_type = 0;
+
+static void
+bench_prop_class_init (AZClass *klass)
+{
+	az_class_define_property (klass, 0, (const unsigned char *) "value", AZ_TYPE_INT32, 0, AZ_FIELD_INSTANCE, AZ_FIELD_READ_VALUE, AZ_FIELD_WRITE_VALUE, ARIKKEI_OFFSET (BenchPropInstance, value), NULL, NULL);
+}
+
+static void
+bench_properties (unsigned int n)
+{
+	if (!bench_prop_type) {
+		az_register_type (&bench_prop_type, (const unsigned char *) "BenchProperties", AZ_TYPE_STRUCT, sizeof (BenchPropClass), sizeof (BenchPropInstance), 0, 0, 1,
+			bench_prop_class_init, NULL, NULL);
+	}
+	const AZImplementation *impl = AZ_IMPL_FROM_TYPE (bench_prop_type);
+	BenchPropInstance inst = {0};
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		int32_t v = (int32_t) i;
+		az_instance_set_property_by_key (impl, &inst, (const uint8_t *) "value", AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), &v, NULL);
+	}
+	bench_report ("property-set-by-key", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		const AZImplementation *prop_impl;
+		AZValue64 val;
+		az_instance_get_property_by_key (impl, &inst, (const uint8_t *) "value", &prop_impl, &val);
+		sum += val.value.int32_v;
+	}
+	bench_report ("property-get-by-key", 1, n, bench_now () - t0);
+	/* Inherited property of class class */
+	const AZClass *int_class = AZ_CLASS_FROM_TYPE (AZ_TYPE_INT32);
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		const AZImplementation *prop_impl;
+		AZValue64 val;
+		az_instance_get_property_by_key (&int_class->impl, NULL, (const uint8_t *) "isArithmetic", &prop_impl, &val);
+		sum += val.value.boolean_v;
+	}
+	bench_report ("property-get-by-key-inherited", 1, n, bench_now () - t0);
+	sink = sum;
+}
+
+/* Functions */
+
+static int32_t
+bench_add_i32 (int32_t a, int32_t b)
+{
+	return a + b;
+}
+
+static void
+bench_functions (unsigned int n)
+{
+	unsigned int arg_types[2] = {AZ_TYPE_INT32, AZ_TYPE_INT32};
+	AZFunctionSignature *sig = az_function_signature_new (0, AZ_TYPE_INT32, 2, arg_types);
+	uint64_t sum = 0;
+	/* Direct native call */
+	const AZImplementation *impls[2] = {AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32)};
+	AZValue a, b;
+	const AZValue *vals[2] = {&a, &b};
+	const AZImplementation *ret_impl;
+	AZValue64 ret_val;
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		a.int32_v = i;
+		b.int32_v = 1;
+		az_function_call_native ((void (*) (void)) bench_add_i32, sig, &ret_impl, &ret_val, impls, vals);
+		sum += ret_val.value.int32_v;
+	}
+	bench_report ("function-call-native", 1, n, bench_now () - t0);
+	/* Native call with precompiled plan */
+	const AZNativeCallPlan *plan = az_native_call_plan_get (sig);
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		a.int32_v = i;
+		b.int32_v = 1;
+		az_function_call_native_plan ((void (*) (void)) bench_add_i32, plan, &ret_impl, &ret_val, impls, vals);
+		sum += ret_val.value.int32_v;
+	}
+	bench_report ("function-call-native-plan", 1, n, bench_now () - t0);
+	/* Packed invocation through function interface */
+	AZFunctionNative fnat;
+	az_function_native_setup (&fnat, sig, (void (*) (void)) bench_add_i32);
+	void *f_inst;
+	const AZFunctionImplementation *f_impl = (const AZFunctionImplementation *) az_instance_get_interface_from_type (AZ_TYPE_FUNCTION_NATIVE, &fnat, AZ_TYPE_FUNCTION, &f_inst);
+	AZPackedValue this_val = {0};
+	AZPackedValue args[2];
+	AZPackedValue64 ret;
+	memset (args, 0, sizeof (args));
+	memset (&ret, 0, sizeof (ret));
+	for (unsigned int check = 0; check < 2; check++) {
+		t0 = bench_now ();
+		for (unsigned int i = 0; i < n; i++) {
+			az_packed_value_set_int (&args[0], AZ_TYPE_INT32, i);
+			az_packed_value_set_int (&args[1], AZ_TYPE_INT32, 1);
+			az_function_invoke_packed (f_impl, f_inst, &this_val, &ret, args, check);
+			sum += ret.v.value.int32_v;
+		}
+		bench_report ((check) ? "function-invoke-packed-checked" : "function-invoke-packed", 1, n, bench_now () - t0);
+	}
+	/* Invocation through caller-owned argument frame */
+	union {
+		AZFunctionFrame frame;
+		uint8_t data[AZ_FUNCTION_FRAME_SIZE (2)];
+	} frame_buf;
+	AZFunctionFrame *frame = &frame_buf.frame;
+	az_function_frame_setup (frame, 2);
+	az_function_frame_set_arg (frame, 0, impls[0], &a);
+	az_function_frame_set_arg (frame, 1, impls[1], &b);
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		a.int32_v = i;
+		b.int32_v = 1;
+		az_function_invoke_frame (f_impl, f_inst, frame, &ret_impl, &ret_val, NULL);
+		sum += ret_val.value.int32_v;
+	}
+	bench_report ("function-invoke-frame", 1, n, bench_now () - t0);
+	/* Batch invocation over argument columns */
+	unsigned int n_cols = 1000;
+	AZValue *cols = (AZValue *) malloc (3 * n_cols * sizeof (AZValue));
+	const AZValue *arg_cols[2] = {cols, cols + n_cols};
+	for (unsigned int i = 0; i < n_cols; i++) {
+		cols[i].int32_v = i;
+		cols[n_cols + i].int32_v = 1;
+	}
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i += n_cols) {
+		az_function_invoke_batch (f_impl, f_inst, impls, arg_cols, n_cols, NULL, cols + 2 * n_cols, NULL);
+		sum += cols[2 * n_cols + (i & 0xff)].int32_v;
+	}
+	bench_report ("function-invoke-batch", 1, n, bench_now () - t0);
+	free (cols);
+	/* Invocation through closure with bound first argument */
+	b.int32_v = 1;
+	void *bound_insts[1] = {&b};
+	AZFunctionClosure *closure = az_function_closure_new (AZ_IMPL_FROM_TYPE (AZ_TYPE_FUNCTION_NATIVE), &fnat, 1, impls, bound_insts);
+	void *c_inst;
+	const AZFunctionImplementation *c_impl = (const AZFunctionImplementation *) az_instance_get_interface_from_type (AZ_TYPE_FUNCTION_CLOSURE, closure, AZ_TYPE_FUNCTION, &c_inst);
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		a.int32_v = i;
+		az_function_invoke (c_impl, c_inst, impls, vals, &ret_impl, &ret_val, NULL);
+		sum += ret_val.value.int32_v;
+	}
+	bench_report ("function-invoke-closure", 1, n, bench_now () - t0);
+	az_function_closure_unref (closure);
+	/* Signature compatibility test, private and interned signatures */
+	unsigned int other_types[2] = {AZ_TYPE_INT32, AZ_TYPE_ANY};
+	AZFunctionSignature *other = az_function_signature_new (0, AZ_TYPE_INT32, 2, other_types);
+	for (unsigned int interned = 0; interned < 2; interned++) {
+		const AZFunctionSignature *lhs = (interned) ? az_function_signature_intern (other) : other;
+		const AZFunctionSignature *rhs = (interned) ? az_function_signature_intern (sig) : sig;
+		t0 = bench_now ();
+		for (unsigned int i = 0; i < n; i++) {
+			sum += az_function_signature_is_assignable_to (lhs, rhs, 1);
+		}
+		bench_report ((interned) ? "function-signature-assignable-interned" : "function-signature-assignable", 1, n, bench_now () - t0);
+	}
+	az_function_signature_delete (other);
+	az_function_signature_delete (sig);
+	sink = sum;
+}
+
+/* Slab allocator */
+
+#define BENCH_SLAB_SIZE 48
+#define BENCH_SLAB_BLOCKS 64
+
+typedef struct {
+	unsigned int use_slab;
+	unsigned int n;
+} SlabData;
+
+static int
+slab_thread (void *arg)
+{
+	SlabData *d = (SlabData *) arg;
+	void *blocks[BENCH_SLAB_BLOCKS];
+	for (unsigned int i = 0; i < d->n; i += BENCH_SLAB_BLOCKS) {
+		for (unsigned int j = 0; j < BENCH_SLAB_BLOCKS; j++) {
+			blocks[j] = (d->use_slab) ? az_slab_alloc (BENCH_SLAB_SIZE) : malloc (BENCH_SLAB_SIZE);
+		}
+		for (unsigned int j = 0; j < BENCH_SLAB_BLOCKS; j++) {
+			if (d->use_slab) {
+				az_slab_free (blocks[j], BENCH_SLAB_SIZE);
+			} else {
+				free (blocks[j]);
+			}
+		}
+	}
+	return 0;
+}
+
+static void
+bench_slab (unsigned int n)
+{
+	thrd_t threads[BENCH_MAX_THREADS];
+	SlabData data[BENCH_MAX_THREADS];
+	for (unsigned int m = 0; m < 2; m++) {
+		/* Slab first, then malloc for reference */
+		unsigned int use_slab = (m == 0);
+		for (unsigned int n_threads = 1; n_threads <= BENCH_MAX_THREADS; n_threads *= 2) {
+			for (unsigned int i = 0; i < n_threads; i++) {
+				data[i].use_slab = use_slab;
+				data[i].n = n;
+			}
+			double t0 = bench_now ();
+			for (unsigned int i = 0; i < n_threads; i++) thrd_create (&threads[i], slab_thread, &data[i]);
+			for (unsigned int i = 0; i < n_threads; i++) thrd_join (threads[i], NULL);
+			bench_report ((use_slab) ? "slab-alloc-free" : "slab-alloc-free-malloc", n_threads, (uint64_t) n_threads * n, bench_now () - t0);
+		}
+	}
+}
+
+/* Collections */
+
+static uint32_t
+int32_map_hash (const AZHashMapImplementation *impl, const void *key)
+{
+	uint32_t x = *((const uint32_t *) key);
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	return (x >> 16) ^ x;
+}
+
+static unsigned int
+int32_map_equal (const AZHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+	return *((const uint32_t *) lhs) == *((const uint32_t *) rhs);
+}
+
+static uint32_t
+int32_set_hash (const AZHashSetImplementation *impl, const void *elem)
+{
+	return int32_map_hash (NULL, elem);
+}
+
+static unsigned int
+int32_set_equal (const AZHashSetImplementation *impl, const void *lhs, const void *rhs)
+{
+	return *((const uint32_t *) lhs) == *((const uint32_t *) rhs);
+}
+
+static void
+bench_hash_map (unsigned int n)
+{
+	AZHashMapImplementation impl;
+	az_implementation_init_by_type ((AZImplementation *) &impl, AZ_TYPE_HASH_MAP);
+	impl.key_impl = &AZInt32Klass.impl;
+	impl.val_impl = &AZInt32Klass.impl;
+	impl.root_size = 31;
+	impl.key_offset = 8;
+	impl.key_size = 4;
+	impl.val_offset = 16;
+	impl.val_size = 4;
+	impl.entry_size = 32;
+	impl.hash = int32_map_hash;
+	impl.equal = int32_map_equal;
+	unsigned int n_keys = n / 8;
+	AZHashMap hmap;
+	az_instance_init ((const AZImplementation *) &impl, &hmap);
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		int32_t v = i * 3;
+		az_hash_map_insert (&impl, &hmap, &i, &v);
+	}
+	bench_report ("hash-map-insert", 1, n_keys, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n; i++) {
+		int32_t key = i % (2 * n_keys);
+		const int32_t *val = (const int32_t *) az_hash_map_lookup (&impl, &hmap, &key);
+		if (val) sum += *val;
+	}
+	bench_report ("hash-map-lookup", 1, n, bench_now () - t0);
+	/* Same without callbacks (hashed and compared by key type) */
+	impl.hash = NULL;
+	impl.equal = NULL;
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n; i++) {
+		int32_t key = i % (2 * n_keys);
+		const int32_t *val = (const int32_t *) az_hash_map_lookup (&impl, &hmap, &key);
+		if (val) sum += *val;
+	}
+	bench_report ("hash-map-lookup-typed", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		sum += az_hash_map_remove (&impl, &hmap, &i);
+	}
+	bench_report ("hash-map-remove", 1, n_keys, bench_now () - t0);
+	az_instance_finalize ((const AZImplementation *) &impl, &hmap);
+	sink = sum;
+}
+
+/* Random lookups on table bigger than cache, one at a time and batched */
+static void
+bench_hash_map_batch (unsigned int n)
+{
+	AZHashMapImplementation impl;
+	az_implementation_init_by_type ((AZImplementation *) &impl, AZ_TYPE_HASH_MAP);
+	impl.key_impl = &AZInt32Klass.impl;
+	impl.val_impl = &AZInt32Klass.impl;
+	impl.key_offset = 8;
+	impl.key_size = 4;
+	impl.val_offset = 16;
+	impl.val_size = 4;
+	impl.entry_size = 32;
+	impl.hash = int32_map_hash;
+	impl.equal = int32_map_equal;
+	unsigned int n_keys = n / 2;
+	AZHashMap hmap;
+	az_instance_init ((const AZImplementation *) &impl, &hmap);
+	az_hash_map_reserve (&impl, &hmap, n_keys);
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) az_hash_map_insert (&impl, &hmap, &i, &i);
+	int32_t *keys = (int32_t *) malloc (n * sizeof (int32_t));
+	const void **key_ptrs = (const void **) malloc (n * sizeof (void *));
+	const void **vals = (const void **) malloc (n * sizeof (void *));
+	for (unsigned int i = 0; i < n; i++) {
+		keys[i] = (int32_t) ((i * 2654435761u) % (2 * n_keys));
+		key_ptrs[i] = &keys[i];
+	}
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		if (az_hash_map_lookup (&impl, &hmap, &keys[i])) sum += 1;
+	}
+	bench_report ("hash-map-lookup-random", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	sum += az_hash_map_lookup_batch (&impl, &hmap, key_ptrs, vals, n);
+	bench_report ("hash-map-lookup-batch", 1, n, bench_now () - t0);
+	free (vals);
+	free (key_ptrs);
+	free (keys);
+	az_instance_finalize ((const AZImplementation *) &impl, &hmap);
+	sink = sum;
+}
+
+static uint32_t
+int32_flat_hash (const AZFlatHashMapImplementation *impl, const void *key)
+{
+	return int32_map_hash (NULL, key);
+}
+
+static unsigned int
+int32_flat_equal (const AZFlatHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+	return *((const uint32_t *) lhs) == *((const uint32_t *) rhs);
+}
+
+static void
+bench_flat_hash_map (unsigned int n)
+{
+	AZFlatHashMapImplementation impl;
+	az_implementation_init_by_type ((AZImplementation *) &impl, AZ_TYPE_FLAT_HASH_MAP);
+	impl.key_impl = &AZInt32Klass.impl;
+	impl.val_impl = &AZInt32Klass.impl;
+	impl.key_offset = 0;
+	impl.key_size = 4;
+	impl.val_offset = 4;
+	impl.val_size = 4;
+	impl.slot_size = 8;
+	impl.hash = int32_flat_hash;
+	impl.equal = int32_flat_equal;
+	unsigned int n_keys = n / 8;
+	AZFlatHashMap hmap;
+	az_instance_init ((const AZImplementation *) &impl, &hmap);
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		int32_t v = i * 3;
+		az_flat_hash_map_insert (&impl, &hmap, &i, &v);
+	}
+	bench_report ("flat-hash-map-insert", 1, n_keys, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n; i++) {
+		int32_t key = i % (2 * n_keys);
+		const int32_t *val = (const int32_t *) az_flat_hash_map_lookup (&impl, &hmap, &key);
+		if (val) sum += *val;
+	}
+	bench_report ("flat-hash-map-lookup", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		sum += az_flat_hash_map_remove (&impl, &hmap, &i);
+	}
+	bench_report ("flat-hash-map-remove", 1, n_keys, bench_now () - t0);
+	az_instance_finalize ((const AZImplementation *) &impl, &hmap);
+	sink = sum;
+}
+
+static unsigned int
+btree_sum (const void *key, const void *val, void *data)
+{
+	*((uint64_t *) data) += *((const int32_t *) val);
+	return 1;
+}
+
+/* Random inserts and lookups, short range scans and bulk load */
+static void
+bench_btree_map (unsigned int n)
+{
+	AZBTreeMapImplementation impl;
+	az_implementation_init_by_type ((AZImplementation *) &impl, AZ_TYPE_BTREE_MAP);
+	impl.key_impl = &AZInt32Klass.impl;
+	impl.val_impl = &AZInt32Klass.impl;
+	impl.key_size = 4;
+	impl.val_size = 4;
+	unsigned int n_keys = n / 8;
+	AZBTreeMap tree;
+	az_instance_init ((const AZImplementation *) &impl, &tree);
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		int32_t key = (int32_t) ((i * 2654435761u) % n_keys), v = key * 3;
+		az_btree_map_insert (&impl, &tree, &key, &v);
+	}
+	bench_report ("btree-map-insert", 1, n_keys, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n; i++) {
+		int32_t key = (int32_t) ((i * 2654435761u) % (2 * n_keys));
+		const int32_t *val = (const int32_t *) az_btree_map_lookup (&impl, &tree, &key);
+		if (val) sum += *val;
+	}
+	bench_report ("btree-map-lookup", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n / 64; i++) {
+		int32_t lo = (int32_t) ((i * 2654435761u) % n_keys), hi = lo + 64;
+		az_btree_map_forall_range (&impl, &tree, &lo, &hi, btree_sum, &sum);
+	}
+	bench_report ("btree-map-range-64", 1, n / 64, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		sum += az_btree_map_remove (&impl, &tree, &i);
+	}
+	bench_report ("btree-map-remove", 1, n_keys, bench_now () - t0);
+	int32_t *keys = (int32_t *) malloc (n_keys * sizeof (int32_t));
+	void **ptrs = (void **) malloc (n_keys * sizeof (void *));
+	for (unsigned int i = 0; i < n_keys; i++) {
+		keys[i] = (int32_t) i;
+		ptrs[i] = &keys[i];
+	}
+	t0 = bench_now ();
+	az_btree_map_load_sorted (&impl, &tree, ptrs, ptrs, n_keys);
+	bench_report ("btree-map-load-sorted", 1, n_keys, bench_now () - t0);
+	free (ptrs);
+	free (keys);
+	az_instance_finalize ((const AZImplementation *) &impl, &tree);
+	sink = sum;
+}
+
+static uint32_t
+int32_cmap_hash (const AZConcurrentHashMapImplementation *impl, const void *key)
+{
+	return int32_map_hash (NULL, key);
+}
+
+static unsigned int
+int32_cmap_equal (const AZConcurrentHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+	return *((const uint32_t *) lhs) == *((const uint32_t *) rhs);
+}
+
+typedef struct {
+	const AZConcurrentHashMapImplementation *impl;
+	AZConcurrentHashMap *cmap;
+	unsigned int n_keys;
+	unsigned int n;
+	uint64_t sum;
+} CMapData;
+
+/* Mostly reads with 1/16 of get_or_insert on the same key range */
+static int
+cmap_thread (void *arg)
+{
+	CMapData *d = (CMapData *) arg;
+	for (int32_t i = 0; i < (int32_t) d->n; i++) {
+		int32_t key = (int32_t) ((i * 2654435761u) % d->n_keys);
+		AZValue val;
+		if (i & 15) {
+			if (az_concurrent_hash_map_get (d->impl, d->cmap, &key, &val, sizeof (AZValue))) d->sum += val.int32_v;
+		} else {
+			az_concurrent_hash_map_get_or_insert (d->impl, d->cmap, &key, &i, &val, sizeof (AZValue), NULL);
+		}
+	}
+	return 0;
+}
+
+static void
+bench_concurrent_hash_map (unsigned int n)
+{
+	AZConcurrentHashMapImplementation impl;
+	az_implementation_init_by_type ((AZImplementation *) &impl, AZ_TYPE_CONCURRENT_HASH_MAP);
+	impl.key_impl = &AZInt32Klass.impl;
+	impl.val_impl = &AZInt32Klass.impl;
+	impl.key_offset = 16;
+	impl.key_size = 4;
+	impl.val_offset = 24;
+	impl.val_size = 4;
+	impl.entry_size = 32;
+	impl.hash = int32_cmap_hash;
+	impl.equal = int32_cmap_equal;
+	unsigned int n_keys = n / 8;
+	AZConcurrentHashMap cmap;
+	az_instance_init ((const AZImplementation *) &impl, &cmap);
+	for (int32_t i = 0; i < (int32_t) n_keys; i += 2) az_concurrent_hash_map_insert (&impl, &cmap, &i, &i);
+	thrd_t threads[BENCH_MAX_THREADS];
+	CMapData data[BENCH_MAX_THREADS];
+	for (unsigned int n_threads = 1; n_threads <= BENCH_MAX_THREADS; n_threads *= 2) {
+		for (unsigned int i = 0; i < n_threads; i++) {
+			data[i].impl = &impl;
+			data[i].cmap = &cmap;
+			data[i].n_keys = n_keys;
+			data[i].n = n / 2;
+			data[i].sum = 0;
+		}
+		double t0 = bench_now ();
+		for (unsigned int i = 0; i < n_threads; i++) thrd_create (&threads[i], cmap_thread, &data[i]);
+		for (unsigned int i = 0; i < n_threads; i++) thrd_join (threads[i], NULL);
+		bench_report ("concurrent-hash-map-get", n_threads, (uint64_t) n_threads * (n / 2), bench_now () - t0);
+		for (unsigned int i = 0; i < n_threads; i++) sink += data[i].sum;
+	}
+	az_instance_finalize ((const AZImplementation *) &impl, &cmap);
+}
+
+static void
+bench_hash_set (unsigned int n)
+{
+	AZHashSetImplementation impl;
+	az_implementation_init_by_type ((AZImplementation *) &impl, AZ_TYPE_HASH_SET);
+	impl.elem_impl = &AZInt32Klass.impl;
+	impl.root_size = 31;
+	impl.elem_offset = 8;
+	impl.elem_size = 4;
+	impl.entry_size = 16;
+	impl.hash = int32_set_hash;
+	impl.equal = int32_set_equal;
+	unsigned int n_keys = n / 8;
+	AZHashSet hset;
+	az_instance_init ((const AZImplementation *) &impl, &hset);
+	uint64_t sum = 0;
+	double t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		az_hash_set_insert (&impl, &hset, &i);
+	}
+	bench_report ("hash-set-insert", 1, n_keys, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n; i++) {
+		int32_t key = i % (2 * n_keys);
+		sum += az_hash_set_contains (&impl, &hset, &key);
+	}
+	bench_report ("hash-set-contains", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	for (int32_t i = 0; i < (int32_t) n_keys; i++) {
+		sum += az_hash_set_remove (&impl, &hset, &i);
+	}
+	bench_report ("hash-set-remove", 1, n_keys, bench_now () - t0);
+	az_instance_finalize ((const AZImplementation *) &impl, &hset);
+	sink = sum;
+}
+
+static void
+bench_array_list (unsigned int n)
+{
+	AZArrayList *alist = az_array_list_new (AZ_TYPE_INT32, 4);
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		int32_t v = (int32_t) i;
+		az_array_list_append (alist, AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), &v);
+	}
+	bench_report ("array-list-append", 1, n, bench_now () - t0);
+	int64_t sum = 0;
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		AZValue val;
+		az_array_list_get_element (alist, i, &val, 16);
+		sum += val.int32_v;
+	}
+	bench_report ("array-list-get", 1, n, bench_now () - t0);
+	az_array_list_delete (alist);
+	int32_t *vals = (int32_t *) az_value_new_array (AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), 1000);
+	for (unsigned int i = 0; i < 1000; i++) vals[i] = (int32_t) i;
+	alist = az_array_list_new (AZ_TYPE_INT32, 4);
+	t0 = bench_now ();
+	az_array_list_reserve (alist, n);
+	for (unsigned int i = 0; i < n; i += 1000) {
+		az_array_list_append_n (alist, AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), vals, (n - i < 1000) ? n - i : 1000);
+	}
+	bench_report ("array-list-append-n", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	while (alist->list.collection.size) {
+		unsigned int len = alist->list.collection.size;
+		az_array_list_remove_range (alist, (len < 1000) ? 0 : len - 1000, (len < 1000) ? len : 1000);
+	}
+	bench_report ("array-list-remove-range", 1, n, bench_now () - t0);
+	az_array_list_delete (alist);
+	az_value_delete_array (AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), vals, 1000);
+	sink = sum;
+}
+
+/* Work queue of 1000 entries, push to back and pop from front */
+static void
+bench_deque (unsigned int n)
+{
+	AZDeque *deque = az_deque_new (AZ_TYPE_INT32, 4);
+	AZArrayList *alist = az_array_list_new (AZ_TYPE_INT32, 4);
+	for (int32_t i = 0; i < 1000; i++) {
+		az_deque_push_back (deque, AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), &i);
+		az_array_list_append (alist, AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), &i);
+	}
+	int64_t sum = 0;
+	double t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		const AZImplementation *impl;
+		AZValue val;
+		az_deque_pop_front (deque, &impl, &val, 16);
+		sum += val.int32_v;
+		az_deque_push_back (deque, impl, &val);
+	}
+	bench_report ("deque-fifo", 1, n, bench_now () - t0);
+	t0 = bench_now ();
+	for (unsigned int i = 0; i < n; i++) {
+		AZValue val;
+		const AZImplementation *impl = az_array_list_get_element (alist, 0, &val, 16);
+		az_array_list_remove (alist, 0);
+		sum += val.int32_v;
+		az_array_list_append (alist, impl, &val);
+	}
+	bench_report ("deque-fifo-array-list", 1, n, bench_now () - t0);
+	az_array_list_delete (alist);
+	az_deque_delete (deque);
+	sink = sum;
+}
+
+/* Serialization */
+
+static void
+bench_serialization (unsigned int n)
+{
+	unsigned char buf[64];
+	uint64_t sum = 0;
+	const AZImplementation *impls[3] = {AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), AZ_IMPL_FROM_TYPE (AZ_TYPE_DOUBLE), AZ_IMPL_FROM_TYPE (AZ_TYPE_STRING)};
+	const char *names[3] = {"serialize-roundtrip-int32", "serialize-roundtrip-double", "serialize-roundtrip-string"};
+	AZString *str = az_string_new ((const uint8_t *) "serialization benchmark");
+	for (unsigned int k = 0; k < 3; k++) {
+		AZValue src, dst;
+		if (k == 0) src.int32_v = 12345;
+		if (k == 1) src.double_v = 3.14159;
+		if (k == 2) src.string = str;
+		void *inst = (k == 2) ? (void *) str : (void *) &src;
+		double t0 = bench_now ();
+		for (unsigned int i = 0; i < n; i++) {
+			unsigned int len = az_instance_serialize (impls[k], inst, buf, 64, NULL);
+			sum += az_value_deserialize (impls[k], &dst, buf, len, NULL);
+			az_value_clear (impls[k], &dst);
+		}
+		bench_report (names[k], 1, n, bench_now () - t0);
+	}
+	az_string_unref (str);
+	sink = sum;
+}
+
+typedef struct {
+	const char *name;
+	void (*run) (unsigned int n);
+	unsigned int n;
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+	{"type", bench_type_lookup, 10000000},
+	{"type", bench_type_is_a, 10000000},
+	{"interface", bench_interface, 10000000},
+	{"reference", bench_references, 4000000},
+	{"slab", bench_slab, 4000000},
+	{"string", bench_strings, 2000000},
+	{"property", bench_properties, 2000000},
+	{"function", bench_functions, 2000000},
+	{"hash-map", bench_hash_map, 2000000},
+	{"hash-map-batch", bench_hash_map_batch, 4000000},
+	{"flat-hash-map", bench_flat_hash_map, 2000000},
+	{"concurrent-hash-map", bench_concurrent_hash_map, 2000000},
+	{"hash-set", bench_hash_set, 2000000},
+	{"btree-map", bench_btree_map, 2000000},
+	{"array-list", bench_array_list, 2000000},
+	{"deque", bench_deque, 2000000},
+	{"serialize", bench_serialization, 2000000}
+};
+
+int
+main (int argc, const char *argv[])
+{
+	filters = (const char **) malloc (argc * sizeof (const char *));
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp (argv[i], "--json")) {
+			json = 1;
+		} else if (!strcmp (argv[i], "--scale") && (i + 1 < argc)) {
+			scale = (unsigned int) atoi (argv[++i]);
+			if (!scale) scale = 1;
+		} else {
+			filters[n_filters++] = argv[i];
+		}
+	}
+	az_init ();
+	if (json) {
+		fprintf (stdout, "[");
+	} else {
+		fprintf (stdout, "name,threads,ops,seconds,ns_per_op,mops\n");
+	}
+	for (unsigned int i = 0; i < sizeof (benchmarks) / sizeof (benchmarks[0]); i++) {
+		if (!bench_enabled (benchmarks[i].name)) continue;
+		benchmarks[i].run (benchmarks[i].n / scale);
+	}
+	if (json) fprintf (stdout, "\n]\n");
+	free (filters);
+	return 0;
+}
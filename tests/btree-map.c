@@ -0,0 +1,328 @@
+#define __BTREE_MAP_TEST_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <az/az.h>
+#include <az/base.h>
+#include <az/value.h>
+#include <az/instance.h>
+#include <az/string.h>
+#include <az/collections/collection.h>
+#include <az/collections/map.h>
+#include <az/collections/btree-map.h>
+
+#include "unity/unity.h"
+
+#define NUM_ENTRIES 10000
+
+static void
+btree_map_impl_setup(AZBTreeMapImplementation *impl, unsigned int node_size)
+{
+    az_implementation_init_by_type((AZImplementation *) impl, AZ_TYPE_BTREE_MAP);
+    impl->key_impl = &AZInt32Klass.impl;
+    impl->val_impl = &AZInt32Klass.impl;
+    impl->node_size = node_size;
+    impl->key_size = 4;
+    impl->val_size = 4;
+}
+
+static void
+shuffle(int32_t *keys, unsigned int n)
+{
+    for (unsigned int i = n - 1; i > 0; i--) {
+        unsigned int j = (unsigned int) rand() % (i + 1);
+        int32_t t = keys[i];
+        keys[i] = keys[j];
+        keys[j] = t;
+    }
+}
+
+/* Iteration has to be in strictly ascending order and visit every entry once */
+static void
+check_order(const AZBTreeMapImplementation *impl, AZBTreeMap *tree)
+{
+    unsigned int count = 0;
+    int32_t last = 0;
+    AZValue iter;
+    const AZImplementation *iter_impl = az_collection_get_iterator(&impl->map_impl.collection_impl, &tree->map.collection, &iter);
+    while (iter_impl) {
+        AZValue key, val;
+        TEST_ASSERT_NOT_NULL(az_map_get_key(&impl->map_impl, &tree->map, &iter, &key, sizeof(AZValue)));
+        TEST_ASSERT_NOT_NULL(az_collection_get_element(&impl->map_impl.collection_impl, &tree->map.collection, &iter, &val, sizeof(AZValue)));
+        if (count) TEST_ASSERT_TRUE(key.int32_v > last);
+        TEST_ASSERT_EQUAL_INT32(key.int32_v * 3, val.int32_v);
+        last = key.int32_v;
+        count += 1;
+        iter_impl = az_collection_iterator_next(&impl->map_impl.collection_impl, &tree->map.collection, &iter);
+    }
+    TEST_ASSERT_EQUAL_UINT(tree->map.collection.size, count);
+}
+
+static void
+test_insert_remove(const AZBTreeMapImplementation *impl, int32_t *keys, unsigned int n_entries)
+{
+    AZBTreeMap tree;
+    az_instance_init((const AZImplementation *) impl, &tree);
+
+    TEST_ASSERT_EQUAL_UINT(AZ_TYPE_INT32, az_collection_get_element_type((AZCollectionImplementation *) impl, &tree.map.collection));
+    TEST_ASSERT_EQUAL_UINT(AZ_TYPE_INT32, az_map_get_key_type(&impl->map_impl, &tree.map));
+
+    for (unsigned int i = 0; i < n_entries; i++) {
+        int32_t val = keys[i] * 3;
+        az_btree_map_insert(impl, &tree, &keys[i], &val);
+    }
+    TEST_ASSERT_EQUAL_UINT(n_entries, tree.map.collection.size);
+    TEST_ASSERT_TRUE(tree.height > 0);
+    check_order(impl, &tree);
+
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT(az_btree_map_exists(impl, &tree, &keys[i]));
+        const int32_t *found = (const int32_t *) az_btree_map_lookup(impl, &tree, &keys[i]);
+        TEST_ASSERT_NOT_NULL(found);
+        TEST_ASSERT_EQUAL_INT32(keys[i] * 3, *found);
+    }
+    int32_t absent = -1;
+    TEST_ASSERT(!az_btree_map_exists(impl, &tree, &absent));
+
+    /* Overwrite keeps size */
+    int32_t val = -5;
+    az_btree_map_insert(impl, &tree, &keys[0], &val);
+    TEST_ASSERT_EQUAL_UINT(n_entries, tree.map.collection.size);
+    TEST_ASSERT_EQUAL_INT32(-5, *((const int32_t *) az_btree_map_lookup(impl, &tree, &keys[0])));
+    val = keys[0] * 3;
+    az_btree_map_insert(impl, &tree, &keys[0], &val);
+
+    /* Map and keyset interfaces */
+    AZValue lookup;
+    TEST_ASSERT_NOT_NULL(az_map_lookup(&impl->map_impl, &tree.map, &AZInt32Klass.impl, &keys[1], &lookup, sizeof(AZValue)));
+    TEST_ASSERT_EQUAL_INT32(keys[1] * 3, lookup.int32_v);
+    TEST_ASSERT(az_collection_contains(&impl->map_impl.collection_impl, &tree.map.collection, &AZInt32Klass.impl, &val));
+    AZSet *keyset;
+    const AZSetImplementation *keyset_impl = az_map_get_keys(&impl->map_impl, &tree.map, &keyset);
+    TEST_ASSERT(az_collection_contains(&keyset_impl->collection_impl, &keyset->collection, &AZInt32Klass.impl, &keys[2]));
+    TEST_ASSERT(!az_collection_contains(&keyset_impl->collection_impl, &keyset->collection, &AZInt32Klass.impl, &absent));
+
+    /* Remove every other key in random order */
+    for (unsigned int i = 0; i < n_entries; i += 2) {
+        TEST_ASSERT(az_btree_map_remove(impl, &tree, &keys[i]));
+        TEST_ASSERT(!az_btree_map_remove(impl, &tree, &keys[i]));
+    }
+    TEST_ASSERT_EQUAL_UINT(n_entries / 2, tree.map.collection.size);
+    check_order(impl, &tree);
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT_EQUAL_UINT(i & 1, az_btree_map_exists(impl, &tree, &keys[i]));
+    }
+
+    /* Reinsert and remove everything */
+    for (unsigned int i = 0; i < n_entries; i += 2) {
+        int32_t val = keys[i] * 3;
+        az_btree_map_insert(impl, &tree, &keys[i], &val);
+    }
+    check_order(impl, &tree);
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT(az_btree_map_remove(impl, &tree, &keys[i]));
+    }
+    TEST_ASSERT_EQUAL_UINT(0, tree.map.collection.size);
+    TEST_ASSERT_NULL(tree.root);
+    TEST_ASSERT_NULL(az_collection_get_iterator(&impl->map_impl.collection_impl, &tree.map.collection, &lookup));
+
+    az_instance_finalize((const AZImplementation *) impl, &tree);
+}
+
+static unsigned int
+sum_range(const void *key, const void *val, void *data)
+{
+    *((int64_t *) data) += *((const int32_t *) key);
+    return 1;
+}
+
+/* Even keys 0..2(n-1) */
+static void
+test_range(const AZBTreeMapImplementation *impl, unsigned int n_entries)
+{
+    AZBTreeMap tree;
+    az_instance_init((const AZImplementation *) impl, &tree);
+    for (int32_t i = 0; i < (int32_t) n_entries; i++) {
+        int32_t key = 2 * i, val = key * 3;
+        az_btree_map_insert(impl, &tree, &key, &val);
+    }
+
+    AZValue iter;
+    int32_t key = 101;
+    TEST_ASSERT_NOT_NULL(az_btree_map_lower_bound(impl, &tree, &key, &iter));
+    TEST_ASSERT_EQUAL_INT32(102, *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+    TEST_ASSERT_EQUAL_INT32(306, *((const int32_t *) az_btree_map_iterator_val(impl, &tree, &iter)));
+    TEST_ASSERT_NOT_NULL(az_btree_map_floor(impl, &tree, &key, &iter));
+    TEST_ASSERT_EQUAL_INT32(100, *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+    key = 100;
+    TEST_ASSERT_NOT_NULL(az_btree_map_lower_bound(impl, &tree, &key, &iter));
+    TEST_ASSERT_EQUAL_INT32(100, *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+    TEST_ASSERT_NOT_NULL(az_btree_map_upper_bound(impl, &tree, &key, &iter));
+    TEST_ASSERT_EQUAL_INT32(102, *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+    TEST_ASSERT_NOT_NULL(az_btree_map_floor(impl, &tree, &key, &iter));
+    TEST_ASSERT_EQUAL_INT32(100, *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+
+    /* Out of range */
+    key = -1;
+    TEST_ASSERT_NULL(az_btree_map_floor(impl, &tree, &key, &iter));
+    TEST_ASSERT_NOT_NULL(az_btree_map_lower_bound(impl, &tree, &key, &iter));
+    TEST_ASSERT_EQUAL_INT32(0, *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+    key = 2 * n_entries;
+    TEST_ASSERT_NULL(az_btree_map_lower_bound(impl, &tree, &key, &iter));
+    TEST_ASSERT_NOT_NULL(az_btree_map_floor(impl, &tree, &key, &iter));
+    TEST_ASSERT_EQUAL_INT32(2 * (n_entries - 1), *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+
+    /* Forward range scan with collection iterator */
+    int32_t lo = 1000, hi = 2000;
+    unsigned int count = 0;
+    const AZImplementation *iter_impl = az_btree_map_lower_bound(impl, &tree, &lo, &iter);
+    while (iter_impl && (*((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)) < hi)) {
+        count += 1;
+        iter_impl = az_collection_iterator_next(&impl->map_impl.collection_impl, &tree.map.collection, &iter);
+    }
+    TEST_ASSERT_EQUAL_UINT(500, count);
+    int64_t sum = 0;
+    TEST_ASSERT(az_btree_map_forall_range(impl, &tree, &lo, &hi, sum_range, &sum));
+    TEST_ASSERT_EQUAL_INT64(500 * (1000 + 1998) / 2, sum);
+
+    /* Backward scan over everything */
+    count = 0;
+    iter_impl = az_btree_map_get_last(impl, &tree, &iter);
+    int32_t expected = 2 * (n_entries - 1);
+    while (iter_impl) {
+        TEST_ASSERT_EQUAL_INT32(expected, *((const int32_t *) az_btree_map_iterator_key(impl, &tree, &iter)));
+        expected -= 2;
+        count += 1;
+        iter_impl = az_btree_map_iterator_prev(impl, &tree, &iter);
+    }
+    TEST_ASSERT_EQUAL_UINT(n_entries, count);
+
+    az_instance_finalize((const AZImplementation *) impl, &tree);
+}
+
+static void
+test_load_sorted(const AZBTreeMapImplementation *impl, int32_t *keys, unsigned int n_entries)
+{
+    int32_t *vals = (int32_t *) malloc(n_entries * sizeof(int32_t));
+    void **key_ptrs = (void **) malloc(n_entries * sizeof(void *));
+    void **val_ptrs = (void **) malloc(n_entries * sizeof(void *));
+    for (unsigned int i = 0; i < n_entries; i++) {
+        keys[i] = (int32_t) i * 5;
+        vals[i] = keys[i] * 3;
+        key_ptrs[i] = &keys[i];
+        val_ptrs[i] = &vals[i];
+    }
+
+    for (unsigned int n = 1; n <= n_entries; n = n * 7 + 1) {
+        AZBTreeMap tree;
+        az_instance_init((const AZImplementation *) impl, &tree);
+        az_btree_map_load_sorted(impl, &tree, key_ptrs, val_ptrs, n);
+        TEST_ASSERT_EQUAL_UINT(n, tree.map.collection.size);
+        check_order(impl, &tree);
+        /* The tree has to stay valid for updates */
+        for (unsigned int i = 0; i < n; i++) {
+            int32_t key = keys[i] + 1, val = key * 3;
+            az_btree_map_insert(impl, &tree, &key, &val);
+        }
+        for (unsigned int i = 0; i < n; i += 2) {
+            TEST_ASSERT(az_btree_map_remove(impl, &tree, &keys[i]));
+        }
+        TEST_ASSERT_EQUAL_UINT(2 * n - (n + 1) / 2, tree.map.collection.size);
+        check_order(impl, &tree);
+        az_instance_finalize((const AZImplementation *) impl, &tree);
+    }
+
+    /* Unsorted input falls back to insertion */
+    shuffle(keys, n_entries);
+    AZBTreeMap tree;
+    az_instance_init((const AZImplementation *) impl, &tree);
+    for (unsigned int i = 0; i < n_entries; i++) vals[i] = keys[i] * 3;
+    az_btree_map_load_sorted(impl, &tree, key_ptrs, val_ptrs, n_entries);
+    TEST_ASSERT_EQUAL_UINT(n_entries, tree.map.collection.size);
+    check_order(impl, &tree);
+    az_instance_finalize((const AZImplementation *) impl, &tree);
+
+    free(val_ptrs);
+    free(key_ptrs);
+    free(vals);
+}
+
+/* String keys are ordered by the class compare, init has to reset compare of uninitialized implementation */
+static void
+test_string_keys(void)
+{
+    AZBTreeMapImplementation impl;
+    memset(&impl, 0xff, sizeof(impl));
+    az_implementation_init_by_type((AZImplementation *) &impl, AZ_TYPE_BTREE_MAP);
+    impl.key_impl = AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING);
+    impl.val_impl = &AZInt32Klass.impl;
+    impl.key_size = 8;
+    impl.val_size = 4;
+
+    AZBTreeMap tree;
+    az_instance_init((const AZImplementation *) &impl, &tree);
+    for (int32_t i = 0; i < 1000; i++) {
+        char c[32];
+        snprintf(c, 32, "key %04d", (i * 37) % 1000);
+        AZString *key = az_string_new((const unsigned char *) c);
+        int32_t val = (i * 37) % 1000;
+        az_btree_map_insert(&impl, &tree, key, &val);
+        az_string_unref(key);
+    }
+    TEST_ASSERT_EQUAL_UINT(1000, tree.map.collection.size);
+    int32_t expected = 0;
+    AZValue iter;
+    const AZImplementation *iter_impl = az_collection_get_iterator(&impl.map_impl.collection_impl, &tree.map.collection, &iter);
+    while (iter_impl) {
+        TEST_ASSERT_EQUAL_INT32(expected, *((const int32_t *) az_btree_map_iterator_val(&impl, &tree, &iter)));
+        expected += 1;
+        iter_impl = az_collection_iterator_next(&impl.map_impl.collection_impl, &tree.map.collection, &iter);
+    }
+    TEST_ASSERT_EQUAL_INT32(1000, expected);
+
+    AZString *key = az_string_new((const unsigned char *) "key 05");
+    TEST_ASSERT_NOT_NULL(az_btree_map_lower_bound(&impl, &tree, key, &iter));
+    TEST_ASSERT_EQUAL_STRING("key 0500", (const char *) ((const AZString *) az_btree_map_iterator_key(&impl, &tree, &iter))->str);
+    az_string_unref(key);
+    for (int32_t i = 0; i < 1000; i += 2) {
+        char c[32];
+        snprintf(c, 32, "key %04d", i);
+        AZString *key = az_string_new((const unsigned char *) c);
+        TEST_ASSERT(az_btree_map_remove(&impl, &tree, key));
+        az_string_unref(key);
+    }
+    TEST_ASSERT_EQUAL_UINT(500, tree.map.collection.size);
+    az_instance_finalize((const AZImplementation *) &impl, &tree);
+    TEST_ASSERT_NULL(az_string_lookup((const unsigned char *) "key 0001"));
+    TEST_ASSERT_NULL(az_string_lookup((const unsigned char *) "key 0000"));
+}
+
+void
+test_btree_map(void)
+{
+    az_init();
+
+    static int32_t keys[NUM_ENTRIES];
+    srand(42);
+    for (unsigned int i = 0; i < NUM_ENTRIES; i++) keys[i] = (int32_t) i;
+    shuffle(keys, NUM_ENTRIES);
+
+    /* Default and smallest nodes (deep tree) */
+    AZBTreeMapImplementation impl = {};
+    btree_map_impl_setup(&impl, 256);
+    AZBTreeMapImplementation small_impl = {};
+    btree_map_impl_setup(&small_impl, 64);
+
+    test_insert_remove(&impl, keys, NUM_ENTRIES);
+    test_insert_remove(&small_impl, keys, NUM_ENTRIES);
+
+    test_range(&impl, NUM_ENTRIES);
+    test_range(&small_impl, NUM_ENTRIES);
+
+    test_load_sorted(&impl, keys, NUM_ENTRIES);
+    test_load_sorted(&small_impl, keys, NUM_ENTRIES);
+
+    test_string_keys();
+}
@@ -0,0 +1,412 @@
+#define __CONCURRENT_HASH_MAP_TEST_C__
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arikkei/arikkei-threads.h>
+
+#include <az/az.h>
+#include <az/base.h>
+#include <az/value.h>
+#include <az/instance.h>
+#include <az/string.h>
+#include <az/collections/collection.h>
+#include <az/collections/map.h>
+#include <az/collections/concurrent-hash-map.h>
+
+#include "unity/unity.h"
+
+#define NUM_ENTRIES 10000
+#define NUM_THREADS 8
+#define NUM_SHARED_KEYS 2000
+
+static uint32_t
+int32_hash(const AZConcurrentHashMapImplementation *impl, const void *key)
+{
+    uint32_t x = *((const uint32_t *) key);
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = (x >> 16) ^ x;
+    return x;
+}
+
+static unsigned int
+int32_equal(const AZConcurrentHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+    return *((const uint32_t *) lhs) == *((const uint32_t *) rhs);
+}
+
+/* Int32 keys, string values */
+static void
+concurrent_hash_map_impl_setup(AZConcurrentHashMapImplementation *impl)
+{
+    az_implementation_init_by_type((AZImplementation *) impl, AZ_TYPE_CONCURRENT_HASH_MAP);
+    impl->key_impl = &AZInt32Klass.impl;
+    impl->val_impl = AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING);
+    impl->key_offset = 16;
+    impl->key_size = 4;
+    impl->val_offset = 24;
+    impl->val_size = 8;
+    impl->entry_size = 32;
+    impl->hash = int32_hash;
+    impl->equal = int32_equal;
+}
+
+static AZString *
+key_string(const char *prefix, int32_t key)
+{
+    char c[32];
+    snprintf(c, 32, "%s %d", prefix, key);
+    return az_string_new((const unsigned char *) c);
+}
+
+typedef struct {
+    const AZConcurrentHashMapImplementation *impl;
+    AZConcurrentHashMap *cmap;
+    unsigned int count;
+} ForallData;
+
+/* Looks up the same key again from forall callback */
+static unsigned int
+forall_lookup(const void *key, const void *val, void *data)
+{
+    ForallData *d = (ForallData *) data;
+    AZValue copy;
+    const AZImplementation *val_impl = az_concurrent_hash_map_get(d->impl, d->cmap, key, &copy, sizeof(AZValue));
+    if (!val_impl) return 0;
+    unsigned int same = copy.string == (const AZString *) val;
+    az_value_clear(val_impl, &copy);
+    d->count += 1;
+    return same;
+}
+
+/* The key may have been removed concurrently, but if present, it has to have the same value */
+static unsigned int
+forall_lookup_concurrent(const void *key, const void *val, void *data)
+{
+    ForallData *d = (ForallData *) data;
+    AZValue copy;
+    const AZImplementation *val_impl = az_concurrent_hash_map_get(d->impl, d->cmap, key, &copy, sizeof(AZValue));
+    if (!val_impl) return 1;
+    unsigned int same = copy.string == (const AZString *) val;
+    az_value_clear(val_impl, &copy);
+    d->count += 1;
+    return same;
+}
+
+static void
+test_basic(const AZConcurrentHashMapImplementation *impl)
+{
+    AZConcurrentHashMap cmap;
+    az_instance_init((const AZImplementation *) impl, &cmap);
+
+    TEST_ASSERT_EQUAL_UINT(AZ_TYPE_STRING, az_collection_get_element_type((AZCollectionImplementation *) impl, &cmap.map.collection));
+    TEST_ASSERT_EQUAL_UINT(AZ_TYPE_INT32, az_map_get_key_type(&impl->map_impl, &cmap.map));
+
+    for (int32_t i = 0; i < NUM_ENTRIES; i++) {
+        AZString *str = key_string("value", i);
+        az_concurrent_hash_map_insert(impl, &cmap, &i, str);
+        az_string_unref(str);
+    }
+    TEST_ASSERT_EQUAL_UINT(NUM_ENTRIES, az_collection_get_size(&impl->map_impl.collection_impl, &cmap.map.collection));
+    TEST_ASSERT_EQUAL_UINT(NUM_ENTRIES, az_collection_get_size(&impl->map_impl.keyset_impl.collection_impl, &cmap.map.collection));
+    TEST_ASSERT_EQUAL_UINT(NUM_ENTRIES, az_concurrent_hash_map_get_size(&cmap));
+
+    for (int32_t i = 0; i < NUM_ENTRIES; i++) {
+        AZValue val;
+        TEST_ASSERT(az_concurrent_hash_map_exists(impl, &cmap, &i));
+        const AZImplementation *val_impl = az_concurrent_hash_map_get(impl, &cmap, &i, &val, sizeof(AZValue));
+        TEST_ASSERT_EQUAL_PTR(impl->val_impl, val_impl);
+        AZString *str = key_string("value", i);
+        TEST_ASSERT_EQUAL_PTR(str, val.string);
+        az_string_unref(str);
+        az_value_clear(val_impl, &val);
+    }
+
+    /* Map interface and iteration */
+    unsigned int count = 0;
+    AZValue iter;
+    const AZImplementation *iter_impl = az_collection_get_iterator(&impl->map_impl.collection_impl, &cmap.map.collection, &iter);
+    while (iter_impl) {
+        AZValue key, val;
+        TEST_ASSERT_NOT_NULL(az_map_get_key(&impl->map_impl, &cmap.map, &iter, &key, sizeof(AZValue)));
+        TEST_ASSERT_NOT_NULL(az_collection_get_element(&impl->map_impl.collection_impl, &cmap.map.collection, &iter, &val, sizeof(AZValue)));
+        AZString *str = key_string("value", key.int32_v);
+        TEST_ASSERT_EQUAL_PTR(str, val.string);
+        TEST_ASSERT(az_collection_contains(&impl->map_impl.collection_impl, &cmap.map.collection, impl->val_impl, str));
+        az_string_unref(str);
+        az_value_clear(impl->val_impl, &val);
+        count += 1;
+        iter_impl = az_collection_iterator_next(&impl->map_impl.collection_impl, &cmap.map.collection, &iter);
+    }
+    TEST_ASSERT_EQUAL_UINT(NUM_ENTRIES, count);
+
+    /* Lookups from forall callback */
+    ForallData fdata = { impl, &cmap, 0 };
+    TEST_ASSERT(az_concurrent_hash_map_forall(impl, &cmap, forall_lookup, &fdata));
+    TEST_ASSERT_EQUAL_UINT(NUM_ENTRIES, fdata.count);
+
+    /* Value copies stay alive after removal */
+    int32_t key = 7;
+    AZValue val;
+    TEST_ASSERT_NOT_NULL(az_concurrent_hash_map_get(impl, &cmap, &key, &val, sizeof(AZValue)));
+    TEST_ASSERT(az_concurrent_hash_map_remove(impl, &cmap, &key));
+    TEST_ASSERT(!az_concurrent_hash_map_remove(impl, &cmap, &key));
+    TEST_ASSERT(!az_concurrent_hash_map_exists(impl, &cmap, &key));
+    TEST_ASSERT_EQUAL_UINT(1, val.string->reference.refcount);
+    TEST_ASSERT_EQUAL_STRING("value 7", (const char *) val.string->str);
+    az_value_clear(impl->val_impl, &val);
+    TEST_ASSERT_EQUAL_UINT(NUM_ENTRIES - 1, az_collection_get_size(&impl->map_impl.collection_impl, &cmap.map.collection));
+    TEST_ASSERT_EQUAL_UINT(NUM_ENTRIES - 1, az_concurrent_hash_map_get_size(&cmap));
+
+    az_concurrent_hash_map_clear(impl, &cmap);
+    TEST_ASSERT_EQUAL_UINT(0, az_collection_get_size(&impl->map_impl.collection_impl, &cmap.map.collection));
+    TEST_ASSERT_EQUAL_UINT(0, az_concurrent_hash_map_get_size(&cmap));
+    TEST_ASSERT_NULL(az_collection_get_iterator(&impl->map_impl.collection_impl, &cmap.map.collection, &iter));
+
+    az_instance_finalize((const AZImplementation *) impl, &cmap);
+}
+
+typedef struct {
+    const AZConcurrentHashMapImplementation *impl;
+    AZConcurrentHashMap *cmap;
+    unsigned int thread;
+    unsigned int n_inserted;
+    AZString *results[NUM_SHARED_KEYS];
+} MTMapData;
+
+static atomic_uint n_computed;
+
+static unsigned int
+compute_value(const void *key, AZValue *val, void *data)
+{
+    atomic_fetch_add(&n_computed, 1);
+    val->string = key_string("computed", *((const int32_t *) key));
+    return 1;
+}
+
+static int
+get_or_insert_thread(void *arg)
+{
+    MTMapData *d = (MTMapData *) arg;
+    d->n_inserted = 0;
+    for (int32_t i = 0; i < NUM_SHARED_KEYS; i++) {
+        /* Every thread tries its own value, all have to end up with the first one */
+        AZString *str = key_string((d->thread & 1) ? "odd" : "even", i);
+        AZValue val;
+        unsigned int inserted;
+        az_concurrent_hash_map_get_or_insert(d->impl, d->cmap, &i, str, &val, sizeof(AZValue), &inserted);
+        az_string_unref(str);
+        d->n_inserted += inserted;
+        d->results[i] = val.string;
+        /* Readers and writers on unrelated keys */
+        int32_t other = NUM_SHARED_KEYS + d->thread * NUM_SHARED_KEYS + i;
+        az_concurrent_hash_map_compute_if_absent(d->impl, d->cmap, &other, compute_value, NULL, &val, sizeof(AZValue));
+        az_value_clear(d->impl->val_impl, &val);
+        if (i & 1) az_concurrent_hash_map_remove(d->impl, d->cmap, &other);
+    }
+    return 0;
+}
+
+static void
+test_mt(const AZConcurrentHashMapImplementation *impl)
+{
+    AZConcurrentHashMap cmap;
+    az_instance_init((const AZImplementation *) impl, &cmap);
+    atomic_store(&n_computed, 0);
+
+    thrd_t threads[NUM_THREADS];
+    static MTMapData data[NUM_THREADS];
+    for (unsigned int i = 0; i < NUM_THREADS; i++) {
+        data[i].impl = impl;
+        data[i].cmap = &cmap;
+        data[i].thread = i;
+        TEST_ASSERT(thrd_create(&threads[i], get_or_insert_thread, &data[i]) == thrd_success);
+    }
+    for (unsigned int i = 0; i < NUM_THREADS; i++) {
+        TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+    }
+
+    unsigned int n_inserted = 0;
+    for (unsigned int i = 0; i < NUM_THREADS; i++) n_inserted += data[i].n_inserted;
+    TEST_ASSERT_EQUAL_UINT(NUM_SHARED_KEYS, n_inserted);
+    TEST_ASSERT_EQUAL_UINT(NUM_THREADS * NUM_SHARED_KEYS, atomic_load(&n_computed));
+    TEST_ASSERT_EQUAL_UINT(NUM_SHARED_KEYS + NUM_THREADS * NUM_SHARED_KEYS / 2, az_collection_get_size(&impl->map_impl.collection_impl, &cmap.map.collection));
+    TEST_ASSERT_EQUAL_UINT(NUM_SHARED_KEYS + NUM_THREADS * NUM_SHARED_KEYS / 2, az_concurrent_hash_map_get_size(&cmap));
+
+    for (int32_t k = 0; k < NUM_SHARED_KEYS; k++) {
+        AZValue val;
+        TEST_ASSERT_NOT_NULL(az_concurrent_hash_map_get(impl, &cmap, &k, &val, sizeof(AZValue)));
+        for (unsigned int i = 0; i < NUM_THREADS; i++) {
+            TEST_ASSERT_EQUAL_PTR(val.string, data[i].results[k]);
+            az_string_unref(data[i].results[k]);
+        }
+        az_value_clear(impl->val_impl, &val);
+    }
+
+    az_instance_finalize((const AZImplementation *) impl, &cmap);
+}
+
+typedef struct {
+    ForallData forall;
+    atomic_uint *done;
+    unsigned int n_passes;
+    unsigned int errors;
+} MTForallData;
+
+/* Iterates with nested lookups until writer is finished */
+static int
+forall_thread(void *arg)
+{
+    MTForallData *d = (MTForallData *) arg;
+    d->n_passes = 0;
+    d->errors = 0;
+    while (!atomic_load(d->done)) {
+        if (!az_concurrent_hash_map_forall(d->forall.impl, d->forall.cmap, forall_lookup_concurrent, &d->forall)) d->errors += 1;
+        d->n_passes += 1;
+    }
+    return 0;
+}
+
+/* Writer has to progress while readers keep iterating shards with nested lookups */
+static void
+test_mt_forall(const AZConcurrentHashMapImplementation *impl)
+{
+    AZConcurrentHashMap cmap;
+    az_instance_init((const AZImplementation *) impl, &cmap);
+    for (int32_t i = 0; i < NUM_SHARED_KEYS; i++) {
+        AZString *str = key_string("value", i);
+        az_concurrent_hash_map_insert(impl, &cmap, &i, str);
+        az_string_unref(str);
+    }
+
+    atomic_uint done;
+    atomic_init(&done, 0);
+    thrd_t threads[NUM_THREADS];
+    static MTForallData data[NUM_THREADS];
+    for (unsigned int i = 0; i < NUM_THREADS; i++) {
+        data[i].forall.impl = impl;
+        data[i].forall.cmap = &cmap;
+        data[i].forall.count = 0;
+        data[i].done = &done;
+        TEST_ASSERT(thrd_create(&threads[i], forall_thread, &data[i]) == thrd_success);
+    }
+    for (int32_t i = NUM_SHARED_KEYS; i < 2 * NUM_SHARED_KEYS; i++) {
+        AZString *str = key_string("value", i);
+        az_concurrent_hash_map_insert(impl, &cmap, &i, str);
+        az_string_unref(str);
+        int32_t old = i - NUM_SHARED_KEYS;
+        TEST_ASSERT(az_concurrent_hash_map_remove(impl, &cmap, &old));
+    }
+    atomic_store(&done, 1);
+    for (unsigned int i = 0; i < NUM_THREADS; i++) {
+        TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+        TEST_ASSERT_EQUAL_UINT(0, data[i].errors);
+    }
+    TEST_ASSERT_EQUAL_UINT(NUM_SHARED_KEYS, az_concurrent_hash_map_get_size(&cmap));
+    TEST_ASSERT_EQUAL_UINT(NUM_SHARED_KEYS, az_collection_get_size(&impl->map_impl.collection_impl, &cmap.map.collection));
+
+    az_instance_finalize((const AZImplementation *) impl, &cmap);
+}
+
+typedef struct {
+    const AZConcurrentHashMapImplementation *impl;
+    AZConcurrentHashMap *cmap;
+    atomic_uint *done;
+    unsigned int n_found;
+    unsigned int errors;
+} MTLookupData;
+
+/* Found values have to be alive and belong to the key */
+static int
+lookup_thread(void *arg)
+{
+    MTLookupData *d = (MTLookupData *) arg;
+    d->n_found = 0;
+    d->errors = 0;
+    while (!atomic_load(d->done)) {
+        for (int32_t k = 0; k < NUM_SHARED_KEYS; k++) {
+            AZValue val;
+            const AZImplementation *val_impl = az_concurrent_hash_map_get(d->impl, d->cmap, &k, &val, sizeof(AZValue));
+            if (!val_impl) continue;
+            const char *space = strchr((const char *) val.string->str, ' ');
+            if (!space || (atoi(space + 1) != k)) d->errors += 1;
+            az_value_clear(val_impl, &val);
+            d->n_found += 1;
+        }
+    }
+    return 0;
+}
+
+/* Lookups run while values are replaced, removed and the shards grow */
+static void
+test_mt_lookup(const AZConcurrentHashMapImplementation *impl)
+{
+    AZConcurrentHashMap cmap;
+    az_instance_init((const AZImplementation *) impl, &cmap);
+    for (int32_t i = 0; i < NUM_SHARED_KEYS; i++) {
+        AZString *str = key_string("value", i);
+        az_concurrent_hash_map_insert(impl, &cmap, &i, str);
+        az_string_unref(str);
+    }
+
+    atomic_uint done;
+    atomic_init(&done, 0);
+    thrd_t threads[NUM_THREADS];
+    static MTLookupData data[NUM_THREADS];
+    for (unsigned int i = 0; i < NUM_THREADS; i++) {
+        data[i].impl = impl;
+        data[i].cmap = &cmap;
+        data[i].done = &done;
+        TEST_ASSERT(thrd_create(&threads[i], lookup_thread, &data[i]) == thrd_success);
+    }
+    for (unsigned int pass = 0; pass < 4; pass++) {
+        for (int32_t i = 0; i < NUM_SHARED_KEYS; i++) {
+            AZString *str = key_string((pass & 1) ? "value" : "replaced", i);
+            az_concurrent_hash_map_insert(impl, &cmap, &i, str);
+            az_string_unref(str);
+            if (i & 1) {
+                TEST_ASSERT(az_concurrent_hash_map_remove(impl, &cmap, &i));
+                str = key_string("reinserted", i);
+                az_concurrent_hash_map_insert(impl, &cmap, &i, str);
+                az_string_unref(str);
+            }
+        }
+        az_concurrent_hash_map_clear(impl, &cmap);
+        for (int32_t i = 0; i < NUM_SHARED_KEYS; i++) {
+            AZString *str = key_string("value", i);
+            az_concurrent_hash_map_insert(impl, &cmap, &i, str);
+            az_string_unref(str);
+        }
+    }
+    atomic_store(&done, 1);
+    for (unsigned int i = 0; i < NUM_THREADS; i++) {
+        TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+        TEST_ASSERT_EQUAL_UINT(0, data[i].errors);
+    }
+    TEST_ASSERT_EQUAL_UINT(NUM_SHARED_KEYS, az_concurrent_hash_map_get_size(&cmap));
+
+    az_instance_finalize((const AZImplementation *) impl, &cmap);
+}
+
+void
+test_concurrent_hash_map(void)
+{
+    az_init();
+
+    AZConcurrentHashMapImplementation impl = {};
+    concurrent_hash_map_impl_setup(&impl);
+
+    test_basic(&impl);
+
+    test_mt(&impl);
+
+    test_mt_forall(&impl);
+
+    test_mt_lookup(&impl);
+
+    TEST_ASSERT_NULL(az_string_lookup((const unsigned char *) "value 0"));
+    TEST_ASSERT_NULL(az_string_lookup((const unsigned char *) "computed 2000"));
+}
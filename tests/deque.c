@@ -0,0 +1,131 @@
+#define __DEQUE_TEST_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <az/az.h>
+#include <az/base.h>
+#include <az/boxed-value.h>
+#include <az/value.h>
+#include <az/instance.h>
+#include <az/string.h>
+#include <az/collections/collection.h>
+#include <az/collections/list.h>
+#include <az/collections/deque.h>
+
+#include "unity/unity.h"
+
+#define NUM_ELEMENTS 1000
+
+/* Fill deque with 0..n-1 using both ends, mixing pops to force wraparound */
+static void
+test_deque_int32(unsigned int el_type)
+{
+    AZDeque *deque = az_deque_new(el_type, 8);
+    TEST_ASSERT(!deque->element_impl == (el_type == AZ_TYPE_ANY));
+    AZValue val;
+    const AZImplementation *impl;
+    TEST_ASSERT(!az_deque_pop_front(deque, &impl, &val, 16));
+    TEST_ASSERT(!az_deque_pop_back(deque, &impl, &val, 16));
+    /* FIFO with wraparound */
+    int32_t next_in = 0, next_out = 0;
+    for (unsigned int round = 0; round < 100; round++) {
+        for (unsigned int i = 0; i < 7; i++) {
+            TEST_ASSERT(az_deque_push_back(deque, &AZInt32Klass.impl, &next_in));
+            next_in += 1;
+        }
+        for (unsigned int i = 0; i < 5; i++) {
+            TEST_ASSERT(az_deque_pop_front(deque, &impl, &val, 16));
+            TEST_ASSERT(impl == &AZInt32Klass.impl);
+            TEST_ASSERT(val.int32_v == next_out);
+            next_out += 1;
+        }
+    }
+    TEST_ASSERT(deque->list.collection.size == (unsigned int) (next_in - next_out));
+    for (unsigned int i = 0; i < deque->list.collection.size; i++) {
+        TEST_ASSERT(az_deque_get_element(deque, i, &val, 16) == &AZInt32Klass.impl);
+        TEST_ASSERT(val.int32_v == next_out + (int32_t) i);
+    }
+    /* Push to front and pop from back */
+    az_deque_clear(deque);
+    for (int32_t i = 0; i < NUM_ELEMENTS; i++) {
+        if (i & 1) {
+            TEST_ASSERT(az_deque_push_front(deque, &AZInt32Klass.impl, &i));
+        } else {
+            TEST_ASSERT(az_deque_push_back(deque, &AZInt32Klass.impl, &i));
+        }
+    }
+    TEST_ASSERT(deque->list.collection.size == NUM_ELEMENTS);
+    int32_t v = NUM_ELEMENTS - 2;
+    TEST_ASSERT(az_collection_contains(&AZDequeKlass->list_impl.collection_impl, &deque->list.collection, &AZInt32Klass.impl, &v));
+    v = NUM_ELEMENTS;
+    TEST_ASSERT(!az_collection_contains(&AZDequeKlass->list_impl.collection_impl, &deque->list.collection, &AZInt32Klass.impl, &v));
+    /* Front has odd numbers descending, back even numbers ascending */
+    for (unsigned int i = 0; i < NUM_ELEMENTS / 2; i++) {
+        TEST_ASSERT(az_deque_get_element(deque, i, &val, 16) == &AZInt32Klass.impl);
+        TEST_ASSERT(val.int32_v == NUM_ELEMENTS - 1 - 2 * (int32_t) i);
+    }
+    for (int32_t i = NUM_ELEMENTS - 2; i >= 0; i -= 2) {
+        TEST_ASSERT(az_deque_pop_back(deque, &impl, &val, 16));
+        TEST_ASSERT(val.int32_v == i);
+    }
+    for (int32_t i = 1; i < NUM_ELEMENTS; i += 2) {
+        TEST_ASSERT(az_deque_pop_back(deque, &impl, &val, 16));
+        TEST_ASSERT(val.int32_v == i);
+    }
+    TEST_ASSERT(!deque->list.collection.size);
+    az_deque_delete(deque);
+}
+
+static void
+test_deque_string(unsigned int el_type)
+{
+    AZString *str = az_string_new((const unsigned char *) "Deque");
+    AZDeque *deque = az_deque_new(el_type, 8);
+    for (unsigned int i = 0; i < 20; i++) {
+        TEST_ASSERT(az_deque_push_front(deque, (i & 1) ? NULL : AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), (i & 1) ? NULL : str));
+    }
+    TEST_ASSERT(str->reference.refcount == 11);
+    TEST_ASSERT(az_collection_contains(&AZDequeKlass->list_impl.collection_impl, &deque->list.collection, NULL, NULL));
+    AZValue val;
+    const AZImplementation *impl;
+    TEST_ASSERT(az_deque_get_element(deque, 0, &val, 16) == NULL);
+    TEST_ASSERT(az_deque_get_element(deque, 1, &val, 16) == AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING));
+    TEST_ASSERT(val.string == str);
+    az_value_clear(AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), &val);
+    TEST_ASSERT(az_deque_pop_front(deque, &impl, &val, 16));
+    TEST_ASSERT(!impl);
+    TEST_ASSERT(az_deque_pop_back(deque, &impl, &val, 16));
+    TEST_ASSERT(impl == AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING));
+    TEST_ASSERT(val.string == str);
+    TEST_ASSERT(str->reference.refcount == 11);
+    az_value_clear(impl, &val);
+    TEST_ASSERT(str->reference.refcount == 10);
+    az_deque_delete(deque);
+    TEST_ASSERT(str->reference.refcount == 1);
+    az_string_unref(str);
+}
+
+void
+test_deque(void)
+{
+    az_init();
+    test_deque_int32(AZ_TYPE_INT32);
+    test_deque_int32(AZ_TYPE_ANY);
+    test_deque_string(AZ_TYPE_STRING);
+    test_deque_string(AZ_TYPE_ANY);
+    /* Oversized values are boxed when popped into small value */
+    AZDeque *deque = az_deque_new(AZ_TYPE_COMPLEX_DOUBLE, 8);
+    AZComplexDouble c = {1.0, -1.0};
+    TEST_ASSERT(az_deque_push_back(deque, &AZComplexDoubleKlass.impl, &c));
+    AZValue val;
+    const AZImplementation *impl;
+    TEST_ASSERT(az_deque_pop_front(deque, &impl, &val, 8));
+    TEST_ASSERT(impl == &AZBoxedValueKlass.klass.impl);
+    AZBoxedValue *boxed = (AZBoxedValue *) val.block;
+    TEST_ASSERT(boxed->val.cdouble_v.r == 1.0);
+    TEST_ASSERT(boxed->val.cdouble_v.i == -1.0);
+    az_value_clear(impl, &val);
+    az_deque_delete(deque);
+}
@@ -1,5 +1,6 @@
 #define __HASH_MAP_TEST_C__
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +11,7 @@
 #include <az/interface.h>
 #include <az/instance.h>
 #include <az/packed-value.h>
+#include <az/string.h>
 #include <az/collections/collection.h>
 #include <az/collections/map.h>
 #include <az/collections/set.h>
@@ -35,6 +37,23 @@ int32_equal(const AZHashMapImplementation *impl, const void *lhs, const void *rh
     return *((const uint32_t *) lhs) == *((const uint32_t *) rhs);
 }
 
+static unsigned int n_hash_calls = 0;
+static unsigned int n_equal_calls = 0;
+
+static uint32_t
+counting_hash(const AZHashMapImplementation *impl, const void *key)
+{
+    n_hash_calls += 1;
+    return int32_hash(impl, key);
+}
+
+static unsigned int
+counting_equal(const AZHashMapImplementation *impl, const void *lhs, const void *rhs)
+{
+    n_equal_calls += 1;
+    return int32_equal(impl, lhs, rhs);
+}
+
 static unsigned int
 align16(unsigned int v)
 {
@@ -289,6 +308,218 @@ test_keyset(const AZHashMapImplementation *impl, int32_t *keys, int32_t *vals, u
     az_instance_finalize((const AZImplementation *) impl, &hmap);
 }
 
+/* The hash is a bijection, so equal should only be called for the same keys */
+static void
+test_cached_hash(int32_t *keys, int32_t *vals, unsigned int n_entries)
+{
+    AZHashMapImplementation impl = {};
+    hash_map_impl_setup(&impl, 7);
+    impl.hash = counting_hash;
+    impl.equal = counting_equal;
+
+    AZHashMap hmap;
+    az_instance_init((const AZImplementation *) &impl, &hmap);
+
+    n_hash_calls = n_equal_calls = 0;
+    for (unsigned int i = 0; i < n_entries; i++) {
+        az_hash_map_insert(&impl, &hmap, &keys[i], &vals[i]);
+    }
+    TEST_ASSERT_TRUE(hmap.root_size > 7);
+    TEST_ASSERT_EQUAL_UINT(n_entries, n_hash_calls);
+    TEST_ASSERT_EQUAL_UINT(0, n_equal_calls);
+
+    n_hash_calls = n_equal_calls = 0;
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT(az_hash_map_exists(&impl, &hmap, &keys[i]));
+    }
+    TEST_ASSERT_EQUAL_UINT(n_entries, n_hash_calls);
+    TEST_ASSERT_EQUAL_UINT(n_entries, n_equal_calls);
+
+    az_instance_finalize((const AZImplementation *) &impl, &hmap);
+}
+
+/* Without callbacks keys are hashed and compared by their type */
+static void
+test_type_hash(void)
+{
+    /* Hash and equals are inherited by all classes */
+    TEST_ASSERT_NOT_NULL(AZ_CLASS_FROM_TYPE(AZ_TYPE_INT8)->hash);
+    TEST_ASSERT_NOT_NULL(AZ_CLASS_FROM_TYPE(AZ_TYPE_BLOCK)->equals);
+    TEST_ASSERT_NOT_NULL(AZ_CLASS_FROM_TYPE(AZ_TYPE_OBJECT)->hash);
+    TEST_ASSERT_NOT_NULL(AZ_CLASS_FROM_TYPE(AZ_TYPE_HASH_MAP)->equals);
+
+    double pzero = 0.0, nzero = -0.0;
+    TEST_ASSERT(az_instance_equals(&AZDoubleKlass.impl, &pzero, &nzero));
+    TEST_ASSERT_EQUAL_UINT32(az_instance_hash(&AZDoubleKlass.impl, &pzero), az_instance_hash(&AZDoubleKlass.impl, &nzero));
+    int8_t a = 5, b = 5, c = 6;
+    TEST_ASSERT(az_instance_equals(&AZInt8Klass.impl, &a, &b));
+    TEST_ASSERT(!az_instance_equals(&AZInt8Klass.impl, &a, &c));
+    TEST_ASSERT_EQUAL_UINT32(az_instance_hash(&AZInt8Klass.impl, &a), az_instance_hash(&AZInt8Klass.impl, &b));
+
+    /* String keys, init has to reset hash and equal of uninitialized implementation */
+    AZHashMapImplementation impl;
+    memset(&impl, 0xff, sizeof(impl));
+    az_implementation_init_by_type((AZImplementation *) &impl, AZ_TYPE_HASH_MAP);
+    impl.key_impl = AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING);
+    impl.val_impl = &AZInt32Klass.impl;
+    impl.root_size = 31;
+    impl.entry_size = 32;
+    impl.key_offset = 8;
+    impl.key_size = 8;
+    impl.val_offset = 16;
+    impl.val_size = 4;
+
+    AZHashMap hmap;
+    az_instance_init((const AZImplementation *) &impl, &hmap);
+    for (int32_t i = 0; i < 1000; i++) {
+        char c[32];
+        snprintf(c, 32, "key %d", i);
+        AZString *key = az_string_new((const unsigned char *) c);
+        az_hash_map_insert(&impl, &hmap, key, &i);
+        az_string_unref(key);
+    }
+    TEST_ASSERT_EQUAL_UINT(1000, hmap.map.collection.size);
+    for (int32_t i = 0; i < 1000; i++) {
+        char c[32];
+        snprintf(c, 32, "key %d", i);
+        AZString *key = az_string_new((const unsigned char *) c);
+        TEST_ASSERT_EQUAL_UINT32(key->hash, az_instance_hash(impl.key_impl, key));
+        const int32_t *found = (const int32_t *) az_hash_map_lookup(&impl, &hmap, key);
+        TEST_ASSERT_NOT_NULL(found);
+        TEST_ASSERT_EQUAL_INT32(i, *found);
+        az_string_unref(key);
+    }
+    AZString *absent = az_string_new((const unsigned char *) "absent");
+    TEST_ASSERT_NULL(az_hash_map_lookup(&impl, &hmap, absent));
+    az_string_unref(absent);
+    az_instance_finalize((const AZImplementation *) &impl, &hmap);
+    TEST_ASSERT_NULL(az_string_lookup((const unsigned char *) "key 0"));
+}
+
+/* NaN keys are equal to themselves when compared by type */
+static void
+test_nan_key(void)
+{
+    double nan = NAN;
+    float fnan = NAN;
+    TEST_ASSERT(az_instance_equals(&AZDoubleKlass.impl, &nan, &nan));
+    TEST_ASSERT(az_instance_equals(&AZFloatKlass.impl, &fnan, &fnan));
+
+    AZHashMapImplementation impl;
+    az_implementation_init_by_type((AZImplementation *) &impl, AZ_TYPE_HASH_MAP);
+    impl.key_impl = &AZDoubleKlass.impl;
+    impl.val_impl = &AZInt32Klass.impl;
+    impl.root_size = 31;
+    impl.entry_size = 32;
+    impl.key_offset = 8;
+    impl.key_size = 8;
+    impl.val_offset = 16;
+    impl.val_size = 4;
+
+    AZHashMap hmap;
+    az_instance_init((const AZImplementation *) &impl, &hmap);
+    double keys[3] = {NAN, 1.0, -0.0};
+    for (int32_t i = 0; i < 3; i++) {
+        az_hash_map_insert(&impl, &hmap, &keys[i], &i);
+    }
+    /* Inserting NaN again replaces the value */
+    int32_t val = 10;
+    az_hash_map_insert(&impl, &hmap, &nan, &val);
+    TEST_ASSERT_EQUAL_UINT(3, hmap.map.collection.size);
+    const int32_t *found = (const int32_t *) az_hash_map_lookup(&impl, &hmap, &nan);
+    TEST_ASSERT_NOT_NULL(found);
+    TEST_ASSERT_EQUAL_INT32(10, *found);
+    double pzero = 0.0;
+    found = (const int32_t *) az_hash_map_lookup(&impl, &hmap, &pzero);
+    TEST_ASSERT_NOT_NULL(found);
+    TEST_ASSERT_EQUAL_INT32(2, *found);
+    TEST_ASSERT(az_hash_map_remove(&impl, &hmap, &nan));
+    TEST_ASSERT(!az_hash_map_exists(&impl, &hmap, &nan));
+    TEST_ASSERT_EQUAL_UINT(2, hmap.map.collection.size);
+    az_instance_finalize((const AZImplementation *) &impl, &hmap);
+}
+
+static void
+test_reserve_shrink(int32_t *keys, int32_t *vals, unsigned int n_entries)
+{
+    AZHashMapImplementation impl = {};
+    hash_map_impl_setup(&impl, 31);
+
+    AZHashMap hmap;
+    az_instance_init((const AZImplementation *) &impl, &hmap);
+
+    /* Bulk load after reserve does not reallocate */
+    az_hash_map_reserve(&impl, &hmap, n_entries);
+    AZHashMapEntry *entries = hmap.entries;
+    for (unsigned int i = 0; i < n_entries; i++) {
+        az_hash_map_insert(&impl, &hmap, &keys[i], &vals[i]);
+    }
+    TEST_ASSERT_EQUAL_PTR(entries, hmap.entries);
+    TEST_ASSERT_EQUAL_UINT(n_entries, hmap.map.collection.size);
+
+    unsigned int allocated_size = hmap.allocated_size;
+    for (unsigned int i = 10; i < n_entries; i++) {
+        az_hash_map_remove(&impl, &hmap, &keys[i]);
+    }
+    az_hash_map_shrink_to_fit(&impl, &hmap);
+    TEST_ASSERT_TRUE(hmap.allocated_size < allocated_size / 10);
+    TEST_ASSERT_EQUAL_UINT(10, hmap.map.collection.size);
+    for (unsigned int i = 0; i < n_entries; i++) {
+        const int32_t *found = (const int32_t *) az_hash_map_lookup(&impl, &hmap, &keys[i]);
+        if (i < 10) {
+            TEST_ASSERT_NOT_NULL(found);
+            TEST_ASSERT_EQUAL_INT32(vals[i], *found);
+        } else {
+            TEST_ASSERT_NULL(found);
+        }
+    }
+    az_instance_finalize((const AZImplementation *) &impl, &hmap);
+
+    /* Load factor limits the average chain length */
+    impl.max_load_factor = 0.75f;
+    az_instance_init((const AZImplementation *) &impl, &hmap);
+    for (unsigned int i = 0; i < n_entries; i++) {
+        az_hash_map_insert(&impl, &hmap, &keys[i], &vals[i]);
+        TEST_ASSERT_TRUE(hmap.map.collection.size <= hmap.root_size * 3 / 4);
+    }
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT(az_hash_map_exists(&impl, &hmap, &keys[i]));
+    }
+    az_instance_finalize((const AZImplementation *) &impl, &hmap);
+}
+
+static void
+test_batch(const AZHashMapImplementation *impl, int32_t *keys, int32_t *vals, unsigned int n_entries)
+{
+    AZHashMap hmap;
+    az_instance_init((const AZImplementation *) impl, &hmap);
+
+    /* Insert the first half by batch */
+    void **key_ptrs = (void **) malloc(n_entries * sizeof(void *));
+    void **val_ptrs = (void **) malloc(n_entries * sizeof(void *));
+    for (unsigned int i = 0; i < n_entries; i++) {
+        key_ptrs[i] = &keys[i];
+        val_ptrs[i] = &vals[i];
+    }
+    az_hash_map_insert_batch(impl, &hmap, key_ptrs, val_ptrs, n_entries / 2);
+    TEST_ASSERT_EQUAL_UINT(n_entries / 2, hmap.map.collection.size);
+
+    const void **results = (const void **) malloc(n_entries * sizeof(void *));
+    unsigned int n_found = az_hash_map_lookup_batch(impl, &hmap, (const void *const *) key_ptrs, results, n_entries);
+    TEST_ASSERT_EQUAL_UINT(n_entries / 2, n_found);
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT_EQUAL_PTR(az_hash_map_lookup(impl, &hmap, &keys[i]), results[i]);
+        if (i < n_entries / 2) {
+            TEST_ASSERT_EQUAL_INT32(vals[i], *((const int32_t *) results[i]));
+        }
+    }
+
+    free(results);
+    free(val_ptrs);
+    free(key_ptrs);
+    az_instance_finalize((const AZImplementation *) impl, &hmap);
+}
+
 void
 test_hash_map(void)
 {
@@ -315,4 +546,18 @@ test_hash_map(void)
     test_insert_remove_all(&impl, keys, vals, NUM_ENTRIES);
 
     test_overwrite_remove_val(&impl, keys, vals, NUM_ENTRIES);
+
+    test_batch(&impl, keys, vals, NUM_ENTRIES);
+
+    test_cached_hash(keys, vals, NUM_ENTRIES);
+
+    test_reserve_shrink(keys, vals, NUM_ENTRIES);
+
+    impl.hash = NULL;
+    impl.equal = NULL;
+    test_insert_remove(&impl, keys, vals, NUM_ENTRIES);
+    test_overwrite_remove_val(&impl, keys, vals, NUM_ENTRIES);
+    test_batch(&impl, keys, vals, NUM_ENTRIES);
+    test_type_hash();
+    test_nan_key();
 }
@@ -208,6 +208,55 @@ test_collection_interface(const AZHashSetImplementation *impl, int32_t *elems, u
     az_instance_finalize((const AZImplementation *) impl, &hset);
 }
 
+static void
+test_reserve_shrink(const AZHashSetImplementation *impl, int32_t *elems, unsigned int n_entries)
+{
+    AZHashSet hset;
+    az_instance_init((const AZImplementation *) impl, &hset);
+
+    az_hash_set_reserve(impl, &hset, n_entries);
+    AZHashSetEntry *entries = hset.entries;
+    for (unsigned int i = 0; i < n_entries; i++) {
+        az_hash_set_insert(impl, &hset, &elems[i]);
+    }
+    TEST_ASSERT_EQUAL_PTR(entries, hset.entries);
+
+    unsigned int allocated_size = hset.allocated_size;
+    for (unsigned int i = 10; i < n_entries; i++) {
+        az_hash_set_remove(impl, &hset, &elems[i]);
+    }
+    az_hash_set_shrink_to_fit(impl, &hset);
+    TEST_ASSERT_TRUE(hset.allocated_size < allocated_size / 10);
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT_EQUAL_UINT(i < 10, az_hash_set_contains(impl, &hset, &elems[i]));
+    }
+
+    az_instance_finalize((const AZImplementation *) impl, &hset);
+}
+
+static void
+test_batch(const AZHashSetImplementation *impl, int32_t *elems, unsigned int n_entries)
+{
+    AZHashSet hset;
+    az_instance_init((const AZImplementation *) impl, &hset);
+
+    void **elem_ptrs = (void **) malloc(n_entries * sizeof(void *));
+    for (unsigned int i = 0; i < n_entries; i++) elem_ptrs[i] = &elems[i];
+    az_hash_set_insert_batch(impl, &hset, elem_ptrs + n_entries / 2, n_entries - n_entries / 2);
+    TEST_ASSERT_EQUAL_UINT(n_entries - n_entries / 2, hset.set.collection.size);
+
+    unsigned int *results = (unsigned int *) malloc(n_entries * sizeof(unsigned int));
+    unsigned int n_found = az_hash_set_contains_batch(impl, &hset, (const void *const *) elem_ptrs, results, n_entries);
+    TEST_ASSERT_EQUAL_UINT(n_entries - n_entries / 2, n_found);
+    for (unsigned int i = 0; i < n_entries; i++) {
+        TEST_ASSERT_EQUAL_UINT(i >= n_entries / 2, results[i]);
+    }
+
+    free(results);
+    free(elem_ptrs);
+    az_instance_finalize((const AZImplementation *) impl, &hset);
+}
+
 void
 test_hash_set(void)
 {
@@ -228,4 +277,12 @@ test_hash_set(void)
     test_insert_remove_all(&impl, elems, NUM_ENTRIES);
     test_iterator(&impl, elems, NUM_ENTRIES);
     test_collection_interface(&impl, elems, NUM_ENTRIES);
+    test_reserve_shrink(&impl, elems, NUM_ENTRIES);
+    test_batch(&impl, elems, NUM_ENTRIES);
+
+    /* Elements hashed and compared by type */
+    impl.hash = NULL;
+    impl.equal = NULL;
+    test_insert_remove(&impl, elems, NUM_ENTRIES);
+    test_batch(&impl, elems, NUM_ENTRIES);
 }
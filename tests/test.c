@@ -12,10 +12,13 @@
 #include <az/boxed-value.h>
 #include <az/extend.h>
 #include <az/function.h>
+#include <az/function-closure.h>
 #include <az/function-native.h>
 #include <az/function-value.h>
+#include <az/interface.h>
 #include <az/packed-value.h>
 #include <az/reference-of.h>
+#include <az/slab.h>
 #include <az/string.h>
 #include <az/types.h>
 #include <az/value.h>
@@ -32,6 +35,13 @@
 
 static void test_types();
 static void test_types_mt();
+static void test_types_mt_lookup();
+static void test_types_is_a();
+static void test_references_mt();
+static void test_strings_mt();
+static void test_signatures_mt();
+static void test_slab_mt();
+static void test_construct();
 static void test_to_string();
 static void test_boxed_value();
 static void test_array_list();
@@ -40,7 +50,11 @@ static void test_call_native();
 static void test_object_list();
 
 void test_hash_map(void);
+void test_flat_hash_map(void);
+void test_concurrent_hash_map(void);
 void test_hash_set(void);
+void test_btree_map(void);
+void test_deque(void);
 
 void setUp(void) {
     // set stuff up here
@@ -59,6 +73,20 @@ main(int argc, const char *argv[])
             RUN_TEST(test_types);
         } else if (!strcmp(argv[i], "types-mt")) {
             RUN_TEST(test_types_mt);
+        } else if (!strcmp(argv[i], "types-mt-lookup")) {
+            RUN_TEST(test_types_mt_lookup);
+        } else if (!strcmp(argv[i], "types-is-a")) {
+            RUN_TEST(test_types_is_a);
+        } else if (!strcmp(argv[i], "references-mt")) {
+            RUN_TEST(test_references_mt);
+        } else if (!strcmp(argv[i], "strings-mt")) {
+            RUN_TEST(test_strings_mt);
+        } else if (!strcmp(argv[i], "signatures-mt")) {
+            RUN_TEST(test_signatures_mt);
+        } else if (!strcmp(argv[i], "slab-mt")) {
+            RUN_TEST(test_slab_mt);
+        } else if (!strcmp(argv[i], "construct")) {
+            RUN_TEST(test_construct);
         } else if (!strcmp(argv[i], "to-string")) {
             RUN_TEST(test_to_string);
         } else if (!strcmp(argv[i], "boxed-value")) {
@@ -73,8 +101,16 @@ main(int argc, const char *argv[])
             RUN_TEST(test_object_list);
         } else if (!strcmp(argv[i], "hash-map")) {
             RUN_TEST(test_hash_map);
+        } else if (!strcmp(argv[i], "flat-hash-map")) {
+            RUN_TEST(test_flat_hash_map);
+        } else if (!strcmp(argv[i], "concurrent-hash-map")) {
+            RUN_TEST(test_concurrent_hash_map);
         } else if (!strcmp(argv[i], "hash-set")) {
             RUN_TEST(test_hash_set);
+        } else if (!strcmp(argv[i], "btree-map")) {
+            RUN_TEST(test_btree_map);
+        } else if (!strcmp(argv[i], "deque")) {
+            RUN_TEST(test_deque);
         }
     }
     return UNITY_END();
@@ -173,6 +209,10 @@ test_types()
         TEST_ASSERT(val.value.boolean_v == AZ_TYPE_IS_SIGNED(AZ_TYPE_FROM_INDEX(i)));
         fprintf(stderr, " signed %d\n", val.value.boolean_v);
     }
+    /* Properties above are resolved through the flattened table of class class */
+    const AZClass *class_class = AZ_CLASS_FROM_TYPE(AZ_TYPE_CLASS);
+    TEST_ASSERT(class_class->props_index != NULL);
+    TEST_ASSERT(class_class->n_props_all >= 3);
 }
 
 /*
@@ -229,6 +269,127 @@ test_types_mt()
     }
 }
 
+/*
+ * Concurrent type lookups
+ *
+ * All threads resolve classes from typecodes in a tight loop (the AZ_CLASS_FROM_TYPE
+ * pattern used by value copies, property access and interface lookups) without taking
+ * the registry lock. Throughput is measured by the type-lookup benchmark.
+ */
+#define MT_LOOKUP_ITERATIONS 4000000
+
+typedef struct {
+    unsigned int n_types;
+    unsigned int n_failed;
+    uint64_t sum;
+} MTLookupData;
+
+static int
+lookup_type_thread (void *arg)
+{
+    MTLookupData *d = (MTLookupData *) arg;
+    for (unsigned int i = 0; i < MT_LOOKUP_ITERATIONS; i++) {
+        unsigned int idx = 1 + (i % (d->n_types - 1));
+        const AZClass *klass = AZ_CLASS_FROM_TYPE(idx);
+        /* Not all base type indices are in use */
+        if (!klass) continue;
+        if (AZ_TYPE_INDEX(klass->impl.type) != idx) d->n_failed += 1;
+        d->sum += klass->instance_size;
+    }
+    return 0;
+}
+
+static void
+run_lookup_threads (unsigned int n_threads, unsigned int n_types, MTLookupData data[])
+{
+    thrd_t threads[MT_NUM_THREADS];
+    for (unsigned int i = 0; i < n_threads; i++) {
+        data[i].n_types = n_types;
+        data[i].n_failed = 0;
+        data[i].sum = 0;
+        TEST_ASSERT(thrd_create(&threads[i], lookup_type_thread, &data[i]) == thrd_success);
+    }
+    for (unsigned int i = 0; i < n_threads; i++) {
+        TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+    }
+}
+
+static void
+test_types_mt_lookup()
+{
+    az_init();
+    /* Make sure there are some dynamically registered types in the table */
+    az_array_get_type();
+    az_hash_map_get_type();
+    az_active_object_get_type();
+    unsigned int n_types = AZ_TYPE_INDEX(az_array_object_get_type()) + 1;
+    MTLookupData data[MT_NUM_THREADS];
+    for (unsigned int n_threads = 1; n_threads <= MT_NUM_THREADS; n_threads *= 2) {
+        run_lookup_threads(n_threads, n_types, data);
+        for (unsigned int i = 0; i < n_threads; i++) {
+            TEST_ASSERT_EQUAL_UINT(0, data[i].n_failed);
+            TEST_ASSERT_EQUAL_UINT64(data[0].sum, data[i].sum);
+        }
+    }
+}
+
+/*
+ * Subtype checks on a deep hierarchy
+ *
+ * Compares az_type_is_a (ancestor display) against walking the parent chain
+ */
+#define IS_A_DEPTH 32
+
+static unsigned int is_a_types[IS_A_DEPTH];
+static char is_a_names[IS_A_DEPTH][16];
+
+static unsigned int
+type_is_a_walk (unsigned int type, unsigned int test)
+{
+    if (!type) return 0;
+    if (type == test) return 1;
+    const AZClass *klass = AZ_CLASS_FROM_TYPE(type);
+    while (klass->parent) {
+        if (klass->parent->impl.type == test) return 1;
+        klass = klass->parent;
+    }
+    return 0;
+}
+
+static void
+test_types_is_a()
+{
+    az_init();
+    unsigned int parent = AZ_TYPE_BLOCK;
+    for (int i = 0; i < IS_A_DEPTH; i++) {
+        snprintf(is_a_names[i], 16, "IsA%d", i);
+        az_register_type (&is_a_types[i], (const unsigned char *) is_a_names[i], parent, sizeof (AZClass), 0, 0, 0, 0, NULL, NULL, NULL);
+        parent = is_a_types[i];
+    }
+    unsigned int tests[IS_A_DEPTH + 4];
+    for (int i = 0; i < IS_A_DEPTH; i++) tests[i] = is_a_types[i];
+    tests[IS_A_DEPTH] = AZ_TYPE_ANY;
+    tests[IS_A_DEPTH + 1] = AZ_TYPE_BLOCK;
+    tests[IS_A_DEPTH + 2] = AZ_TYPE_OBJECT;
+    tests[IS_A_DEPTH + 3] = AZ_TYPE_INT32;
+    for (int i = 0; i < IS_A_DEPTH + 4; i++) {
+        for (int j = 0; j < IS_A_DEPTH + 4; j++) {
+            TEST_ASSERT_EQUAL_UINT(type_is_a_walk(tests[i], tests[j]), az_type_is_a(tests[i], tests[j]));
+        }
+    }
+    TEST_ASSERT(az_type_is_a(is_a_types[IS_A_DEPTH - 1], is_a_types[0]));
+    TEST_ASSERT(!az_type_is_a(is_a_types[0], is_a_types[IS_A_DEPTH - 1]));
+    TEST_ASSERT(az_type_is_a(AZ_TYPE_STRING, AZ_TYPE_REFERENCE));
+    TEST_ASSERT(!az_type_is_a(AZ_TYPE_STRING, AZ_TYPE_OBJECT));
+    /* Interface dispatch index resolves super-interfaces */
+    TEST_ASSERT(az_type_implements(AZ_TYPE_OBJECT_LIST, AZ_TYPE_LIST));
+    TEST_ASSERT(az_type_implements(AZ_TYPE_OBJECT_LIST, AZ_TYPE_COLLECTION));
+    TEST_ASSERT(!az_type_implements(AZ_TYPE_OBJECT_LIST, AZ_TYPE_MAP));
+    /* Unregistered types are not subtypes of anything */
+    TEST_ASSERT(!az_type_is_a(AZ_TYPE_STRING, 0));
+    TEST_ASSERT(!az_type_is_a(AZ_TYPE_STRING, AZ_TYPE_MASK - 1));
+}
+
 /*
  * Verify the to_string contract:
  * - NULL destination is accepted (nothing written, required length returned)
@@ -466,6 +627,110 @@ test_array_list()
         verify_list(alist, idx, types);
         az_array_list_delete(alist);
     }
+    /* Homogeneous lists */
+    alist = az_array_list_new(AZ_TYPE_INT32, 8);
+    TEST_ASSERT(alist->element_impl == &AZInt32Klass.impl);
+    TEST_ASSERT(alist->val_size == 4);
+    for (int32_t i = 0; i < 1000; i++) {
+        TEST_ASSERT(az_array_list_append(alist, &AZInt32Klass.impl, &i));
+    }
+    TEST_ASSERT(!az_array_list_append(alist, &AZUint32Klass.impl, buf));
+    TEST_ASSERT(!az_array_list_append(alist, NULL, NULL));
+    int32_t v = -1;
+    TEST_ASSERT(az_array_list_insert(alist, 0, &AZInt32Klass.impl, &v));
+    TEST_ASSERT(az_array_list_remove(alist, 500));
+    v = -2;
+    TEST_ASSERT(az_array_list_set_element(alist, 1, &AZInt32Klass.impl, &v));
+    TEST_ASSERT(alist->list.collection.size == 1000);
+    for (unsigned int i = 0; i < 1000; i++) {
+        AZValue val;
+        const AZImplementation *impl = az_array_list_get_element(alist, i, &val, 16);
+        TEST_ASSERT(impl == &AZInt32Klass.impl);
+        int32_t expected = (i == 0) ? -1 : (i == 1) ? -2 : (i < 500) ? (int32_t) i - 1 : (int32_t) i;
+        TEST_ASSERT(val.int32_v == expected);
+    }
+    v = 998;
+    TEST_ASSERT(az_collection_contains(&AZArrayListKlass->list_impl.collection_impl, &alist->list.collection, &AZInt32Klass.impl, &v));
+    v = 499;
+    TEST_ASSERT(!az_collection_contains(&AZArrayListKlass->list_impl.collection_impl, &alist->list.collection, &AZInt32Klass.impl, &v));
+    az_array_list_delete(alist);
+    /* Oversized values are boxed on read */
+    alist = az_array_list_new(types[9], 8);
+    TEST_ASSERT(alist->element_impl == AZ_IMPL_FROM_TYPE(types[9]));
+    for (unsigned int i = 0; i < 10; i++) {
+        memset(buf, (char) i, 256);
+        TEST_ASSERT(az_array_list_append(alist, AZ_IMPL_FROM_TYPE(types[9]), &buf));
+    }
+    for (unsigned int i = 0; i < 10; i++) {
+        AZValue val;
+        memset(buf, (char) i, 256);
+        const AZImplementation *impl = az_array_list_get_element(alist, i, &val, 16);
+        TEST_ASSERT(impl == &AZBoxedValueKlass.klass.impl);
+        AZBoxedValue *boxed = (AZBoxedValue *) val.block;
+        TEST_ASSERT(az_value_equals(AZ_IMPL_FROM_TYPE(types[9]), &boxed->val, (const AZValue *) buf));
+        az_value_clear(impl, &val);
+    }
+    az_array_list_delete(alist);
+    /* References and null blocks */
+    AZString *str = az_string_new((const unsigned char *) "Homogeneous");
+    alist = az_array_list_new(AZ_TYPE_STRING, 8);
+    TEST_ASSERT(alist->element_impl == AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING));
+    TEST_ASSERT(az_array_list_append(alist, AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), str));
+    TEST_ASSERT(az_array_list_append(alist, NULL, NULL));
+    TEST_ASSERT(az_array_list_insert(alist, 0, AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), str));
+    TEST_ASSERT(str->reference.refcount == 3);
+    AZValue val;
+    TEST_ASSERT(az_array_list_get_element(alist, 1, &val, 16) == AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING));
+    TEST_ASSERT(val.string == str);
+    TEST_ASSERT(str->reference.refcount == 4);
+    az_value_clear(AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), &val);
+    TEST_ASSERT(!az_array_list_get_element(alist, 2, &val, 16));
+    TEST_ASSERT(az_collection_contains(&AZArrayListKlass->list_impl.collection_impl, &alist->list.collection, NULL, NULL));
+    TEST_ASSERT(az_array_list_remove(alist, 0));
+    TEST_ASSERT(str->reference.refcount == 2);
+    az_array_list_delete(alist);
+    TEST_ASSERT(str->reference.refcount == 1);
+    /* Bulk operations */
+    int32_t *ivals = (int32_t *) az_value_new_array(&AZInt32Klass.impl, 100);
+    for (int32_t i = 0; i < 100; i++) ivals[i] = i;
+    for (unsigned int s = 0; s < 2; s++) {
+        alist = az_array_list_new((s) ? AZ_TYPE_ANY : AZ_TYPE_INT32, 8);
+        TEST_ASSERT(az_array_list_reserve(alist, 150));
+        TEST_ASSERT(alist->data_size == 150);
+        TEST_ASSERT(az_array_list_append_n(alist, &AZInt32Klass.impl, ivals, 100));
+        TEST_ASSERT(!az_array_list_append_n(alist, &AZUint8Klass.impl, ivals, 100) == !s);
+        if (s) TEST_ASSERT(az_array_list_remove_range(alist, 100, 100));
+        TEST_ASSERT(az_array_list_insert_range(alist, 10, &AZInt32Klass.impl, ivals, 50));
+        TEST_ASSERT(alist->data_size == ((s) ? 300 : 150));
+        TEST_ASSERT(az_array_list_remove_range(alist, 60, 50));
+        TEST_ASSERT(!az_array_list_remove_range(alist, 60, 41));
+        TEST_ASSERT(az_array_list_remove_range(alist, 0, 10));
+        TEST_ASSERT(alist->list.collection.size == 90);
+        for (unsigned int i = 0; i < 90; i++) {
+            AZValue val;
+            TEST_ASSERT(az_array_list_get_element(alist, i, &val, 16) == &AZInt32Klass.impl);
+            TEST_ASSERT(val.int32_v == (int32_t) ((i < 50) ? i : i + 10));
+        }
+        az_array_list_delete(alist);
+    }
+    az_value_delete_array(&AZInt32Klass.impl, ivals, 100);
+    AZString **svals = (AZString **) az_value_new_array(AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), 10);
+    for (unsigned int i = 0; i < 10; i++) svals[i] = (i & 1) ? NULL : str;
+    for (unsigned int s = 0; s < 2; s++) {
+        alist = az_array_list_new((s) ? AZ_TYPE_ANY : AZ_TYPE_STRING, 8);
+        TEST_ASSERT(az_array_list_append_n(alist, AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), svals, 10));
+        TEST_ASSERT(az_array_list_insert_range(alist, 5, AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), svals, 10));
+        TEST_ASSERT(str->reference.refcount == 11);
+        TEST_ASSERT(az_array_list_get_element(alist, 4, &val, 16) == AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING));
+        az_value_clear(AZ_IMPL_FROM_TYPE(AZ_TYPE_STRING), &val);
+        TEST_ASSERT(!az_array_list_get_element(alist, 6, &val, 16));
+        TEST_ASSERT(az_array_list_remove_range(alist, 2, 10));
+        TEST_ASSERT(str->reference.refcount == 5);
+        az_array_list_delete(alist);
+        TEST_ASSERT(str->reference.refcount == 1);
+    }
+    arikkei_aligned_free(svals);
+    az_string_unref(str);
 }
 
 static void
@@ -495,7 +760,7 @@ test_array()
 }
 
 /*
- * az_function_call_native (ARM64)
+ * az_function_call_native
  */
 
 static int32_t native_add_i32 (int32_t a, int32_t b)
@@ -503,6 +768,51 @@ static int32_t native_add_i32 (int32_t a, int32_t b)
     return a + b;
 }
 
+static unsigned int
+value_sub_i32 (const AZImplementation **arg_impls, const AZValue **arg_vals, const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
+{
+    *ret_impl = AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32);
+    ret_val->value.int32_v = arg_vals[0]->int32_v - arg_vals[1]->int32_v;
+    return 1;
+}
+
+static unsigned int
+value_length_plus_i32 (const AZImplementation **arg_impls, const AZValue **arg_vals, const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
+{
+    *ret_impl = AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32);
+    ret_val->value.int32_v = (int32_t) arg_vals[0]->string->length + arg_vals[1]->int32_v;
+    return 1;
+}
+
+/* Sum of 20 int32 arguments weighted by their position */
+static unsigned int
+value_sum20_i32 (const AZImplementation **arg_impls, const AZValue **arg_vals, const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
+{
+    *ret_impl = AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32);
+    ret_val->value.int32_v = 0;
+    for (int i = 0; i < 20; i++) ret_val->value.int32_v += (i + 1) * arg_vals[i]->int32_v;
+    return 1;
+}
+
+/* Returns shared string for arguments below 5 and fails otherwise */
+static AZString *batch_str;
+
+static unsigned int
+value_batch_string (const AZImplementation **arg_impls, const AZValue **arg_vals, const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
+{
+    if (arg_vals[0]->int32_v >= 5) return 0;
+    az_string_ref (batch_str);
+    *ret_impl = AZ_IMPL_FROM_TYPE (AZ_TYPE_STRING);
+    ret_val->value.string = batch_str;
+    return 1;
+}
+
+static unsigned int
+value_void (const AZImplementation **arg_impls, const AZValue **arg_vals, const AZImplementation **ret_impl, AZValue64 *ret_val, AZContext *ctx)
+{
+    return 1;
+}
+
 static float native_add_f (float a, float b)
 {
     return a + b;
@@ -598,7 +908,21 @@ call_native (void (*func) (void), unsigned int ret_type, unsigned int n_args, co
     sig32.ret_type = ret_type;
     sig32.n_args = n_args;
     if (n_args) memcpy (sig32.arg_types, arg_types, n_args * sizeof (unsigned int));
-    return az_function_call_native (func, &sig32.signature, ret_impl, ret_val, arg_impls, arg_vals);
+    /* Private plan has to give the same result as the direct call */
+    AZNativeCallPlan *plan = az_native_call_plan_new (&sig32.signature);
+    const AZImplementation *plan_impl = NULL;
+    AZValue64 plan_val;
+    if (plan) {
+        memcpy (&plan_val, ret_val, sizeof (AZValue64));
+        TEST_ASSERT (az_function_call_native_plan (func, plan, &plan_impl, &plan_val, arg_impls, arg_vals));
+        az_native_call_plan_delete (plan);
+    }
+    unsigned int result = az_function_call_native (func, &sig32.signature, ret_impl, ret_val, arg_impls, arg_vals);
+    if (plan && result) {
+        TEST_ASSERT (plan_impl == *ret_impl);
+        TEST_ASSERT (!memcmp (&plan_val, ret_val, sizeof (AZValue64)));
+    }
+    return result;
 }
 
 static void
@@ -841,6 +1165,201 @@ test_call_native()
         TEST_ASSERT (az_function_invoke ((const AZFunctionImplementation *) f_impl, f_inst, impls, vals, &ret_impl, &ret_val, NULL));
         TEST_ASSERT (ret_impl == AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32));
         TEST_ASSERT_EQUAL_INT32 (42, ret_val.value.int32_v);
+        /* Equal signatures share the plan */
+        AZFunctionSignature *sig2 = az_function_signature_new (0, AZ_TYPE_INT32, 2, arg_types);
+        TEST_ASSERT (az_native_call_plan_get (sig2) == fnat.plan);
+        az_function_signature_delete (sig2);
+        /* Private plan reused for several calls (if the architecture builds plans) */
+        AZNativeCallPlan *plan = az_native_call_plan_new (sig);
+        TEST_ASSERT (plan == NULL || fnat.plan != NULL);
+        for (int i = 0; plan && (i < 10); i++) {
+            a.int32_v = i;
+            b.int32_v = -3 * i;
+            TEST_ASSERT (az_function_call_native_plan ((void (*) (void)) native_add_i32, plan, &ret_impl, &ret_val, impls, vals));
+            TEST_ASSERT (ret_impl == AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32));
+            TEST_ASSERT_EQUAL_INT32 (-2 * i, ret_val.value.int32_v);
+        }
+        az_native_call_plan_delete (plan);
+        /* Caller-owned argument frame */
+        union {
+            AZFunctionFrame frame;
+            uint8_t data[AZ_FUNCTION_FRAME_SIZE (2)];
+        } buf;
+        AZFunctionFrame *frame = &buf.frame;
+        az_function_frame_setup (frame, 2);
+        az_function_frame_set_arg (frame, 0, impls[0], &a);
+        az_function_frame_set_arg (frame, 1, impls[1], &b);
+        TEST_ASSERT (!(frame->flags & AZ_FUNCTION_FRAME_VALIDATED));
+        for (int i = 0; i < 10; i++) {
+            a.int32_v = i;
+            b.int32_v = 100;
+            TEST_ASSERT (az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+            TEST_ASSERT (frame->flags & AZ_FUNCTION_FRAME_VALIDATED);
+            TEST_ASSERT_EQUAL_INT32 (100 + i, ret_val.value.int32_v);
+        }
+        /* Changing argument type invalidates the frame */
+        az_function_frame_set_arg (frame, 1, AZ_IMPL_FROM_TYPE (AZ_TYPE_DOUBLE), &b);
+        TEST_ASSERT (!(frame->flags & AZ_FUNCTION_FRAME_VALIDATED));
+        TEST_ASSERT (!az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+        az_function_frame_set_arg (frame, 1, NULL, NULL);
+        TEST_ASSERT (!az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+        /* Trusted frame is not validated */
+        az_function_frame_set_arg (frame, 1, AZ_IMPL_FROM_TYPE (AZ_TYPE_UINT32), &b);
+        TEST_ASSERT (!az_function_frame_validate (frame, sig));
+        frame->flags |= AZ_FUNCTION_FRAME_VALIDATED;
+        frame->signature = sig;
+        TEST_ASSERT (az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+        TEST_ASSERT_EQUAL_INT32 (109, ret_val.value.int32_v);
+        /* Batch invocation over argument columns, native and the default scalar loop */
+        AZValue col_a[100], col_b[100], col_r[100];
+        const AZValue *cols[2] = {col_a, col_b};
+        const AZImplementation *ret_impls[100];
+        for (int i = 0; i < 100; i++) {
+            col_a[i].int32_v = i;
+            col_b[i].int32_v = 2 * i;
+        }
+        TEST_ASSERT (az_function_invoke_batch ((const AZFunctionImplementation *) f_impl, f_inst, impls, cols, 100, ret_impls, col_r, NULL));
+        for (int i = 0; i < 100; i++) {
+            TEST_ASSERT (ret_impls[i] == AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32));
+            TEST_ASSERT_EQUAL_INT32 (3 * i, col_r[i].int32_v);
+        }
+        /* Native batch with stack arguments */
+        {
+            unsigned int d_types[10];
+            const AZImplementation *d_impls[10];
+            AZValue d_cols[10][20];
+            const AZValue *d_col_ptrs[10];
+            for (int j = 0; j < 10; j++) {
+                d_types[j] = AZ_TYPE_DOUBLE;
+                d_impls[j] = AZ_IMPL_FROM_TYPE (AZ_TYPE_DOUBLE);
+                d_col_ptrs[j] = d_cols[j];
+                for (int i = 0; i < 20; i++) d_cols[j][i].double_v = i * 10 + j;
+            }
+            AZFunctionNative fnat_d;
+            az_function_native_setup (&fnat_d, az_function_signature_get (0, AZ_TYPE_DOUBLE, 10, d_types), (void (*) (void)) native_sum10d);
+            void *fd_inst;
+            const AZImplementation *fd_impl = az_instance_get_interface_from_type (fn_type, &fnat_d, AZ_TYPE_FUNCTION, &fd_inst);
+            TEST_ASSERT (az_function_invoke_batch ((const AZFunctionImplementation *) fd_impl, fd_inst, d_impls, d_col_ptrs, 20, ret_impls, col_r, NULL));
+            for (int i = 0; i < 20; i++) {
+                TEST_ASSERT (ret_impls[i] == AZ_IMPL_FROM_TYPE (AZ_TYPE_DOUBLE));
+                TEST_ASSERT_EQUAL_DOUBLE (i * 100 + 45, col_r[i].double_v);
+            }
+        }
+        AZFunctionValue fval;
+        az_function_value_setup (&fval, az_function_signature_get (0, AZ_TYPE_INT32, 2, arg_types), value_sub_i32);
+        f_impl = az_instance_get_interface_from_type (AZ_TYPE_FUNCTION_VALUE, &fval, AZ_TYPE_FUNCTION, &f_inst);
+        TEST_ASSERT (((const AZFunctionImplementation *) f_impl)->invoke_batch == NULL);
+        TEST_ASSERT (az_function_invoke_batch ((const AZFunctionImplementation *) f_impl, f_inst, impls, cols, 100, NULL, col_r, NULL));
+        for (int i = 0; i < 100; i++) {
+            TEST_ASSERT_EQUAL_INT32 (-i, col_r[i].int32_v);
+        }
+        /* Failed batch releases the results of completed rows */
+        batch_str = az_string_new ((const unsigned char *) "Batch");
+        az_function_value_setup (&fval, az_function_signature_get (0, AZ_TYPE_STRING, 1, arg_types), value_batch_string);
+        TEST_ASSERT (az_function_invoke_batch ((const AZFunctionImplementation *) f_impl, f_inst, impls, cols, 5, ret_impls, col_r, NULL));
+        TEST_ASSERT_EQUAL_UINT (6, batch_str->reference.refcount);
+        for (int i = 0; i < 5; i++) az_value_clear (ret_impls[i], &col_r[i]);
+        TEST_ASSERT (!az_function_invoke_batch ((const AZFunctionImplementation *) f_impl, f_inst, impls, cols, 10, ret_impls, col_r, NULL));
+        TEST_ASSERT_EQUAL_UINT (1, batch_str->reference.refcount);
+        TEST_ASSERT (!az_function_invoke_batch ((const AZFunctionImplementation *) f_impl, f_inst, impls, cols, 10, NULL, col_r, NULL));
+        TEST_ASSERT_EQUAL_UINT (1, batch_str->reference.refcount);
+        az_string_unref (batch_str);
+        /* Rows without return value leave the result column untouched */
+        az_function_value_setup (&fval, az_function_signature_get (0, AZ_TYPE_NONE, 1, arg_types), value_void);
+        for (int i = 0; i < 10; i++) col_r[i].int32_v = -1;
+        TEST_ASSERT (az_function_invoke_batch ((const AZFunctionImplementation *) f_impl, f_inst, impls, cols, 10, ret_impls, col_r, NULL));
+        for (int i = 0; i < 10; i++) {
+            TEST_ASSERT (ret_impls[i] == NULL);
+            TEST_ASSERT_EQUAL_INT32 (-1, col_r[i].int32_v);
+        }
+        az_function_value_setup (&fval, az_function_signature_get (0, AZ_TYPE_INT32, 2, arg_types), value_sub_i32);
+        /* Frame reused with a function of different signature is validated again */
+        TEST_ASSERT (frame->flags & AZ_FUNCTION_FRAME_VALIDATED);
+        TEST_ASSERT (!az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+        az_function_frame_set_arg (frame, 1, impls[1], &b);
+        a.int32_v = 50;
+        b.int32_v = 8;
+        TEST_ASSERT (az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+        TEST_ASSERT (frame->signature == fval.signature);
+        TEST_ASSERT_EQUAL_INT32 (42, ret_val.value.int32_v);
+        /* Closure binding the first argument, target value is copied */
+        AZFunctionNative fnat2 = fnat;
+        const AZImplementation *bound_impls[2] = {AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32), AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32)};
+        void *bound_insts[2] = {&a, &b};
+        a.int32_v = 1000;
+        AZFunctionClosure *closure = az_function_closure_new (AZ_IMPL_FROM_TYPE (fn_type), &fnat2, 1, bound_impls, bound_insts);
+        TEST_ASSERT (closure != NULL);
+        memset (&fnat2, 0, sizeof (fnat2));
+        a.int32_v = 0;
+        TEST_ASSERT (closure->signature == az_function_signature_get (0, AZ_TYPE_INT32, 1, arg_types));
+        f_impl = az_instance_get_interface_from_type (AZ_TYPE_FUNCTION_CLOSURE, closure, AZ_TYPE_FUNCTION, &f_inst);
+        TEST_ASSERT (f_impl == &AZFunctionClosureKlass->function_impl.implementation);
+        TEST_ASSERT (az_function_get_signature ((const AZFunctionImplementation *) f_impl, f_inst) == closure->signature);
+        /* Validated frame with different number of arguments is rejected */
+        TEST_ASSERT (frame->flags & AZ_FUNCTION_FRAME_VALIDATED);
+        TEST_ASSERT (!az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+        frame->signature = closure->signature;
+        TEST_ASSERT (!az_function_invoke_frame ((const AZFunctionImplementation *) f_impl, f_inst, frame, &ret_impl, &ret_val, NULL));
+        for (int i = 0; i < 10; i++) {
+            b.int32_v = i;
+            TEST_ASSERT (az_function_invoke ((const AZFunctionImplementation *) f_impl, f_inst, impls + 1, vals + 1, &ret_impl, &ret_val, NULL));
+            TEST_ASSERT (ret_impl == AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32));
+            TEST_ASSERT_EQUAL_INT32 (1000 + i, ret_val.value.int32_v);
+        }
+        /* Binding the remaining argument of a closure holds a reference to it */
+        b.int32_v = 24;
+        AZFunctionClosure *closure2 = az_function_closure_new (AZ_IMPL_FROM_TYPE (AZ_TYPE_FUNCTION_CLOSURE), closure, 1, bound_impls + 1, bound_insts + 1);
+        TEST_ASSERT (closure2 != NULL);
+        TEST_ASSERT_EQUAL_UINT (2, closure->reference.refcount);
+        TEST_ASSERT_EQUAL_UINT (0, closure2->signature->n_args);
+        f_impl = az_instance_get_interface_from_type (AZ_TYPE_FUNCTION_CLOSURE, closure2, AZ_TYPE_FUNCTION, &f_inst);
+        TEST_ASSERT (az_function_invoke ((const AZFunctionImplementation *) f_impl, f_inst, NULL, NULL, &ret_impl, &ret_val, NULL));
+        TEST_ASSERT_EQUAL_INT32 (1024, ret_val.value.int32_v);
+        az_function_closure_unref (closure);
+        az_function_closure_unref (closure2);
+        /* Bound reference arguments are held by closure */
+        AZString *str = az_string_new ((const unsigned char *) "Closure");
+        unsigned int str_types[2] = {AZ_TYPE_STRING, AZ_TYPE_INT32};
+        az_function_value_setup (&fval, az_function_signature_get (0, AZ_TYPE_INT32, 2, str_types), value_length_plus_i32);
+        bound_impls[0] = AZ_IMPL_FROM_TYPE (AZ_TYPE_STRING);
+        bound_insts[0] = str;
+        closure = az_function_closure_new (AZ_IMPL_FROM_TYPE (AZ_TYPE_FUNCTION_VALUE), &fval, 1, bound_impls, bound_insts);
+        TEST_ASSERT (closure != NULL);
+        TEST_ASSERT_EQUAL_UINT (2, str->reference.refcount);
+        f_impl = az_instance_get_interface_from_type (AZ_TYPE_FUNCTION_CLOSURE, closure, AZ_TYPE_FUNCTION, &f_inst);
+        b.int32_v = 3;
+        TEST_ASSERT (az_function_invoke ((const AZFunctionImplementation *) f_impl, f_inst, impls + 1, vals + 1, &ret_impl, &ret_val, NULL));
+        TEST_ASSERT_EQUAL_INT32 (10, ret_val.value.int32_v);
+        TEST_ASSERT_EQUAL_UINT (2, str->reference.refcount);
+        az_function_closure_unref (closure);
+        TEST_ASSERT_EQUAL_UINT (1, str->reference.refcount);
+        az_string_unref (str);
+        /* More than 16 arguments in total (5 bound and 15 call arguments) */
+        unsigned int types20[20];
+        const AZImplementation *impls20[20];
+        AZValue vals20[20];
+        void *insts20[20];
+        const AZValue *val_ptrs20[20];
+        for (int i = 0; i < 20; i++) {
+            types20[i] = AZ_TYPE_INT32;
+            impls20[i] = AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32);
+            vals20[i].int32_v = i;
+            insts20[i] = &vals20[i];
+            val_ptrs20[i] = &vals20[i];
+        }
+        az_function_value_setup (&fval, az_function_signature_get (0, AZ_TYPE_INT32, 20, types20), value_sum20_i32);
+        closure = az_function_closure_new (AZ_IMPL_FROM_TYPE (AZ_TYPE_FUNCTION_VALUE), &fval, 5, impls20, insts20);
+        TEST_ASSERT (closure != NULL);
+        TEST_ASSERT_EQUAL_UINT (15, closure->signature->n_args);
+        f_impl = az_instance_get_interface_from_type (AZ_TYPE_FUNCTION_CLOSURE, closure, AZ_TYPE_FUNCTION, &f_inst);
+        for (int k = 0; k < 3; k++) {
+            ret_impl = NULL;
+            TEST_ASSERT (az_function_invoke ((const AZFunctionImplementation *) f_impl, f_inst, impls20 + 5, val_ptrs20 + 5, &ret_impl, &ret_val, NULL));
+            TEST_ASSERT (ret_impl == AZ_IMPL_FROM_TYPE (AZ_TYPE_INT32));
+            /* sum of (i + 1) * i for i in 0..19 */
+            TEST_ASSERT_EQUAL_INT32 (2660, ret_val.value.int32_v);
+        }
+        az_function_closure_unref (closure);
         az_function_signature_delete (sig);
     }
 }
@@ -916,3 +1435,429 @@ test_object_list()
         az_object_unref ((AZObject *) o1);
     }
 }
+
+/*
+ * Concurrent reference counting
+ *
+ * All threads ref/unref the same shared object (worst case contention on a single
+ * cache line) and their own private object. The refcounts have to be unchanged after
+ * all threads have finished. Throughput is measured by the reference benchmark.
+ */
+#define MT_REF_ITERATIONS 2000000
+
+typedef struct {
+    AZObject *shared;
+    AZObject *own;
+} MTRefData;
+
+static int
+ref_unref_thread (void *arg)
+{
+    MTRefData *d = (MTRefData *) arg;
+    for (unsigned int i = 0; i < MT_REF_ITERATIONS; i++) {
+        az_object_ref(d->shared);
+        az_object_ref(d->own);
+        az_object_unref(d->own);
+        az_object_unref(d->shared);
+    }
+    return 0;
+}
+
+static void
+test_references_mt()
+{
+    az_init();
+    unsigned int ao_type = test_active_object_get_type();
+    AZObject *shared = az_object_new(ao_type);
+    thrd_t threads[MT_NUM_THREADS];
+    MTRefData data[MT_NUM_THREADS];
+    for (unsigned int n_threads = 1; n_threads <= MT_NUM_THREADS; n_threads *= 2) {
+        for (unsigned int i = 0; i < n_threads; i++) {
+            data[i].shared = shared;
+            data[i].own = az_object_new(ao_type);
+        }
+        for (unsigned int i = 0; i < n_threads; i++) {
+            TEST_ASSERT(thrd_create(&threads[i], ref_unref_thread, &data[i]) == thrd_success);
+        }
+        for (unsigned int i = 0; i < n_threads; i++) {
+            TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+        }
+        TEST_ASSERT_EQUAL_UINT(1, shared->reference.refcount);
+        for (unsigned int i = 0; i < n_threads; i++) {
+            TEST_ASSERT_EQUAL_UINT(1, data[i].own->reference.refcount);
+            az_object_unref(data[i].own);
+        }
+    }
+    az_object_unref(shared);
+}
+
+/*
+ * Concurrent string interning
+ *
+ * All threads repeatedly intern and release the same set of strings (so strings are
+ * created and destroyed concurrently), keeping one reference to each to compare.
+ * Every thread has to end up with the same instance for equal strings.
+ */
+#define MT_NUM_STRINGS 256
+#define MT_STRING_ITERATIONS 200
+
+typedef struct {
+    AZString *strings[MT_NUM_STRINGS];
+} MTStringData;
+
+static int
+intern_strings_thread (void *arg)
+{
+    MTStringData *d = (MTStringData *) arg;
+    char c[32];
+    for (unsigned int k = 0; k < MT_STRING_ITERATIONS; k++) {
+        for (unsigned int i = 0; i < MT_NUM_STRINGS; i++) {
+            snprintf(c, 32, "string %u", i);
+            AZString *str = az_string_new((const uint8_t *) c);
+            AZString *looked_up = az_string_lookup((const uint8_t *) c);
+            if (looked_up != str) d->strings[i] = NULL;
+            az_string_unref(looked_up);
+            az_string_unref(str);
+        }
+    }
+    for (unsigned int i = 0; i < MT_NUM_STRINGS; i++) {
+        snprintf(c, 32, "string %u", i);
+        d->strings[i] = az_string_new((const uint8_t *) c);
+    }
+    return 0;
+}
+
+static void
+test_strings_mt()
+{
+    az_init();
+    thrd_t threads[MT_NUM_THREADS];
+    MTStringData data[MT_NUM_THREADS];
+    for (int i = 0; i < MT_NUM_THREADS; i++) {
+        TEST_ASSERT(thrd_create(&threads[i], intern_strings_thread, &data[i]) == thrd_success);
+    }
+    for (int i = 0; i < MT_NUM_THREADS; i++) {
+        TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+    }
+    for (unsigned int k = 0; k < MT_NUM_STRINGS; k++) {
+        TEST_ASSERT(data[0].strings[k] != NULL);
+        TEST_ASSERT_EQUAL_UINT(MT_NUM_THREADS, data[0].strings[k]->reference.refcount);
+        for (int i = 1; i < MT_NUM_THREADS; i++) {
+            TEST_ASSERT(az_string_equals(data[0].strings[k], data[i].strings[k]));
+        }
+    }
+    for (int i = 0; i < MT_NUM_THREADS; i++) {
+        for (unsigned int k = 0; k < MT_NUM_STRINGS; k++) az_string_unref(data[i].strings[k]);
+    }
+    TEST_ASSERT(az_string_lookup((const uint8_t *) "string 0") == NULL);
+}
+
+/*
+ * Signature interning
+ *
+ * Threads intern the same set of signatures concurrently and test assignability between
+ * them, all threads have to get the same instances and consistent results.
+ */
+#define MT_NUM_SIGNATURES 64
+#define MT_SIGNATURE_ITERATIONS 200
+
+typedef struct {
+    const AZFunctionSignature *sigs[MT_NUM_SIGNATURES];
+    unsigned int errors;
+} MTSignatureData;
+
+static const AZFunctionSignature *
+signature_by_index (unsigned int idx)
+{
+    unsigned int arg_types[4] = {AZ_TYPE_INT32, (idx & 1) ? AZ_TYPE_ANY : AZ_TYPE_STRING, AZ_TYPE_DOUBLE, AZ_TYPE_POINTER};
+    return az_function_signature_get (AZ_TYPE_NONE, (idx & 2) ? AZ_TYPE_INT32 : AZ_TYPE_NONE, (idx >> 2) % 5, arg_types);
+}
+
+static int
+intern_signatures_thread (void *arg)
+{
+    MTSignatureData *d = (MTSignatureData *) arg;
+    d->errors = 0;
+    for (unsigned int k = 0; k < MT_SIGNATURE_ITERATIONS; k++) {
+        for (unsigned int i = 0; i < MT_NUM_SIGNATURES; i++) {
+            const AZFunctionSignature *sig = signature_by_index (i);
+            if (k && (sig != d->sigs[i])) d->errors += 1;
+            d->sigs[i] = sig;
+            /* Odd signatures accept string where even ones declare any */
+            const AZFunctionSignature *other = signature_by_index (i ^ 1);
+            unsigned int expected = (sig->n_args < 2) || (i & 1);
+            if (az_function_signature_is_assignable_to (sig, other, 0) != expected) d->errors += 1;
+        }
+    }
+    return 0;
+}
+
+static void
+test_signatures_mt()
+{
+    az_init();
+    unsigned int arg_types[2] = {AZ_TYPE_INT32, AZ_TYPE_STRING};
+    AZFunctionSignature *sig = az_function_signature_new (AZ_TYPE_NONE, AZ_TYPE_INT32, 2, arg_types);
+    const AZFunctionSignature *interned = az_function_signature_intern (sig);
+    TEST_ASSERT(interned != sig);
+    TEST_ASSERT(!az_function_signature_is_interned (sig));
+    TEST_ASSERT(az_function_signature_is_interned (interned));
+    TEST_ASSERT(az_function_signature_get (AZ_TYPE_NONE, AZ_TYPE_INT32, 2, arg_types) == interned);
+    TEST_ASSERT(az_function_signature_get_va (AZ_TYPE_INT32, 2, AZ_TYPE_INT32, AZ_TYPE_STRING) == interned);
+    TEST_ASSERT(az_function_signature_get_va (AZ_TYPE_NONE, 2, AZ_TYPE_INT32, AZ_TYPE_STRING) != interned);
+    TEST_ASSERT(az_function_signature_get (AZ_TYPE_STRING, AZ_TYPE_INT32, 1, arg_types) == az_function_signature_get_va (AZ_TYPE_INT32, 2, AZ_TYPE_STRING, AZ_TYPE_INT32));
+    /* Interned and private signatures are compared by content */
+    const AZFunctionSignature *any = az_function_signature_get_va (AZ_TYPE_INT32, 2, AZ_TYPE_INT32, AZ_TYPE_ANY);
+    for (unsigned int k = 0; k < 2; k++) {
+        TEST_ASSERT(az_function_signature_is_assignable_to (any, interned, 1));
+        TEST_ASSERT(!az_function_signature_is_assignable_to (interned, any, 1));
+        TEST_ASSERT(az_function_signature_is_assignable_to (any, sig, 1));
+        TEST_ASSERT(!az_function_signature_is_assignable_to (sig, any, 1));
+    }
+    az_function_signature_delete (sig);
+    /* Private signatures are not cached, so reused addresses can not return stale results */
+    for (unsigned int k = 0; k < 8; k++) {
+        unsigned int priv_types[2] = {AZ_TYPE_INT32, (k & 1) ? AZ_TYPE_ANY : AZ_TYPE_STRING};
+        AZFunctionSignature *priv = az_function_signature_new (AZ_TYPE_NONE, AZ_TYPE_INT32, 2, priv_types);
+        TEST_ASSERT_EQUAL_UINT(k & 1, az_function_signature_is_assignable_to (priv, any, 1));
+        az_function_signature_delete (priv);
+    }
+
+    thrd_t threads[MT_NUM_THREADS];
+    MTSignatureData data[MT_NUM_THREADS];
+    for (int i = 0; i < MT_NUM_THREADS; i++) {
+        TEST_ASSERT(thrd_create(&threads[i], intern_signatures_thread, &data[i]) == thrd_success);
+    }
+    for (int i = 0; i < MT_NUM_THREADS; i++) {
+        TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+        TEST_ASSERT_EQUAL_UINT(0, data[i].errors);
+    }
+    for (unsigned int k = 0; k < MT_NUM_SIGNATURES; k++) {
+        TEST_ASSERT(az_function_signature_is_interned (data[0].sigs[k]));
+        for (int i = 1; i < MT_NUM_THREADS; i++) {
+            TEST_ASSERT(data[i].sigs[k] == data[0].sigs[k]);
+        }
+    }
+}
+
+/*
+ * Slab allocator
+ *
+ * Threads allocate instances of a small class (slab is enabled by default size) and free
+ * the instances allocated by the neighbouring thread, so most blocks are released to a
+ * different thread cache than they came from. Every block has to keep its contents
+ * until freed.
+ */
+#define MT_SLAB_INSTANCES 20000
+#define MT_SLAB_ROUNDS 20
+
+typedef struct {
+    uint64_t id;
+    uint64_t payload[5];
+} SlabTestInstance;
+
+typedef struct {
+    unsigned int type;
+    unsigned int idx;
+    SlabTestInstance **own;
+    SlabTestInstance **other;
+    unsigned int errors;
+} MTSlabData;
+
+static int
+slab_alloc_thread (void *arg)
+{
+    MTSlabData *d = (MTSlabData *) arg;
+    for (unsigned int i = 0; i < MT_SLAB_INSTANCES; i++) {
+        SlabTestInstance *inst = (SlabTestInstance *) az_instance_new (d->type);
+        inst->id = ((uint64_t) d->idx << 32) | i;
+        for (unsigned int j = 0; j < 5; j++) inst->payload[j] = inst->id + j;
+        d->own[i] = inst;
+    }
+    return 0;
+}
+
+static int
+slab_free_thread (void *arg)
+{
+    MTSlabData *d = (MTSlabData *) arg;
+    for (unsigned int i = 0; i < MT_SLAB_INSTANCES; i++) {
+        SlabTestInstance *inst = d->other[i];
+        for (unsigned int j = 0; j < 5; j++) {
+            if (inst->payload[j] != inst->id + j) d->errors += 1;
+        }
+        az_instance_delete (d->type, inst);
+    }
+    return 0;
+}
+
+/* Blocks released by a thread that never allocated have to reach the depot at thread exit */
+#define MT_SLAB_FREE_ONLY_SIZE 256
+#define MT_SLAB_FREE_ONLY_BLOCKS 8
+
+static int
+slab_free_blocks_thread (void *arg)
+{
+    void **blocks = (void **) arg;
+    for (unsigned int i = 0; i < MT_SLAB_FREE_ONLY_BLOCKS; i++) az_slab_free (blocks[i], MT_SLAB_FREE_ONLY_SIZE);
+    return 0;
+}
+
+static int
+slab_alloc_blocks_thread (void *arg)
+{
+    void **blocks = (void **) arg;
+    for (unsigned int i = 0; i < MT_SLAB_FREE_ONLY_BLOCKS; i++) blocks[i] = az_slab_alloc (MT_SLAB_FREE_ONLY_SIZE);
+    return 0;
+}
+
+static unsigned int
+slab_blocks_contain (void **blocks, void *block)
+{
+    for (unsigned int i = 0; i < MT_SLAB_FREE_ONLY_BLOCKS; i++) {
+        if (blocks[i] == block) return 1;
+    }
+    return 0;
+}
+
+static void
+test_slab_mt()
+{
+    az_init();
+    unsigned int type = 0;
+    az_slab_set_default_max_size (AZ_SLAB_MAX_SIZE);
+    AZClass *klass = az_register_type (&type, (const unsigned char *) "SlabTest", AZ_TYPE_BLOCK, sizeof (AZClass), sizeof (SlabTestInstance), 0, 0, 0, NULL, NULL, NULL);
+    az_slab_set_default_max_size (0);
+    TEST_ASSERT(klass->allocator == &az_slab_allocator);
+    unsigned int other_type = 0;
+    klass = az_register_type (&other_type, (const unsigned char *) "SlabTestMalloc", AZ_TYPE_BLOCK, sizeof (AZClass), sizeof (SlabTestInstance), 0, 0, 0, NULL, NULL, NULL);
+    TEST_ASSERT(klass->allocator == NULL);
+    /* Small and big arrays */
+    void *small = az_slab_alloc (AZ_SLAB_MAX_SIZE);
+    void *big = az_slab_alloc (AZ_SLAB_MAX_SIZE + 1);
+    TEST_ASSERT(small && big);
+    TEST_ASSERT(((uintptr_t) small & (AZ_SLAB_QUANTUM - 1)) == 0);
+    az_slab_free (small, AZ_SLAB_MAX_SIZE);
+    az_slab_free (big, AZ_SLAB_MAX_SIZE + 1);
+
+    thrd_t threads[MT_NUM_THREADS];
+    MTSlabData data[MT_NUM_THREADS];
+    SlabTestInstance **instances = (SlabTestInstance **) malloc (MT_NUM_THREADS * MT_SLAB_INSTANCES * sizeof (SlabTestInstance *));
+    for (unsigned int t = 0; t < 2; t++) {
+        unsigned int test_type = (t == 0) ? type : other_type;
+        for (unsigned int k = 0; k < MT_SLAB_ROUNDS; k++) {
+            for (unsigned int i = 0; i < MT_NUM_THREADS; i++) {
+                data[i].type = test_type;
+                data[i].idx = i;
+                data[i].own = instances + i * MT_SLAB_INSTANCES;
+                data[i].other = instances + ((i + 1) % MT_NUM_THREADS) * MT_SLAB_INSTANCES;
+                data[i].errors = 0;
+                TEST_ASSERT(thrd_create(&threads[i], slab_alloc_thread, &data[i]) == thrd_success);
+            }
+            for (unsigned int i = 0; i < MT_NUM_THREADS; i++) {
+                TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+            }
+            for (unsigned int i = 0; i < MT_NUM_THREADS; i++) {
+                TEST_ASSERT(thrd_create(&threads[i], slab_free_thread, &data[i]) == thrd_success);
+            }
+            for (unsigned int i = 0; i < MT_NUM_THREADS; i++) {
+                TEST_ASSERT(thrd_join(threads[i], NULL) == thrd_success);
+                TEST_ASSERT_EQUAL_UINT(0, data[i].errors);
+            }
+        }
+    }
+    free (instances);
+
+    /* Free-only thread, the size class is not used by anything else */
+    void *freed[MT_SLAB_FREE_ONLY_BLOCKS], *reused[MT_SLAB_FREE_ONLY_BLOCKS];
+    for (unsigned int i = 0; i < MT_SLAB_FREE_ONLY_BLOCKS; i++) freed[i] = az_slab_alloc (MT_SLAB_FREE_ONLY_SIZE);
+    TEST_ASSERT(thrd_create(&threads[0], slab_free_blocks_thread, freed) == thrd_success);
+    TEST_ASSERT(thrd_join(threads[0], NULL) == thrd_success);
+    /* New thread refills its cache from depot first */
+    TEST_ASSERT(thrd_create(&threads[0], slab_alloc_blocks_thread, reused) == thrd_success);
+    TEST_ASSERT(thrd_join(threads[0], NULL) == thrd_success);
+    for (unsigned int i = 0; i < MT_SLAB_FREE_ONLY_BLOCKS; i++) {
+        TEST_ASSERT(slab_blocks_contain(freed, reused[i]));
+        az_slab_free (reused[i], MT_SLAB_FREE_ONLY_SIZE);
+    }
+}
+
+/*
+ * Flattened constructor and destructor chains
+ *
+ * Superclass, interfaces and the class itself have to be constructed (and destructed in
+ * reverse order) with correct implementation and instance pointers.
+ */
+typedef struct {
+    AZClass klass;
+    AZImplementation iface_impl;
+} ConstructTestClass;
+
+typedef struct {
+    uint32_t base_value;
+    uint32_t iface_values[2];
+    uint32_t value;
+} ConstructTestInstance;
+
+static char construct_log[16];
+static unsigned int construct_log_len;
+static const AZImplementation *construct_iface_impl;
+
+static void
+construct_log_append (char c)
+{
+    if (construct_log_len < 15) construct_log[construct_log_len++] = c;
+    construct_log[construct_log_len] = 0;
+}
+
+static void construct_base_init (const AZImplementation *impl, void *inst) { ((ConstructTestInstance *) inst)->base_value = 1; construct_log_append('B'); }
+static void construct_base_finalize (const AZImplementation *impl, void *inst) { construct_log_append('b'); }
+static void construct_iface_init (const AZImplementation *impl, void *inst) {
+    uint32_t *values = (uint32_t *) inst;
+    if (!values[0] && !values[1]) construct_log_append('I');
+    construct_iface_impl = impl;
+}
+static void construct_iface_finalize (const AZImplementation *impl, void *inst) { construct_log_append('i'); }
+static void construct_init (const AZImplementation *impl, void *inst) { ((ConstructTestInstance *) inst)->value = 3; construct_log_append('C'); }
+static void construct_finalize (const AZImplementation *impl, void *inst) { construct_log_append('c'); }
+
+static unsigned int construct_iface_type = 0;
+
+static void
+construct_class_init (AZClass *klass)
+{
+    az_class_declare_interface (klass, 0, construct_iface_type, ARIKKEI_OFFSET(ConstructTestClass, iface_impl), ARIKKEI_OFFSET(ConstructTestInstance, iface_values));
+}
+
+static void
+test_construct()
+{
+    az_init();
+    unsigned int base_type = 0, type = 0, zero_type = 0;
+    az_register_interface_type (&construct_iface_type, (const unsigned char *) "ConstructTestInterface", AZ_TYPE_INTERFACE, sizeof (AZInterfaceClass), sizeof (AZImplementation), 2 * sizeof (uint32_t), AZ_FLAG_ZERO_MEMORY,
+        0, 0, NULL, NULL, construct_iface_init, construct_iface_finalize);
+    az_register_type (&base_type, (const unsigned char *) "ConstructTestBase", AZ_TYPE_STRUCT, sizeof (AZClass), sizeof (uint32_t), 0, 0, 0,
+        NULL, construct_base_init, construct_base_finalize);
+    ConstructTestClass *klass = (ConstructTestClass *) az_register_type (&type, (const unsigned char *) "ConstructTest", base_type, sizeof (ConstructTestClass), sizeof (ConstructTestInstance), 0, 1, 0,
+        construct_class_init, construct_init, construct_finalize);
+    TEST_ASSERT(klass->klass.init_steps != NULL);
+    TEST_ASSERT_EQUAL_UINT(4, klass->klass.n_init_steps);
+    TEST_ASSERT_EQUAL_UINT(3, klass->klass.n_init_calls);
+    TEST_ASSERT_EQUAL_UINT(3, klass->klass.n_finalize_steps);
+    ConstructTestInstance inst;
+    memset (&inst, 0xff, sizeof (inst));
+    construct_log_len = 0;
+    az_instance_init (&klass->klass.impl, &inst);
+    TEST_ASSERT_EQUAL_STRING("BIC", construct_log);
+    TEST_ASSERT(construct_iface_impl == &klass->iface_impl);
+    TEST_ASSERT_EQUAL_UINT(1, inst.base_value);
+    TEST_ASSERT_EQUAL_UINT(3, inst.value);
+    az_instance_finalize (&klass->klass.impl, &inst);
+    TEST_ASSERT_EQUAL_STRING("BICcib", construct_log);
+    /* Pure zeroing construction */
+    az_register_type (&zero_type, (const unsigned char *) "ConstructTestZero", AZ_TYPE_STRUCT, sizeof (AZClass), 3 * sizeof (uint32_t), AZ_FLAG_ZERO_MEMORY, 0, 0, NULL, NULL, NULL);
+    TEST_ASSERT_EQUAL_UINT(0, AZ_CLASS_FROM_TYPE(zero_type)->n_init_calls);
+    uint32_t *elements = (uint32_t *) az_instance_new_array (zero_type, 16);
+    for (unsigned int i = 0; i < 3 * 16; i++) TEST_ASSERT_EQUAL_UINT(0, elements[i]);
+    az_instance_delete_array (zero_type, elements, 16);
+}